@@ -8,13 +8,16 @@
 #include <base/scope_guard.h>
 #include <base/uri.h>
 #include <cstdlib>
+#include <engine/result_cache.h>
 #include <fstream>
+#include <image/frame_window.h>
 #include <image/media_io.h>
 #include <image/plane.h>
 #include <image/plane_ops.h>
 #include <image/threading.h>
 #include <iomanip>
 #include <iostream>
+#include <media/async_video_track.h>
 #include <media/reader.h>
 #include <media/sample.h>
 #include <media/writer.h>
@@ -205,6 +208,20 @@ int safemain( int argc, char *argv[] )
             base::cmd_line::arg<1>,
             "Number of threads to use for processing",
             false ),
+        base::cmd_line::option(
+            0,
+            std::string( "cache-size" ),
+            "<MB>",
+            base::cmd_line::arg<1>,
+            "Memory to hold computed results in for re-use between frames",
+            false ),
+        base::cmd_line::option(
+            0,
+            std::string( "huge-pages" ),
+            "<none|transparent|explicit>",
+            base::cmd_line::arg<1>,
+            "Back image planes with huge pages",
+            false ),
         base::cmd_line::option(
             0,
             std::string( "output-settings" ),
@@ -244,6 +261,28 @@ int safemain( int argc, char *argv[] )
         threading::init( tCount );
     }
 
+    auto &cacheSize = options["cache-size"];
+    if ( cacheSize )
+        engine::result_cache::get().set_limit(
+            static_cast<size_t>( atoll( cacheSize.value() ) ) * 1024 * 1024 );
+
+    auto &hugePages = options["huge-pages"];
+    if ( hugePages )
+    {
+        std::string             m = hugePages.value();
+        allocator::page_backing b = allocator::page_backing::heap;
+        if ( m == "transparent" )
+            b = allocator::page_backing::transparent_huge;
+        else if ( m == "explicit" )
+            b = allocator::page_backing::explicit_huge;
+        else if ( m != "none" )
+            throw_runtime( "Invalid huge page mode requested: {0}", m );
+        if ( !allocator::get().set_page_backing( b ) &&
+             b != allocator::page_backing::heap )
+            std::cerr << "WARNING: huge pages (" << m
+                      << ") unavailable, using regular pages" << std::endl;
+    }
+
     std::cout << "CPU features:\n";
     base::cpu::output( std::cout );
     std::cout << std::endl;
@@ -476,20 +515,140 @@ int safemain( int argc, char *argv[] )
                       << " of " << vt->begin() << " - " << vt->end()
                       << " @ rate " << vt->rate() << std::endl;
 
+            // frames are streamed to the file a chunk of rows at a
+            // time by the write behind while the graph of the next is
+            // evaluated, but the graphs of consecutive frames share
+            // nodes, so the output is computed before it is handed off
+            media::async_video_track outTrack( oc.video_tracks()[ci], 0, 1 );
+            auto store = [&]( int64_t fn,
+                              const image_buf &img,
+                              const std::vector<std::string> &chans ) {
+                store_frame( outTrack, fn, img, chans, "f16" );
+            };
+
+            // each frame is read once and kept while it is within
+            // the temporal radius, along with its log and the motion
+            // estimated against it
+            frame_window window(
+                [&]( int64_t fn ) {
+                    media::sample s( fn, vt->rate() );
+                    auto          frm = s( vt );
+                    return extract_frame(
+                        *frm,
+                        std::string(),
+                        std::string(),
+                        { "R", "G", "B" },
+                        inputU.pretty() );
+                },
+                vt->begin(),
+                vt->end(),
+                temporalRadius );
+            auto logImg = []( const image_buf &i ) {
+                image_buf r = i;
+                for ( int p = 0; p < 3; ++p )
+                    r[p] = log1p( i[p] );
+                return r;
+            };
+            auto matchSource = [&]( int64_t fn ) {
+                if ( useLog )
+                    return window.derived( fn, "log", logImg );
+                return window.frame( fn );
+            };
+            auto estimate = [&]( int64_t a, int64_t b ) {
+                image_buf tmpA = matchSource( a );
+                image_buf tmpB = matchSource( b );
+                if ( temporalmethod == "patchmatch" )
+                    return patch_match(
+                        tmpA,
+                        tmpB,
+                        plane(),
+                        a,
+                        b,
+                        matchRadius,
+                        patch_style::SSD,
+                        tempIters );
+                if ( temporalmethod == "hierpatch" )
+                    return hier_patch_match(
+                        tmpA,
+                        tmpB,
+                        plane(),
+                        a,
+                        b,
+                        matchRadius,
+                        patch_style::SSD,
+                        tempIters );
+
+                plane lumA =
+                    tmpA[0] * 0.3F + tmpA[1] * 0.6F + tmpA[2] * 0.1F;
+                plane lumB =
+                    tmpB[0] * 0.3F + tmpB[1] * 0.6F + tmpB[2] * 0.1F;
+                if ( temporalmethod == "ahtvl1" )
+                {
+                    TODO( "expose tracking parameters" );
+                    float lambda     = 200.F;
+                    float theta      = 0.1F;
+                    float epsilon    = 0.005F;
+                    float edgePower  = 3.F;
+                    float edgeAlpha  = 50.F;
+                    int   edgeBorder = 5;
+                    int   tvl1Iters  = 100;
+                    int   warpIters  = 3;
+                    float eta        = 0.65F;
+
+                    return oflow_ahtvl1(
+                        lumA,
+                        lumB,
+                        plane(),
+                        plane(),
+                        vector_field(),
+                        lambda,
+                        theta,
+                        epsilon,
+                        edgePower,
+                        edgeAlpha,
+                        edgeBorder,
+                        tvl1Iters,
+                        warpIters,
+                        false, // adaptiveIters
+                        eta );
+                }
+                if ( temporalmethod == "pdtncc" )
+                {
+                    TODO( "expose tracking parameters" );
+                    float lambda = 20.F;
+                    //float theta      = 0.1F;
+                    float gamma      = 0.001F; //0.001F;
+                    int   innerIters = 200;
+                    int   warpIters  = 5;
+                    float eta        = 0.65F;
+
+                    return oflow_primaldual(
+                        lumA,
+                        lumB,
+                        plane(),
+                        plane(),
+                        vector_field(),
+                        lambda,
+                        //theta,
+                        gamma,
+                        innerIters,
+                        warpIters,
+                        true, // adaptiveIters
+                        eta );
+                }
+                return vector_field();
+            };
+
             for ( int64_t f = fs; f <= fe; ++f )
             {
                 std::cout << "Processing frame: " << f << std::endl;
+                window.move_to( f );
                 image_buf centerImg;
                 image_buf weight;
                 plane     cenAlpha;
                 {
                     media::sample cenSamp( f, vt->rate() );
-                    auto          centerFrm = cenSamp( vt );
-                    centerImg               = extract_frame(
-                        *centerFrm,
-                        std::string(),
-                        std::string(),
-                        { "R", "G", "B" } );
+                    centerImg = window.frame( f );
                     // if ( centerFrm->has_channel( "A" ) )
                     // {
                     //     if ( f == fs )
@@ -509,7 +668,8 @@ int safemain( int argc, char *argv[] )
                             *curVarFrm,
                             std::string(),
                             std::string(),
-                            { "R", "G", "B" } );
+                            { "R", "G", "B" },
+                            varU.pretty() );
                         //						plane varP = varimg[0];
                         //						float varRng = ( varThreshHigh - varThreshLow );
                         //						for ( int p = 0; p < 3; ++p )
@@ -556,10 +716,7 @@ int safemain( int argc, char *argv[] )
 
                 image_buf filteredCenter = centerImg;
                 if ( useLog )
-                {
-                    for ( int p = 0; p < 3; ++p )
-                        filteredCenter[p] = log1p( filteredCenter[p] );
-                }
+                    filteredCenter = window.derived( f, "log", logImg );
 
                 if ( spatmethod == "guided_color" )
                 {
@@ -679,10 +836,7 @@ int safemain( int argc, char *argv[] )
                 //				debug_save_image( filteredCenter, "filtered_center.#######.exr", f, { "R", "G", "B" }, "f16" );
                 if ( temporalRadius <= 0 )
                 {
-                    oc.video_tracks()[ci]->store(
-                        f,
-                        to_frame( filteredCenter, { "R", "G", "B" }, "f16" ),
-                        allocator::get() );
+                    store( f, filteredCenter, { "R", "G", "B" } );
                     std::cout << "Finished frame: " << f << std::endl;
                     continue;
                 }
@@ -697,22 +851,13 @@ int safemain( int argc, char *argv[] )
                     if ( curF < vt->begin() || curF > vt->end() )
                         continue;
 
-                    media::sample sCur( curF, vt->rate() );
-
                     image_buf img;
                     plane     curAlpha;
                     if ( curF == f )
                         img = centerImg;
                     else
                     {
-                        std::cout << "  reading temporal frame " << curF
-                                  << std::endl;
-                        auto curFrm = sCur( vt );
-                        img         = extract_frame(
-                            *curFrm,
-                            std::string(),
-                            std::string(),
-                            { "R", "G", "B" } );
+                        img = window.frame( curF );
                         // if ( curFrm->has_channel( "A" ) )
                         // {
                         //     image_buf tmpA = extract_frame(
@@ -723,131 +868,16 @@ int safemain( int argc, char *argv[] )
                         //     curAlpha = tmpA[0];
                         // }
 
-                        image_buf tmpCen = centerImg;
-                        image_buf tmpImg = img;
-                        if ( useLog )
-                        {
-                            for ( int i = 0; i < 3; ++i )
-                            {
-                                tmpCen[i] = log1p( centerImg[i] );
-                                tmpImg[i] = log1p( img[i] );
-                            }
-                        }
-
-                        vector_field vf, vb;
-                        if ( temporalmethod == "patchmatch" )
-                            vf = patch_match(
-                                tmpCen,
-                                tmpImg,
-                                plane(),
-                                f,
-                                curF,
-                                matchRadius,
-                                patch_style::SSD,
-                                tempIters );
-                        else if ( temporalmethod == "hierpatch" )
-                            vf = hier_patch_match(
-                                tmpCen,
-                                tmpImg,
-                                plane(),
-                                f,
-                                curF,
-                                matchRadius,
-                                patch_style::SSD,
-                                tempIters );
-                        else if ( temporalmethod == "ahtvl1" )
-                        {
-                            TODO( "expose tracking parameters" );
-                            float lambda     = 200.F;
-                            float theta      = 0.1F;
-                            float epsilon    = 0.005F;
-                            float edgePower  = 3.F;
-                            float edgeAlpha  = 50.F;
-                            int   edgeBorder = 5;
-                            int   tvl1Iters  = 100;
-                            int   warpIters  = 3;
-                            float eta        = 0.65F;
-
-                            plane lumA = tmpCen[0] * 0.3F + tmpCen[1] * 0.6F +
-                                         tmpCen[2] * 0.1F;
-                            plane lumB = tmpImg[0] * 0.3F + tmpImg[1] * 0.6F +
-                                         tmpImg[2] * 0.1F;
-                            vf = oflow_ahtvl1(
-                                lumA,
-                                lumB,
-                                plane(),
-                                plane(),
-                                vector_field(),
-                                lambda,
-                                theta,
-                                epsilon,
-                                edgePower,
-                                edgeAlpha,
-                                edgeBorder,
-                                tvl1Iters,
-                                warpIters,
-                                false, // adaptiveIters
-                                eta );
-                            if ( confThresh > 0.F )
-                                vb = oflow_ahtvl1(
-                                    lumB,
-                                    lumA,
-                                    plane(),
-                                    plane(),
-                                    vector_field(),
-                                    lambda,
-                                    theta,
-                                    epsilon,
-                                    edgePower,
-                                    edgeAlpha,
-                                    edgeBorder,
-                                    tvl1Iters,
-                                    warpIters,
-                                    false, // adaptiveIters
-                                    eta );
-                        }
-                        else if ( temporalmethod == "pdtncc" )
-                        {
-                            TODO( "expose tracking parameters" );
-                            float lambda = 20.F;
-                            //float theta      = 0.1F;
-                            float gamma      = 0.001F; //0.001F;
-                            int   innerIters = 200;
-                            int   warpIters  = 5;
-                            float eta        = 0.65F;
-
-                            plane lumA = tmpCen[0] * 0.3F + tmpCen[1] * 0.6F +
-                                         tmpCen[2] * 0.1F;
-                            plane lumB = tmpImg[0] * 0.3F + tmpImg[1] * 0.6F +
-                                         tmpImg[2] * 0.1F;
-                            vf = oflow_primaldual(
-                                lumA,
-                                lumB,
-                                plane(),
-                                plane(),
-                                vector_field(),
-                                lambda,
-                                //theta,
-                                gamma,
-                                innerIters,
-                                warpIters,
-                                true, // adaptiveIters
-                                eta );
-                            if ( confThresh > 0.F )
-                                vb = oflow_primaldual(
-                                    lumB,
-                                    lumA,
-                                    plane(),
-                                    plane(),
-                                    vector_field(),
-                                    lambda,
-                                    //theta,
-                                    gamma,
-                                    innerIters,
-                                    warpIters,
-                                    true, // adaptiveIters
-                                    eta );
-                        }
+                        // the backward motion is the forward motion of
+                        // an earlier center, so is found in the window
+                        vector_field vf =
+                            window.motion( f, curF, temporalmethod, estimate );
+                        vector_field vb;
+                        if ( confThresh > 0.F &&
+                             ( temporalmethod == "ahtvl1" ||
+                               temporalmethod == "pdtncc" ) )
+                            vb = window.motion(
+                                curF, f, temporalmethod, estimate );
 
                         if ( vecFilter > 0.F )
                         {
@@ -1006,24 +1036,20 @@ int safemain( int argc, char *argv[] )
                 //				accumImg[0].graph_ptr()->dump_refs( std::cout );
                 if ( !integAmt.valid() )
                 {
-                    oc.video_tracks()[ci]->store(
-                        f,
-                        to_frame( accumImg, { "R", "G", "B" }, "f16" ),
-                        allocator::get() );
+                    store( f, accumImg, { "R", "G", "B" } );
                 }
                 else
                 {
                     accumImg.add_plane( integAmt / ( ( cnt - 1.F ) * 3.F ) );
-                    oc.video_tracks()[ci]->store(
-                        f,
-                        to_frame( accumImg, { "R", "G", "B", "A" }, "f16" ),
-                        allocator::get() );
+                    store( f, accumImg, { "R", "G", "B", "A" } );
                 }
                 std::cout << "Finished frame: " << f << std::endl;
             }
+            outTrack.flush();
         }
     }
     image::allocator::get().report( std::cout );
+    std::cout << engine::result_cache::get().stats();
 
     return 0;
 }
@@ -3,16 +3,50 @@
 
 #include <base/cmd_line.h>
 #include <base/contract.h>
-#include <base/posix_file_system.h>
-#include <base/scope_guard.h>
-#include <base/uri.h>
+#include <base/string_util.h>
 #include <limits.h>
+#include <map>
+#include <memory>
 #include <stdlib.h>
+#include <web/file_response.h>
 #include <web/server.h>
-#include <web/socket.h>
 
 namespace
 {
+////////////////////////////////////////
+
+std::string content_type( const std::string &path )
+{
+    static const std::map<std::string, std::string> types = {
+        { "css", "text/css" },
+        { "exr", "image/x-exr" },
+        { "gif", "image/gif" },
+        { "htm", "text/html" },
+        { "html", "text/html" },
+        { "jpeg", "image/jpeg" },
+        { "jpg", "image/jpeg" },
+        { "js", "application/javascript" },
+        { "json", "application/json" },
+        { "mov", "video/quicktime" },
+        { "mp4", "video/mp4" },
+        { "png", "image/png" },
+        { "svg", "image/svg+xml" },
+        { "tif", "image/tiff" },
+        { "tiff", "image/tiff" },
+        { "txt", "text/plain" } };
+
+    size_t dot = path.find_last_of( "./" );
+    if ( dot != std::string::npos && path[dot] == '.' )
+    {
+        auto t = types.find( base::to_lower( path.substr( dot + 1 ) ) );
+        if ( t != types.end() )
+            return t->second;
+    }
+    return "application/octet-stream";
+}
+
+////////////////////////////////////////
+
 int safemain( int argc, char *argv[] )
 {
     // Parse command-line arguments
@@ -66,28 +100,39 @@ int safemain( int argc, char *argv[] )
     }
 #endif
 
-    // Setup file system.
-    auto fs = base::file_system::get( std::string( "file" ) );
-
     // Create a web server
     web::server server( port, 10 );
-    server.default_resource( "GET" ) = [&]( web::request &   req,
-                                            net::tcp_socket &client ) {
-        base::uri path( "file", "", master_dir, req.path().full_path() );
+    auto        send_file = [&]( web::request &req, net::tcp_socket &client ) {
+        std::string path = req.path().full_path();
+        // nothing outside the directory served
+        if ( path.empty() || path[0] != '/' || path.find( "/../" ) != std::string::npos ||
+             ( path.size() >= 3 && path.compare( path.size() - 3, 3, "/.." ) == 0 ) )
+        {
+            server.not_found( req, client );
+            return;
+        }
+        path = master_dir + path;
+        if ( path.back() == '/' )
+            path += "index.html";
 
-        if ( fs->exists( path ) )
+        std::unique_ptr<web::file_response> file;
+        try
         {
-            std::cout << "Sending " << path << std::endl;
-            base::istream in = fs->open_read( path );
-            web::response resp;
-            resp.send( client, in );
+            file = std::make_unique<web::file_response>( path );
         }
-        else
+        catch ( const std::exception & )
         {
             std::cout << "File " << path << " not found" << std::endl;
             server.not_found( req, client );
+            return;
         }
+
+        std::cout << "Sending " << path << std::endl;
+        file->set_header( "Content-Type", content_type( path ) );
+        file->send( req, client );
     };
+    server.default_resource( "GET" )  = send_file;
+    server.default_resource( "HEAD" ) = send_file;
 
     std::cout << base::format(
                      "Serving directory {0} on port {1}", master_dir, port )
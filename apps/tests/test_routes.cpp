@@ -0,0 +1,95 @@
+// SPDX-License-Identifier: MIT
+// Copyright contributors to the gecko project.
+
+#include <base/contract.h>
+#include <chrono>
+#include <iostream>
+#include <regex>
+#include <web/route_table.h>
+
+namespace
+{
+typedef std::chrono::steady_clock clock_type;
+
+// nanoseconds per look up of the last route added, with the routes in
+// a table, or matched one after another like the server used to
+double time_lookup( size_t count, bool table )
+{
+    std::vector<std::string> patterns;
+    for ( size_t i = 0; i < count; ++i )
+    {
+        switch ( i % 4 )
+        {
+            case 0:
+            case 1: patterns.push_back( base::format( "/api/v1/thing{0}/list", i ) ); break;
+            case 2:
+                // the server used to only take regular expressions
+                patterns.push_back(
+                    base::format( "/api/v1/thing{0}/{1}", i, table ? "{id}" : "([^/]+)" ) );
+                break;
+            case 3:
+                patterns.push_back( base::format( "/api/v1/thing{0}/([0-9]+)/.*", i ) );
+                break;
+        }
+    }
+    std::string path = base::format( "/api/v1/thing{0}/list", ( count - 1 ) & ~size_t( 3 ) );
+
+    web::route_table t;
+    for ( auto &p: patterns )
+        t.add( p );
+
+    size_t loops = table ? 200000 : std::max( size_t( 2 ), 20000 / count );
+    size_t found = 0;
+    auto   start = clock_type::now();
+    for ( size_t l = 0; l < loops; ++l )
+    {
+        if ( table )
+        {
+            web::route_table::match m;
+            found += t.find( path, m ) ? 1 : 0;
+        }
+        else
+        {
+            for ( auto &p: patterns )
+            {
+                if ( std::regex_match( path, std::regex( p ) ) )
+                {
+                    ++found;
+                    break;
+                }
+            }
+        }
+    }
+    auto elapsed = std::chrono::duration<double, std::nano>( clock_type::now() - start );
+    if ( found != loops )
+        throw_runtime( "route not found" );
+    return elapsed.count() / static_cast<double>( loops );
+}
+
+int safemain( void )
+{
+    std::cout << "routes  table (ns)  regex per route (ns)" << std::endl;
+    for ( size_t count: { 10, 100, 500, 1000 } )
+    {
+        double t = time_lookup( count, true );
+        double r = time_lookup( count, false );
+        std::cout << base::format( "{0,w6}  {1,w10}  {2}", count, size_t( t ), size_t( r ) )
+                  << std::endl;
+    }
+    return 0;
+}
+
+} // namespace
+
+int main( void )
+{
+    try
+    {
+        return safemain();
+    }
+    catch ( const std::exception &e )
+    {
+        base::print_exception( std::cerr, e );
+    }
+    return -1;
+}
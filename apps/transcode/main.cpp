@@ -10,6 +10,7 @@
 #include <image/plane_ops.h>
 #include <image/threading.h>
 #include <iostream>
+#include <media/async_video_track.h>
 #include <media/reader.h>
 #include <media/sample.h>
 #include <media/writer.h>
@@ -86,8 +87,18 @@ int safemain( int argc, char *argv[] )
         media::container oc =
             media::writer::open( outputU, tds, outputOptions );
         size_t ovt = 0;
-        for ( auto &vt: c.video_tracks() )
+        for ( auto &inTrack: c.video_tracks() )
         {
+            // decode the next frames and encode the previous ones
+            // while the current one is resized
+            std::shared_ptr<media::video_track> vt =
+                std::make_shared<media::async_video_track>(
+                    inTrack, 2, 0, 1, []( media::frame &frm ) {
+                        image::decode_frame(
+                            frm, std::string(), std::string(), { "R", "G", "B" } );
+                    } );
+            auto outTrack = std::make_shared<media::async_video_track>(
+                oc.video_tracks()[ovt], 0, 1 );
             for ( int64_t f = vt->begin(); f <= vt->end(); ++f )
             {
                 media::sample s( f, vt->rate() );
@@ -116,12 +127,13 @@ int safemain( int argc, char *argv[] )
                     //					img[p] = origSzPt;
                 }
 
-                oc.video_tracks()[ovt]->store(
-                    f,
-                    to_frame( img, { "R", "G", "B" }, "f16" ),
-                    allocator::get() );
+                // computed here, only the encode is left to the
+                // writer, streamed a chunk of rows at a time while the
+                // next frame is resized
+                store_frame( *outTrack, f, img, { "R", "G", "B" }, "f16" );
                 //				oc.video_tracks()[ovt]->store( f, curFrm );
             }
+            outTrack->flush();
             ++ovt;
         }
     }
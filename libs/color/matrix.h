@@ -84,12 +84,12 @@ public:
         : _m{ { static_cast<value_type>( o[0][0] ),
                 static_cast<value_type>( o[0][1] ),
                 static_cast<value_type>( o[0][2] ),
-                static_cast<value_type>( o[1][3] ),
-                static_cast<value_type>( o[1][4] ),
-                static_cast<value_type>( o[1][5] ),
-                static_cast<value_type>( o[2][6] ),
-                static_cast<value_type>( o[2][7] ),
-                static_cast<value_type>( o[2][8] ) } }
+                static_cast<value_type>( o[1][0] ),
+                static_cast<value_type>( o[1][1] ),
+                static_cast<value_type>( o[1][2] ),
+                static_cast<value_type>( o[2][0] ),
+                static_cast<value_type>( o[2][1] ),
+                static_cast<value_type>( o[2][2] ) } }
     {}
 
     inline constexpr matrix( const matrix & ) = default;
@@ -127,7 +127,7 @@ public:
         value_type A   = ( e() * i() - f() * h() );
         value_type B   = ( f() * g() - d() * i() ); // -( di - fg );
         value_type C   = ( d() * h() - e() * g() );
-        value_type det = a() * A + b() * B + c() + C;
+        value_type det = a() * A + b() * B + c() * C;
         if ( std::abs( det ) < std::numeric_limits<value_type>::epsilon() )
             throw std::runtime_error(
                 "Unable to invert degenerate color matrix" );
@@ -4,17 +4,24 @@
 #include "graph.h"
 
 #include "registry.h"
+#include "result_cache.h"
 
 #include <base/compiler_abi.h>
 #include <base/compiler_support.h>
 #include <base/contract.h>
 #include <base/scope_guard.h>
+#include <base/thread_pool.h>
+#include <base/thread_util.h>
 
 #include <algorithm>
+#include <condition_variable>
 #include <deque>
+#include <exception>
 #include <fstream>
 #include <iomanip>
+#include <iostream>
 #include <map>
+#include <memory>
 #include <numeric>
 #include <set>
 #include <sstream>
@@ -23,6 +30,38 @@
 
 ////////////////////////////////////////
 
+namespace
+{
+/// set on the engine worker threads so a graph processed from inside
+/// an op runs serially instead of waiting on the pool it occupies
+thread_local bool tlsInEngineWorker = false;
+
+size_t engine_worker_count( void )
+{
+    static size_t count =
+        static_cast<size_t>( std::max( long( 1 ), base::thread::core_count() ) );
+    return count;
+}
+
+/// pool that independent branches of a graph are run on
+base::thread_pool &engine_pool( void )
+{
+    static base::thread_pool pool( engine_worker_count() );
+    return pool;
+}
+
+/// ops that do no allocation or threading are cheaper to run on the
+/// scheduling thread than to hand to a worker
+inline bool is_inline_style( engine::op::style s )
+{
+    return s == engine::op::style::SIMPLE || s == engine::op::style::VALUE;
+}
+
+/// bytes processing is expected to fit within, 0 to not check
+std::atomic<size_t> theMemoryBudget( 0 );
+
+} // namespace
+
 namespace engine
 {
 ////////////////////////////////////////
@@ -44,6 +83,20 @@ graph::~graph( void ) {}
 
 ////////////////////////////////////////
 
+void graph::set_memory_budget( size_t bytes )
+{
+    theMemoryBudget.store( bytes, std::memory_order_relaxed );
+}
+
+////////////////////////////////////////
+
+size_t graph::memory_budget( void )
+{
+    return theMemoryBudget.load( std::memory_order_relaxed );
+}
+
+////////////////////////////////////////
+
 node_id graph::add_node(
     const base::cstring &          opname,
     const dimensions &             d,
@@ -506,6 +559,27 @@ void graph::dump_refs( std::ostream &os ) const
 
 ////////////////////////////////////////
 
+struct graph::work_unit
+{
+    /// node to compute, or the first member seen of a subgroup
+    node_id id = nullnode;
+    /// subgroup index when this unit processes a whole subgroup
+    size_t    group = size_t( -1 );
+    op::style style = op::style::SIMPLE;
+    /// number of units that have to finish before this can run
+    size_t              pending = 0;
+    std::vector<size_t> dependents;
+    /// inputs read by this unit that can be dropped once every
+    /// reader has run
+    std::vector<node_id> releasable_inputs;
+    /// estimated bytes of the values produced
+    size_t bytes = 0;
+    /// position in the memory plan, used as the scheduling priority
+    size_t rank = 0;
+};
+
+////////////////////////////////////////
+
 static void update_nid( void *ud, node_id old, node_id nid )
 {
     node_id *nptr = reinterpret_cast<node_id *>( ud );
@@ -528,6 +602,10 @@ const any &graph::process( node_id nid )
     reference( nid, update_nid, &nid );
     on_scope_exit { unreference( nid, update_nid, &nid ); };
 
+    fetch_cached( nid );
+    if ( _nodes[nid].value().has_value() )
+        return _nodes[nid].value();
+
     optimize();
     //	std::cout << "optimized, start of processing: " << _start_of_processing << std::endl;
 
@@ -553,76 +631,465 @@ const any &graph::process( node_id nid )
             if ( _process_list.find( in ) == _process_list.end() )
                 check.push_back( in );
         }
+
+        // a subgroup is processed as a whole, so the inputs of the
+        // other members are needed as well
+        if ( curN.in_subgroup() )
+        {
+            for ( node_id in: _subgroups[_node_to_subgroup[cur]].inputs() )
+            {
+                if ( _nodes[in].value().has_value() )
+                    continue;
+
+                if ( _process_list.find( in ) == _process_list.end() )
+                    check.push_back( in );
+            }
+        }
     }
 
-    std::vector<any> inputs;
+    std::vector<work_unit> units;
+    build_work_units( units );
+    plan_work_units( units );
 
     //	std::cout << "Have " << _process_list.size() << " nodes to process" << std::endl;
     //	static int procGC = 0;
     //	std::stringstream pgcg;
     //	pgcg << "process_graph_" << procGC++ << ".dot";
     //	dump_dot( pgcg.str() );
+    run_work_units( units );
+
+    clear_grouping();
+    clean_graph();
+
+    //	std::cout << "Final nid " << nid << " with " << _nodes.size() << " nodes left in graph" << std::endl;
+    return _nodes[nid].value();
+}
+
+////////////////////////////////////////
+
+void graph::build_work_units( std::vector<work_unit> &units )
+{
+    std::map<node_id, size_t> nodeToUnit;
+    std::map<size_t, size_t>  groupToUnit;
+
+    units.clear();
     for ( node_id c: _process_list )
     {
-        node &curN = _nodes[c];
+        const node &curN = _nodes[c];
         if ( curN.op() == nullop )
             continue;
         if ( curN.value().has_value() )
             continue;
 
-        //		std::cout << "  computing node " << c << std::endl;
         if ( curN.in_subgroup() )
         {
-            size_t    sgi = _node_to_subgroup[c];
-            subgroup &sg  = _subgroups[sgi];
-            //			std::cout << "   -> processing subgroup " << sgi << std::endl;
-            if ( sg.processed() )
+            size_t sgi = _node_to_subgroup[c];
+            auto   gu  = groupToUnit.find( sgi );
+            if ( gu != groupToUnit.end() )
             {
-                //				std::cout << "       -> subgroup already processed" << std::endl;
+                nodeToUnit[c] = gu->second;
                 continue;
             }
-            bool haveAllValues = true;
-            for ( auto sginn: sg.inputs() )
+            if ( _subgroups[sgi].processed() )
+                continue;
+            groupToUnit[sgi] = units.size();
+        }
+
+        nodeToUnit[c] = units.size();
+        units.emplace_back( work_unit() );
+        work_unit &u = units.back();
+        u.id         = c;
+        u.style      = _ops[curN.op()].processing_style();
+        if ( curN.in_subgroup() )
+            u.group = _node_to_subgroup[c];
+    }
+
+    // the whole subgroup is computed by the unit, not just the members
+    // on the path to the requested node
+    for ( auto &gu: groupToUnit )
+    {
+        for ( node_id m: _subgroups[gu.first].members() )
+            nodeToUnit.emplace( m, gu.second );
+    }
+
+    // a value can be dropped as soon as all the readers have run as
+    // long as nobody outside this request will ever look at it again
+    auto isReleasable = [&]( node_id in ) {
+        const node &inN = _nodes[in];
+        if ( inN.has_ref() )
+            return false;
+        for ( size_t o = 0, nO = inN.output_size(); o != nO; ++o )
+        {
+            if ( nodeToUnit.find( inN.output( o ) ) == nodeToUnit.end() )
+                return false;
+        }
+        return true;
+    };
+
+    std::set<size_t> deps;
+    for ( size_t ui = 0, nU = units.size(); ui != nU; ++ui )
+    {
+        deps.clear();
+        auto addDep = [&]( node_id in ) {
+            if ( _nodes[in].value().has_value() )
+                return;
+            auto dep = nodeToUnit.find( in );
+            postcondition(
+                dep != nodeToUnit.end(),
+                "node {0} needs node {1} which is not scheduled",
+                units[ui].id,
+                in );
+            if ( dep->second != ui )
+                deps.insert( dep->second );
+        };
+        std::vector<node_id> &rel     = units[ui].releasable_inputs;
+        auto                  addRead = [&]( node_id in ) {
+            if ( std::find( rel.begin(), rel.end(), in ) == rel.end() &&
+                 isReleasable( in ) )
+                rel.push_back( in );
+        };
+
+        if ( units[ui].group != size_t( -1 ) )
+        {
+            const subgroup &sg = _subgroups[units[ui].group];
+            for ( node_id in: sg.inputs() )
+            {
+                addDep( in );
+                addRead( in );
+            }
+            for ( node_id out: sg.outputs() )
+                units[ui].bytes += byte_size( _nodes[out].dims() );
+        }
+        else
+        {
+            const node &curN = _nodes[units[ui].id];
+            for ( size_t i = 0, nI = curN.input_size(); i != nI; ++i )
+            {
+                addDep( curN.input( i ) );
+                addRead( curN.input( i ) );
+            }
+            units[ui].bytes = byte_size( curN.dims() );
+        }
+
+        units[ui].pending = deps.size();
+        for ( size_t d: deps )
+            units[d].dependents.push_back( ui );
+    }
+}
+
+////////////////////////////////////////
+
+void graph::plan_work_units( std::vector<work_unit> &units )
+{
+    // greedy list scheduling: out of the units that are ready, run
+    // the one that grows the live memory the least (or frees the
+    // most), simulating the release of inputs after their last reader
+    std::map<node_id, size_t> readers;
+    size_t                    live = 0;
+    for ( auto &u: units )
+    {
+        for ( node_id in: u.releasable_inputs )
+        {
+            if ( readers[in]++ == 0 && _nodes[in].value().has_value() )
+                live += byte_size( _nodes[in].dims() );
+        }
+    }
+
+    std::vector<size_t> pending( units.size() );
+    std::set<size_t>    ready;
+    for ( size_t ui = 0, nU = units.size(); ui != nU; ++ui )
+    {
+        pending[ui] = units[ui].pending;
+        if ( pending[ui] == 0 )
+            ready.insert( ui );
+    }
+
+    size_t peak = live;
+    size_t rank = 0;
+    while ( !ready.empty() )
+    {
+        auto   best      = ready.end();
+        size_t bestAlloc = 0;
+        size_t bestFree  = 0;
+        for ( auto r = ready.begin(); r != ready.end(); ++r )
+        {
+            const work_unit &u     = units[*r];
+            size_t           freed = 0;
+            for ( node_id in: u.releasable_inputs )
+            {
+                if ( readers[in] == 1 )
+                    freed += byte_size( _nodes[in].dims() );
+            }
+            // compares alloc - free without going negative
+            if ( best == ready.end() ||
+                 u.bytes + bestFree < bestAlloc + freed ||
+                 ( u.bytes + bestFree == bestAlloc + freed &&
+                   u.id < units[*best].id ) )
+            {
+                best      = r;
+                bestAlloc = u.bytes;
+                bestFree  = freed;
+            }
+        }
+
+        size_t     ui = *best;
+        work_unit &u  = units[ui];
+        ready.erase( best );
+        u.rank = rank++;
+
+        live += u.bytes;
+        peak = std::max( peak, live );
+        for ( node_id in: u.releasable_inputs )
+        {
+            if ( --readers[in] == 0 )
+                live -= std::min( live, byte_size( _nodes[in].dims() ) );
+        }
+        for ( size_t d: u.dependents )
+        {
+            if ( --pending[d] == 0 )
+                ready.insert( d );
+        }
+    }
+
+    size_t budget = memory_budget();
+    if ( budget > 0 && peak > budget )
+    {
+        std::cerr << "WARNING: processing plan for " << units.size()
+                  << " graph nodes needs an estimated " << peak
+                  << " bytes, exceeding the memory budget of " << budget
+                  << " bytes" << std::endl;
+    }
+}
+
+////////////////////////////////////////
+
+void graph::run_work_units( std::vector<work_unit> &units )
+{
+    // state shared with the worker tasks, kept alive by them until
+    // they have finished signalling
+    struct sched_state
+    {
+        std::mutex              mutex;
+        std::condition_variable cond;
+        std::exception_ptr      error;
+        size_t                  in_flight = 0;
+    };
+    auto state = std::make_shared<sched_state>();
+
+    // ordered by the rank in the memory plan
+    std::set<std::pair<size_t, size_t>> ready;
+    size_t                              remaining = units.size();
+    std::map<node_id, size_t>           readers;
+    for ( size_t ui = 0, nU = units.size(); ui != nU; ++ui )
+    {
+        if ( units[ui].pending == 0 )
+            ready.emplace( units[ui].rank, ui );
+        for ( node_id in: units[ui].releasable_inputs )
+            ++readers[in];
+    }
+
+    // called with the mutex held
+    auto finish = [&]( size_t ui ) {
+        --remaining;
+        for ( size_t d: units[ui].dependents )
+        {
+            if ( --units[d].pending == 0 )
+                ready.emplace( units[d].rank, d );
+        }
+        // nobody else is reading these, drop our hold on the memory
+        // instead of waiting for the graph to be cleaned
+        for ( node_id in: units[ui].releasable_inputs )
+        {
+            if ( --readers[in] == 0 )
+                _nodes[in].value() = any();
+        }
+    };
+
+    // if we are being run from one of the engine workers (a nested
+    // graph), don't queue more work behind ourselves
+    size_t maxWorkers = engine_worker_count();
+    bool   serial     = tlsInEngineWorker || maxWorkers < 2 || units.size() < 2;
+
+    std::unique_lock<std::mutex> lk( state->mutex );
+    while ( remaining > 0 )
+    {
+        auto next = ready.end();
+        if ( !state->error )
+        {
+            for ( auto r = ready.begin(); r != ready.end(); ++r )
             {
-                if ( !_nodes[sginn].value().has_value() )
+                op::style s = units[r->second].style;
+                // solitary ops are not allowed to run alongside
+                // anything else
+                if ( s == op::style::SOLITARY )
+                {
+                    if ( state->in_flight == 0 )
+                    {
+                        next = r;
+                        break;
+                    }
+                    continue;
+                }
+                if ( serial || is_inline_style( s ) ||
+                     state->in_flight < maxWorkers )
                 {
-                    std::cout << "  subgroup " << sgi << " input node " << sginn
-                              << " missing value" << std::endl;
-                    haveAllValues = false;
+                    next = r;
                     break;
                 }
             }
-            if ( !haveAllValues )
+        }
+
+        if ( next == ready.end() )
+        {
+            if ( state->in_flight == 0 )
             {
-                std::cout << "waiting to process subgroup " << sgi
-                          << " until later, missing values: last input "
-                          << sg.last_input() << ", current node " << c
-                          << std::endl;
-                continue;
+                if ( state->error )
+                    break;
+                throw_runtime(
+                    "Unable to schedule {0} remaining graph nodes, missing dependencies",
+                    remaining );
             }
+            state->cond.wait( lk );
+            continue;
+        }
 
-            sg.process();
+        size_t ui = next->second;
+        ready.erase( next );
+
+        op::style s = units[ui].style;
+        if ( serial || is_inline_style( s ) || s == op::style::SOLITARY )
+        {
+            // nothing else is started while we run this on the
+            // calling thread, which also provides the solitary guarantee
+            lk.unlock();
+            try
+            {
+                run_work_unit( units[ui] );
+            }
+            catch ( ... )
+            {
+                lk.lock();
+                state->error = std::current_exception();
+                continue;
+            }
+            lk.lock();
+            finish( ui );
             continue;
         }
 
-        size_t nInputs = curN.input_size();
-        inputs.resize( nInputs );
-        for ( size_t i = 0; i != nInputs; ++i )
+        ++state->in_flight;
+        const work_unit &u = units[ui];
+        engine_pool().queue( [this, state, &u, &finish, ui]( void ) {
+            tlsInEngineWorker = true;
+            std::exception_ptr err;
+            try
+            {
+                run_work_unit( u );
+            }
+            catch ( ... )
+            {
+                err = std::current_exception();
+            }
+
+            std::lock_guard<std::mutex> guard( state->mutex );
+            --state->in_flight;
+            if ( err )
+            {
+                if ( !state->error )
+                    state->error = err;
+            }
+            else
+                finish( ui );
+            state->cond.notify_one();
+        } );
+    }
+
+    if ( state->error )
+        std::rethrow_exception( state->error );
+}
+
+////////////////////////////////////////
+
+void graph::run_work_unit( const work_unit &u )
+{
+    result_cache &rc = result_cache::get();
+    if ( u.group != size_t( -1 ) )
+    {
+        _subgroups[u.group].process();
+        for ( node_id out: _subgroups[u.group].outputs() )
         {
-            node_id inid  = curN.input( i );
-            node &  curIn = _nodes[inid];
-            inputs[i]     = curIn.value();
+            const node &outN = _nodes[out];
+            rc.store( cache_key( out ), outN.value(), byte_size( outN.dims() ) );
         }
+        return;
+    }
+
+    node &           curN    = _nodes[u.id];
+    size_t           nInputs = curN.input_size();
+    std::vector<any> inputs( nInputs );
+    for ( size_t i = 0; i != nInputs; ++i )
+        inputs[i] = _nodes[curN.input( i )].value();
+
+    const op &o  = _ops[curN.op()];
+    curN.value() = o.function().process( *this, curN.dims(), inputs );
+    if ( is_cacheable( u.id ) )
+        rc.store( cache_key( u.id ), curN.value(), byte_size( curN.dims() ) );
+}
+
+////////////////////////////////////////
+
+void graph::fetch_cached( node_id nid )
+{
+    result_cache &rc = result_cache::get();
+    if ( rc.limit() == 0 )
+        return;
+
+    // walk up from the requested node, stopping at anything that
+    // already has a value (or now does from the cache)
+    std::set<node_id>   visited;
+    std::deque<node_id> check;
+    check.push_back( nid );
+    while ( !check.empty() )
+    {
+        node_id cur = check.front();
+        check.pop_front();
+        if ( !visited.insert( cur ).second )
+            continue;
 
-        const op &o  = _ops[curN.op()];
-        curN.value() = o.function().process( *this, curN.dims(), inputs );
+        node &curN = _nodes[cur];
+        if ( curN.op() == nullop || curN.value().has_value() )
+            continue;
+
+        if ( is_cacheable( cur ) && rc.find( cache_key( cur ), curN.value() ) )
+            continue;
+
+        for ( size_t i = 0, nI = curN.input_size(); i != nI; ++i )
+        {
+            if ( curN.input( i ) != nullnode )
+                check.push_back( curN.input( i ) );
+        }
     }
+}
 
-    clear_grouping();
-    clean_graph();
+////////////////////////////////////////
 
-    //	std::cout << "Final nid " << nid << " with " << _nodes.size() << " nodes left in graph" << std::endl;
-    return _nodes[nid].value();
+bool graph::is_cacheable( node_id n ) const
+{
+    // simple ops and constants are cheaper to compute than to look up
+    const node &curN = _nodes[n];
+    op::style   s    = _ops[curN.op()].processing_style();
+    return s != op::style::SIMPLE && s != op::style::VALUE &&
+           byte_size( curN.dims() ) > 0;
+}
+
+////////////////////////////////////////
+
+hash::value graph::cache_key( node_id n ) const
+{
+    // op ids are only meaningful within a registry
+    hash h;
+    h << _nodes[n].hash_value() << reinterpret_cast<uintptr_t>( &_ops );
+    return h.finish();
 }
 
 ////////////////////////////////////////
@@ -973,11 +1440,97 @@ void graph::apply_grouping( void )
                 break;
             }
             case op::style::N_TO_ONE:
-                //				std::cout << "CREATING subgroup " << _subgroups.size() << " for N_TO_ONE node " << n << std::endl;
-                _node_to_subgroup[n] = _subgroups.size();
-                cur.set_in_subgroup();
-                _subgroups.emplace_back( subgroup( *this, n ) );
+            {
+                // an n-to-one op reading a bounded number of scanlines
+                // around the current one can join the group computing
+                // its input, reading those scanlines through a rolling
+                // window instead of a full plane
+                size_t  subI   = size_t( -1 );
+                node_id soloIn = nullnode;
+                if ( curOp.radius() >= 0 )
+                {
+                    for ( size_t i = 0, nI = cur.input_size(); i != nI; ++i )
+                    {
+                        node_id curIn = cur.input( i );
+                        if ( _nodes[curIn].value().has_value() || curIn == soloIn )
+                            continue;
+                        if ( soloIn != nullnode )
+                        {
+                            soloIn = nullnode;
+                            break;
+                        }
+                        soloIn = curIn;
+                    }
+                }
+
+                if ( soloIn != nullnode )
+                {
+                    node &curInN = _nodes[soloIn];
+
+                    bool doCombine = ( curInN.output_size() == 1 );
+                    doCombine = doCombine &&
+                                ( curInN.in_subgroup() && !curInN.has_ref() );
+                    doCombine = doCombine &&
+                                ( curOp.function().result_type() ==
+                                  _ops[curInN.op()].function().result_type() );
+                    doCombine = doCombine && ( curInN.dims() == cur.dims() );
+
+                    size_t cIdx = find_subgroup( soloIn );
+                    doCombine   = doCombine && cIdx != size_t( -1 ) &&
+                                _subgroups[cIdx].window_node() == nullnode;
+
+                    // the members computing the input are run ahead of
+                    // the rest of the group, so every one of them must
+                    // feed the input and nothing else: a group output
+                    // or a member read again after the window would
+                    // be handed the wrong row
+                    if ( doCombine )
+                    {
+                        const subgroup &     cg = _subgroups[cIdx];
+                        std::set<node_id>    feeds;
+                        std::vector<node_id> toVisit( 1, soloIn );
+                        while ( !toVisit.empty() )
+                        {
+                            node_id v = toVisit.back();
+                            toVisit.pop_back();
+                            if ( !feeds.insert( v ).second )
+                                continue;
+                            for ( size_t i = 0, nI = _nodes[v].input_size();
+                                  i != nI;
+                                  ++i )
+                            {
+                                if ( cg.is_member( _nodes[v].input( i ) ) )
+                                    toVisit.push_back( _nodes[v].input( i ) );
+                            }
+                        }
+                        for ( node_id m: cg.members() )
+                        {
+                            if ( m != soloIn &&
+                                 ( cg.is_output( m ) || feeds.count( m ) == 0 ) )
+                            {
+                                doCombine = false;
+                                break;
+                            }
+                        }
+                    }
+                    if ( doCombine )
+                    {
+                        _subgroups[cIdx].add( n );
+                        _subgroups[cIdx].set_window( n );
+                        _node_to_subgroup[n] = cIdx;
+                        cur.set_in_subgroup();
+                        subI = cIdx;
+                    }
+                }
+                if ( subI == size_t( -1 ) )
+                {
+                    //				std::cout << "CREATING subgroup " << _subgroups.size() << " for N_TO_ONE node " << n << std::endl;
+                    _node_to_subgroup[n] = _subgroups.size();
+                    cur.set_in_subgroup();
+                    _subgroups.emplace_back( subgroup( *this, n ) );
+                }
                 break;
+            }
             case op::style::MULTI_THREADED:
             case op::style::SINGLE_THREADED:
             case op::style::SOLITARY:
@@ -1052,6 +1605,7 @@ void graph::split_subgroup( size_t i, node_id n )
     size_t   newIdx = _subgroups.size();
     _subgroups.emplace_back( subgroup( *this ) );
     subgroup &nAfter = _subgroups.back();
+    node_id   win    = cur.window_node();
     for ( node_id x: cur.members() )
     {
         if ( x <= n )
@@ -1062,6 +1616,20 @@ void graph::split_subgroup( size_t i, node_id n )
             _node_to_subgroup[x] = newIdx;
         }
     }
+    // the windowed member only keeps the window when the member
+    // computing its input stays in the same group
+    if ( win != nullnode )
+    {
+        subgroup &wg = ( win <= n ) ? nI : nAfter;
+        for ( size_t i = 0, nIn = _nodes[win].input_size(); i != nIn; ++i )
+        {
+            if ( wg.is_member( _nodes[win].input( i ) ) )
+            {
+                wg.set_window( win );
+                break;
+            }
+        }
+    }
     cur.swap( nI );
 }
 
@@ -122,6 +122,14 @@ public:
 
     inline bool computing( void ) const { return _computing.load() > 0; }
 
+    /// Sets the number of bytes processing is expected to fit in.
+    ///
+    /// Processing is ordered to minimize the estimated peak memory
+    /// use, and a warning is emitted when that estimate exceeds
+    /// this. A value of 0 (the default) disables the check.
+    static void   set_memory_budget( size_t bytes );
+    static size_t memory_budget( void );
+
 private:
     graph( void )          = delete;
     graph( const graph & ) = delete;
@@ -129,7 +137,16 @@ private:
     graph &operator=( const graph & ) = delete;
     graph &operator=( graph && ) = delete;
 
+    struct work_unit;
+
     const any &process( node_id nid );
+    void       build_work_units( std::vector<work_unit> &units );
+    void       plan_work_units( std::vector<work_unit> &units );
+    void       run_work_units( std::vector<work_unit> &units );
+    void       run_work_unit( const work_unit &u );
+    void       fetch_cached( node_id nid );
+    bool       is_cacheable( node_id n ) const;
+    hash::value cache_key( node_id n ) const;
     void       move_constants( void );
     void       apply_peephole( void );
 
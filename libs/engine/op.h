@@ -144,17 +144,23 @@ public:
     /// @brief Construct an op that does n-to-one processing.
     ///
     /// This should be allowed to be grouped with one-to-one, at least
-    /// at the beginning of the group.
+    /// at the beginning of the group. The radius is the number of
+    /// scanlines above and below the current one which are read from
+    /// the inputs, or -1 when the op may read any scanline. A bounded
+    /// radius allows the op to be grouped after the one-to-one ops
+    /// computing its input, reading a rolling window of scanlines.
     template <typename Functor, typename GroupProcessFunc>
     inline op(
         base::cstring n,
         Functor       f,
         const GroupProcessFunc &,
         const std::function<void( subgroup &, const dimensions & )> &g,
-        n_to_one_parallel_t )
+        n_to_one_parallel_t,
+        int radius = -1 )
         : _name( n )
         , _func( new opfunc_one_to_one<Functor, GroupProcessFunc, 2>( f, g ) )
         , _style( style::N_TO_ONE )
+        , _radius( radius )
     {}
 
     /// TODO: should we provide some threading support here, or just
@@ -209,6 +215,9 @@ public:
 
     inline style processing_style( void ) const;
 
+    /// scanline radius of an n-to-one op, -1 if unbounded
+    inline int radius( void ) const;
+
     inline size_t         input_size( void ) const;
     const std::type_info &input_type( size_t I ) const;
 
@@ -220,6 +229,7 @@ private:
     std::string                  _name;
     std::shared_ptr<op_function> _func;
     style                        _style;
+    int                          _radius = -1;
 };
 
 ////////////////////////////////////////
@@ -232,6 +242,10 @@ inline op::style op::processing_style( void ) const { return _style; }
 
 ////////////////////////////////////////
 
+inline int op::radius( void ) const { return _radius; }
+
+////////////////////////////////////////
+
 inline size_t op::input_size( void ) const
 {
     precondition(
@@ -161,7 +161,7 @@ public:
         throw_runtime( "attempt to dispatch group on a simple thing" );
     }
 
-private:
+protected:
     template <size_t I>
     inline
         typename base::function_traits<Functor>::template get_arg_type<I>::type
@@ -180,6 +180,7 @@ private:
         return _p( extract<S>( inputs )... );
     }
 
+private:
     process_func _p;
 };
 
@@ -197,13 +198,13 @@ public:
         const override
     {
         std::lock_guard<std::mutex> lk( _mutex );
-        return dispatch(
+        return this->dispatch(
             inputs,
             base::gen_sequence<base::function_traits<Functor>::arity>{} );
     }
 
 private:
-    std::mutex _mutex;
+    mutable std::mutex _mutex;
 };
 
 } // namespace engine
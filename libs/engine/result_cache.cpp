@@ -0,0 +1,157 @@
+// SPDX-License-Identifier: MIT
+// Copyright contributors to the gecko project.
+
+#include "result_cache.h"
+
+#include <ostream>
+
+////////////////////////////////////////
+
+namespace engine
+{
+////////////////////////////////////////
+
+result_cache::result_cache( void ) {}
+
+////////////////////////////////////////
+
+result_cache::~result_cache( void ) {}
+
+////////////////////////////////////////
+
+void result_cache::set_limit( size_t maxBytes )
+{
+    std::lock_guard<std::mutex> lk( _mutex );
+    _stats.limit = maxBytes;
+    reduce( maxBytes );
+}
+
+////////////////////////////////////////
+
+size_t result_cache::limit( void ) const
+{
+    std::lock_guard<std::mutex> lk( _mutex );
+    return _stats.limit;
+}
+
+////////////////////////////////////////
+
+bool result_cache::find( const hash::value &key, any &val )
+{
+    std::lock_guard<std::mutex> lk( _mutex );
+    if ( _stats.limit == 0 )
+        return false;
+
+    auto i = _index.find( key );
+    if ( i == _index.end() )
+    {
+        ++_stats.misses;
+        return false;
+    }
+
+    ++_stats.hits;
+    _lru.splice( _lru.begin(), _lru, i->second );
+    val = i->second->value;
+    return true;
+}
+
+////////////////////////////////////////
+
+void result_cache::store( const hash::value &key, const any &val, size_t bytes )
+{
+    std::lock_guard<std::mutex> lk( _mutex );
+    if ( bytes == 0 || bytes > _stats.limit )
+        return;
+
+    auto i = _index.find( key );
+    if ( i != _index.end() )
+    {
+        _stats.bytes -= i->second->bytes;
+        _lru.erase( i->second );
+        _index.erase( i );
+    }
+
+    reduce( _stats.limit - bytes );
+
+    _lru.emplace_front( entry{ key, val, bytes } );
+    _index[key] = _lru.begin();
+    _stats.bytes += bytes;
+    _stats.entries = _lru.size();
+    ++_stats.inserts;
+}
+
+////////////////////////////////////////
+
+void result_cache::clear( void )
+{
+    std::lock_guard<std::mutex> lk( _mutex );
+    _index.clear();
+    _lru.clear();
+    _stats.bytes   = 0;
+    _stats.entries = 0;
+}
+
+////////////////////////////////////////
+
+result_cache::statistics result_cache::stats( void ) const
+{
+    std::lock_guard<std::mutex> lk( _mutex );
+    return _stats;
+}
+
+////////////////////////////////////////
+
+void result_cache::reset_stats( void )
+{
+    std::lock_guard<std::mutex> lk( _mutex );
+    _stats.hits          = 0;
+    _stats.misses        = 0;
+    _stats.inserts       = 0;
+    _stats.evictions     = 0;
+    _stats.evicted_bytes = 0;
+}
+
+////////////////////////////////////////
+
+result_cache &result_cache::get( void )
+{
+    static result_cache globCache;
+    return globCache;
+}
+
+////////////////////////////////////////
+
+void result_cache::reduce( size_t targsize )
+{
+    // assumes the caller holds the mutex
+    while ( _stats.bytes > targsize && !_lru.empty() )
+    {
+        entry &e = _lru.back();
+        _stats.bytes -= e.bytes;
+        _stats.evicted_bytes += e.bytes;
+        ++_stats.evictions;
+        _index.erase( e.key );
+        _lru.pop_back();
+    }
+    _stats.entries = _lru.size();
+}
+
+////////////////////////////////////////
+
+std::ostream &operator<<( std::ostream &os, const result_cache::statistics &s )
+{
+    os << "\nResult cache report:"
+       << "\n               Hits: " << s.hits
+       << "\n             Misses: " << s.misses
+       << "\n            Inserts: " << s.inserts
+       << "\n          Evictions: " << s.evictions
+       << "\n      Evicted Bytes: " << s.evicted_bytes
+       << "\n            Entries: " << s.entries
+       << "\n          Cur Bytes: " << s.bytes
+       << "\n              Limit: " << s.limit << std::endl;
+    return os;
+}
+
+////////////////////////////////////////
+
+} // namespace engine
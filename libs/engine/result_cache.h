@@ -0,0 +1,91 @@
+// SPDX-License-Identifier: MIT
+// Copyright contributors to the gecko project.
+
+#pragma once
+
+#include "types.h"
+
+#include <list>
+#include <map>
+#include <mutex>
+
+////////////////////////////////////////
+
+namespace engine
+{
+///
+/// @brief Class result_cache provides a least-recently-used store of
+/// computed node values that outlives any one graph.
+///
+/// Values are keyed by the hash of the node that computed them (the
+/// operation, dimensions and the hashes of the inputs), so a later
+/// request - or a later frame - building the same computation finds
+/// the result instead of recomputing it. This is only as good as the
+/// hashes of the leaf values, which must identify their content
+/// (i.e. the image planes read from a file should be given a stable
+/// identity of file, frame and channel).
+///
+/// The cache is disabled (a limit of 0 bytes) by default.
+///
+class result_cache
+{
+public:
+    struct statistics
+    {
+        size_t hits          = 0;
+        size_t misses        = 0;
+        size_t inserts       = 0;
+        size_t evictions     = 0;
+        size_t evicted_bytes = 0;
+        size_t entries       = 0;
+        size_t bytes         = 0;
+        size_t limit         = 0;
+    };
+
+    result_cache( void );
+    ~result_cache( void );
+    result_cache( const result_cache & ) = delete;
+    result_cache( result_cache && )      = delete;
+    result_cache &operator=( const result_cache & ) = delete;
+    result_cache &operator=( result_cache && ) = delete;
+
+    /// Sets the number of bytes of results to hold, evicting the
+    /// least recently used entries as needed. 0 disables the cache
+    void   set_limit( size_t maxBytes );
+    size_t limit( void ) const;
+
+    /// returns true and sets the value if there is an entry for the
+    /// provided key, marking the entry as the most recently used
+    bool find( const hash::value &key, any &val );
+
+    /// stores the value, taking the estimated number of bytes it
+    /// holds on to, replacing any entry of the same key
+    void store( const hash::value &key, const any &val, size_t bytes );
+
+    void clear( void );
+
+    statistics stats( void ) const;
+    void       reset_stats( void );
+
+    static result_cache &get( void );
+
+private:
+    struct entry
+    {
+        hash::value key;
+        any         value;
+        size_t      bytes;
+    };
+    typedef std::list<entry> lru_list;
+
+    void reduce( size_t targsize );
+
+    mutable std::mutex                         _mutex;
+    lru_list                                   _lru;
+    std::map<hash::value, lru_list::iterator>  _index;
+    statistics                                 _stats;
+};
+
+std::ostream &operator<<( std::ostream &os, const result_cache::statistics &s );
+
+} // namespace engine
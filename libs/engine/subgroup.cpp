@@ -31,6 +31,7 @@ void subgroup::clear( void )
     _nodes.clear();
     _inputs.clear();
     _outputs.clear();
+    _window = nullnode;
 }
 
 ////////////////////////////////////////
@@ -154,6 +155,18 @@ bool subgroup::internal_merge_check( const subgroup &o ) const
 
 ////////////////////////////////////////
 
+void subgroup::set_window( node_id n )
+{
+    precondition(
+        _window == nullnode || _window == n,
+        "subgroup already has a windowed member {0}",
+        _window );
+    precondition( is_member( n ), "windowed node {0} is not a member", n );
+    _window = n;
+}
+
+////////////////////////////////////////
+
 node_id subgroup::last_input( void ) const
 {
     if ( _inputs.empty() )
@@ -181,6 +194,7 @@ void subgroup::swap( subgroup &o )
     std::swap( _inputs, o._inputs );
     std::swap( _nodes, o._nodes );
     std::swap( _outputs, o._outputs );
+    std::swap( _window, o._window );
 }
 
 ////////////////////////////////////////
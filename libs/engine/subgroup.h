@@ -53,6 +53,18 @@ public:
 
     bool can_merge( const subgroup &o ) const;
 
+    /// @brief marks an n-to-one member as reading the scanlines of
+    /// the member computing its input through a rolling window
+    ///
+    /// The members computing the input of the windowed node are run
+    /// ahead of the rest by the radius of the windowed op, so only
+    /// the outputs of the group need full planes. Those members may
+    /// not be outputs or be read by any other member. A subgroup has
+    /// at most one windowed member.
+    void set_window( node_id n );
+    /// returns the windowed member, or nullnode if there is none
+    inline node_id window_node( void ) const { return _window; }
+
     /// returns the last input node that needs
     /// computation
     node_id last_input( void ) const;
@@ -75,6 +87,7 @@ private:
     std::set<node_id>    _inputs;
     std::vector<node_id> _nodes;
     std::vector<node_id> _outputs;
+    node_id              _window = nullnode;
 
     bool _processed = false;
 };
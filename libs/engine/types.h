@@ -8,6 +8,7 @@
 
 #include <base/any.h>
 
+#include <algorithm>
 #include <cstddef>
 #include <cstdint>
 //#include <experimental/any>
@@ -64,6 +65,18 @@ inline bool operator!=( const dimensions &a, const dimensions &b )
 }
 std::ostream &operator<<( std::ostream &os, const dimensions &d );
 
+/// estimate of the bytes needed to store a value with the provided
+/// dimensions, 0 for values that don't declare an item size
+inline size_t byte_size( const dimensions &d )
+{
+    size_t w = static_cast<size_t>( std::max( d.x2 - d.x1 + 1, 0 ) );
+    size_t h = static_cast<size_t>( std::max( d.y2 - d.y1 + 1, 0 ) );
+    size_t p = static_cast<size_t>( std::max( d.planes, int16_t( 1 ) ) );
+    size_t i = static_cast<size_t>( std::max( d.images, int16_t( 1 ) ) );
+    return w * h * p * i *
+           static_cast<size_t>( std::max( d.bytes_per_item, int16_t( 0 ) ) );
+}
+
 /// @brief storage type for storing an operator id
 ///
 /// 65536 operations should be plenty, right?
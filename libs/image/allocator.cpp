@@ -2,13 +2,87 @@
 // Copyright contributors to the gecko project.
 
 #include "allocator.h"
+
+#include "threading.h"
 #ifdef _WIN32
 #    include <malloc.h>
 #endif
+#ifdef __linux__
+#    include <sys/mman.h>
+#endif
 #include <base/contract.h>
+#include <cstdint>
 #include <cstdlib>
+#include <engine/graph.h>
+#include <fstream>
 #include <functional>
 #include <iostream>
+#include <iterator>
+#include <vector>
+
+////////////////////////////////////////
+
+namespace
+{
+/// the allocator whose blocks are held in the per-thread magazines,
+/// cleared when it is destroyed so threads exiting later free their
+/// magazines directly
+std::atomic<image::allocator *> theCacheOwner( nullptr );
+
+/// blocks are rounded up to 64 bytes up to 256, then there are 4
+/// size classes per power of two up to allocator::binLimit, wasting
+/// at most 25%
+constexpr size_t size_bin( size_t bytes )
+{
+    if ( bytes <= 256 )
+        return ( bytes + 63 ) / 64 - 1;
+    size_t v = bytes - 1;
+    size_t p = 8;
+    while ( ( v >> ( p + 1 ) ) != 0 )
+        ++p;
+    return 4 + ( p - 8 ) * 4 + ( ( v >> ( p - 2 ) ) & 3 );
+}
+
+constexpr size_t bin_bytes( size_t bin )
+{
+    if ( bin < 4 )
+        return ( bin + 1 ) * 64;
+    size_t p = ( bin - 4 ) / 4 + 8;
+    return ( 5 + ( bin - 4 ) % 4 ) << ( p - 2 );
+}
+
+inline void free_aligned( void *p )
+{
+#ifdef _WIN32
+    _aligned_free( p );
+#else
+    free( p );
+#endif
+}
+
+inline void update_max( std::atomic<size_t> &m, size_t v )
+{
+    size_t cur = m.load( std::memory_order_relaxed );
+    while ( v > cur && !m.compare_exchange_weak(
+                           cur, v, std::memory_order_relaxed ) )
+        ;
+}
+
+/// the smallest page we may need to write to for the first touch
+constexpr size_t touchStride = 4096;
+
+#ifdef __linux__
+bool transparent_huge_available( void )
+{
+    std::ifstream f( "/sys/kernel/mm/transparent_hugepage/enabled" );
+    std::string   mode;
+    std::getline( f, mode );
+    return mode.find( "[always]" ) != std::string::npos ||
+           mode.find( "[madvise]" ) != std::string::npos;
+}
+#endif
+
+} // namespace
 
 ////////////////////////////////////////
 
@@ -16,14 +90,154 @@ namespace image
 {
 ////////////////////////////////////////
 
-allocator::allocator( void ) {}
+/// shared lock-free depot of returned blocks, a fixed set of slots
+/// per size class which are claimed and emptied with an atomic
+/// exchange, so there is no list to walk (or ABA to worry about)
+struct allocator::depot
+{
+    static_assert(
+        size_bin( binLimit ) + 1 == binCount &&
+            bin_bytes( binCount - 1 ) == binLimit,
+        "size classes must end at the bin limit" );
+
+    static constexpr size_t slotCount = 32;
+
+    bool push( size_t bin, void *p ) noexcept
+    {
+        for ( auto &s: slots[bin] )
+        {
+            void *expect = nullptr;
+            if ( s.load( std::memory_order_relaxed ) == nullptr &&
+                 s.compare_exchange_strong(
+                     expect, p, std::memory_order_release ) )
+                return true;
+        }
+        return false;
+    }
+
+    void *pop( size_t bin ) noexcept
+    {
+        for ( auto &s: slots[bin] )
+        {
+            if ( s.load( std::memory_order_relaxed ) != nullptr )
+            {
+                void *p = s.exchange( nullptr, std::memory_order_acquire );
+                if ( p )
+                    return p;
+            }
+        }
+        return nullptr;
+    }
+
+    std::atomic<void *> slots[binCount][slotCount] = {};
+};
+
+////////////////////////////////////////
+
+/// per-thread magazines of returned blocks for the size classes
+/// (the scanlines and temporaries that are churned through by the
+/// processing threads). Only the owning thread fills a slot, but any
+/// thread may empty one, so the stash can be trimmed back to its
+/// limit without waiting for the threads to give their blocks back
+struct allocator::thread_cache
+{
+    static constexpr size_t magazineSize = 8;
+
+    struct magazine
+    {
+        bool put( void *p ) noexcept
+        {
+            for ( auto &s: blocks )
+            {
+                if ( s.load( std::memory_order_relaxed ) == nullptr )
+                {
+                    s.store( p, std::memory_order_release );
+                    return true;
+                }
+            }
+            return false;
+        }
+
+        void *take( void ) noexcept
+        {
+            for ( auto &s: blocks )
+            {
+                if ( s.load( std::memory_order_relaxed ) != nullptr )
+                {
+                    void *p = s.exchange( nullptr, std::memory_order_acquire );
+                    if ( p )
+                        return p;
+                }
+            }
+            return nullptr;
+        }
+
+        std::atomic<void *> blocks[magazineSize] = {};
+    };
+
+    thread_cache( void )
+    {
+        std::lock_guard<std::mutex> lk( registry_mutex() );
+        registry().push_back( this );
+    }
+
+    ~thread_cache( void )
+    {
+        {
+            std::lock_guard<std::mutex> lk( registry_mutex() );
+            auto &r = registry();
+            r.erase( std::remove( r.begin(), r.end(), this ), r.end() );
+        }
+
+        allocator *o = theCacheOwner.load();
+        for ( size_t b = 0; b != binCount; ++b )
+        {
+            while ( void *p = mags[b].take() )
+            {
+                if ( o )
+                    o->spill( p, b );
+                else
+                    free_aligned( p );
+            }
+        }
+    }
+
+    /// never destroyed, as threads may exit after the static
+    /// destructors have run
+    static std::mutex &registry_mutex( void )
+    {
+        static std::mutex *m = new std::mutex;
+        return *m;
+    }
+
+    static std::vector<thread_cache *> &registry( void )
+    {
+        static std::vector<thread_cache *> *r = new std::vector<thread_cache *>;
+        return *r;
+    }
+
+    magazine mags[binCount];
+};
+
+////////////////////////////////////////
+
+allocator::allocator( void ) : _depot( new depot )
+{
+    allocator *expect = nullptr;
+    theCacheOwner.compare_exchange_strong( expect, this );
+}
 
 ////////////////////////////////////////
 
 allocator::~allocator( void )
 {
+    allocator *self = this;
+    theCacheOwner.compare_exchange_strong( self, nullptr );
+
     clear_stash();
-    if ( _cur_alloced > 0 )
+    // anything left in the stash is in the magazines of threads
+    // still running, which free them when they exit
+    if ( _cur_alloced.load() > _cur_stash_size.load() )
     {
         // still have stuff in flight...
         // we can't throw here, as would be nice, just report an error
@@ -36,9 +250,10 @@ allocator::~allocator( void )
 
 void allocator::set_stash_size( size_t maxBytes )
 {
-    std::lock_guard<std::mutex> lk( _mutex );
-    _max_stash_size = maxBytes;
-    reduce_stash( _max_stash_size );
+    _max_stash_size.store( maxBytes );
+    reduce_stash( maxBytes );
+    // processing plans are checked against the same budget
+    engine::graph::set_memory_budget( maxBytes );
 }
 
 ////////////////////////////////////////
@@ -59,57 +274,71 @@ void allocator::set_skippiness( size_t s )
 
 ////////////////////////////////////////
 
-std::shared_ptr<void> allocator::allocate( size_t bytes, size_t align )
+bool allocator::set_page_backing( page_backing b, size_t minBytes )
 {
-    precondition( bytes != 0, "attempt to create empty buffer with 0 bytes" );
-    void *p = nullptr;
+    _page_min_bytes.store( std::max( minBytes, hugePageSize ) );
+    _page_backing.store( b );
+    // stashed blocks were made under the previous mode
+    clear_stash();
 
-    std::unique_lock<std::mutex> lk( _mutex );
-    if ( !_stash_misc.empty() )
+#ifdef __linux__
+    switch ( b )
     {
-        for ( auto i = _stash_misc.begin(); i != _stash_misc.end(); )
+        case page_backing::heap: break;
+        case page_backing::transparent_huge:
+            return transparent_huge_available();
+        case page_backing::explicit_huge:
         {
-            if ( ( *i ).size < bytes || ( *i ).size > ( bytes * 2 ) )
-            {
-                ++( ( *i ).skip_count );
-                if ( ( *i ).skip_count > _stash_skippiness )
-                {
-                    destroy( ( *i ).ptr, ( *i ).size );
-                    _cur_stash_size -= ( *i ).size;
-                    i = _stash_misc.erase( i );
-                }
-                else
-                {
-                    ++i;
-                }
-            }
-            else
-            {
-                p                 = ( *i ).ptr;
-                ( *i ).skip_count = 0;
-                _cur_stash_size -= ( *i ).size;
-                _cur_memory_live += ( *i ).size;
-                _inflight_misc.push_front( ( *i ) );
-                _stash_misc.erase( i );
-                break;
-            }
+            void *p = mmap(
+                nullptr,
+                hugePageSize,
+                PROT_READ | PROT_WRITE,
+                MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB,
+                -1,
+                0 );
+            if ( p == MAP_FAILED )
+                return false;
+            munmap( p, hugePageSize );
+            return true;
         }
     }
-    if ( !p )
-    {
-        p = create( lk, bytes, align, _max_misc_size );
+#endif
+    return false;
+}
 
-        memMisc m;
-        m.ptr        = p;
-        m.size       = bytes;
-        m.skip_count = 0;
-        _inflight_misc.emplace_back( std::move( m ) );
-    }
+////////////////////////////////////////
+
+allocator::page_backing allocator::page_backing_mode( void ) const
+{
+    return _page_backing.load();
+}
+
+////////////////////////////////////////
+
+allocator::page_stats allocator::page_report( void ) const
+{
+    std::lock_guard<std::mutex> lk( _mapped_mutex );
+    return _page_stats;
+}
+
+////////////////////////////////////////
+
+std::shared_ptr<void> allocator::allocate( size_t bytes, size_t align )
+{
+    precondition( bytes != 0, "attempt to create empty buffer with 0 bytes" );
 
-    ++_cur_misc_live;
-    _max_misc_live = std::max( _max_misc_live, _cur_misc_live );
+    size_t bin, binBytes;
+    void * p = obtain( bytes, align, bin, binBytes, _max_misc_size );
+
+    update_max( _max_misc_live, ++_cur_misc_live );
     return std::shared_ptr<void>(
-        p, std::bind( &allocator::return_misc, this, std::placeholders::_1 ) );
+        p,
+        std::bind(
+            &allocator::return_misc,
+            this,
+            std::placeholders::_1,
+            bin,
+            binBytes ) );
 }
 
 ////////////////////////////////////////
@@ -117,429 +346,516 @@ std::shared_ptr<void> allocator::allocate( size_t bytes, size_t align )
 std::shared_ptr<float> allocator::scanline( int &stride, int w )
 {
     precondition( w != 0, "attempt to create empty scanline" );
-    float *p = nullptr;
 
-    std::unique_lock<std::mutex> lk( _mutex );
-    if ( !_stash_scan.empty() )
-    {
-        for ( auto i = _stash_scan.begin(); i != _stash_scan.end(); )
-        {
-            if ( ( *i ).w < w || ( *i ).w > ( w * 2 ) )
-            {
-                ++( ( *i ).skip_count );
-                if ( ( *i ).skip_count > _stash_skippiness )
-                {
-                    destroy( ( *i ).ptr, ( *i ).size );
-                    _cur_stash_size -= ( *i ).size;
-                    i = _stash_scan.erase( i );
-                }
-                else
-                {
-                    ++i;
-                }
-            }
-            else
-            {
-                p                 = ( *i ).ptr;
-                stride            = ( *i ).stride;
-                ( *i ).skip_count = 0;
-                _cur_stash_size -= ( *i ).size;
-                _cur_memory_live += ( *i ).size;
-                _inflight_scan.push_front( ( *i ) );
-                _stash_scan.erase( i );
-                break;
-            }
-        }
-    }
+    int s = w;
+    if ( ( s % floatAlignCount ) != 0 )
+        s = s + ( floatAlignCount - ( s % floatAlignCount ) );
+    size_t bytes = static_cast<size_t>( s ) * sizeof( float );
 
-    if ( !p )
-    {
-        int s = w;
-        if ( ( s % floatAlignCount ) != 0 )
-            s = s + ( floatAlignCount - ( s % floatAlignCount ) );
-        size_t bytes = static_cast<size_t>( s ) * sizeof( float );
-        p            = reinterpret_cast<float *>(
-            create( lk, bytes, defaultAlign, _max_scan_size ) );
-
-        stride = s;
-
-        memScan m;
-        m.ptr        = p;
-        m.w          = w;
-        m.stride     = s;
-        m.size       = bytes;
-        m.skip_count = 0;
-        _inflight_scan.emplace_back( std::move( m ) );
-    }
+    size_t bin, binBytes;
+    float *p = reinterpret_cast<float *>(
+        obtain( bytes, defaultAlign, bin, binBytes, _max_scan_size ) );
+    stride = s;
 
-    ++_cur_scan_live;
-    _max_scan_live = std::max( _max_scan_live, _cur_scan_live );
+    update_max( _max_scan_live, ++_cur_scan_live );
     return std::shared_ptr<float>(
-        p, std::bind( &allocator::return_scan, this, std::placeholders::_1 ) );
+        p,
+        std::bind(
+            &allocator::return_scan,
+            this,
+            std::placeholders::_1,
+            bin,
+            binBytes ) );
 }
 
 ////////////////////////////////////////
 
 std::shared_ptr<float> allocator::buffer( int &stride, int w, int h )
 {
-    float *p = nullptr;
+    int s = w;
+    if ( ( s % floatAlignCount ) != 0 )
+        s = s + ( floatAlignCount - ( s % floatAlignCount ) );
+    size_t bytes = static_cast<size_t>( s ) * static_cast<size_t>( h ) *
+                   sizeof( float );
+
+    size_t bin, binBytes;
+    float *p = reinterpret_cast<float *>(
+        obtain( bytes, defaultAlign, bin, binBytes, _max_buffer_size, h ) );
+    stride = s;
+
+    update_max( _max_buffers_live, ++_cur_buffers_live );
+    return std::shared_ptr<float>(
+        p,
+        std::bind(
+            &allocator::return_buffer,
+            this,
+            std::placeholders::_1,
+            bin,
+            binBytes ) );
+}
 
-    std::unique_lock<std::mutex> lk( _mutex );
-    if ( !_stash_buf.empty() )
-    {
-        for ( auto i = _stash_buf.begin(); i != _stash_buf.end(); )
-        {
-            if ( ( *i ).bpe != sizeof( float ) || ( *i ).w < w ||
-                 ( *i ).w > ( w * 2 ) )
-            {
-                ++( ( *i ).skip_count );
-                if ( ( *i ).skip_count > _stash_skippiness )
-                {
-                    destroy( ( *i ).ptr, ( *i ).size );
-                    _cur_stash_size -= ( *i ).size;
-                    i = _stash_buf.erase( i );
-                }
-                else
-                {
-                    ++i;
-                }
-            }
-            else
-            {
-                p                 = reinterpret_cast<float *>( ( *i ).ptr );
-                stride            = ( *i ).stride;
-                ( *i ).skip_count = 0;
-                _cur_stash_size -= ( *i ).size;
-                _cur_memory_live += ( *i ).size;
-                _inflight_buf.push_front( ( *i ) );
-                _stash_buf.erase( i );
-                break;
-            }
-        }
-    }
+////////////////////////////////////////
 
-    if ( !p )
+std::shared_ptr<double> allocator::dbl_buffer( int &stride, int w, int h )
+{
+    int s = w;
+    if ( ( s % doubleAlignCount ) != 0 )
+        s = s + ( doubleAlignCount - ( s % doubleAlignCount ) );
+    size_t bytes = static_cast<size_t>( s ) * static_cast<size_t>( h ) *
+                   sizeof( double );
+
+    size_t  bin, binBytes;
+    double *p = reinterpret_cast<double *>(
+        obtain( bytes, defaultAlign, bin, binBytes, _max_buffer_size, h ) );
+    stride = s;
+
+    update_max( _max_buffers_live, ++_cur_buffers_live );
+    return std::shared_ptr<double>(
+        p,
+        std::bind(
+            &allocator::return_dbl_buffer,
+            this,
+            std::placeholders::_1,
+            bin,
+            binBytes ) );
+}
+
+////////////////////////////////////////
+
+void allocator::clear_stash( void ) noexcept { reduce_stash( 0 ); }
+
+////////////////////////////////////////
+
+void allocator::report( std::ostream &os )
+{
+    os << "\nAllocator report:"
+       << "\n     Max Bytes Alloc: " << _max_alloced.load()
+       << "\n     Cur Bytes Alloc: " << _cur_alloced.load()
+       << "\n     Max Buffer Size: " << _max_buffer_size.load()
+       << "\n    Max Buffers Live: " << _max_buffers_live.load()
+       << "\n    Cur Buffers Live: " << _cur_buffers_live.load()
+       << "\n       Max Scan Size: " << _max_scan_size.load()
+       << "\n       Max Scan Live: " << _max_scan_live.load()
+       << "\n       Cur Scan Live: " << _cur_scan_live.load()
+       << "\n       Max Misc Size: " << _max_misc_size.load()
+       << "\n       Max Misc Live: " << _max_misc_live.load()
+       << "\n       Cur Misc Live: " << _cur_misc_live.load()
+       << "\n      Max Stash Size: " << _max_stash_size.load()
+       << "\n      Cur Stash Size: " << _cur_stash_size.load() << std::endl;
+
+    if ( _page_backing.load() != page_backing::heap )
     {
-        int s = w;
-        if ( ( s % floatAlignCount ) != 0 )
-            s = s + ( floatAlignCount - ( s % floatAlignCount ) );
-        size_t bytes = static_cast<size_t>( s * h ) * sizeof( float );
-        p            = reinterpret_cast<float *>(
-            create( lk, bytes, defaultAlign, _max_buffer_size ) );
-
-        stride = s;
-
-        memBuf m;
-        m.ptr        = p;
-        m.w          = w;
-        m.h          = h;
-        m.stride     = s;
-        m.bpe        = sizeof( float );
-        m.size       = bytes;
-        m.skip_count = 0;
-        _inflight_buf.emplace_back( std::move( m ) );
+        page_stats ps = page_report();
+        os << "  Mapped Blocks Live: " << ps.mapped_blocks
+           << "\n    Huge Page Blocks: " << ps.huge_blocks
+           << "\n     Fallback Blocks: " << ps.fallback_blocks
+           << "\n   Mapped Bytes Live: " << ps.mapped_bytes << std::endl;
     }
+}
 
-    ++_cur_buffers_live;
-    _max_buffers_live = std::max( _max_buffers_live, _cur_buffers_live );
-    return std::shared_ptr<float>(
-        p,
-        std::bind( &allocator::return_buffer, this, std::placeholders::_1 ) );
+////////////////////////////////////////
+
+allocator &allocator::get( void )
+{
+    static allocator globAlloc;
+    return globAlloc;
 }
 
 ////////////////////////////////////////
 
-std::shared_ptr<double> allocator::dbl_buffer( int &stride, int w, int h )
+allocator::thread_cache &allocator::local_cache( void )
+{
+    static thread_local thread_cache tlsCache;
+    return tlsCache;
+}
+
+////////////////////////////////////////
+
+void *allocator::obtain(
+    size_t               bytes,
+    size_t               align,
+    size_t &             bin,
+    size_t &             binBytes,
+    std::atomic<size_t> &maxEntry,
+    int                  rows )
 {
-    double *p = nullptr;
+    if ( align > defaultAlign )
+    {
+        // odd requests are not binned
+        bin      = noBin;
+        binBytes = bytes;
+        return create( bytes, align, maxEntry );
+    }
 
-    std::unique_lock<std::mutex> lk( _mutex );
-    if ( !_stash_buf.empty() )
+    void *p = nullptr;
+    if ( bytes > binLimit )
     {
-        for ( auto i = _stash_buf.begin(); i != _stash_buf.end(); )
+        // large buffers are kept at their exact size, and planes of
+        // the same dimensions come back around to match them
+        bin      = largeBin;
+        binBytes = bytes;
         {
-            if ( ( *i ).bpe != sizeof( double ) || ( *i ).w < w ||
-                 ( *i ).w > ( w * 2 ) )
+            std::lock_guard<std::mutex> lk( _mutex );
+            auto                        i = _large_stash.find( bytes );
+            if ( i != _large_stash.end() )
             {
-                ++( ( *i ).skip_count );
-                if ( ( *i ).skip_count > _stash_skippiness )
-                {
-                    destroy( ( *i ).ptr, ( *i ).size );
-                    _cur_stash_size -= ( *i ).size;
-                    i = _stash_buf.erase( i );
-                }
-                else
-                {
-                    ++i;
-                }
-            }
-            else
-            {
-                p                 = reinterpret_cast<double *>( ( *i ).ptr );
-                stride            = ( *i ).stride;
-                ( *i ).skip_count = 0;
-                _cur_stash_size -= ( *i ).size;
-                _cur_memory_live += ( *i ).size;
-                _inflight_buf.push_front( ( *i ) );
-                _stash_buf.erase( i );
-                break;
+                p = i->second;
+                _large_stash.erase( i );
             }
         }
     }
+    else
+    {
+        bin      = size_bin( std::max( bytes, size_t( 1 ) ) );
+        binBytes = bin_bytes( bin );
+        if ( theCacheOwner.load( std::memory_order_relaxed ) == this )
+            p = local_cache().mags[bin].take();
+        if ( !p )
+            p = _depot->pop( bin );
+    }
 
-    if ( !p )
+    if ( p )
     {
-        int s = w;
-        if ( ( s % doubleAlignCount ) != 0 )
-            s = s + ( doubleAlignCount - ( s % doubleAlignCount ) );
-        size_t bytes = static_cast<size_t>( s * h ) * sizeof( double );
-        p            = reinterpret_cast<double *>(
-            create( lk, bytes, defaultAlign, _max_buffer_size ) );
-
-        stride = s;
-
-        memBuf m;
-        m.ptr        = p;
-        m.w          = w;
-        m.h          = h;
-        m.stride     = s;
-        m.bpe        = sizeof( double );
-        m.size       = bytes;
-        m.skip_count = 0;
-        _inflight_buf.emplace_back( std::move( m ) );
+        _cur_stash_size -= binBytes;
+        update_max( _max_memory_live, _cur_memory_live += binBytes );
+        return p;
     }
 
-    ++_cur_buffers_live;
-    _max_buffers_live = std::max( _max_buffers_live, _cur_buffers_live );
-    return std::shared_ptr<double>(
-        p,
-        std::bind(
-            &allocator::return_dbl_buffer, this, std::placeholders::_1 ) );
+    return create( binBytes, defaultAlign, maxEntry, bytes, rows );
 }
 
 ////////////////////////////////////////
 
-void allocator::clear_stash( void ) noexcept
+void allocator::release( void *p, size_t bin, size_t bytes ) noexcept
 {
-    std::lock_guard<std::mutex> lk( _mutex );
-    reduce_stash( 0 );
+    if ( !p )
+        return;
+
+    _cur_memory_live -= bytes;
+    if ( bin != noBin && stash( p, bin, bytes ) )
+        return;
+    destroy( p, bytes );
 }
 
 ////////////////////////////////////////
 
-void allocator::report( std::ostream &os )
+bool allocator::stash( void *p, size_t bin, size_t bytes ) noexcept
 {
-    std::lock_guard<std::mutex> lk( _mutex );
-    os << "\nAllocator report:"
-       << "\n     Max Bytes Alloc: " << _max_alloced
-       << "\n     Cur Bytes Alloc: " << _cur_alloced
-       << "\n     Max Buffer Size: " << _max_buffer_size
-       << "\n    Max Buffers Live: " << _max_buffers_live
-       << "\n    Cur Buffers Live: " << _cur_buffers_live
-       << "\n       Max Scan Size: " << _max_scan_size
-       << "\n       Max Scan Live: " << _max_scan_live
-       << "\n       Cur Scan Live: " << _cur_scan_live
-       << "\n       Max Misc Size: " << _max_misc_size
-       << "\n       Max Misc Live: " << _max_misc_live
-       << "\n       Cur Misc Live: " << _cur_misc_live
-       << "\n      Max Stash Size: " << _max_stash_size
-       << "\n      Cur Stash Size: " << _cur_stash_size << std::endl;
+    size_t maxS = _max_stash_size.load( std::memory_order_relaxed );
+    if ( bytes > maxS )
+        return false;
+
+    // reserve the room first, so racing returns can not take the
+    // stash over the limit
+    if ( ( _cur_stash_size += bytes ) > maxS )
+    {
+        reduce_stash( maxS );
+        if ( _cur_stash_size.load() > maxS )
+        {
+            _cur_stash_size -= bytes;
+            return false;
+        }
+    }
+
+    if ( bin == largeBin )
+    {
+        try
+        {
+            std::lock_guard<std::mutex> lk( _mutex );
+            _large_stash.emplace( bytes, p );
+            return true;
+        }
+        catch ( ... )
+        {
+            _cur_stash_size -= bytes;
+            return false;
+        }
+    }
+
+    if ( theCacheOwner.load( std::memory_order_relaxed ) == this &&
+         local_cache().mags[bin].put( p ) )
+        return true;
+
+    if ( _depot->push( bin, p ) )
+        return true;
+
+    _cur_stash_size -= bytes;
+    return false;
 }
 
 ////////////////////////////////////////
 
-allocator &allocator::get( void )
+void allocator::spill( void *p, size_t bin ) noexcept
 {
-    static allocator globAlloc;
-    return globAlloc;
+    // moves a block that is already counted in the stash out of a
+    // thread magazine
+    if ( _depot->push( bin, p ) )
+        return;
+
+    size_t bytes = bin_bytes( bin );
+    _cur_stash_size -= bytes;
+    destroy( p, bytes );
 }
 
 ////////////////////////////////////////
 
-void allocator::reduce_stash( size_t targsize )
+void allocator::reduce_stash( size_t targsize ) noexcept
 {
-    // assumes the caller holds the mutex
+    if ( _cur_stash_size.load() <= targsize )
+        return;
 
-    // blow away random buffers first
-    while ( _cur_stash_size > targsize && !_stash_misc.empty() )
+    std::lock_guard<std::mutex> lk( _mutex );
+
+    // blow away bigger ticket items first
+    while ( _cur_stash_size.load() > targsize && !_large_stash.empty() )
     {
-        memMisc &x = _stash_misc.front();
-        destroy( x.ptr, x.size );
-        _cur_stash_size -= x.size;
-        _stash_misc.erase( _stash_misc.begin() );
+        auto   i     = std::prev( _large_stash.end() );
+        void * p     = i->second;
+        size_t bytes = i->first;
+        _large_stash.erase( i );
+        _cur_stash_size -= bytes;
+        destroy( p, bytes );
     }
 
-    // blow away bigger ticket items next
-    while ( _cur_stash_size > targsize && !_stash_buf.empty() )
+    for ( size_t b = binCount; b > 0 && _cur_stash_size.load() > targsize; --b )
     {
-        memBuf &x = _stash_buf.front();
-        destroy( x.ptr, x.size );
-        _cur_stash_size -= x.size;
-        _stash_buf.erase( _stash_buf.begin() );
+        size_t bytes = bin_bytes( b - 1 );
+        while ( _cur_stash_size.load() > targsize )
+        {
+            void *p = _depot->pop( b - 1 );
+            if ( !p )
+                break;
+            _cur_stash_size -= bytes;
+            destroy( p, bytes );
+        }
     }
 
-    while ( _cur_stash_size > targsize && !_stash_scan.empty() )
+    if ( _cur_stash_size.load() <= targsize )
+        return;
+
+    // the rest is held in the magazines of the threads
+    std::lock_guard<std::mutex> rlk( thread_cache::registry_mutex() );
+    for ( size_t b = binCount; b > 0 && _cur_stash_size.load() > targsize; --b )
     {
-        memScan &x = _stash_scan.front();
-        destroy( x.ptr, x.size );
-        _cur_stash_size -= x.size;
-        _stash_scan.erase( _stash_scan.begin() );
+        size_t bytes = bin_bytes( b - 1 );
+        for ( thread_cache *tc: thread_cache::registry() )
+        {
+            while ( _cur_stash_size.load() > targsize )
+            {
+                void *p = tc->mags[b - 1].take();
+                if ( !p )
+                    break;
+                _cur_stash_size -= bytes;
+                destroy( p, bytes );
+            }
+        }
     }
 }
 
 ////////////////////////////////////////
 
 void *allocator::create(
-    std::unique_lock<std::mutex> &lk,
-    size_t                        bytes,
-    size_t                        align,
-    size_t &                      maxEntry )
+    size_t               bytes,
+    size_t               align,
+    std::atomic<size_t> &maxEntry,
+    size_t               usedBytes,
+    int                  rows )
 {
-    lk.unlock();
-
     void *p = nullptr;
+    if ( bytes >= _page_min_bytes.load( std::memory_order_relaxed ) &&
+         align <= hugePageSize &&
+         _page_backing.load( std::memory_order_relaxed ) != page_backing::heap )
+        p = map_pages( bytes );
+
+    if ( p )
+    {
+        if ( rows > 1 )
+        {
+            // place the pages by writing to them from the threads
+            // that will (most likely) process the rows
+            char * base     = static_cast<char *>( p );
+            size_t rowBytes = usedBytes / static_cast<size_t>( rows );
+            threading::get().dispatch(
+                [base, rowBytes]( size_t, int s, int e ) {
+                    size_t b = static_cast<size_t>( s ) * rowBytes;
+                    size_t l = static_cast<size_t>( e ) * rowBytes;
+                    b        = ( b + touchStride - 1 ) & ~( touchStride - 1 );
+                    for ( ; b < l; b += touchStride )
+                        base[b] = 0;
+                },
+                0,
+                rows );
+        }
+    }
+    else
+    {
 #ifdef _WIN32
-    p = _aligned_malloc( bytes, align );
-    if ( p == nullptr )
-        throw_location( std::system_error(
-            errno,
-            std::system_category(),
-            base::format(
-                "Unable to allocate aligned memory of {0} bytes, aligned to {1}",
-                bytes,
-                align ) ) );
+        p = _aligned_malloc( bytes, align );
+        if ( p == nullptr )
+            throw_location( std::system_error(
+                errno,
+                std::system_category(),
+                base::format(
+                    "Unable to allocate aligned memory of {0} bytes, aligned to {1}",
+                    bytes,
+                    align ) ) );
 #else
-    int s = posix_memalign( &p, align, bytes );
-    if ( s != 0 )
-        throw_location( std::system_error(
-            s,
-            std::system_category(),
-            base::format(
-                "Unable to allocate aligned memory of {0} bytes, aligned to {1}",
-                bytes,
-                align ) ) );
+        int s = posix_memalign( &p, align, bytes );
+        if ( s != 0 )
+            throw_location( std::system_error(
+                s,
+                std::system_category(),
+                base::format(
+                    "Unable to allocate aligned memory of {0} bytes, aligned to {1}",
+                    bytes,
+                    align ) ) );
 #endif
+    }
 
-    lk.lock();
-
-    _cur_alloced += bytes;
-    _max_alloced = std::max( _max_alloced, _cur_alloced );
-    _cur_memory_live += bytes;
-    _max_memory_live = std::max( _max_memory_live, _cur_memory_live );
-    maxEntry         = std::max( maxEntry, bytes );
+    update_max( _max_alloced, _cur_alloced += bytes );
+    update_max( _max_memory_live, _cur_memory_live += bytes );
+    update_max( maxEntry, bytes );
 
     return p;
 }
 
 ////////////////////////////////////////
 
-void allocator::destroy( void *p, size_t b )
+void allocator::destroy( void *p, size_t b ) noexcept
 {
-    free( p );
+    // how the block was made is looked up rather than worked out from
+    // the current settings, which may have changed since
+    if ( _mapped_count.load( std::memory_order_acquire ) == 0 || !unmap_pages( p ) )
+        free_aligned( p );
     _cur_alloced -= b;
 }
 
 ////////////////////////////////////////
 
-void allocator::return_misc( void *p ) noexcept
+void *allocator::map_pages( size_t bytes )
 {
-    if ( p )
+#ifdef __linux__
+    size_t len  = ( bytes + hugePageSize - 1 ) & ~( hugePageSize - 1 );
+    void * p    = MAP_FAILED;
+    bool   huge = false;
+
+    if ( _page_backing.load() == page_backing::explicit_huge )
     {
-        std::lock_guard<std::mutex> lk( _mutex );
-        for ( auto i = _inflight_misc.begin(); i != _inflight_misc.end(); ++i )
-        {
-            if ( ( *i ).ptr == p )
-            {
-                _cur_stash_size += ( *i ).size;
-                _cur_memory_live -= ( *i ).size;
-                --_cur_misc_live;
-                _stash_misc.push_back( ( *i ) );
-                _inflight_misc.erase( i );
-                reduce_stash( _max_stash_size );
-                return;
-            }
-        }
+        p    = mmap(
+            nullptr,
+            len,
+            PROT_READ | PROT_WRITE,
+            MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB,
+            -1,
+            0 );
+        huge = ( p != MAP_FAILED );
+    }
 
-        std::cout << "ERROR: invalid pointer passed to return_misc"
-                  << std::endl;
+    if ( p == MAP_FAILED )
+    {
+        // map an extra huge page worth so the block can be trimmed to
+        // start on a huge page boundary, which transparent huge pages
+        // need
+        size_t full = len + hugePageSize;
+        void * raw  = mmap(
+            nullptr,
+            full,
+            PROT_READ | PROT_WRITE,
+            MAP_PRIVATE | MAP_ANONYMOUS,
+            -1,
+            0 );
+        if ( raw == MAP_FAILED )
+            return nullptr;
+
+        uintptr_t r = reinterpret_cast<uintptr_t>( raw );
+        uintptr_t a = ( r + hugePageSize - 1 ) & ~uintptr_t( hugePageSize - 1 );
+        if ( a > r )
+            munmap( raw, a - r );
+        if ( a + len < r + full )
+            munmap( reinterpret_cast<void *>( a + len ), r + full - a - len );
+        p = reinterpret_cast<void *>( a );
+
+        if ( _page_backing.load() == page_backing::transparent_huge )
+            huge = ( madvise( p, len, MADV_HUGEPAGE ) == 0 );
     }
+
+    std::lock_guard<std::mutex> lk( _mapped_mutex );
+    _mapped[p] = len;
+    _mapped_count.fetch_add( 1, std::memory_order_release );
+    ++_page_stats.mapped_blocks;
+    _page_stats.mapped_bytes += len;
+    if ( huge )
+        ++_page_stats.huge_blocks;
+    else
+        ++_page_stats.fallback_blocks;
+    return p;
+#else
+    static_cast<void>( bytes );
+    return nullptr;
+#endif
 }
 
 ////////////////////////////////////////
 
-void allocator::return_scan( float *p ) noexcept
+bool allocator::unmap_pages( void *p ) noexcept
+{
+    std::lock_guard<std::mutex> lk( _mapped_mutex );
+    auto                        i = _mapped.find( p );
+    if ( i == _mapped.end() )
+        return false;
+
+#ifdef __linux__
+    munmap( p, i->second );
+#endif
+    --_page_stats.mapped_blocks;
+    _page_stats.mapped_bytes -= i->second;
+    _mapped.erase( i );
+    _mapped_count.fetch_sub( 1, std::memory_order_relaxed );
+    return true;
+}
+
+////////////////////////////////////////
+
+void allocator::return_misc( void *p, size_t bin, size_t bytes ) noexcept
 {
     if ( p )
     {
-        std::lock_guard<std::mutex> lk( _mutex );
-        for ( auto i = _inflight_scan.begin(); i != _inflight_scan.end(); ++i )
-        {
-            if ( ( *i ).ptr == p )
-            {
-                _cur_stash_size += ( *i ).size;
-                _cur_memory_live -= ( *i ).size;
-                --_cur_scan_live;
-                _stash_scan.push_back( ( *i ) );
-                _inflight_scan.erase( i );
-                reduce_stash( _max_stash_size );
-                return;
-            }
-        }
-
-        std::cout << "ERROR: invalid pointer passed to return_scan"
-                  << std::endl;
+        --_cur_misc_live;
+        release( p, bin, bytes );
     }
 }
 
 ////////////////////////////////////////
 
-void allocator::return_buffer( float *p ) noexcept
+void allocator::return_scan( float *p, size_t bin, size_t bytes ) noexcept
 {
     if ( p )
     {
-        std::lock_guard<std::mutex> lk( _mutex );
-        for ( auto i = _inflight_buf.begin(); i != _inflight_buf.end(); ++i )
-        {
-            if ( ( *i ).ptr == p )
-            {
-                _cur_stash_size += ( *i ).size;
-                _cur_memory_live -= ( *i ).size;
-                --_cur_buffers_live;
-                _stash_buf.push_back( ( *i ) );
-                _inflight_buf.erase( i );
-                reduce_stash( _max_stash_size );
-                return;
-            }
-        }
-
-        std::cout << "ERROR: invalid pointer passed to return_buffer"
-                  << std::endl;
+        --_cur_scan_live;
+        release( p, bin, bytes );
     }
 }
 
 ////////////////////////////////////////
 
-void allocator::return_dbl_buffer( double *p ) noexcept
+void allocator::return_buffer( float *p, size_t bin, size_t bytes ) noexcept
 {
     if ( p )
     {
-        std::lock_guard<std::mutex> lk( _mutex );
-        for ( auto i = _inflight_buf.begin(); i != _inflight_buf.end(); ++i )
-        {
-            if ( ( *i ).ptr == p )
-            {
-                _cur_stash_size += ( *i ).size;
-                _cur_memory_live -= ( *i ).size;
-                --_cur_buffers_live;
-                _stash_buf.push_back( ( *i ) );
-                _inflight_buf.erase( i );
-                reduce_stash( _max_stash_size );
-                return;
-            }
-        }
+        --_cur_buffers_live;
+        release( p, bin, bytes );
+    }
+}
 
-        std::cout << "ERROR: invalid pointer passed to return_dbl_buffer"
-                  << std::endl;
+////////////////////////////////////////
+
+void allocator::return_dbl_buffer(
+    double *p, size_t bin, size_t bytes ) noexcept
+{
+    if ( p )
+    {
+        --_cur_buffers_live;
+        release( p, bin, bytes );
     }
 }
 
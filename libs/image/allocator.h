@@ -6,7 +6,7 @@
 #include <algorithm>
 #include <atomic>
 #include <base/allocator.h>
-#include <list>
+#include <map>
 #include <memory>
 #include <mutex>
 #include <ostream>
@@ -17,6 +17,23 @@ namespace image
 {
 /// @brief allocator provides a means to track memory usage
 ///
+/// Returned memory is kept (up to the stash size) in bins of size
+/// classes, 4 per power of two, so a request for a scanline or other
+/// small block is served from the bin for its rounded up size. Each
+/// thread keeps a small magazine of recently returned blocks per bin,
+/// which refills from and spills to a shared lock-free depot, so the
+/// common case takes no lock and no search. Blocks larger than the
+/// biggest size class (i.e. full image planes) are allocated and
+/// stashed at their exact size instead, as rounding those up would
+/// waste up to a quarter of each.
+///
+/// Large buffers (i.e. full image planes) can optionally be backed by
+/// huge pages mapped directly from the system, to cut down on TLB
+/// misses when walking many planes at random. Those are first touched
+/// by the image threads, split by rows the same way as a dispatch, so
+/// on a NUMA system the pages of a plane land on the nodes of the
+/// threads that will process them.
+///
 /// TODO: Add a cached_ptr type instead of using std::shared_ptr to
 /// abstract when something is cached out of main RAM?
 class allocator : public base::allocator
@@ -25,10 +42,28 @@ public:
     static constexpr int    doubleAlignCount = 8;
     static constexpr int    floatAlignCount  = 16;
     static constexpr size_t defaultAlign     = 64;
+    static constexpr size_t hugePageSize     = size_t( 2 ) << 20;
+
+    enum class page_backing
+    {
+        heap,             ///< aligned heap memory (default)
+        transparent_huge, ///< mapped, advising transparent huge pages
+        explicit_huge     ///< mapped from the reserved huge page pool
+    };
+
+    struct page_stats
+    {
+        size_t mapped_blocks   = 0; ///< blocks currently mapped from the system
+        size_t huge_blocks     = 0; ///< blocks mapped with huge pages so far
+        size_t fallback_blocks = 0; ///< blocks refused huge pages so far
+        size_t mapped_bytes    = 0; ///< bytes currently mapped
+    };
+
     allocator( void );
     ~allocator( void ) override;
 
-    /// Sets how much memory to keep around speculatively
+    /// Sets how much memory to keep around speculatively, this is
+    /// also the budget engine processing plans are checked against
     void set_stash_size( size_t maxBytes );
 
     /// Sets the allocation size at which point memory starts to cache
@@ -38,8 +73,20 @@ public:
 
     /// controls how many times an item will be skipped in the stash
     /// prior to being discarded as stale
+    ///
+    /// NB: retained for compatibility, the size class bins are not
+    /// searched, so nothing is skipped any more
     void set_skippiness( size_t s );
 
+    /// Sets how buffers of at least minBytes are backed. Returns true
+    /// if the system accepted a trial huge page request, otherwise
+    /// the mode is still set, but expect the buffers to silently fall
+    /// back to regular pages (see page_report). Only supported on
+    /// linux, elsewhere buffers stay on the heap and this returns false
+    bool set_page_backing( page_backing b, size_t minBytes = 4 * hugePageSize );
+    page_backing page_backing_mode( void ) const;
+    page_stats   page_report( void ) const;
+
     /// allocates a generic 1D buffer scanline with specified byte alignment
     std::shared_ptr<void>
     allocate( size_t bytes, size_t align = defaultAlign ) override;
@@ -62,72 +109,74 @@ public:
     static allocator &get( void );
 
 private:
-    void  reduce_stash( size_t targsize );
+    struct thread_cache;
+    struct depot;
+    friend struct thread_cache;
+
+    /// size classes cover blocks up to binLimit bytes
+    static constexpr size_t binLimit = size_t( 1 ) << 20;
+    static constexpr size_t binCount = 52;
+    static constexpr size_t noBin    = size_t( -1 );
+    static constexpr size_t largeBin = size_t( -2 );
+
+    static thread_cache &local_cache( void );
+
+    void *obtain(
+        size_t               bytes,
+        size_t               align,
+        size_t &             bin,
+        size_t &             binBytes,
+        std::atomic<size_t> &maxEntry,
+        int                  rows = 0 );
+    void  release( void *p, size_t bin, size_t bytes ) noexcept;
+    bool  stash( void *p, size_t bin, size_t bytes ) noexcept;
+    void  spill( void *p, size_t bin ) noexcept;
+    void  reduce_stash( size_t targsize ) noexcept;
     void *create(
-        std::unique_lock<std::mutex> &lk,
-        size_t                        bytes,
-        size_t                        align,
-        size_t &                      maxEntry );
-    void destroy( void *p, size_t b );
-
-    void return_misc( void * ) noexcept;
-    void return_scan( float * ) noexcept;
-    void return_buffer( float * ) noexcept;
-    void return_dbl_buffer( double * ) noexcept;
-
-    std::mutex _mutex;
-    size_t     _max_alloced      = 0;
-    size_t     _max_memory_live  = 0;
-    size_t     _max_misc_size    = 0;
-    size_t     _max_misc_live    = 0;
-    size_t     _max_scan_size    = 0;
-    size_t     _max_scan_live    = 0;
-    size_t     _max_buffer_size  = 0;
-    size_t     _max_buffers_live = 0;
-
-    size_t _cur_buffers_live = 0;
-    size_t _cur_scan_live    = 0;
-    size_t _cur_misc_live    = 0;
-    size_t _cur_memory_live  = 0;
-    size_t _cur_alloced      = 0;
-    size_t _cur_stash_size   = 0;
-
-    size_t _max_stash_size   = 0;
-    size_t _stash_skippiness = 5;
-    size_t _cache_start      = 0;
-
-    struct memMisc
-    {
-        void * ptr;
-        size_t size;
-        size_t skip_count;
-    };
-    std::list<memMisc> _inflight_misc;
-    std::list<memMisc> _stash_misc;
-
-    struct memScan
-    {
-        float *ptr;
-        int    w;
-        int    stride;
-        size_t size;
-        size_t skip_count;
-    };
-    std::list<memScan> _inflight_scan;
-    std::list<memScan> _stash_scan;
-
-    struct memBuf
-    {
-        void * ptr;
-        int    w;
-        int    h;
-        int    stride;
-        size_t bpe;
-        size_t size;
-        size_t skip_count;
-    };
-    std::list<memBuf> _inflight_buf;
-    std::list<memBuf> _stash_buf;
+        size_t               bytes,
+        size_t               align,
+        std::atomic<size_t> &maxEntry,
+        size_t               usedBytes = 0,
+        int                  rows      = 0 );
+    void  destroy( void *p, size_t b ) noexcept;
+    void *map_pages( size_t bytes );
+    bool  unmap_pages( void *p ) noexcept;
+
+    void return_misc( void *p, size_t bin, size_t bytes ) noexcept;
+    void return_scan( float *p, size_t bin, size_t bytes ) noexcept;
+    void return_buffer( float *p, size_t bin, size_t bytes ) noexcept;
+    void return_dbl_buffer( double *p, size_t bin, size_t bytes ) noexcept;
+
+    std::mutex          _mutex;
+    std::atomic<size_t> _max_alloced{ 0 };
+    std::atomic<size_t> _max_memory_live{ 0 };
+    std::atomic<size_t> _max_misc_size{ 0 };
+    std::atomic<size_t> _max_misc_live{ 0 };
+    std::atomic<size_t> _max_scan_size{ 0 };
+    std::atomic<size_t> _max_scan_live{ 0 };
+    std::atomic<size_t> _max_buffer_size{ 0 };
+    std::atomic<size_t> _max_buffers_live{ 0 };
+
+    std::atomic<size_t> _cur_buffers_live{ 0 };
+    std::atomic<size_t> _cur_scan_live{ 0 };
+    std::atomic<size_t> _cur_misc_live{ 0 };
+    std::atomic<size_t> _cur_memory_live{ 0 };
+    std::atomic<size_t> _cur_alloced{ 0 };
+    std::atomic<size_t> _cur_stash_size{ 0 };
+
+    std::atomic<size_t> _max_stash_size{ 0 };
+    size_t              _stash_skippiness = 5;
+    size_t              _cache_start      = 0;
+
+    std::unique_ptr<depot>        _depot;
+    std::multimap<size_t, void *> _large_stash;
+
+    std::atomic<page_backing> _page_backing{ page_backing::heap };
+    std::atomic<size_t>       _page_min_bytes{ 4 * hugePageSize };
+    mutable std::mutex        _mapped_mutex;
+    std::map<void *, size_t>  _mapped;
+    std::atomic<size_t>       _mapped_count{ 0 };
+    page_stats                _page_stats;
 };
 
 } // namespace image
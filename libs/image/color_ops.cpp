@@ -6,7 +6,16 @@
 #include "threading.h"
 
 #include <color/color.h>
-#include <sstream>
+#include <cmath>
+#include <cstring>
+#ifdef __SSE__
+#    if defined( LINUX ) || defined( __linux__ )
+#        include <x86intrin.h>
+#    else
+#        include <immintrin.h>
+#        include <xmmintrin.h>
+#    endif
+#endif
 
 ////////////////////////////////////////
 
@@ -14,12 +23,16 @@ namespace color
 {
 engine::hash &operator<<( engine::hash &h, const state &p );
 
-/// \todo { do something smarter (fewer memory allocs) here than serialize to a string }
 engine::hash &operator<<( engine::hash &h, const state &p )
 {
-    std::stringstream tmp;
-    tmp << p;
-    h << tmp.str();
+    const state::cx &             c  = p.chroma();
+    const transfer_curve_control &cc = p.curve_controls();
+    h << static_cast<unsigned int>( p.current_space() ) << c.red.x << c.red.y
+      << c.green.x << c.green.y << c.blue.x << c.blue.y << c.white.x
+      << c.white.y << p.luminance_scale() << p.black_offset()
+      << static_cast<unsigned int>( p.signal() )
+      << static_cast<unsigned int>( p.curve() ) << cc._A << cc._B << cc._C
+      << cc._D << cc._E;
     return h;
 }
 
@@ -27,18 +40,362 @@ engine::hash &operator<<( engine::hash &h, const state &p )
 
 ////////////////////////////////////////
 
+namespace
+{
+using namespace image;
+
+////////////////////////////////////////
+
+/// @brief a transfer curve sampled for lookup.
+///
+/// The samples are spaced evenly within each power of two (indexed
+/// by the top bits of the float), so the linear interpolation between
+/// them has a bounded relative error (~1e-5) across the whole range,
+/// where even spacing would lose the toe of the curve. Values outside
+/// the sampled range (tiny, huge, inf, nan) are evaluated directly.
+class curve_lut
+{
+public:
+    static constexpr int      mantBits = 8;
+    static constexpr int      minExp   = -14;
+    static constexpr int      maxExp   = 10;
+    static constexpr int      fracBits = 23 - mantBits;
+    static constexpr uint32_t loBits   = uint32_t( 127 + minExp ) << 23;
+    static constexpr uint32_t spanBits = uint32_t( maxExp - minExp ) << 23;
+    static constexpr size_t   count    = size_t( maxExp - minExp ) << mantBits;
+
+    curve_lut( void ) = default;
+    curve_lut( color::transfer t, bool toLinear ) : _curve( t ), _to_linear( toLinear )
+    {
+        _pos.resize( count + 1 );
+        _neg.resize( count + 1 );
+        for ( size_t i = 0; i <= count; ++i )
+        {
+            double a = std::ldexp(
+                1.0 + double( i & ( ( size_t( 1 ) << mantBits ) - 1 ) ) /
+                          double( size_t( 1 ) << mantBits ),
+                minExp + static_cast<int>( i >> mantBits ) );
+            _pos[i] = static_cast<float>( eval( a ) );
+            _neg[i] = static_cast<float>( eval( -a ) );
+        }
+    }
+
+    inline float operator()( float v ) const
+    {
+        uint32_t bits;
+        std::memcpy( &bits, &v, sizeof( bits ) );
+        uint32_t off = ( bits & 0x7FFFFFFF ) - loBits;
+        if ( off >= spanBits )
+            return static_cast<float>( eval( v ) );
+
+        const float *t    = ( bits >> 31 ) ? _neg.data() : _pos.data();
+        uint32_t     idx  = off >> fracBits;
+        float        frac = static_cast<float>( off & ( ( 1U << fracBits ) - 1 ) ) *
+                     ( 1.F / static_cast<float>( 1U << fracBits ) );
+        return t[idx] + frac * ( t[idx + 1] - t[idx] );
+    }
+
+private:
+    template <typename T> inline T eval( T v ) const
+    {
+        return _to_linear ? color::linearize( v, _curve ) : color::encode( v, _curve );
+    }
+
+    color::transfer    _curve     = color::transfer::LINEAR;
+    bool               _to_linear = true;
+    std::vector<float> _pos;
+    std::vector<float> _neg;
+};
+
+////////////////////////////////////////
+
+/// a 3x3 matrix and offset, out = m * in + o
+struct affine
+{
+    double m[3][3] = { { 1, 0, 0 }, { 0, 1, 0 }, { 0, 0, 1 } };
+    double o[3]    = { 0, 0, 0 };
+
+    bool is_identity( void ) const
+    {
+        for ( int r = 0; r < 3; ++r )
+        {
+            if ( o[r] != 0.0 )
+                return false;
+            for ( int c = 0; c < 3; ++c )
+                if ( m[r][c] != ( r == c ? 1.0 : 0.0 ) )
+                    return false;
+        }
+        return true;
+    }
+
+    void apply( const double in[3], double out[3] ) const
+    {
+        for ( int r = 0; r < 3; ++r )
+            out[r] = m[r][0] * in[0] + m[r][1] * in[1] + m[r][2] * in[2] + o[r];
+    }
+
+    /// returns the affine applying a then b
+    static affine concat( const affine &a, const affine &b )
+    {
+        affine ret;
+        for ( int r = 0; r < 3; ++r )
+        {
+            for ( int c = 0; c < 3; ++c )
+                ret.m[r][c] = b.m[r][0] * a.m[0][c] + b.m[r][1] * a.m[1][c] +
+                              b.m[r][2] * a.m[2][c];
+            ret.o[r] = b.m[r][0] * a.o[0] + b.m[r][1] * a.o[1] +
+                       b.m[r][2] * a.o[2] + b.o[r];
+        }
+        return ret;
+    }
+
+    /// samples a function of a triplet as an affine transform,
+    /// returning false if it turns out to not be one
+    template <typename F> bool sample( F &&f )
+    {
+        double zero[3] = { 0, 0, 0 };
+        f( zero, o );
+        for ( int c = 0; c < 3; ++c )
+        {
+            double in[3] = { 0, 0, 0 }, out[3];
+            in[c]        = 1.0;
+            f( in, out );
+            for ( int r = 0; r < 3; ++r )
+                m[r][c] = out[r] - o[r];
+        }
+
+        double probe[3] = { 0.25, -1.5, 3.0 }, expect[3], got[3];
+        f( probe, expect );
+        apply( probe, got );
+        for ( int r = 0; r < 3; ++r )
+            if ( std::abs( expect[r] - got[r] ) >
+                 1e-9 * std::max( 1.0, std::abs( expect[r] ) ) )
+                return false;
+        return true;
+    }
+
+    void run( float *out[3], const float *in[3], int w ) const
+    {
+#if defined( __SSE__ )
+        // the plane lines are padded out to a multiple of 4 (and more)
+        __m128 mv[3][3], ov[3];
+        for ( int r = 0; r < 3; ++r )
+        {
+            ov[r] = _mm_set1_ps( static_cast<float>( o[r] ) );
+            for ( int c = 0; c < 3; ++c )
+                mv[r][c] = _mm_set1_ps( static_cast<float>( m[r][c] ) );
+        }
+        for ( int x = 0; x < w; x += 4 )
+        {
+            __m128 a = _mm_load_ps( in[0] + x );
+            __m128 b = _mm_load_ps( in[1] + x );
+            __m128 c = _mm_load_ps( in[2] + x );
+            for ( int r = 0; r < 3; ++r )
+                _mm_store_ps(
+                    out[r] + x,
+                    _mm_add_ps(
+                        _mm_add_ps(
+                            _mm_mul_ps( mv[r][0], a ), _mm_mul_ps( mv[r][1], b ) ),
+                        _mm_add_ps( _mm_mul_ps( mv[r][2], c ), ov[r] ) ) );
+        }
+#else
+        float mf[3][3], of[3];
+        for ( int r = 0; r < 3; ++r )
+        {
+            of[r] = static_cast<float>( o[r] );
+            for ( int c = 0; c < 3; ++c )
+                mf[r][c] = static_cast<float>( m[r][c] );
+        }
+        for ( int x = 0; x < w; ++x )
+        {
+            float a = in[0][x], b = in[1][x], c = in[2][x];
+            for ( int r = 0; r < 3; ++r )
+                out[r][x] = mf[r][0] * a + mf[r][1] * b + mf[r][2] * c + of[r];
+        }
+#endif
+    }
+};
+
+////////////////////////////////////////
+
+/// @brief the chain color::convert walks for a pair of states, worked
+/// out once and flattened to (at most) an affine, a linearize lookup,
+/// a matrix, an encode lookup and an affine, where the range and
+/// opponency steps are folded into the matrix unless a transfer curve
+/// is in between.
+class color_pipeline
+{
+public:
+    color_pipeline( const color::state &from, const color::state &to )
+        : _from( from ), _to( to )
+    {
+        affine pre, post;
+        bool   ok = pre.sample( [&]( const double in[3], double out[3] ) {
+            double a = in[0], b = in[1], c = in[2];
+            color::to_full( a, b, c, a, b, c, from.current_space(), from.signal(), 32 );
+            if ( color::has_opponency( from.current_space() ) )
+                color::remove_opponency( a, b, c, a, b, c, from.current_space() );
+            out[0] = a;
+            out[1] = b;
+            out[2] = c;
+        } );
+        ok = ok && post.sample( [&]( const double in[3], double out[3] ) {
+            double a = in[0], b = in[1], c = in[2];
+            if ( color::has_opponency( to.current_space() ) )
+                color::add_opponency( a, b, c, a, b, c, to.current_space() );
+            color::from_full(
+                a, b, c, a, b, c, to.current_space(), to.signal(), 32, false );
+            out[0] = a;
+            out[1] = b;
+            out[2] = c;
+        } );
+        if ( !ok )
+        {
+            // something not expressible as a matrix, just convert
+            _fallback = true;
+            return;
+        }
+
+        affine mid;
+        bool   linCurve = false, encCurve = false;
+        if ( from.curve() != to.curve() || !( to.is_same_matrix( from ) ) )
+        {
+            color::matrix<double> m = to.get_from_xyz_mat() *
+                                      to.adaptation( from, color::cone_response::NONE ) *
+                                      from.get_to_xyz_mat();
+            for ( int c = 0; c < 3; ++c )
+            {
+                color::triplet<double> v;
+                v.x = c == 0 ? 1.0 : 0.0;
+                v.y = c == 1 ? 1.0 : 0.0;
+                v.z = c == 2 ? 1.0 : 0.0;
+                v   = m * v;
+                mid.m[0][c] = v.x;
+                mid.m[1][c] = v.y;
+                mid.m[2][c] = v.z;
+            }
+            linCurve = from.curve() != color::transfer::LINEAR;
+            encCurve = to.curve() != color::transfer::LINEAR;
+            if ( linCurve )
+                _lin = curve_lut( from.curve(), true );
+            if ( encCurve )
+                _enc = curve_lut( to.curve(), false );
+        }
+
+        if ( linCurve )
+            _pre = pre;
+        else
+            mid = affine::concat( pre, mid );
+        if ( encCurve )
+            _post = post;
+        else
+            mid = affine::concat( mid, post );
+        _mat = mid;
+
+        _has_pre  = linCurve && !_pre.is_identity();
+        _has_lin  = linCurve;
+        _has_mat  = !_mat.is_identity();
+        _has_enc  = encCurve;
+        _has_post = encCurve && !_post.is_identity();
+    }
+
+    /// converts a line, the output may be the same as the input
+    void run( float *out[3], const float *in[3], int w ) const
+    {
+        if ( _fallback )
+        {
+            for ( int x = 0; x < w; ++x )
+            {
+                float a = in[0][x], b = in[1][x], c = in[2][x];
+                color::convert( a, b, c, _from, _to, 32 );
+                out[0][x] = a;
+                out[1][x] = b;
+                out[2][x] = c;
+            }
+            return;
+        }
+
+        const float *src[3] = { in[0], in[1], in[2] };
+        if ( _has_pre )
+        {
+            _pre.run( out, src, w );
+            set_source( src, out );
+        }
+        if ( _has_lin )
+        {
+            run_curve( _lin, out, src, w );
+            set_source( src, out );
+        }
+        if ( _has_mat )
+        {
+            _mat.run( out, src, w );
+            set_source( src, out );
+        }
+        if ( _has_enc )
+        {
+            run_curve( _enc, out, src, w );
+            set_source( src, out );
+        }
+        if ( _has_post )
+        {
+            _post.run( out, src, w );
+            set_source( src, out );
+        }
+        for ( int c = 0; c < 3; ++c )
+            if ( src[c] != out[c] )
+                std::copy( src[c], src[c] + w, out[c] );
+    }
+
+private:
+    static inline void set_source( const float *src[3], float *out[3] )
+    {
+        src[0] = out[0];
+        src[1] = out[1];
+        src[2] = out[2];
+    }
+
+    static inline void
+    run_curve( const curve_lut &l, float *out[3], const float *in[3], int w )
+    {
+        for ( int c = 0; c < 3; ++c )
+        {
+            const float *inP  = in[c];
+            float *      outP = out[c];
+            for ( int x = 0; x < w; ++x )
+                outP[x] = l( inP[x] );
+        }
+    }
+
+    color::state _from;
+    color::state _to;
+    affine       _pre;
+    curve_lut    _lin;
+    affine       _mat;
+    curve_lut    _enc;
+    affine       _post;
+    bool         _fallback = false;
+    bool         _has_pre  = false;
+    bool         _has_lin  = false;
+    bool         _has_mat  = false;
+    bool         _has_enc  = false;
+    bool         _has_post = false;
+};
+
+} // namespace
+
+////////////////////////////////////////
+
 namespace image
 {
 ////////////////////////////////////////
 
 static void colorspace_line(
     size_t,
-    int                 s,
-    int                 e,
-    image_buf &         ret,
-    const image_buf &   src,
-    const color::state &from,
-    const color::state &to )
+    int                   s,
+    int                   e,
+    image_buf &           ret,
+    const image_buf &     src,
+    const color_pipeline &pipe )
 {
     plane &      xOut = ret[0];
     plane &      yOut = ret[1];
@@ -50,26 +407,10 @@ static void colorspace_line(
     int w = ret.width();
     for ( int y = s; y < e; ++y )
     {
-        float *      xLine   = xOut.line( y );
-        float *      yLine   = yOut.line( y );
-        float *      zLine   = zOut.line( y );
-        const float *xInLine = xIn.line( y );
-        const float *yInLine = yIn.line( y );
-        const float *zInLine = zIn.line( y );
-
-        for ( int x = 0; x < w; ++x )
-        {
-            float xV = xInLine[x];
-            float yV = yInLine[x];
-            float zV = zInLine[x];
-
-            /// \todo { extract the logic inside here out to a higher level... }
-            color::convert( xV, yV, zV, from, to, 32 );
+        float *      outLines[3] = { xOut.line( y ), yOut.line( y ), zOut.line( y ) };
+        const float *inLines[3]  = { xIn.line( y ), yIn.line( y ), zIn.line( y ) };
+        pipe.run( outLines, inLines, w );
 
-            xLine[x] = xV;
-            yLine[x] = yV;
-            zLine[x] = zV;
-        }
         for ( size_t i = 3; i < ret.size(); ++i )
             std::copy(
                 src[i].line( y ), src[i].line( y ) + w, ret[i].line( y ) );
@@ -85,6 +426,7 @@ compute_colorspace( const image_buf &a, color::state from, color::state to )
     for ( size_t i = 0; i != a.size(); ++i )
         ret.add_plane( plane( a.x1(), a.y1(), a.x2(), a.y2() ) );
 
+    color_pipeline pipe( from, to );
     threading::get().dispatch(
         std::bind(
             colorspace_line,
@@ -93,8 +435,7 @@ compute_colorspace( const image_buf &a, color::state from, color::state to )
             std::placeholders::_3,
             std::ref( ret ),
             std::cref( a ),
-            std::cref( from ),
-            std::cref( to ) ),
+            std::cref( pipe ) ),
         a.y1(),
         a.height() );
     return ret;
@@ -0,0 +1,223 @@
+// SPDX-License-Identifier: MIT
+// Copyright contributors to the gecko project.
+
+#include "frame_window.h"
+
+#include <base/contract.h>
+#include <chrono>
+
+////////////////////////////////////////
+
+namespace
+{
+constexpr int64_t nullframe = std::numeric_limits<int64_t>::min();
+
+} // namespace
+
+////////////////////////////////////////
+
+namespace image
+{
+////////////////////////////////////////
+
+frame_window::frame_window( loader load, int64_t first, int64_t last, int radius )
+    : _load( std::move( load ) )
+    , _first( first )
+    , _last( last )
+    , _radius( radius )
+    , _center( first )
+    , _wanted( nullframe )
+    , _pending_frame( nullframe )
+{
+    precondition( static_cast<bool>( _load ), "frame window requires a loader" );
+    precondition( radius >= 0, "invalid frame window radius {0}", radius );
+    _slots.resize( static_cast<size_t>( 2 * radius + 1 ) );
+    for ( auto &s: _slots )
+        s.frame = nullframe;
+}
+
+////////////////////////////////////////
+
+frame_window::~frame_window( void )
+{
+    _wanted.store( nullframe );
+    if ( _pending.valid() )
+        _pending.wait();
+    reap( true );
+}
+
+////////////////////////////////////////
+
+void frame_window::move_to( int64_t f )
+{
+    _center = f;
+    for ( auto &s: _slots )
+    {
+        if ( s.frame == nullframe )
+            continue;
+
+        if ( !contains( s.frame ) )
+        {
+            reset( s, nullframe );
+            continue;
+        }
+
+        for ( auto m = s.motion.begin(); m != s.motion.end(); )
+        {
+            if ( contains( m->first.first ) )
+                ++m;
+            else
+                m = s.motion.erase( m );
+        }
+    }
+
+    prefetch( f + _radius + 1 );
+}
+
+////////////////////////////////////////
+
+const image_buf &frame_window::frame( int64_t f )
+{
+    slot &s = find( f );
+    if ( s.frame != f )
+    {
+        image_buf img;
+        if ( _pending.valid() && _pending_frame == f )
+            img = _pending.get();
+        else
+            img = read( f );
+        reset( s, f );
+        s.image = std::move( img );
+    }
+    return s.image;
+}
+
+////////////////////////////////////////
+
+const image_buf &
+frame_window::derived( int64_t f, const std::string &name, const deriver &make )
+{
+    const image_buf &img = frame( f );
+    slot &           s   = find( f );
+    auto             i   = s.derived.find( name );
+    if ( i == s.derived.end() )
+        i = s.derived.emplace( name, make( img ) ).first;
+    return i->second;
+}
+
+////////////////////////////////////////
+
+const vector_field &frame_window::motion(
+    int64_t a, int64_t b, const std::string &name, const estimator &est )
+{
+    precondition(
+        contains( b ),
+        "frame {0} is not in the window of radius {1} around {2}",
+        b,
+        _radius,
+        _center );
+    // motion is held by the slot of the first frame, so make sure
+    // the slot belongs to it
+    frame( a );
+    slot &s   = find( a );
+    auto  key = std::make_pair( b, name );
+    auto  i   = s.motion.find( key );
+    if ( i == s.motion.end() )
+        i = s.motion.emplace( key, est( a, b ) ).first;
+    return i->second;
+}
+
+////////////////////////////////////////
+
+frame_window::slot &frame_window::find( int64_t f )
+{
+    precondition(
+        contains( f ),
+        "frame {0} is not in the window of radius {1} around {2}",
+        f,
+        _radius,
+        _center );
+    int64_t n = static_cast<int64_t>( _slots.size() );
+    return _slots[static_cast<size_t>( ( ( f % n ) + n ) % n )];
+}
+
+////////////////////////////////////////
+
+void frame_window::reset( slot &s, int64_t f )
+{
+    s.frame = f;
+    s.image = image_buf();
+    s.derived.clear();
+    s.motion.clear();
+}
+
+////////////////////////////////////////
+
+void frame_window::prefetch( int64_t f )
+{
+    if ( _pending.valid() )
+    {
+        if ( _pending_frame == f )
+            return;
+
+        // a read which was not asked for yet may still be of use
+        if ( contains( _pending_frame ) )
+            frame( _pending_frame );
+        else
+        {
+            // destroying the future of std::async would wait for the
+            // read to finish, so set it aside to be dropped once it is
+            // done (or skipped, if it has not started)
+            _wanted.store( nullframe );
+            _stale.push_back( std::move( _pending ) );
+        }
+    }
+    reap( false );
+
+    if ( f < _first || f > _last )
+        return;
+
+    _pending_frame = f;
+    _wanted.store( f );
+    _pending = std::async( std::launch::async, [this, f]() {
+        std::lock_guard<std::mutex> lk( _read_mutex );
+        if ( _wanted.load() != f )
+            return image_buf();
+        return _load( f );
+    } );
+}
+
+////////////////////////////////////////
+
+void frame_window::reap( bool wait )
+{
+    for ( auto i = _stale.begin(); i != _stale.end(); )
+    {
+        if ( wait ||
+             i->wait_for( std::chrono::seconds( 0 ) ) == std::future_status::ready )
+        {
+            // a failed read nobody wanted is not of interest
+            try
+            {
+                i->get();
+            }
+            catch ( ... )
+            {}
+            i = _stale.erase( i );
+        }
+        else
+            ++i;
+    }
+}
+
+////////////////////////////////////////
+
+image_buf frame_window::read( int64_t f )
+{
+    std::lock_guard<std::mutex> lk( _read_mutex );
+    return _load( f );
+}
+
+////////////////////////////////////////
+
+} // namespace image
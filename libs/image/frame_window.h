@@ -0,0 +1,115 @@
+// SPDX-License-Identifier: MIT
+// Copyright contributors to the gecko project.
+
+#pragma once
+
+#include "image.h"
+#include "vector_field.h"
+
+#include <atomic>
+#include <cstdint>
+#include <functional>
+#include <future>
+#include <limits>
+#include <map>
+#include <mutex>
+#include <string>
+#include <utility>
+#include <vector>
+
+////////////////////////////////////////
+
+namespace image
+{
+///
+/// @brief Class frame_window provides a sliding window of decoded
+/// frames for temporal processing.
+///
+/// The window holds the frames within radius of a center frame, along
+/// with images derived from them (i.e. the log of a frame) and the
+/// motion estimated between pairs of them, all keyed by frame number.
+/// As the center moves forward, only the frame entering the window is
+/// read, and the pairs matched for a previous center are found again
+/// instead of being estimated again. The frame which will enter the
+/// window next is read in the background while the current center is
+/// processed.
+///
+/// The window is meant to be driven by one thread: the loader is the
+/// only thing run in the background. Calls to the loader are never
+/// run at the same time, as the readers of a track are not safe to
+/// use from several threads at once.
+///
+class frame_window
+{
+public:
+    typedef std::function<image_buf( int64_t )>             loader;
+    typedef std::function<image_buf( const image_buf & )>   deriver;
+    typedef std::function<vector_field( int64_t, int64_t )> estimator;
+
+    /// frames outside of [first, last] are never read, and the
+    /// window starts centered on first
+    frame_window( loader load, int64_t first, int64_t last, int radius );
+    ~frame_window( void );
+    frame_window( const frame_window & ) = delete;
+    frame_window( frame_window && )      = delete;
+    frame_window &operator=( const frame_window & ) = delete;
+    frame_window &operator=( frame_window && ) = delete;
+
+    inline int     radius( void ) const { return _radius; }
+    inline int64_t center( void ) const { return _center; }
+
+    /// whether the frame is in the window and in the range of frames
+    inline bool contains( int64_t f ) const
+    {
+        return f >= _first && f <= _last && f >= _center - _radius &&
+               f <= _center + _radius;
+    }
+
+    /// centers the window on f, releasing the frames (and anything
+    /// made from them) which are no longer in it, and starts reading
+    /// the frame which will enter the window next
+    void move_to( int64_t f );
+
+    /// returns the frame, reading it if it has not been yet
+    const image_buf &frame( int64_t f );
+
+    /// returns the named image made from frame f, which is made once
+    /// while f stays in the window
+    const image_buf &
+    derived( int64_t f, const std::string &name, const deriver &make );
+
+    /// returns the named motion from frame a to frame b, which is
+    /// estimated once while both stay in the window
+    const vector_field &motion(
+        int64_t a, int64_t b, const std::string &name, const estimator &est );
+
+private:
+    struct slot
+    {
+        int64_t                                                 frame;
+        image_buf                                               image;
+        std::map<std::string, image_buf>                        derived;
+        std::map<std::pair<int64_t, std::string>, vector_field> motion;
+    };
+
+    slot &    find( int64_t f );
+    void      reset( slot &s, int64_t f );
+    void      prefetch( int64_t f );
+    void      reap( bool wait );
+    image_buf read( int64_t f );
+
+    loader            _load;
+    int64_t           _first;
+    int64_t           _last;
+    int               _radius;
+    int64_t           _center;
+    std::vector<slot> _slots;
+
+    std::mutex                          _read_mutex;
+    std::atomic<int64_t>                _wanted;
+    std::future<image_buf>              _pending;
+    int64_t                             _pending_frame;
+    std::vector<std::future<image_buf>> _stale;
+};
+
+} // namespace image
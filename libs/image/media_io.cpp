@@ -6,7 +6,9 @@
 #include "allocator.h"
 
 #include <base/contract.h>
+#include <base/pointer.h>
 #include <media/frame.h>
+#include <media/frame_stream.h>
 #include <media/image.h>
 #include <media/image_buffer.h>
 #include <media/writer.h>
@@ -15,37 +17,6 @@
 
 namespace
 {
-void update_image_buffer(
-    media::image_buffer &      buf,
-    const media::plane_layout &pl,
-    const media::area_rect &   area )
-{
-    if ( area.x1() == buf.x1() && area.x2() == buf.x2() &&
-         area.y1() == buf.y1() && area.y2() == buf.y2() && buf.offset() == 0 )
-    {
-        int64_t bytes = static_cast<int64_t>( ( int64_t( pl._bits ) + 7 ) / 8 );
-        int64_t ystride =
-            ( area.width() * bytes ) >> int64_t( pl._xsubsample_shift );
-        if ( buf.bits() == int64_t( pl._bits ) &&
-             buf.xstride_bytes() == ( int64_t( pl._bits ) / 8 ) &&
-             buf.ystride_bytes() == ystride )
-        {
-            // same buffer size, we can just return and re-use the buffer
-            return;
-        }
-    }
-    buf = media::image_buffer::full_plane(
-        area.x1(),
-        area.y1(),
-        area.x2(),
-        area.y2(),
-        pl._bits,
-        pl._xsubsample_shift,
-        pl._ysubsample_shift,
-        pl._floating,
-        pl._unsigned );
-}
-
 class frame_image_adapter : public ::media::image
 {
 public:
@@ -114,6 +85,12 @@ protected:
         for ( size_t i = 0; i != planes.size(); ++i )
             fill_plane( i, planes[i] );
     }
+    /// any number of rows can be converted, so let the writer pull
+    /// its own chunk size instead of converting the whole image
+    std::pair<int64_t, int64_t> compute_preferred_chunk( void ) const override
+    {
+        return std::make_pair( active_area().width(), int64_t( 1 ) );
+    }
 
 private:
     img_buf _image;
@@ -125,13 +102,78 @@ private:
 
 namespace image
 {
+namespace
+{
+////////////////////////////////////////
+
+// the indices of the named planes of the image, all of them when
+// none are named
+std::vector<size_t> plane_indices(
+    const media::image &            img,
+    const std::vector<std::string> &planes,
+    const std::string &             layer,
+    const std::string &             view,
+    int64_t                         f )
+{
+    std::vector<size_t> pMapping;
+    if ( planes.empty() )
+    {
+        pMapping.reserve( img.size() );
+        for ( size_t p = 0, nP = img.size(); p != nP; ++p )
+            pMapping.push_back( p );
+        return pMapping;
+    }
+
+    pMapping.reserve( planes.size() );
+    for ( auto &plane: planes )
+    {
+        bool found = false;
+        for ( size_t p = 0, nP = img.size(); p != nP; ++p )
+        {
+            if ( img.plane_name( p ) == plane )
+            {
+                pMapping.push_back( p );
+                found = true;
+                break;
+            }
+        }
+        if ( !found )
+            throw_runtime(
+                "Request for channel '{0}' in layer '{0}', view '{1}' does not exist in frame {2}",
+                plane,
+                layer,
+                view,
+                f );
+    }
+    return pMapping;
+}
+
+////////////////////////////////////////
+
+// the planes named, as only they are written, computed
+image_buf named_planes( const image_buf &i, const std::vector<std::string> &chans )
+{
+    image_buf img;
+    for ( size_t c = 0, nC = std::min( chans.size(), i.size() ); c != nC; ++c )
+    {
+        i[c].cdata();
+        img.add_plane( i[c] );
+    }
+    return img;
+}
+
+////////////////////////////////////////
+
+} // namespace
+
 ////////////////////////////////////////
 
 image_buf extract_frame(
     const media::frame &            f,
     const std::string &             layer,
     const std::string &             view,
-    const std::vector<std::string> &planes )
+    const std::vector<std::string> &planes,
+    const std::string &             source )
 {
     image_buf                     r;
     std::shared_ptr<media::image> img = f.find_image( layer, view );
@@ -147,53 +189,42 @@ image_buf extract_frame(
             // TODO: how do we handle 4:2:2 interleaved?
             throw_not_yet();
         }
-        else if ( planes.empty() )
+        else
         {
-            media::image_buffer tmp;
-            for ( size_t p = 0, nP = img->size(); p != nP; ++p )
+            std::vector<size_t> pMapping =
+                plane_indices( *img, planes, layer, view, f.number() );
+
+            // have the media decode straight into the plane memory,
+            // reading all the requested channels at once
+            std::vector<plane>               pls;
+            std::vector<media::image_buffer> bufs;
+            pls.reserve( pMapping.size() );
+            bufs.reserve( pMapping.size() );
+            for ( size_t idx = 0; idx != pMapping.size(); ++idx )
             {
-                update_image_buffer( tmp, img->layout( p ), active );
-                img->extract_plane( p, tmp );
-                plane pl( dx1, dy1, dx2, dy2 );
-                for ( int64_t y = dy1; y <= dy2; ++y )
-                    tmp.get_scanline( y, pl.line( static_cast<int>( y ) ), 1 );
-                r.add_plane( std::move( pl ) );
+                pls.emplace_back( dx1, dy1, dx2, dy2 );
+                plane &pl = pls.back();
+                bufs.emplace_back(
+                    std::shared_ptr<float>( pl.data(), base::no_deleter() ),
+                    dx1,
+                    dy1,
+                    dx2,
+                    dy2,
+                    int64_t( sizeof( float ) * 8 ),
+                    int64_t( pl.stride() ) * int64_t( sizeof( float ) * 8 ) );
             }
-        }
-        else
-        {
-            std::vector<size_t> pMapping;
-            pMapping.reserve( planes.size() );
+            img->extract_planes( pMapping, bufs );
 
-            media::image_buffer tmp;
-            for ( auto &plane: planes )
+            for ( size_t idx = 0; idx != pMapping.size(); ++idx )
             {
-                bool found = false;
-                for ( size_t p = 0, nP = img->size(); p != nP; ++p )
-                {
-                    if ( img->plane_name( p ) == plane )
-                    {
-                        pMapping.push_back( p );
-                        found = true;
-                        break;
-                    }
-                }
-                if ( !found )
-                    throw_runtime(
-                        "Request for channel '{0}' in layer '{0}', view '{1}' does not exist in frame {2}",
-                        plane,
+                plane &pl = pls[idx];
+                if ( !source.empty() )
+                    pl.set_source(
+                        source,
+                        f.number(),
                         layer,
                         view,
-                        f.number() );
-            }
-
-            for ( size_t idx: pMapping )
-            {
-                update_image_buffer( tmp, img->layout( idx ), active );
-                img->extract_plane( idx, tmp );
-                plane pl( dx1, dy1, dx2, dy2 );
-                for ( int64_t y = dy1; y <= dy2; ++y )
-                    tmp.get_scanline( y, pl.line( static_cast<int>( y ) ), 1 );
+                        img->plane_name( pMapping[idx] ) );
                 r.add_plane( std::move( pl ) );
             }
         }
@@ -212,6 +243,21 @@ image_buf extract_frame(
 
 ////////////////////////////////////////
 
+void decode_frame(
+    media::frame &                  f,
+    const std::string &             layer,
+    const std::string &             view,
+    const std::vector<std::string> &planes )
+{
+    // extract_frame reports what is missing
+    std::shared_ptr<media::image> img = f.find_image( layer, view );
+    if ( !img || img->interleaved() )
+        return;
+    img->decode_planes( plane_indices( *img, planes, layer, view, f.number() ) );
+}
+
+////////////////////////////////////////
+
 std::shared_ptr<media::frame> to_frame(
     const image_buf &               i,
     const std::vector<std::string> &chans,
@@ -262,6 +308,77 @@ std::shared_ptr<media::frame> to_frame(
 
 ////////////////////////////////////////
 
+void write_image( media::frame_stream &s, size_t idx, const image_buf &i )
+{
+    int64_t y1 = s.next_row( idx );
+    int64_t y2 = i.y2();
+    if ( y1 > y2 )
+        return;
+
+    // the stream converts from the plane memory as it encodes
+    std::vector<media::image_buffer> bufs;
+    bufs.reserve( i.size() );
+    for ( auto &p: i )
+    {
+        precondition(
+            y1 >= p.y1() && y2 <= p.y2(),
+            "plane rows {0} - {1} do not cover rows {2} - {3} of the stream",
+            p.y1(),
+            p.y2(),
+            y1,
+            y2 );
+        bufs.emplace_back(
+            std::shared_ptr<float>(
+                const_cast<float *>( p.line( static_cast<int>( y1 ) ) ),
+                base::no_deleter() ),
+            p.x1(),
+            y1,
+            p.x2(),
+            y2,
+            int64_t( sizeof( float ) * 8 ),
+            int64_t( p.stride() ) * int64_t( sizeof( float ) * 8 ) );
+    }
+    s.write_band( idx, bufs );
+}
+
+////////////////////////////////////////
+
+void stream_frame(
+    media::video_track &            t,
+    int64_t                         f,
+    const image_buf &               i,
+    const std::vector<std::string> &chans,
+    const std::string &             type,
+    const media::metadata &         meta )
+{
+    image_buf img = named_planes( i, chans );
+
+    // the layout only describes the planes, the pixels come from img
+    auto layout = to_frame( i, chans, type, meta );
+    auto out    = t.start_frame( f, *layout, allocator::get() );
+    write_image( *out, 0, img );
+    out->finish();
+}
+
+////////////////////////////////////////
+
+void store_frame(
+    media::async_video_track &      t,
+    int64_t                         f,
+    const image_buf &               i,
+    const std::vector<std::string> &chans,
+    const std::string &             type,
+    const media::metadata &         meta )
+{
+    image_buf img    = named_planes( i, chans );
+    auto      layout = to_frame( i, chans, type, meta );
+    t.store_stream( f, layout, allocator::get(), [img]( media::frame_stream &s ) {
+        write_image( s, 0, img );
+    } );
+}
+
+////////////////////////////////////////
+
 void debug_save_image(
     const image_buf &               i,
     const std::string &             fn,
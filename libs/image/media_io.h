@@ -5,8 +5,11 @@
 
 #include "image.h"
 
+#include <media/async_video_track.h>
 #include <media/container.h>
 #include <media/frame.h>
+#include <media/frame_stream.h>
+#include <media/video_track.h>
 #include <string>
 #include <vector>
 
@@ -19,10 +22,28 @@ class registry;
 
 namespace image
 {
+/// Extracts the planes of a layer / view of a frame into an image.
+///
+/// If source is provided (i.e. the uri of the file), the planes are
+/// given a stable identity of source, frame, layer, view and channel
+/// so computations using them can be found in the engine result
+/// cache across requests.
 image_buf extract_frame(
     const media::frame &            f,
     const std::string &             layer  = std::string(),
     const std::string &             view   = std::string(),
+    const std::vector<std::string> &planes = std::vector<std::string>(),
+    const std::string &             source = std::string() );
+
+/// @brief decodes the planes extract_frame would read into memory
+///
+/// For the decode function of a media::async_video_track, so the
+/// pixels are decoded by its read ahead, and extract_frame only has
+/// to copy them (@sa media::image::decode_planes).
+void decode_frame(
+    media::frame &                  f,
+    const std::string &             layer  = std::string(),
+    const std::string &             view   = std::string(),
     const std::vector<std::string> &planes = std::vector<std::string>() );
 
 /// Simple image to a frame with a single default / unnamed (well, empty string) layer and one view
@@ -32,6 +53,36 @@ std::shared_ptr<media::frame> to_frame(
     const std::string &             type,
     const media::metadata &         meta = media::metadata() );
 
+/// @brief writes the image as image idx of a frame stream
+///
+/// The rows not yet written are provided to the stream straight from
+/// the plane memory, the stream converting and encoding a chunk at a
+/// time, so there is no converted copy of the full image.
+void write_image( media::frame_stream &s, size_t idx, const image_buf &i );
+
+/// @brief writes the image as frame f of the track through a frame
+/// stream (@sa write_image), so the planes are encoded a chunk of
+/// rows at a time straight from their memory rather than through a
+/// frame adapter. The planes are computed first.
+void stream_frame(
+    media::video_track &            t,
+    int64_t                         f,
+    const image_buf &               i,
+    const std::vector<std::string> &chans,
+    const std::string &             type,
+    const media::metadata &         meta = media::metadata() );
+
+/// @brief queues the image as frame f on the write behind of the
+/// track, to be streamed as stream_frame does by its writer thread.
+/// The planes are computed first, blocks while the queue is full.
+void store_frame(
+    media::async_video_track &      t,
+    int64_t                         f,
+    const image_buf &               i,
+    const std::vector<std::string> &chans,
+    const std::string &             type,
+    const media::metadata &         meta = media::metadata() );
+
 void debug_save_image(
     const image_buf &               i,
     const std::string &             fn,
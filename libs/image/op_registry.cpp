@@ -3,6 +3,7 @@
 
 #include "op_registry.h"
 
+#include "color_ops.h"
 #include "image.h"
 #include "media_io.h"
 //#include "image_ops.h"
@@ -107,6 +108,7 @@ void initOps( void )
     registerImageOps( r );
     image::add_spatial( r );
     image::add_vector_ops( r );
+    image::add_color_ops( r );
 }
 
 } // namespace
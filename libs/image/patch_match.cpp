@@ -669,7 +669,7 @@ static void matchPassHorizThreadForward1(
             }
         }
     }
-    changeCounts[tIdx] = changeCount;
+    changeCounts[tIdx] += changeCount;
 }
 
 template <typename BufType, typename DistFunc>
@@ -750,7 +750,7 @@ static void matchPassHorizThreadForwardN(
             }
         }
     }
-    changeCounts[tIdx] = changeCount;
+    changeCounts[tIdx] += changeCount;
 }
 
 template <typename BufType, typename DistFunc>
@@ -799,7 +799,7 @@ static void matchPassHorizThreadBackward1(
             }
         }
     }
-    changeCounts[tIdx] = changeCount;
+    changeCounts[tIdx] += changeCount;
 }
 
 template <typename BufType, typename DistFunc>
@@ -878,7 +878,7 @@ static void matchPassHorizThreadBackwardN(
             }
         }
     }
-    changeCounts[tIdx] = changeCount;
+    changeCounts[tIdx] += changeCount;
 }
 
 template <typename BufType, typename DistFunc>
@@ -922,7 +922,7 @@ static void matchPassVertThreadDown1(
             }
         }
     }
-    changeCounts[tIdx] = changeCount;
+    changeCounts[tIdx] += changeCount;
 }
 
 template <typename BufType, typename DistFunc>
@@ -978,7 +978,7 @@ static void matchPassVertThreadDownN(
                 ++changeCount;
         }
     }
-    changeCounts[tIdx] = changeCount;
+    changeCounts[tIdx] += changeCount;
 }
 
 template <typename BufType, typename DistFunc>
@@ -1021,7 +1021,7 @@ static void matchPassVertThreadUp1(
             }
         }
     }
-    changeCounts[tIdx] = changeCount;
+    changeCounts[tIdx] += changeCount;
 }
 
 template <typename BufType, typename DistFunc>
@@ -1077,7 +1077,7 @@ static void matchPassVertThreadUpN(
                 ++changeCount;
         }
     }
-    changeCounts[tIdx] = changeCount;
+    changeCounts[tIdx] += changeCount;
 }
 
 template <typename BufType, typename DistFunc>
@@ -1182,7 +1182,7 @@ static void matchPassDiagonal(
             }
         }
     }
-    changeCounts[tIdx] = changeCount;
+    changeCounts[tIdx] += changeCount;
 }
 
 template <typename BufType, typename DistFunc>
@@ -1271,7 +1271,7 @@ static void matchPassRandomThread(
             }
         }
     }
-    changeCounts[tIdx] = changeCount;
+    changeCounts[tIdx] += changeCount;
 }
 
 ////////////////////////////////////////
@@ -1380,7 +1380,7 @@ static void matchPassRegAve(
             }
         }
     }
-    changeCounts[tIdx] = changeCount;
+    changeCounts[tIdx] += changeCount;
 }
 
 static inline size_t getCount( std::vector<size_t> &counts )
@@ -1807,7 +1807,7 @@ static void matchPassHorizThreadForwardAlpha1(
             }
         }
     }
-    changeCounts[tIdx] = changeCount;
+    changeCounts[tIdx] += changeCount;
 }
 
 template <typename BufType, typename DistFunc>
@@ -1898,7 +1898,7 @@ static void matchPassHorizThreadForwardAlphaN(
             }
         }
     }
-    changeCounts[tIdx] = changeCount;
+    changeCounts[tIdx] += changeCount;
 }
 
 template <typename BufType, typename DistFunc>
@@ -1946,7 +1946,7 @@ static void matchPassVertThreadDownAlpha1(
             }
         }
     }
-    changeCounts[tIdx] = changeCount;
+    changeCounts[tIdx] += changeCount;
 }
 
 template <typename BufType, typename DistFunc>
@@ -2012,7 +2012,7 @@ static void matchPassHorizThreadBackwardAlpha1(
             }
         }
     }
-    changeCounts[tIdx] = changeCount;
+    changeCounts[tIdx] += changeCount;
 }
 
 template <typename BufType, typename DistFunc>
@@ -2096,7 +2096,7 @@ static void matchPassHorizThreadBackwardAlphaN(
             }
         }
     }
-    changeCounts[tIdx] = changeCount;
+    changeCounts[tIdx] += changeCount;
 }
 
 template <typename BufType, typename DistFunc>
@@ -2166,7 +2166,7 @@ static void matchPassVertThreadDownAlphaN(
                 ++changeCount;
         }
     }
-    changeCounts[tIdx] = changeCount;
+    changeCounts[tIdx] += changeCount;
 }
 
 template <typename BufType, typename DistFunc>
@@ -2216,7 +2216,7 @@ static void matchPassVertThreadUpAlpha1(
             }
         }
     }
-    changeCounts[tIdx] = changeCount;
+    changeCounts[tIdx] += changeCount;
 }
 
 template <typename BufType, typename DistFunc>
@@ -2286,7 +2286,7 @@ static void matchPassVertThreadUpAlphaN(
                 ++changeCount;
         }
     }
-    changeCounts[tIdx] = changeCount;
+    changeCounts[tIdx] += changeCount;
 }
 
 template <typename BufType, typename DistFunc>
@@ -2457,7 +2457,7 @@ static void matchPassDiagonalAlpha(
             }
         }
     }
-    changeCounts[tIdx] = changeCount;
+    changeCounts[tIdx] += changeCount;
 }
 
 template <typename BufType, typename DistFunc>
@@ -2550,7 +2550,7 @@ static void matchPassRandomThreadAlpha(
             }
         }
     }
-    changeCounts[tIdx] = changeCount;
+    changeCounts[tIdx] += changeCount;
 }
 
 ////////////////////////////////////////
@@ -2668,7 +2668,7 @@ static void matchPassRegAveAlpha(
             }
         }
     }
-    changeCounts[tIdx] = changeCount;
+    changeCounts[tIdx] += changeCount;
 }
 
 ////////////////////////////////////////////////////////////////////////////////
@@ -6,6 +6,26 @@
 #include "plane_buffer.h"
 #include "threading.h"
 
+#include <atomic>
+#include <base/pointer.h>
+#include <cstring>
+
+////////////////////////////////////////
+
+namespace
+{
+std::atomic<uint64_t> thePlaneSerial( 0 );
+
+engine::hash::value unique_identity( void )
+{
+    engine::hash h;
+    h << "plane.serial"
+      << static_cast<unsigned long long>( ++thePlaneSerial );
+    return h.finish();
+}
+
+} // namespace
+
 ////////////////////////////////////////
 
 namespace image
@@ -20,6 +40,7 @@ plane::plane( int x1, int y1, int x2, int y2 )
     : _x1( x1 ), _y1( y1 ), _x2( x2 ), _y2( y2 )
 {
     _mem = allocator::get().buffer( _stride, width(), height() );
+    assign_identity( unique_identity() );
 }
 
 ////////////////////////////////////////
@@ -37,6 +58,7 @@ plane::plane( const engine::dimensions &d )
 plane::plane( const plane &o )
     : computed_base( o )
     , _mem( o._mem )
+    , _identity( o._identity )
     , _x1( o._x1 )
     , _y1( o._y1 )
     , _x2( o._x2 )
@@ -52,6 +74,7 @@ plane::plane( const plane &o )
 plane::plane( plane &&o )
     : computed_base( std::move( o ) )
     , _mem( std::move( o._mem ) )
+    , _identity( o._identity )
     , _x1( std::move( o._x1 ) )
     , _y1( std::move( o._y1 ) )
     , _x2( std::move( o._x2 ) )
@@ -70,12 +93,13 @@ plane::~plane( void ) {}
 
 plane &plane::operator=( plane &&o )
 {
-    _x1     = std::move( o._x1 );
-    _y1     = std::move( o._y1 );
-    _x2     = std::move( o._x2 );
-    _y2     = std::move( o._y2 );
-    _mem    = std::move( o._mem );
-    _stride = std::move( o._stride );
+    _x1       = std::move( o._x1 );
+    _y1       = std::move( o._y1 );
+    _x2       = std::move( o._x2 );
+    _y2       = std::move( o._y2 );
+    _mem      = std::move( o._mem );
+    _stride   = std::move( o._stride );
+    _identity = o._identity;
 
     adopt( std::move( o ) );
     if ( _mem )
@@ -90,12 +114,13 @@ plane &plane::operator=( const plane &o )
 {
     if ( this != &o )
     {
-        _mem    = o._mem;
-        _stride = o._stride;
-        _x1     = o._x1;
-        _y1     = o._y1;
-        _x2     = o._x2;
-        _y2     = o._y2;
+        _mem      = o._mem;
+        _stride   = o._stride;
+        _identity = o._identity;
+        _x1       = o._x1;
+        _y1       = o._y1;
+        _x2       = o._x2;
+        _y2       = o._y2;
 
         internal_copy( o );
         if ( _mem )
@@ -153,6 +178,119 @@ plane plane::clone( void ) const { return plane( x1(), y1(), x2(), y2() ); }
 
 ////////////////////////////////////////
 
+void plane::set_window(
+    const engine::dimensions &d, float *rows, int stride, int wy1 )
+{
+    precondition( !_graph, "unable to window a computed plane" );
+    _x1     = static_cast<int>( d.x1 );
+    _y1     = static_cast<int>( d.y1 );
+    _x2     = static_cast<int>( d.x2 );
+    _y2     = static_cast<int>( d.y2 );
+    _stride = stride;
+    // line() addresses rows relative to y1, so shift the base such
+    // that the first row of the window is the one for wy1
+    _mem = std::shared_ptr<value_type>(
+        rows - static_cast<ptrdiff_t>( wy1 - _y1 ) * stride, base::no_deleter() );
+    _identity.reset();
+    assign_identity( unique_identity() );
+    _identity->window = true;
+}
+
+////////////////////////////////////////
+
+void plane::detach( void )
+{
+    // another plane, or an entry of the engine result cache, holds
+    // on to the same memory, so give this plane a copy of its own to
+    // write into rather than changing the pixels underneath them
+    int                         s = 0;
+    std::shared_ptr<value_type> m =
+        allocator::get().buffer( s, width(), height() );
+    const value_type *src = _mem.get();
+    value_type *      dst = m.get();
+    if ( s == _stride )
+        memcpy(
+            dst,
+            src,
+            static_cast<size_t>( s ) * static_cast<size_t>( height() ) *
+                sizeof( value_type ) );
+    else
+    {
+        for ( int y = 0, h = height(); y < h; ++y )
+            memcpy(
+                dst + static_cast<ptrdiff_t>( y ) * s,
+                src + static_cast<ptrdiff_t>( y ) * _stride,
+                static_cast<size_t>( width() ) * sizeof( value_type ) );
+    }
+
+    _mem    = std::move( m );
+    _stride = s;
+    _identity.reset();
+    assign_identity( unique_identity() );
+}
+
+////////////////////////////////////////
+
+engine::hash::value plane::identity( void ) const
+{
+    bool computed;
+    return identity( computed );
+}
+
+////////////////////////////////////////
+
+engine::hash::value plane::identity( bool &computed ) const
+{
+    computed = false;
+    // hold on to the state in case this plane is re-assigned meanwhile
+    std::shared_ptr<identity_state> st = _identity;
+    if ( !st )
+        return engine::hash::value{ { 0, 0 } };
+
+    std::lock_guard<std::mutex> lk( st->mutex );
+    if ( st->changed.exchange( false ) )
+    {
+        st->id       = unique_identity();
+        st->computed = false;
+    }
+    computed = st->computed;
+    return st->id;
+}
+
+////////////////////////////////////////
+
+void plane::set_identity( const engine::hash::value &id ) { assign_identity( id ); }
+
+////////////////////////////////////////
+
+void plane::assign_identity( const engine::hash::value &id ) const
+{
+    // the planes sharing the memory share the identity as well
+    if ( !_identity )
+        _identity = std::make_shared<identity_state>();
+    std::lock_guard<std::mutex> lk( _identity->mutex );
+    _identity->id       = id;
+    _identity->computed = false;
+    _identity->changed.store( false );
+}
+
+////////////////////////////////////////
+
+void plane::set_source(
+    const std::string &uri,
+    int64_t            frame,
+    const std::string &layer,
+    const std::string &view,
+    const std::string &channel )
+{
+    engine::hash h;
+    h << "plane.source" << uri << static_cast<long long>( frame ) << layer
+      << view << channel;
+    assign_identity( h.finish() );
+}
+
+////////////////////////////////////////
+
 void plane::run_compute( void ) const
 {
     // pending() returns true if we need computation, but another
@@ -167,8 +305,15 @@ void plane::run_compute( void ) const
             "computed plane does not match dimensions provided" );
         postcondition(
             tmp._mem && tmp._stride >= width(), "invalid computed plane" );
-        _stride = tmp._stride;
-        _mem    = tmp._mem;
+        _stride   = tmp._stride;
+        _mem      = tmp._mem;
+        _identity = tmp._identity;
+        // stable across graphs as long as the inputs are
+        engine::hash h;
+        compute_hash( h );
+        assign_identity( h.finish() );
+        std::lock_guard<std::mutex> lk( _identity->mutex );
+        _identity->computed = true;
         return;
     }
 
@@ -179,13 +324,17 @@ void plane::run_compute( void ) const
 
 engine::hash &operator<<( engine::hash &h, const plane &p )
 {
-    if ( p.compute_hash( h ) )
+    // a computed plane stands for its node, unless it has been written
+    // to since it was computed
+    bool                computed = false;
+    engine::hash::value id       = p.identity( computed );
+    bool                written  = p._identity && !computed;
+    if ( !written && p.compute_hash( h ) )
         return h;
 
     h << typeid( p ).hash_code() << p.x1() << p.y1() << p.x2() << p.y2();
     if ( p.valid() )
-        h << reinterpret_cast<intptr_t>( p.cdata() );
-    //		h.add( p.cdata(), p.buffer_size() );
+        h << id;
     return h;
 }
 
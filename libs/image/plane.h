@@ -9,10 +9,12 @@
 #include "plane_util.h"
 
 #include <algorithm>
+#include <atomic>
 #include <base/contract.h>
 #include <base/math_functions.h>
 #include <engine/computed_value.h>
 #include <functional>
+#include <mutex>
 
 ////////////////////////////////////////
 
@@ -99,6 +101,7 @@ public:
     {
         if ( _graph )
             check_compute();
+        changed();
 
         if ( valid() )
             return plane_buffer( data(), _x1, _y1, _x2, _y2, stride() );
@@ -108,6 +111,7 @@ public:
     inline value_type *data( void )
     {
         check_compute();
+        changed();
         return _mem.get();
     }
     inline const value_type *data( void ) const
@@ -154,6 +158,42 @@ public:
     /// copy the memory or any compute parameters
     plane clone( void ) const;
 
+    /// @brief identity used to hash the plane when it is not part of a graph
+    ///
+    /// Newly allocated planes are given a unique identity, and planes
+    /// pulled from a graph take the identity of the node which
+    /// computed them. Planes read from media should be given a stable
+    /// identity (@sa set_source) so results computed from them can
+    /// be found in the engine result cache by later requests. Any
+    /// mutable access to the pixels (data, line, get, or conversion to
+    /// a plane_buffer) of a plane whose memory is shared with another
+    /// plane, or held by the engine result cache, first gives it a
+    /// private copy of the pixels (copy on write), and the written
+    /// plane a new unique identity the next time it is asked for, so
+    /// results computed from the old pixel values are not found
+    /// again. As such, the first write to a shared plane should not
+    /// happen from several threads at once (convert it to a
+    /// plane_buffer prior to dispatching the work).
+    engine::hash::value identity( void ) const;
+    void set_identity( const engine::hash::value &id );
+    /// sets a stable identity from where the plane was read
+    void set_source(
+        const std::string &uri,
+        int64_t            frame,
+        const std::string &layer,
+        const std::string &view,
+        const std::string &channel );
+
+    /// @brief points the plane at a window of externally owned rows
+    ///
+    /// The plane takes the provided dimensions, but only the rows
+    /// starting at wy1 are backed by memory, which the caller keeps
+    /// alive. This is used by the scanline processing to present
+    /// the scanlines computed so far as the input of an n-to-one
+    /// operation without computing the full plane.
+    void set_window(
+        const engine::dimensions &d, float *rows, int stride, int wy1 );
+
 private:
     void        run_compute( void ) const;
     inline void check_compute( void ) const
@@ -164,7 +204,37 @@ private:
         run_compute();
     }
 
-    mutable std::shared_ptr<value_type> _mem;
+    /// shared by the planes sharing the memory
+    struct identity_state
+    {
+        std::mutex          mutex;
+        engine::hash::value id = { { 0, 0 } };
+        std::atomic<bool>   changed{ false };
+        bool                computed = false;
+        bool                window   = false;
+    };
+
+    friend engine::hash &operator<<( engine::hash &h, const plane &p );
+
+    inline void changed( void )
+    {
+        // windows only back some rows and are never written through
+        if ( _mem && _mem.use_count() > 1 &&
+             !( _identity && _identity->window ) )
+            detach();
+
+        // checked first so rows written from many threads only read
+        // the flag once it is set
+        if ( _identity && !_identity->changed.load( std::memory_order_relaxed ) )
+            _identity->changed.store( true, std::memory_order_relaxed );
+    }
+
+    void detach( void );
+    engine::hash::value identity( bool &computed ) const;
+    void assign_identity( const engine::hash::value &id ) const;
+
+    mutable std::shared_ptr<value_type>     _mem;
+    mutable std::shared_ptr<identity_state> _identity;
     int                                 _x1     = 0;
     int                                 _y1     = 0;
     int                                 _x2     = 0;
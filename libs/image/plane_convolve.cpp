@@ -9,6 +9,16 @@
 #include <base/contract.h>
 #include <base/cpu_features.h>
 #include <base/math_functions.h>
+#include <vector>
+
+#ifdef __SSE__
+#    if defined( LINUX ) || defined( __linux__ )
+#        include <x86intrin.h>
+#    else
+#        include <immintrin.h>
+#        include <xmmintrin.h>
+#    endif
+#endif
 
 ////////////////////////////////////////
 
@@ -458,128 +468,351 @@ vert_ngrad5_alpha( scanline &dest, int y, const plane &src, const plane &alpha )
     //		vert_cgrad_alpha( dest, y, src, alpha );
 }
 
-static void horiz_convolve3_mirror(
-    scanline &dest, const scanline &src, float outer, float center )
+////////////////////////////////////////
+
+/// @brief applies a kernel along a line of samples
+///
+/// out[x], for x in [0, n), is the kernel applied to src[x .. x + K),
+/// so src is expected to hold the radius of the kernel past both ends
+/// of the output. N is the size of the kernel if known at compile time
+/// (and is 0 otherwise), and symmetric kernels add the mirrored
+/// samples before multiplying.
+template <int N, bool symmetric> struct conv_row
 {
-    if ( dest.width() < 2 )
+    static void
+    apply( float *out, const float *src, int n, const float *k, int kSize )
     {
-        dest[0] = src[0];
-        return;
+        const int K    = N > 0 ? N : kSize;
+        const int half = K / 2;
+        int       x    = 0;
+#if defined( __SSE__ )
+        for ( ; x + 4 <= n; x += 4 )
+        {
+            const float *s = src + x;
+            __m128       acc;
+            if ( symmetric )
+            {
+                acc = _mm_mul_ps( _mm_loadu_ps( s + half ), _mm_set1_ps( k[half] ) );
+                for ( int l = 0; l < half; ++l )
+                    acc = _mm_add_ps(
+                        acc,
+                        _mm_mul_ps(
+                            _mm_add_ps(
+                                _mm_loadu_ps( s + l ), _mm_loadu_ps( s + K - 1 - l ) ),
+                            _mm_set1_ps( k[l] ) ) );
+            }
+            else
+            {
+                acc = _mm_mul_ps( _mm_loadu_ps( s ), _mm_set1_ps( k[0] ) );
+                for ( int l = 1; l < K; ++l )
+                    acc = _mm_add_ps(
+                        acc, _mm_mul_ps( _mm_loadu_ps( s + l ), _mm_set1_ps( k[l] ) ) );
+            }
+            _mm_storeu_ps( out + x, acc );
+        }
+#endif
+        for ( ; x < n; ++x )
+        {
+            const float *s = src + x;
+            float        sum;
+            if ( symmetric )
+            {
+                sum = s[half] * k[half];
+                for ( int l = 0; l < half; ++l )
+                    sum += ( s[l] + s[K - 1 - l] ) * k[l];
+            }
+            else
+            {
+                sum = s[0] * k[0];
+                for ( int l = 1; l < K; ++l )
+                    sum += s[l] * k[l];
+            }
+            out[x] = sum;
+        }
     }
-    precondition( dest.get() != src.get(), "Need not-in-place flag to op" );
-
-    dest[0] = ( src[0] + src[1] ) * outer + src[0] * center;
-    int wm1 = dest.width() - 1;
-    for ( int x = 1; x < wm1; ++x )
-        dest[x] = ( src[x + 1] + src[x - 1] ) * outer + src[x] * center;
-    dest[wm1] = ( src[wm1] + src[wm1 - 1] ) * outer + src[wm1] * center;
-}
+};
 
-static void horiz_convolve3(
-    scanline &dest, const scanline &src, float left, float center, float right )
+/// @brief the vertical equivalent of conv_row
+///
+/// out[x] is the kernel applied to rows[0][x] .. rows[K - 1][x]
+template <int N, bool symmetric> struct conv_col
 {
-    if ( dest.width() < 2 )
+    static void apply(
+        float *out, const float *const *rows, int n, const float *k, int kSize )
     {
-        dest[0] = src[0];
-        return;
+        const int K    = N > 0 ? N : kSize;
+        const int half = K / 2;
+        int       x    = 0;
+#if defined( __SSE__ )
+        for ( ; x + 4 <= n; x += 4 )
+        {
+            __m128 acc;
+            if ( symmetric )
+            {
+                acc = _mm_mul_ps(
+                    _mm_loadu_ps( rows[half] + x ), _mm_set1_ps( k[half] ) );
+                for ( int l = 0; l < half; ++l )
+                    acc = _mm_add_ps(
+                        acc,
+                        _mm_mul_ps(
+                            _mm_add_ps(
+                                _mm_loadu_ps( rows[l] + x ),
+                                _mm_loadu_ps( rows[K - 1 - l] + x ) ),
+                            _mm_set1_ps( k[l] ) ) );
+            }
+            else
+            {
+                acc = _mm_mul_ps( _mm_loadu_ps( rows[0] + x ), _mm_set1_ps( k[0] ) );
+                for ( int l = 1; l < K; ++l )
+                    acc = _mm_add_ps(
+                        acc,
+                        _mm_mul_ps( _mm_loadu_ps( rows[l] + x ), _mm_set1_ps( k[l] ) ) );
+            }
+            _mm_storeu_ps( out + x, acc );
+        }
+#endif
+        for ( ; x < n; ++x )
+        {
+            float sum;
+            if ( symmetric )
+            {
+                sum = rows[half][x] * k[half];
+                for ( int l = 0; l < half; ++l )
+                    sum += ( rows[l][x] + rows[K - 1 - l][x] ) * k[l];
+            }
+            else
+            {
+                sum = rows[0][x] * k[0];
+                for ( int l = 1; l < K; ++l )
+                    sum += rows[l][x] * k[l];
+            }
+            out[x] = sum;
+        }
     }
-    precondition( dest.get() != src.get(), "Need not-in-place flag to op" );
+};
 
-    dest[0] = src[0] * ( left + center ) + src[1] * right;
-    int wm1 = dest.width() - 1;
-    for ( int x = 1; x < wm1; ++x )
-        dest[x] = src[x - 1] * left + src[x] * center + src[x + 1] * right;
-    dest[wm1] = ( src[wm1] * ( center + right ) + src[wm1 - 1] ) * left;
-}
+typedef void ( *row_func )( float *, const float *, int, const float *, int );
+typedef void ( *col_func )( float *, const float *const *, int, const float *, int );
 
-static void horiz_convolve(
-    scanline &dest, const scanline &src, const std::vector<float> &k )
+/// the largest vertical radius computed a scanline at a time
+constexpr size_t maxWindowRadius = 3;
+
+static bool is_symmetric( const std::vector<float> &k )
 {
-    if ( dest.width() < 2 )
+    for ( size_t i = 0, n = k.size(); i < n / 2; ++i )
     {
-        dest[0] = src[0];
-        return;
+        if ( !base::equal( k[i], k[n - 1 - i] ) )
+            return false;
     }
-    precondition( dest.get() != src.get(), "Need not-in-place flag to op" );
+    return true;
+}
 
-    int halfK = static_cast<int>( k.size() / 2 );
-    int wm1   = dest.width() - 1;
-    for ( int x = 0; x <= wm1; ++x )
+/// picks the specialization for the common small kernels, or the
+/// generic version for the rest
+template <template <int, bool> class Conv, typename Func>
+static Func choose_conv( const std::vector<float> &k )
+{
+    bool sym = is_symmetric( k );
+    switch ( k.size() )
     {
-        float sum = 0.F;
-        for ( int l = -halfK; l <= halfK; ++l )
-        {
-            int pos = std::max( 0, std::min( wm1, x + l ) );
-            sum += src[pos] * k[static_cast<size_t>( l + halfK )];
-        }
-        dest[x] = sum;
+        case 3: return sym ? Conv<3, true>::apply : Conv<3, false>::apply;
+        case 5: return sym ? Conv<5, true>::apply : Conv<5, false>::apply;
+        case 7: return sym ? Conv<7, true>::apply : Conv<7, false>::apply;
+        default: break;
     }
+    return sym ? Conv<0, true>::apply : Conv<0, false>::apply;
 }
 
 ////////////////////////////////////////
 
-static void vert_convolve3_mirror(
-    scanline &dest, int y, const plane &src, float outer, float center )
+/// src is the source line, x0 and n the (zero based) columns to
+/// produce, with the samples past the edges of the line holding the
+/// edge value
+static void conv_line(
+    float *             out,
+    const float *       src,
+    int                 w,
+    int                 x0,
+    int                 n,
+    row_func            f,
+    const std::vector<float> &k,
+    std::vector<float> &pad )
 {
-    precondition( dest.get() != src.line( y ), "Need not-in-place flag to op" );
+    int K    = static_cast<int>( k.size() );
+    int half = K / 2;
+    if ( x0 - half >= 0 && x0 + n + half <= w )
+    {
+        f( out, src + x0 - half, n, k.data(), K );
+        return;
+    }
 
-    int      sy1  = std::min( src.y2(), y + 1 );
-    int      sym1 = std::max( src.y1(), y - 1 );
-    scanline p1   = scan_ref( src, sy1 );
-    scanline c1   = scan_ref( src, y );
-    scanline m1   = scan_ref( src, sym1 );
-    for ( int x = 0, w = dest.width(); x < w; ++x )
-        dest[x] = ( p1[x] + m1[x] ) * outer + c1[x] * center;
+    pad.resize( static_cast<size_t>( n + K - 1 ) );
+    for ( int i = 0; i < n + K - 1; ++i )
+        pad[static_cast<size_t>( i )] =
+            src[std::max( 0, std::min( w - 1, x0 - half + i ) )];
+    f( out, pad.data(), n, k.data(), K );
 }
 
-////////////////////////////////////////
-
-static void vert_convolve3(
-    scanline &   dest,
-    int          y,
-    const plane &src,
-    float        left,
-    float        center,
-    float        right )
+static void horiz_convolve(
+    scanline &dest, const scanline &src, const std::vector<float> &k )
 {
-    precondition( dest.get() != src.line( y ), "Need not-in-place flag to op" );
+    precondition( dest.get() != src.get(), "Need not-in-place flag to op" );
 
-    int      sy1  = std::min( src.y2(), y + 1 );
-    int      sym1 = std::max( src.y1(), y - 1 );
-    scanline p1   = scan_ref( src, sy1 );
-    scanline c1   = scan_ref( src, y );
-    scanline m1   = scan_ref( src, sym1 );
-    for ( int x = 0, w = dest.width(); x < w; ++x )
-        dest[x] = m1[x] * left + c1[x] * center + p1[x] * right;
+    // only grows, so the edges of later lines do not allocate
+    static thread_local std::vector<float> pad;
+    conv_line(
+        dest.get(),
+        src.get(),
+        src.width(),
+        0,
+        dest.width(),
+        choose_conv<conv_row, row_func>( k ),
+        k,
+        pad );
 }
 
-////////////////////////////////////////
-
+/// @brief vertical pass of scanline y, reading the rows under the
+/// kernel, with the rows past the top and bottom holding the edge
+/// rows. Registered once per radius up to maxWindowRadius, so it can
+/// join the scanline group computing its input, reading its rows
+/// through a rolling window.
 static void vert_convolve(
     scanline &dest, int y, const plane &src, const std::vector<float> &k )
 {
     precondition( dest.get() != src.line( y ), "Need not-in-place flag to op" );
 
-    int halfK = static_cast<int>( k.size() / 2 );
+    int          nV    = static_cast<int>( k.size() );
+    int          halfV = nV / 2;
+    const float *rows[2 * maxWindowRadius + 1];
+    for ( int l = 0; l < nV; ++l )
+        rows[l] = src.line( std::max( src.y1(), std::min( src.y2(), y - halfV + l ) ) );
+
+    choose_conv<conv_col, col_func>( k )(
+        dest.get(), rows, dest.width(), k.data(), nV );
+}
+
+/// whether p is still to be computed by a scanline op, so it will be
+/// computed in a scanline group which a windowed pass can join
+static bool in_scanline_group( const plane &p )
+{
+    const auto &g = p.graph_ptr();
+    if ( !g || p.id() == engine::nullnode )
+        return false;
+
+    const engine::node &n = ( *g )[p.id()];
+    if ( n.value().has_value() )
+        return false;
+    return g->op_registry()[n.op()].processing_style() ==
+           engine::op::style::ONE_TO_ONE;
+}
+
+static const char *vert_op_name( size_t kSize )
+{
+    static const char *names[] = { nullptr,
+                                   "p.sep_conv_v1",
+                                   "p.sep_conv_v2",
+                                   "p.sep_conv_v3" };
+    return names[kSize / 2];
+}
 
-    for ( int l = -halfK; l <= halfK; ++l )
+////////////////////////////////////////
+
+/// @brief separable convolution of a tile of the output
+///
+/// The rows of the tile are produced in order, with the horizontal
+/// pass of the source rows under the vertical kernel held in a ring
+/// of K lines the width of the tile, so each source row is filtered
+/// horizontally once per tile and the vertical pass reads from the
+/// ring while it is still in cache. When there is no horizontal
+/// kernel, the ring is just the source rows. Rows past the top and
+/// bottom hold the edge rows.
+static void convolve_tile(
+    plane &                   dst,
+    const plane &             src,
+    const std::vector<float> &kh,
+    const std::vector<float> &kv,
+    int                       x0,
+    int                       y0,
+    int                       tw,
+    int                       th )
+{
+    int w  = src.width();
+    int h  = src.height();
+    int n  = std::min( tw, w - x0 );
+    int ye = std::min( y0 + th, h );
+
+    int      nV    = static_cast<int>( kv.size() );
+    int      halfV = nV / 2;
+    row_func hf = kh.empty() ? nullptr : choose_conv<conv_row, row_func>( kh );
+    col_func vf = choose_conv<conv_col, col_func>( kv );
+
+    std::vector<float>         ring;
+    std::vector<float>         pad;
+    std::vector<const float *> rows( static_cast<size_t>( nV ) );
+    if ( hf )
+        ring.resize( static_cast<size_t>( nV ) * static_cast<size_t>( n ) );
+
+    // the ring slot of (unclamped) row r is ( r - base ) % nV
+    int base = y0 - halfV;
+    int next = base;
+    for ( int y = y0; y < ye; ++y )
     {
-        float    kVal = k[static_cast<size_t>( l + halfK )];
-        int      curY = std::max( src.y1(), std::min( src.y2(), y + l ) );
-        scanline s    = scan_ref( src, curY );
-        if ( l == -halfK )
+        for ( ; next <= y + halfV; ++next )
         {
-            for ( int x = 0, w = dest.width(); x < w; ++x )
-                dest[x] = s[x] * kVal;
+            int sy = std::max( 0, std::min( h - 1, next ) );
+            if ( !hf )
+                continue;
+            float *slot = ring.data() + static_cast<size_t>( ( next - base ) % nV ) *
+                                            static_cast<size_t>( n );
+            conv_line( slot, src.line( src.y1() + sy ), w, x0, n, hf, kh, pad );
         }
-        else
+
+        for ( int l = 0; l < nV; ++l )
         {
-            for ( int x = 0, w = dest.width(); x < w; ++x )
-                dest[x] += s[x] * kVal;
+            int r = y - halfV + l;
+            if ( hf )
+                rows[static_cast<size_t>( l )] =
+                    ring.data() + static_cast<size_t>( ( r - base ) % nV ) *
+                                      static_cast<size_t>( n );
+            else
+                rows[static_cast<size_t>( l )] =
+                    src.line( src.y1() + std::max( 0, std::min( h - 1, r ) ) ) + x0;
         }
+
+        vf( dst.line( dst.y1() + y ) + x0, rows.data(), n, kv.data(), nV );
     }
 }
 
+static plane tiled_convolve(
+    const plane &p, const std::vector<float> &kh, const std::vector<float> &kv )
+{
+    plane r( p.x1(), p.y1(), p.x2(), p.y2() );
+
+    // keep the ring (or the source rows under the kernel) to half of a
+    // typical L2 cache, splitting wide planes into columns of tiles
+    int w  = p.width();
+    int h  = p.height();
+    int nV = static_cast<int>( kv.size() );
+    int tw = std::max( 256, ( 32768 / nV ) & ~15 );
+    if ( tw >= w )
+        tw = w;
+    // the first K - 1 rows of a tile are an extra horizontal pass, so
+    // do not make them too short
+    int th = std::min( h, std::max( 32, 8 * nV ) );
+
+    int nCols = ( w + tw - 1 ) / tw;
+    int nRows = ( h + th - 1 ) / th;
+    threading::get().dispatch(
+        [&]( size_t, int s, int e ) {
+            for ( int t = s; t < e; ++t )
+                convolve_tile( r, p, kh, kv, ( t % nCols ) * tw, ( t / nCols ) * th, tw, th );
+        },
+        0,
+        nCols * nRows );
+
+    return r;
+}
+
 } // namespace
 
 ////////////////////////////////////////
@@ -704,14 +937,6 @@ plane noise_gradient_vert5( const plane &p, const plane &alpha )
 
 plane convolve_horiz( const plane &p, const std::vector<float> &k )
 {
-    if ( k.size() == 3 )
-    {
-        if ( base::equal( k[0], k[2] ) )
-            return plane( "p.sep_conv3_mirror_h", p.dims(), p, k[0], k[1] );
-
-        return plane( "p.sep_conv3_h", p.dims(), p, k[0], k[1], k[2] );
-    }
-
     precondition( k.size() % 2 != 0, "non-odd-sized kernel {0}", k.size() );
     return plane( "p.sep_conv_h", p.dims(), p, k );
 }
@@ -720,16 +945,28 @@ plane convolve_horiz( const plane &p, const std::vector<float> &k )
 
 plane convolve_vert( const plane &p, const std::vector<float> &k )
 {
-    if ( k.size() == 3 )
-    {
-        if ( base::equal( k[0], k[2] ) )
-            return plane( "p.sep_conv3_mirror_v", p.dims(), p, k[0], k[1] );
+    precondition( k.size() % 2 != 0, "non-odd-sized kernel {0}", k.size() );
+    // small kernels are computed a scanline at a time, and join the
+    // group computing the input when there is one
+    if ( k.size() / 2 <= maxWindowRadius && k.size() > 1 )
+        return plane( vert_op_name( k.size() ), p.dims(), p, k );
+    return plane( "p.sep_conv", p.dims(), p, std::vector<float>(), k );
+}
 
-        return plane( "p.sep_conv3_v", p.dims(), p, k[0], k[1], k[2] );
-    }
+////////////////////////////////////////
 
-    precondition( k.size() % 2 != 0, "non-odd-sized kernel {0}", k.size() );
-    return plane( "p.sep_conv_v", p.dims(), p, k );
+plane separable_convolve(
+    const plane &p, const std::vector<float> &kh, const std::vector<float> &kv )
+{
+    precondition( kh.size() % 2 != 0, "non-odd-sized kernel {0}", kh.size() );
+    precondition( kv.size() % 2 != 0, "non-odd-sized kernel {0}", kv.size() );
+    // when the input is computed in a scanline group, the two passes
+    // join that group, reading the horizontal pass through a rolling
+    // window instead of the tiles needing the full input plane
+    if ( kv.size() / 2 <= maxWindowRadius && kv.size() > 1 &&
+         in_scanline_group( p ) )
+        return convolve_vert( convolve_horiz( p, kh ), kv );
+    return plane( "p.sep_conv", p.dims(), p, kh, kv );
 }
 
 ////////////////////////////////////////
@@ -749,7 +986,8 @@ void add_convolve( engine::registry &r )
             base::choose_runtime( vert_igrad ),
             n_scanline_plane_adapter<false, decltype( vert_igrad )>(),
             dispatch_scan_processing,
-            op::n_to_one ) );
+            op::n_to_one,
+            1 ) );
     r.add(
         op( "p.cgrad_h",
             base::choose_runtime( horiz_cgrad ),
@@ -761,7 +999,8 @@ void add_convolve( engine::registry &r )
             base::choose_runtime( vert_cgrad ),
             n_scanline_plane_adapter<false, decltype( vert_cgrad )>(),
             dispatch_scan_processing,
-            op::n_to_one ) );
+            op::n_to_one,
+            1 ) );
     r.add(
         op( "p.ngrad_h5",
             base::choose_runtime( horiz_ngrad5 ),
@@ -773,7 +1012,8 @@ void add_convolve( engine::registry &r )
             base::choose_runtime( vert_ngrad5 ),
             n_scanline_plane_adapter<false, decltype( vert_ngrad5 )>(),
             dispatch_scan_processing,
-            op::n_to_one ) );
+            op::n_to_one,
+            2 ) );
 
     r.add(
         op( "p.igrad_h_alpha",
@@ -786,7 +1026,8 @@ void add_convolve( engine::registry &r )
             base::choose_runtime( vert_igrad_alpha ),
             n_scanline_plane_adapter<false, decltype( vert_igrad_alpha )>(),
             dispatch_scan_processing,
-            op::n_to_one ) );
+            op::n_to_one,
+            1 ) );
     r.add(
         op( "p.cgrad_h_alpha",
             base::choose_runtime( horiz_cgrad_alpha ),
@@ -798,7 +1039,8 @@ void add_convolve( engine::registry &r )
             base::choose_runtime( vert_cgrad_alpha ),
             n_scanline_plane_adapter<false, decltype( vert_cgrad_alpha )>(),
             dispatch_scan_processing,
-            op::n_to_one ) );
+            op::n_to_one,
+            1 ) );
     r.add(
         op( "p.ngrad_h5_alpha",
             base::choose_runtime( horiz_ngrad5_alpha ),
@@ -810,45 +1052,37 @@ void add_convolve( engine::registry &r )
             base::choose_runtime( vert_ngrad5_alpha ),
             n_scanline_plane_adapter<false, decltype( vert_ngrad5_alpha )>(),
             dispatch_scan_processing,
-            op::n_to_one ) );
+            op::n_to_one,
+            2 ) );
 
-    r.add(
-        op( "p.sep_conv3_mirror_h",
-            base::choose_runtime( horiz_convolve3_mirror ),
-            scanline_plane_adapter<false, decltype( horiz_convolve3_mirror )>(),
-            dispatch_scan_processing,
-            op::one_to_one ) );
-    r.add(
-        op( "p.sep_conv3_h",
-            base::choose_runtime( horiz_convolve3 ),
-            scanline_plane_adapter<false, decltype( horiz_convolve3 )>(),
-            dispatch_scan_processing,
-            op::one_to_one ) );
     r.add(
         op( "p.sep_conv_h",
             base::choose_runtime( horiz_convolve ),
             scanline_plane_adapter<false, decltype( horiz_convolve )>(),
             dispatch_scan_processing,
             op::one_to_one ) );
-
-    r.add( op(
-        "p.sep_conv3_mirror_v",
-        base::choose_runtime( vert_convolve3_mirror ),
-        n_scanline_plane_adapter<false, decltype( vert_convolve3_mirror )>(),
-        dispatch_scan_processing,
-        op::n_to_one ) );
     r.add(
-        op( "p.sep_conv3_v",
-            base::choose_runtime( vert_convolve3 ),
-            n_scanline_plane_adapter<false, decltype( vert_convolve3 )>(),
+        op( "p.sep_conv_v1",
+            base::choose_runtime( vert_convolve ),
+            n_scanline_plane_adapter<false, decltype( vert_convolve )>(),
+            dispatch_scan_processing,
+            op::n_to_one,
+            1 ) );
+    r.add(
+        op( "p.sep_conv_v2",
+            base::choose_runtime( vert_convolve ),
+            n_scanline_plane_adapter<false, decltype( vert_convolve )>(),
             dispatch_scan_processing,
-            op::n_to_one ) );
+            op::n_to_one,
+            2 ) );
     r.add(
-        op( "p.sep_conv_v",
+        op( "p.sep_conv_v3",
             base::choose_runtime( vert_convolve ),
             n_scanline_plane_adapter<false, decltype( vert_convolve )>(),
             dispatch_scan_processing,
-            op::n_to_one ) );
+            op::n_to_one,
+            3 ) );
+    r.add( op( "p.sep_conv", base::choose_runtime( tiled_convolve ), op::threaded ) );
 }
 
 ////////////////////////////////////////
@@ -35,13 +35,21 @@ plane central_gradient_vert( const plane &p, const plane &alpha );
 plane noise_gradient_horiz5( const plane &p, const plane &alpha );
 plane noise_gradient_vert5( const plane &p, const plane &alpha );
 
+/// convolves with an odd sized kernel, holding the edge values
 plane convolve_horiz( const plane &p, const std::vector<float> &k );
 plane convolve_vert( const plane &p, const std::vector<float> &k );
 
+/// @brief convolves with kh horizontally and kv vertically
+///
+/// Both passes are done one cache sized tile of the output at a time,
+/// keeping only the horizontally filtered rows under the vertical
+/// kernel (instead of a full plane of them).
+plane separable_convolve(
+    const plane &p, const std::vector<float> &kh, const std::vector<float> &kv );
+
 inline plane separable_convolve( const plane &p, const std::vector<float> &k )
 {
-    // do the vert pass first so we get n:1, 1:1 group behavior
-    return convolve_horiz( convolve_vert( p, k ), k );
+    return separable_convolve( p, k, k );
 }
 
 void add_convolve( engine::registry &r );
@@ -4,8 +4,15 @@
 #include "plane_resize.h"
 
 #include "scanline_process.h"
+#include "sse3/plane_resize.h"
 
+#include <base/contract.h>
 #include <base/cpu_features.h>
+#include <cmath>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <tuple>
 
 ////////////////////////////////////////
 
@@ -110,6 +117,315 @@ doResizeHorizBicubic( scanline &dest, const scanline &in, float scale )
     }
 }
 
+////////////////////////////////////////
+
+enum resample_filter
+{
+    FILTER_BOX = 0,
+    FILTER_TRIANGLE,
+    FILTER_CATMULL_ROM,
+    FILTER_MITCHELL,
+    FILTER_LANCZOS3
+};
+
+static int find_filter( const std::string &filter )
+{
+    if ( filter == "box" )
+        return FILTER_BOX;
+    if ( filter == "bilinear" || filter == "triangle" )
+        return FILTER_TRIANGLE;
+    if ( filter == "bicubic" || filter == "catmull-rom" )
+        return FILTER_CATMULL_ROM;
+    if ( filter == "mitchell" )
+        return FILTER_MITCHELL;
+    if ( filter == "lanczos" || filter == "lanczos3" )
+        return FILTER_LANCZOS3;
+
+    throw_runtime( "Unknown resize filter '{0}'", filter );
+}
+
+static double filter_radius( int filter )
+{
+    switch ( filter )
+    {
+        case FILTER_BOX: return 0.5;
+        case FILTER_TRIANGLE: return 1.0;
+        case FILTER_CATMULL_ROM:
+        case FILTER_MITCHELL: return 2.0;
+        case FILTER_LANCZOS3: return 3.0;
+        default: break;
+    }
+    throw_runtime( "Invalid resize filter {0}", filter );
+}
+
+/// the cubic family of Mitchell and Netravali, (B, C) = (0, 0.5) is
+/// Catmull-Rom and (1/3, 1/3) is what they recommend
+static double cubic_weight( double x, double B, double C )
+{
+    x = std::abs( x );
+    if ( x < 1.0 )
+        return ( ( 12.0 - 9.0 * B - 6.0 * C ) * x * x * x +
+                 ( -18.0 + 12.0 * B + 6.0 * C ) * x * x + ( 6.0 - 2.0 * B ) ) /
+               6.0;
+    if ( x < 2.0 )
+        return ( ( -B - 6.0 * C ) * x * x * x + ( 6.0 * B + 30.0 * C ) * x * x +
+                 ( -12.0 * B - 48.0 * C ) * x + ( 8.0 * B + 24.0 * C ) ) /
+               6.0;
+    return 0.0;
+}
+
+static double sinc( double x )
+{
+    if ( x == 0.0 )
+        return 1.0;
+    x *= M_PI;
+    return std::sin( x ) / x;
+}
+
+static double filter_weight( int filter, double x )
+{
+    switch ( filter )
+    {
+        case FILTER_BOX: return ( x >= -0.5 && x < 0.5 ) ? 1.0 : 0.0;
+        case FILTER_TRIANGLE: return std::max( 0.0, 1.0 - std::abs( x ) );
+        case FILTER_CATMULL_ROM: return cubic_weight( x, 0.0, 0.5 );
+        case FILTER_MITCHELL: return cubic_weight( x, 1.0 / 3.0, 1.0 / 3.0 );
+        case FILTER_LANCZOS3:
+            return std::abs( x ) < 3.0 ? sinc( x ) * sinc( x / 3.0 ) : 0.0;
+        default: break;
+    }
+    return 0.0;
+}
+
+////////////////////////////////////////
+
+/// the source samples and weights for each output position of a
+/// resample from one size to another, the same for every line, so
+/// they are computed once instead of per pixel
+struct resample_table
+{
+    resample_table( int src, int dst, int filter );
+
+    int src;
+    int dst;
+    int filter;
+
+    /// the number of weights per output, a multiple of 4 unless the
+    /// source is narrower than that
+    int                taps = 0;
+    std::vector<int>   first;
+    std::vector<float> weights;
+};
+
+resample_table::resample_table( int src, int dst, int filter )
+    : src( src ), dst( dst ), filter( filter )
+{
+    double scale = static_cast<double>( src ) / static_cast<double>( dst );
+    // when minifying, the kernel is widened to filter out what the
+    // output can not hold
+    double fscale  = std::max( 1.0, scale );
+    double support = filter_radius( filter ) * fscale;
+
+    std::vector<std::vector<double>> contrib( static_cast<size_t>( dst ) );
+    std::vector<int>                 lo( static_cast<size_t>( dst ) );
+    int                              maxTaps = 1;
+    for ( int i = 0; i < dst; ++i )
+    {
+        double center = ( static_cast<double>( i ) + 0.5 ) * scale - 0.5;
+        int    j0     = static_cast<int>( std::floor( center - support ) );
+        int    j1     = static_cast<int>( std::ceil( center + support ) );
+
+        // samples past the edges are folded onto the edge samples
+        int                  clo = std::max( 0, std::min( src - 1, j0 ) );
+        int                  chi = std::max( 0, std::min( src - 1, j1 ) );
+        std::vector<double> &c   = contrib[static_cast<size_t>( i )];
+        c.assign( static_cast<size_t>( chi - clo + 1 ), 0.0 );
+
+        double sum = 0.0;
+        for ( int j = j0; j <= j1; ++j )
+        {
+            double wt = filter_weight(
+                filter, ( static_cast<double>( j ) - center ) / fscale );
+            int js = std::max( 0, std::min( src - 1, j ) );
+            c[static_cast<size_t>( js - clo )] += wt;
+            sum += wt;
+        }
+
+        if ( std::abs( sum ) < 1e-12 )
+        {
+            std::fill( c.begin(), c.end(), 0.0 );
+            int nearest = std::max(
+                0, std::min( src - 1, static_cast<int>( std::lround( center ) ) ) );
+            c[static_cast<size_t>( nearest - clo )] = 1.0;
+            sum                                     = 1.0;
+        }
+
+        // trim the zero weights at the ends of the window
+        size_t b = 0, e = c.size();
+        while ( b + 1 < e && c[b] == 0.0 )
+            ++b;
+        while ( e - 1 > b && c[e - 1] == 0.0 )
+            --e;
+        c = std::vector<double>( c.begin() + static_cast<ptrdiff_t>( b ), c.begin() + static_cast<ptrdiff_t>( e ) );
+        for ( auto &wt: c )
+            wt /= sum;
+
+        lo[static_cast<size_t>( i )] = clo + static_cast<int>( b );
+        maxTaps = std::max( maxTaps, static_cast<int>( c.size() ) );
+    }
+
+    taps = ( maxTaps + 3 ) & ~3;
+    if ( taps > src )
+        taps = src;
+
+    first.resize( static_cast<size_t>( dst ) );
+    weights.assign( static_cast<size_t>( dst ) * static_cast<size_t>( taps ), 0.F );
+    for ( int i = 0; i < dst; ++i )
+    {
+        const std::vector<double> &c = contrib[static_cast<size_t>( i )];
+        // keep the window inside the source, the weights just start
+        // later in it
+        int f = std::min( lo[static_cast<size_t>( i )], src - taps );
+        int o = lo[static_cast<size_t>( i )] - f;
+
+        first[static_cast<size_t>( i )] = f;
+        float *wt = weights.data() + static_cast<size_t>( i ) * static_cast<size_t>( taps );
+        for ( size_t k = 0; k < c.size(); ++k )
+            wt[static_cast<size_t>( o ) + k] = static_cast<float>( c[k] );
+    }
+}
+
+////////////////////////////////////////
+
+static std::mutex tableMutex;
+static std::map<std::tuple<int, int, int>, std::shared_ptr<const resample_table>>
+    tableCache;
+
+/// tables are shared by every plane (and line) resampled between the
+/// same sizes with the same filter
+static std::shared_ptr<const resample_table>
+find_table( int src, int dst, int filter )
+{
+    auto                        key = std::make_tuple( src, dst, filter );
+    std::lock_guard<std::mutex> lk( tableMutex );
+    auto                        i = tableCache.find( key );
+    if ( i != tableCache.end() )
+        return i->second;
+
+    // the sizes in use change slowly, but do not hold on to all of
+    // them forever (planes still using a table keep it alive)
+    if ( tableCache.size() >= 256 )
+        tableCache.clear();
+
+    auto t = std::make_shared<const resample_table>( src, dst, filter );
+    tableCache[key] = t;
+    return t;
+}
+
+/// the tables are passed to the ops as values of the graph, found
+/// once when the op is built rather than for every line
+static engine::hash &
+operator<<( engine::hash &h, const std::shared_ptr<const resample_table> &t )
+{
+    h << t->src << t->dst << t->filter;
+    return h;
+}
+
+static void resample_row(
+    float *      out,
+    int          w,
+    const float *in,
+    const int *  first,
+    const float *weights,
+    int          taps )
+{
+    for ( int x = 0; x < w; ++x )
+    {
+        const float *src = in + first[x];
+        const float *wt  = weights + x * taps;
+        float        sum = 0.F;
+        for ( int k = 0; k < taps; ++k )
+            sum += src[k] * wt[k];
+        out[x] = sum;
+    }
+}
+
+static void resample_horiz( scanline &dest, const scanline &in, const resample_table &t )
+{
+    static auto rowFunc = base::choose_runtime(
+        resample_row, { { base::cpu::simd_feature::SSE3, sse3::resample_row } } );
+
+    rowFunc(
+        dest.get(),
+        dest.width(),
+        in.get(),
+        t.first.data(),
+        t.weights.data(),
+        t.taps );
+}
+
+static void
+resample_vert( scanline &dest, int y, const plane &in, const resample_table &t )
+{
+    size_t       idx = static_cast<size_t>( y );
+    int          row = in.y1() + t.first[idx];
+    const float *wt  = t.weights.data() + idx * static_cast<size_t>( t.taps );
+    int          w   = dest.width();
+    float *      out = dest.get();
+
+    const float *line = in.line( row );
+    for ( int x = 0; x < w; ++x )
+        out[x] = wt[0] * line[x];
+    for ( int k = 1; k < t.taps; ++k )
+    {
+        // the padding is all zero
+        float wk = wt[k];
+        if ( wk == 0.F )
+            continue;
+        line = in.line( row + k );
+        for ( int x = 0; x < w; ++x )
+            out[x] += wk * line[x];
+    }
+}
+
+////////////////////////////////////////
+
+static void doResampleHoriz(
+    scanline &dest, const scanline &in, const std::shared_ptr<const resample_table> &t )
+{
+    resample_horiz( dest, in, *t );
+}
+
+static void doResampleVert(
+    scanline &                                   dest,
+    int                                          y,
+    const plane &                                in,
+    const std::shared_ptr<const resample_table> &t )
+{
+    resample_vert( dest, y - in.y1(), in, *t );
+}
+
+/// both passes for a line of output: the rows of the source under the
+/// vertical filter are summed into a line the width of the source,
+/// which is then filtered down to the output width, so the output of
+/// the vertical pass is never stored
+static void doResample(
+    scanline &                                   dest,
+    int                                          y,
+    const plane &                                in,
+    const std::shared_ptr<const resample_table> &tv,
+    const std::shared_ptr<const resample_table> &th )
+{
+    // the vertical pass is summed into the same line each row, only
+    // replaced when the thread moves to a source of another width
+    static thread_local scanline tmp;
+    if ( tmp.width() != in.width() )
+        tmp = scanline( in.x1(), in.width() );
+
+    resample_vert( tmp, y - in.y1(), in, *tv );
+    resample_horiz( dest, tmp, *th );
+}
+
 } // namespace
 
 ////////////////////////////////////////
@@ -186,14 +502,51 @@ plane resize_vert_bicubic( const plane &p, int newh )
 
 plane resize_horiz( const plane &p, const std::string &filter, int neww )
 {
-    throw_not_yet();
+    if ( filter == "point" || filter == "dirac" )
+        return resize_horiz_point( p, neww );
+
+    precondition( neww > 0, "Invalid new width {0} to resize", neww );
+    int                filt = find_filter( filter );
+    engine::dimensions d    = p.dims();
+    d.x2                    = d.x1 + neww - 1;
+    return plane(
+        "p.resample_horiz", d, p, find_table( p.width(), neww, filt ) );
 }
 
 ////////////////////////////////////////
 
 plane resize_vert( const plane &p, const std::string &filter, int newh )
 {
-    throw_not_yet();
+    if ( filter == "point" || filter == "dirac" )
+        return resize_vert_point( p, newh );
+
+    precondition( newh > 0, "Invalid new height {0} to resize", newh );
+    int                filt = find_filter( filter );
+    engine::dimensions d    = p.dims();
+    d.y2                    = d.y1 + newh - 1;
+    return plane(
+        "p.resample_vert", d, p, find_table( p.height(), newh, filt ) );
+}
+
+////////////////////////////////////////
+
+plane resize( const plane &p, const std::string &filter, int neww, int newh )
+{
+    if ( filter == "point" || filter == "dirac" )
+        return resize_point( p, neww, newh );
+
+    precondition(
+        neww > 0 && newh > 0, "Invalid new size {0}x{1} to resize", neww, newh );
+    int                filt = find_filter( filter );
+    engine::dimensions d    = p.dims();
+    d.x2                    = d.x1 + neww - 1;
+    d.y2                    = d.y1 + newh - 1;
+    return plane(
+        "p.resample",
+        d,
+        p,
+        find_table( p.height(), newh, filt ),
+        find_table( p.width(), neww, filt ) );
 }
 
 ////////////////////////////////////////
@@ -218,31 +571,18 @@ std::vector<plane> make_pyramid(
         int   curH  = static_cast<int>( ceilf( curHf ) );
 
         if ( curW < minSize || curH < minSize )
-        {
-            //			std::cout << "Terminating pyramid at level " << curLev << std::endl;
             break;
-        }
 
         if ( curW >= ret.back().width() )
             curW = ret.back().width() - 1;
         if ( curH >= ret.back().height() )
             curH = ret.back().height() - 1;
 
-//		std::cout << "adding level " << curLev << " at " << curW << "x" << curH << std::endl;
-#define DIRECT_PYRAMIDS 1
-#if DIRECT_PYRAMIDS
-        plane tmp = in;
-#else
-        plane     tmp = ret.back();
-#endif
-        if ( filter == "bilinear" )
-            ret.push_back( resize_bilinear( tmp, curW, curH ) );
-        else if ( filter == "bicubic" )
-            ret.push_back( resize_bicubic( tmp, curW, curH ) );
-        else if ( filter == "point" || filter == "dirac" )
-            ret.push_back( resize_point( tmp, curW, curH ) );
-        else
-            throw_not_yet();
+        // each level is filtered from the one before, which has
+        // already lost the detail the kernel would have to cover, so
+        // the kernels stay small
+        plane lev = resize( ret.back(), filter, curW, curH );
+        ret.emplace_back( std::move( lev ) );
         ++curLev;
     }
 
@@ -275,44 +615,17 @@ std::vector<image_buf> make_pyramid(
         int   curH  = static_cast<int>( ceilf( curHf ) );
 
         if ( curW < minSize || curH < minSize )
-        {
-            //			std::cout << "Terminating pyramid at level " << curLev << std::endl;
             break;
-        }
 
         if ( curW >= ret.back().width() )
             curW = ret.back().width() - 1;
         if ( curH >= ret.back().height() )
             curH = ret.back().height() - 1;
 
-//		std::cout << "adding level " << curLev << " at " << curW << "x" << curH << std::endl;
-#if DIRECT_PYRAMIDS
-        image_buf tmp = in;
-#else
-        image_buf tmp = ret.back();
-#endif
-        if ( filter == "bilinear" )
-        {
-            for ( size_t p = 0; p != in.size(); ++p )
-                tmp[p] = resize_bilinear( in[p], curW, curH );
-            ret.emplace_back( std::move( tmp ) );
-        }
-        else if ( filter == "bicubic" )
-        {
-            for ( size_t p = 0; p != tmp.size(); ++p )
-                tmp[p] = resize_bicubic( tmp[p], curW, curH );
-            ret.emplace_back( std::move( tmp ) );
-        }
-        else if ( filter == "point" || filter == "dirac" )
-        {
-            for ( size_t p = 0; p != tmp.size(); ++p )
-                tmp[p] = resize_point( tmp[p], curW, curH );
-            ret.emplace_back( std::move( tmp ) );
-        }
-        else
-        {
-            throw_not_yet();
-        }
+        image_buf lev = ret.back();
+        for ( size_t p = 0; p != lev.size(); ++p )
+            lev[p] = resize( lev[p], filter, curW, curH );
+        ret.emplace_back( std::move( lev ) );
         ++curLev;
     }
 
@@ -363,6 +676,26 @@ void add_resize( engine::registry &r )
             dispatch_scan_processing,
             op::one_to_one ) );
 
+    r.register_constant<std::shared_ptr<const resample_table>>();
+    r.add(
+        op( "p.resample_vert",
+            base::choose_runtime( doResampleVert ),
+            n_scanline_plane_adapter<false, decltype( doResampleVert )>(),
+            dispatch_scan_processing,
+            op::n_to_one ) );
+    r.add(
+        op( "p.resample_horiz",
+            base::choose_runtime( doResampleHoriz ),
+            scanline_plane_adapter<false, decltype( doResampleHoriz )>(),
+            dispatch_scan_processing,
+            op::one_to_one ) );
+    r.add(
+        op( "p.resample",
+            base::choose_runtime( doResample ),
+            n_scanline_plane_adapter<false, decltype( doResample )>(),
+            dispatch_scan_processing,
+            op::n_to_one ) );
+
     //	r.add( op( "p.resize_vert_generic", base::choose_runtime( doResizeVertGeneric ), n_scanline_plane_adapter<false, decltype(doResizeVertGeneric)>(), dispatch_scan_processing, op::n_to_one ) );
     //	r.add( op( "p.resize_horiz_generic", base::choose_runtime( doResizeHorizGeneric ), scanline_plane_adapter<true, decltype(doResizeHorizGeneric)>(), dispatch_scan_processing, op::one_to_one ) );
 }
@@ -35,14 +35,19 @@ inline plane resize_bicubic( const plane &p, int neww, int newh )
     return resize_horiz_bicubic( resize_vert_bicubic( p, newh ), neww );
 }
 
+/// @brief resamples with the named filter
+///
+/// The filter is one of point (or dirac), box, bilinear (or triangle),
+/// bicubic (or catmull-rom), mitchell, or lanczos (or lanczos3). Other
+/// than point, the filters are widened by the scale factor when
+/// shrinking so the result does not alias. The weights for each size
+/// and filter are computed once and shared.
 plane resize_horiz( const plane &p, const std::string &filter, int neww );
 plane resize_vert( const plane &p, const std::string &filter, int newh );
 
-inline plane
-resize( const plane &p, const std::string &filter, int neww, int newh )
-{
-    return resize_horiz( resize_vert( p, filter, newh ), filter, neww );
-}
+/// resamples both directions in one pass, without storing the
+/// intermediate vertically resampled plane
+plane resize( const plane &p, const std::string &filter, int neww, int newh );
 
 ////////////////////////////////////////
 
@@ -57,6 +62,9 @@ resize( const plane &p, const std::string &filter, int neww, int newh )
 /// would result in a plane that is < max(2, minSize) pixels wide or high (so the
 /// minimum size is 2x2)
 ///
+/// Each level is resampled from the previous one (see @sa resize for
+/// the filters).
+///
 std::vector<plane> make_pyramid(
     const plane &      in,
     const std::string &filter,
@@ -6,6 +6,9 @@
 #include "scanline_group.h"
 #include "threading.h"
 
+#include <cstring>
+#include <engine/graph.h>
+
 ////////////////////////////////////////
 
 namespace image
@@ -16,6 +19,44 @@ scanline_plane_functor::~scanline_plane_functor( void ) {}
 
 ////////////////////////////////////////
 
+void scanline_plane_functor::bind_window( size_t i, const plane & )
+{
+    throw_runtime( "one-to-one operation can not read input {0} by window", i );
+}
+
+////////////////////////////////////////
+
+/// number of scanlines computed for the windowed member of a group
+/// between slides of the window, beyond the rows of the radius
+static constexpr int windowBand = 16;
+
+////////////////////////////////////////
+
+static inline scanline
+member_dest( scanline_plane_functor &cur, scanline_group &scans )
+{
+    if ( cur.is_output() )
+        return scans.output_scan_and_clear( cur.output_index() );
+    return scans.find_or_checkout( cur.inputs(), cur.in_place() );
+}
+
+////////////////////////////////////////
+
+static inline void
+run_member( scanline_plane_functor &cur, scanline &dest, int y )
+{
+    cur.call( dest, y );
+
+    // release the scanlines for the next iteration
+    cur.deref_inputs();
+
+    for ( auto &o: cur.outputs() )
+        static_cast<scanline_plane_functor *>( o.first )->set_input(
+            o.second, dest );
+}
+
+////////////////////////////////////////
+
 static void scanline_thread_process(
     size_t, int start, int end, engine::subgroup &sg, int offx, int w )
 {
@@ -54,24 +95,13 @@ static void scanline_thread_process(
             cur.update_inputs(
                 y ); // for any inputs that are a reference to a plane
 
-            scanline dest;
-            if ( cur.is_output() )
-                dest = scans.output_scan_and_clear( cur.output_index() );
-            else
-                dest = scans.find_or_checkout( cur.inputs(), cur.in_place() );
+            scanline dest = member_dest( cur, scans );
 
             //			if ( y == 0 )
             //			{
             //				std::cout << i << ": " << sg.gref().op_registry()[sg.gref()[sg.members()[i]].op()].name() << std::endl;
             //			}
-            cur.call( dest, y );
-
-            // release the scanlines for the next iteration
-            cur.deref_inputs();
-
-            for ( auto &o: cur.outputs() )
-                static_cast<scanline_plane_functor *>( o.first )->set_input(
-                    o.second, dest );
+            run_member( cur, dest, y );
         }
 
         // don't really need this as we will just overwrite the index
@@ -80,12 +110,184 @@ static void scanline_thread_process(
     }
 }
 
+////////////////////////////////////////
+
+static void scanline_window_process(
+    size_t,
+    int                       start,
+    int                       end,
+    engine::subgroup &        sg,
+    const engine::dimensions &dims )
+{
+    // the members computing the scanlines the windowed member reads
+    // are run ahead of the others by the radius of the windowed op
+    // into a small band of rows presented to it as a plane, and only
+    // the group outputs need full planes
+    const engine::graph &g    = sg.gref();
+    engine::node_id      winN = sg.window_node();
+    const engine::node & wn   = g[winN];
+    int                  rad  = g.op_registry()[wn.op()].radius();
+    int                  offx = static_cast<int>( dims.x1 );
+    int                  w    = static_cast<int>( dims.x2 - dims.x1 + 1 );
+    int                  y1   = static_cast<int>( dims.y1 );
+    int                  y2   = static_cast<int>( dims.y2 );
+
+    std::vector<std::shared_ptr<engine::subgroup_function>> funcs;
+    sg.bind_functions( funcs );
+    size_t         nOuts = sg.outputs().size();
+    size_t         nFunc = sg.size();
+    scanline_group scans( offx, w, nOuts );
+
+    size_t              winIdx = sg.func_idx( winN );
+    size_t              srcIdx = size_t( -1 );
+    std::vector<size_t> winArgs;
+    for ( size_t i = 0, nI = wn.input_size(); i != nI; ++i )
+    {
+        if ( sg.is_member( wn.input( i ) ) )
+        {
+            srcIdx = sg.func_idx( wn.input( i ) );
+            winArgs.push_back( i );
+        }
+    }
+    precondition(
+        rad >= 0 && srcIdx < winIdx,
+        "invalid windowed member {0} in subgroup",
+        winN );
+
+    // only the members feeding the input of the windowed member run
+    // ahead, anything else in the group stays on the current row
+    std::vector<bool>            ahead( nFunc, false );
+    std::vector<engine::node_id> toVisit( 1, wn.input( winArgs.front() ) );
+    while ( !toVisit.empty() )
+    {
+        const engine::node &v = g[toVisit.back()];
+        size_t              i = sg.func_idx( toVisit.back() );
+        toVisit.pop_back();
+        if ( ahead[i] )
+            continue;
+        ahead[i] = true;
+        for ( size_t a = 0, nI = v.input_size(); a != nI; ++a )
+        {
+            if ( sg.is_member( v.input( a ) ) )
+                toVisit.push_back( v.input( a ) );
+        }
+    }
+    for ( size_t i = 0; i != nFunc; ++i )
+    {
+        if ( !ahead[i] )
+            continue;
+        // a row computed ahead can only be consumed ahead (or through
+        // the window), the grouping does not fuse anything else
+        bool aheadOnly = !funcs[i]->is_output();
+        for ( auto &o: funcs[i]->outputs() )
+        {
+            size_t c = 0;
+            while ( c != nFunc && funcs[c].get() != o.first )
+                ++c;
+            aheadOnly = aheadOnly && ( c == winIdx || ( c != nFunc && ahead[c] ) );
+        }
+        precondition(
+            aheadOnly,
+            "member {0} computed ahead of windowed member {1} is read on the current row",
+            sg.members()[i],
+            winN );
+    }
+
+    int lo    = std::max( y1, start - rad );
+    int hi    = std::min( y2, end - 1 + rad );
+    int nRows = std::min( hi - lo + 1, windowBand + 2 * rad );
+    int winY  = lo;
+    int done  = lo - 1;
+
+    int                    stride = 0;
+    std::shared_ptr<float> rows = allocator::get().buffer( stride, w, nRows );
+    plane                  window;
+    window.set_window( dims, rows.get(), stride, winY );
+
+    scanline_plane_functor &winF =
+        static_cast<scanline_plane_functor &>( *( funcs[winIdx] ) );
+    for ( size_t a: winArgs )
+        winF.bind_window( a, window );
+
+    for ( int y = start; y < end; ++y )
+    {
+        int need = std::min( hi, y + rad );
+        if ( need >= winY + nRows )
+        {
+            // slide the window down, keeping the rows still in reach
+            int nextY = std::max( lo, y - rad );
+            int keep  = done - nextY + 1;
+            if ( keep > 0 )
+                memmove(
+                    rows.get(),
+                    rows.get() + ( nextY - winY ) * stride,
+                    static_cast<size_t>( keep * stride ) * sizeof( float ) );
+            winY = nextY;
+            window.set_window( dims, rows.get(), stride, winY );
+        }
+
+        while ( done < need )
+        {
+            ++done;
+            for ( size_t i = 0; i < winIdx; ++i )
+            {
+                if ( !ahead[i] )
+                    continue;
+                scanline_plane_functor &cur =
+                    static_cast<scanline_plane_functor &>( *( funcs[i] ) );
+                cur.update_inputs( done );
+
+                scanline dest;
+                if ( i == srcIdx )
+                    dest = scan_ref( window, done );
+                else
+                    dest = member_dest( cur, scans );
+                run_member( cur, dest, done );
+            }
+        }
+
+        for ( size_t i = 0; i < nOuts; ++i )
+            scans.output_scan(
+                i,
+                scan_ref( base::any_cast<plane &>( sg.output_val( i ) ), y ) );
+
+        for ( size_t i = 0; i < nFunc; ++i )
+        {
+            if ( ahead[i] )
+                continue;
+            scanline_plane_functor &cur =
+                static_cast<scanline_plane_functor &>( *( funcs[i] ) );
+            cur.update_inputs( y );
+
+            scanline dest = member_dest( cur, scans );
+            run_member( cur, dest, y );
+        }
+    }
+}
+
+////////////////////////////////////////
+
 void dispatch_scan_processing(
     engine::subgroup &sg, const engine::dimensions &dims )
 {
     int w = static_cast<int>( dims.x2 - dims.x1 + 1 );
     int h = static_cast<int>( dims.y2 - dims.y1 + 1 );
 
+    if ( sg.window_node() != engine::nullnode )
+    {
+        threading::get().dispatch(
+            std::bind(
+                scanline_window_process,
+                std::placeholders::_1,
+                std::placeholders::_2,
+                std::placeholders::_3,
+                std::ref( sg ),
+                dims ),
+            dims.y1,
+            h );
+        return;
+    }
+
     threading::get().dispatch(
         std::bind(
             scanline_thread_process,
@@ -101,13 +101,17 @@ template <typename T> struct arg_type_adapter
          std::vector<scanline> &,
          size_t             i,
          const engine::any &v,
-         engine::node_id,
-         engine::subgroup &,
+         engine::node_id    n,
+         engine::subgroup & sg,
          engine::subgroup_function *,
          std::vector<std::shared_ptr<engine::subgroup_function>> & )
     {
         precondition(
             i == size_t( -1 ), "item with no binder has index to binder list" );
+        // a member of the group read as a whole value is the input of
+        // the windowed member, and is bound later (@sa bind_window)
+        if ( !v.has_value() && sg.is_member( n ) )
+            return type();
         return cengref( base::any_cast<const base_type &>( v ) );
     }
 };
@@ -211,6 +215,10 @@ public:
 
     virtual const std::vector<scanline> &inputs( void ) const = 0;
     virtual void set_input( size_t i, const scanline &s )     = 0;
+
+    /// binds input i of a windowed member to the plane presenting
+    /// the window of scanlines computed for it
+    virtual void bind_window( size_t i, const plane &p );
 };
 
 template <bool inplace, typename... Args>
@@ -395,6 +403,11 @@ public:
         _binders[i].set( s );
     }
 
+    void bind_window( size_t i, const plane &p ) override
+    {
+        process_window( i, p, base::gen_sequence<sizeof...( Args )>{} );
+    }
+
 private:
     inline void process_bind(
         std::vector<std::shared_ptr<engine::subgroup_function>> &,
@@ -422,6 +435,29 @@ private:
             funcs )... );
     }
 
+    template <size_t... S>
+    inline void
+    process_window( size_t i, const plane &p, const base::sequence<S...> & )
+    {
+        bool found[] = { false,
+                         ( S == i && window_arg( std::get<S>( _args ), p ) )... };
+        precondition(
+            std::find( std::begin( found ), std::end( found ), true ) !=
+                std::end( found ),
+            "input {0} of a windowed operation is not a plane",
+            i );
+    }
+
+    static inline bool window_arg( engine_ref<const plane> &a, const plane &p )
+    {
+        a = cengref( p );
+        return true;
+    }
+    template <typename T> static inline bool window_arg( T &, const plane & )
+    {
+        return false;
+    }
+
     template <size_t... S>
     inline void
     process_call( scanline &dest, int y, const base::sequence<S...> & )
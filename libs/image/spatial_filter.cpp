@@ -11,6 +11,7 @@
 #include <base/cpu_features.h>
 #include <base/math_functions.h>
 #include <base/svd.h>
+#include <limits>
 
 ////////////////////////////////////////
 
@@ -20,58 +21,170 @@ using namespace image;
 
 ////////////////////////////////////////
 
-void apply_erode( scanline &dest, int y, const plane &p, int radius )
+/// erode and dilate are run as separable van Herk / Gil-Werman
+/// passes: the line is cut into blocks the size of the window, and
+/// each output is the min (max) of the suffix of one block and the
+/// prefix of the next, which is 3 comparisons a pixel for any
+/// radius. Samples outside the plane are skipped, which for a min or
+/// max is the same as clamping to the edge.
+template <bool isMax> inline float morph( float a, float b )
 {
-    int maxx = p.width() - 1;
+    return isMax ? std::max( a, b ) : std::min( a, b );
+}
 
-    for ( int x = 0, w = dest.width(); x < w; ++x )
+template <bool isMax> inline float morph_identity( void )
+{
+    return isMax ? -std::numeric_limits<float>::infinity()
+                 : std::numeric_limits<float>::infinity();
+}
+
+#if defined( __SSE__ )
+template <bool isMax> inline __m128 morph4( __m128 a, __m128 b )
+{
+    return isMax ? _mm_max_ps( a, b ) : _mm_min_ps( a, b );
+}
+#endif
+
+/// out = morph( a, b ) across a scanline
+template <bool isMax>
+inline void morph_scan( scanline &out, const scanline &a, const scanline &b )
+{
+#if defined( __SSE__ )
+    for ( int c = 0, nc = out.chunks4(); c < nc; ++c )
+        out.store4( morph4<isMax>( a.load4( c ), b.load4( c ) ), c );
+#else
+    for ( int x = 0, w = out.width(); x < w; ++x )
+        out[x] = morph<isMax>( a[x], b[x] );
+#endif
+}
+
+////////////////////////////////////////
+
+template <bool isMax>
+void apply_morph_h( scanline &dest, int y, const plane &p, int radius )
+{
+    int      w   = dest.width();
+    int      win = 2 * radius + 1;
+    scanline src = scan_ref( p, y );
+
+    // pad the line by a window on each side, so there are no bounds
+    // to check below
+    scanline pad( 0, w + 2 * win );
+    scanline suf( 0, w + win );
+    float *  padP = pad.get();
+    float *  sufP = suf.get();
+    std::fill( padP, padP + win, morph_identity<isMax>() );
+    std::copy( src.begin(), src.end(), padP + win );
+    std::fill( padP + win + w, padP + w + 2 * win, morph_identity<isMax>() );
+
+    // output x in [b, b + win) has the window starting in the block at
+    // b - radius, and ending in the block following that
+    const float *inP = padP + win - radius;
+    for ( int b = 0; b < w; b += win )
     {
-        float minV = dest[x];
-        for ( int cy = y - radius; cy <= y + radius; ++cy )
+        float run = morph_identity<isMax>();
+        for ( int j = win - 1; j >= 0; --j )
         {
-            if ( cy < p.y1() || cy > p.y2() )
-                continue;
-
-            const float *inP = p.line( cy );
-            for ( int cx = x - radius; cx <= x + radius; ++cx )
-            {
-                if ( cx < 0 || cy >= maxx )
-                    continue;
+            run         = morph<isMax>( run, inP[b + j] );
+            sufP[b + j] = run;
+        }
 
-                minV = std::min( minV, inP[cx] );
-            }
+        dest[b] = sufP[b];
+        run     = morph_identity<isMax>();
+        int be  = std::min( win, w - b );
+        for ( int j = 1; j < be; ++j )
+        {
+            run         = morph<isMax>( run, inP[b + win + j - 1] );
+            dest[b + j] = morph<isMax>( sufP[b + j], run );
         }
-        dest[x] = minV;
     }
 }
 
+void apply_erode_h( scanline &dest, int y, const plane &p, int radius )
+{
+    apply_morph_h<false>( dest, y, p, radius );
+}
+
+void apply_dilate_h( scanline &dest, int y, const plane &p, int radius )
+{
+    apply_morph_h<true>( dest, y, p, radius );
+}
+
 ////////////////////////////////////////
 
-void apply_dilate( scanline &dest, int y, const plane &p, int radius )
+template <bool isMax>
+void morph_v_thread( size_t, int s, int e, plane &r, const plane &p, int radius )
 {
-    int maxx = p.width() - 1;
+    int win = 2 * radius + 1;
+    int y1  = p.y1();
+    int y2  = p.y2();
 
-    for ( int x = 0, w = dest.width(); x < w; ++x )
+    scanline run( 0, p.width() );
+    for ( int blk = s; blk < e; ++blk )
     {
-        float maxV = dest[x];
-        for ( int cy = y - radius; cy <= y + radius; ++cy )
+        // output rows [oy, oe) have the window starting in the input
+        // block at oy - radius, and ending in the block following that
+        int oy = y1 + blk * win;
+        int oe = std::min( y2 + 1, oy + win );
+        int iy = oy - radius;
+
+        std::fill( run.begin(), run.end(), morph_identity<isMax>() );
+        for ( int j = win - 1; j >= 0; --j )
         {
-            if ( cy < p.y1() || cy > p.y2() )
-                continue;
-
-            const float *inP = p.line( cy );
-            for ( int cx = x - radius; cx <= x + radius; ++cx )
+            int sy = iy + j;
+            if ( sy >= y1 && sy <= y2 )
+                morph_scan<isMax>( run, run, scan_ref( p, sy ) );
+            if ( oy + j < oe )
             {
-                if ( cx < 0 || cy >= maxx )
-                    continue;
-
-                maxV = std::max( maxV, inP[cx] );
+                scanline d = scan_ref( r, oy + j );
+                std::copy( run.begin(), run.end(), d.begin() );
             }
         }
-        dest[x] = maxV;
+
+        // the first output row is all in the one block
+        std::fill( run.begin(), run.end(), morph_identity<isMax>() );
+        for ( int j = 1; j < oe - oy; ++j )
+        {
+            int sy = iy + win + j - 1;
+            if ( sy <= y2 )
+                morph_scan<isMax>( run, run, scan_ref( p, sy ) );
+            scanline d = scan_ref( r, oy + j );
+            morph_scan<isMax>( d, d, run );
+        }
     }
 }
 
+template <bool isMax> plane apply_morph_v( const plane &p, int radius )
+{
+    plane r( p.x1(), p.y1(), p.x2(), p.y2() );
+
+    int win     = 2 * radius + 1;
+    int nBlocks = ( p.height() + win - 1 ) / win;
+    threading::get().dispatch(
+        std::bind(
+            morph_v_thread<isMax>,
+            std::placeholders::_1,
+            std::placeholders::_2,
+            std::placeholders::_3,
+            std::ref( r ),
+            std::cref( p ),
+            radius ),
+        0,
+        nBlocks );
+
+    return r;
+}
+
+plane apply_erode_v( const plane &p, int radius )
+{
+    return apply_morph_v<false>( p, radius );
+}
+
+plane apply_dilate_v( const plane &p, int radius )
+{
+    return apply_morph_v<true>( p, radius );
+}
+
 ////////////////////////////////////////
 
 inline void sort( float &a, float &b )
@@ -197,10 +310,220 @@ static void generic_median_thread(
     }
 }
 
+////////////////////////////////////////
+
+/// below this diameter, sorting the samples of each pixel is cheaper
+/// than maintaining the histograms, and as the window counts are kept
+/// in 16 bits, there is a maximum
+constexpr int histMedianMinDiam = 4;
+constexpr int histMedianMaxDiam = 255;
+
+/// @brief median filter using sliding histograms, after Perreault &
+/// Hebert.
+///
+/// The plane is processed in tiles, and every sample of a tile
+/// (including the clamped border) is given a unique rank by sorting,
+/// so float data has no bins to quantise to. The ranks are split into
+/// coarse buckets, and the column histograms of those slide down the
+/// tile while the window histogram slides across from them, which
+/// finds the bucket holding the median. As the ranks are unique, the
+/// median is then picked by walking the ranks of that bucket in
+/// order, counting those which fall inside the window, so the result
+/// is exactly what sorting the window would give.
+///
+/// With a tile side of T samples, there are about T buckets of about T
+/// ranks, so sliding the window histogram and walking a bucket cost
+/// O(T) per pixel, and ranking the tile O(log T). As T is
+/// max( 128, 4 * diameter ), that is constant up to a diameter of 32,
+/// growing linearly beyond (against O(diameter^2 log diameter) for
+/// sorting each window).
+class median_histogram
+{
+public:
+    median_histogram( int diam ) : _diam( diam ), _left( ( diam - 1 ) / 2 ) {}
+
+    /// tiles are square in samples, large enough relative to the
+    /// diameter to not spend the time ranking the borders
+    static int tile_size( int diam ) { return std::max( 128, diam * 4 ); }
+
+    void process( plane &r, const plane &p, int ox, int oy, int ow, int oh )
+    {
+        int    tw  = ow + _diam - 1;
+        int    th  = oh + _diam - 1;
+        size_t n   = static_cast<size_t>( tw ) * static_cast<size_t>( th );
+        int    wm1 = p.width() - 1;
+
+        _vals.resize( n );
+        for ( int gy = 0; gy < th; ++gy )
+        {
+            int ready = std::min( p.y2(), std::max( p.y1(), oy - _left + gy ) );
+            const float *lineP = p.line( ready );
+            float *      valP  = _vals.data() + static_cast<size_t>( gy * tw );
+            for ( int gx = 0; gx < tw; ++gx )
+                valP[gx] = lineP[std::min( wm1, std::max( 0, ox - _left + gx ) )];
+        }
+
+        _order.resize( n );
+        for ( size_t i = 0; i != n; ++i )
+            _order[i] = static_cast<uint32_t>( i );
+        std::sort( _order.begin(), _order.end(), [this]( uint32_t a, uint32_t b ) {
+            return _vals[a] < _vals[b];
+        } );
+
+        _rank.resize( n );
+        _sorted.resize( n );
+        _pos.resize( n );
+        for ( size_t k = 0; k != n; ++k )
+        {
+            uint32_t g = _order[k];
+            _rank[g]   = static_cast<uint32_t>( k );
+            _sorted[k] = _vals[g];
+            _pos[k]    = ( ( g / static_cast<uint32_t>( tw ) ) << 16 ) |
+                      ( g % static_cast<uint32_t>( tw ) );
+        }
+
+        // buckets of ~sqrt(n) ranks, so the walk of a bucket and the
+        // update of the histograms cost about the same
+        int shift = 0;
+        while ( ( size_t( 1 ) << ( 2 * shift ) ) < n )
+            ++shift;
+        size_t bucketCount = ( ( n - 1 ) >> shift ) + 1;
+
+        _cols.assign( static_cast<size_t>( tw ) * bucketCount, 0 );
+        _kern.resize( bucketCount );
+        for ( int gy = 0; gy < _diam; ++gy )
+        {
+            const uint32_t *rankP = _rank.data() + static_cast<size_t>( gy * tw );
+            for ( int gx = 0; gx < tw; ++gx )
+                ++_cols[static_cast<size_t>( gx ) * bucketCount +
+                        ( rankP[gx] >> shift )];
+        }
+
+        size_t   middle = static_cast<size_t>( _diam * _diam ) / 2;
+        unsigned diam   = static_cast<unsigned>( _diam );
+        for ( int ly = 0; ly < oh; ++ly )
+        {
+            if ( ly > 0 )
+            {
+                const uint32_t *outP =
+                    _rank.data() + static_cast<size_t>( ( ly - 1 ) * tw );
+                const uint32_t *inP =
+                    _rank.data() + static_cast<size_t>( ( ly + _diam - 1 ) * tw );
+                for ( int gx = 0; gx < tw; ++gx )
+                {
+                    uint16_t *colP =
+                        _cols.data() + static_cast<size_t>( gx ) * bucketCount;
+                    --colP[outP[gx] >> shift];
+                    ++colP[inP[gx] >> shift];
+                }
+            }
+
+            std::fill( _kern.begin(), _kern.end(), 0 );
+            for ( int gx = 0; gx < _diam; ++gx )
+                slide_column( gx, -1, bucketCount );
+
+            float *destP = r.line( oy + ly ) + ox;
+            for ( int lx = 0; lx < ow; ++lx )
+            {
+                if ( lx > 0 )
+                    slide_column( lx + _diam - 1, lx - 1, bucketCount );
+
+                size_t b   = 0;
+                size_t cum = 0;
+                while ( cum + _kern[b] <= middle )
+                    cum += _kern[b++];
+
+                size_t need = middle - cum;
+                size_t k    = b << shift;
+                size_t ke   = std::min( n, k + ( size_t( 1 ) << shift ) );
+                for ( ; k != ke; ++k )
+                {
+                    uint32_t pk = _pos[k];
+                    if ( ( ( pk & 0xFFFF ) - static_cast<unsigned>( lx ) ) < diam &&
+                         ( ( pk >> 16 ) - static_cast<unsigned>( ly ) ) < diam )
+                    {
+                        if ( need == 0 )
+                            break;
+                        --need;
+                    }
+                }
+                destP[lx] = _sorted[k];
+            }
+        }
+    }
+
+private:
+    /// adds the column gx to the window histogram, removing the
+    /// column outx (if not negative)
+    inline void slide_column( int gx, int outx, size_t bucketCount )
+    {
+        uint16_t *      kernP = _kern.data();
+        const uint16_t *inP   = _cols.data() + static_cast<size_t>( gx ) * bucketCount;
+        if ( outx < 0 )
+        {
+            for ( size_t b = 0; b != bucketCount; ++b )
+                kernP[b] = static_cast<uint16_t>( kernP[b] + inP[b] );
+            return;
+        }
+
+        const uint16_t *outP = _cols.data() + static_cast<size_t>( outx ) * bucketCount;
+        for ( size_t b = 0; b != bucketCount; ++b )
+            kernP[b] = static_cast<uint16_t>( kernP[b] + inP[b] - outP[b] );
+    }
+
+    int                   _diam;
+    int                   _left;
+    std::vector<float>    _vals;
+    std::vector<uint32_t> _order;
+    std::vector<uint32_t> _rank;
+    std::vector<float>    _sorted;
+    std::vector<uint32_t> _pos;
+    std::vector<uint16_t> _cols;
+    std::vector<uint16_t> _kern;
+};
+
+////////////////////////////////////////
+
+static void hist_median_thread(
+    size_t, int s, int e, plane &r, const plane &p, int diam, int bandH )
+{
+    median_histogram mh( diam );
+
+    int w = p.width();
+    for ( int band = s; band < e; ++band )
+    {
+        int oy = p.y1() + band * bandH;
+        int oh = std::min( bandH, p.y2() + 1 - oy );
+        for ( int ox = 0; ox < w; ox += bandH )
+            mh.process( r, p, ox, oy, std::min( bandH, w - ox ), oh );
+    }
+}
+
+////////////////////////////////////////
+
 static plane generic_median( const plane &p, int diam )
 {
     plane r( p.x1(), p.y1(), p.x2(), p.y2() );
 
+    if ( diam >= histMedianMinDiam && diam <= histMedianMaxDiam )
+    {
+        int bandH  = median_histogram::tile_size( diam ) - ( diam - 1 );
+        int nBands = ( p.height() + bandH - 1 ) / bandH;
+        threading::get().dispatch(
+            std::bind(
+                hist_median_thread,
+                std::placeholders::_1,
+                std::placeholders::_2,
+                std::placeholders::_3,
+                std::ref( r ),
+                std::cref( p ),
+                diam,
+                bandH ),
+            0,
+            nBands );
+        return r;
+    }
+
     threading::get().dispatch(
         std::bind(
             generic_median_thread,
@@ -864,120 +1187,433 @@ static plane apply_sav_gol( const plane &p, int radius, int order )
 
 ////////////////////////////////////////
 
-static void nlm_add_contrib_l2(
-    float &                   weight,
-    float &                   sum,
-    const plane &             src,
-    int                       x,
-    int                       y,
-    int                       offX,
-    int                       offY,
-    int                       window,
-    const std::vector<float> &windowKern,
-    float                     compareSigma )
-{
-    float wdiff = 0.F;
-    for ( int wY = -window; wY <= window; ++wY )
+/// w = scale * exp( -w ) over a row of nlm weights, evaluated as
+/// 2^x with a polynomial for the fraction, good to a few ulp
+static inline void nlm_weights( float *w, float scale, int n )
+{
+    int x = 0;
+#if defined( __SSE2__ )
+    const __m128 l2e   = _mm_set1_ps( -1.44269504F );
+    const __m128 lo    = _mm_set1_ps( -126.F );
+    const __m128 one   = _mm_set1_ps( 1.F );
+    const __m128 vscal = _mm_set1_ps( scale );
+    for ( ; x + 4 <= n; x += 4 )
     {
-        float yW    = windowKern[wY + window];
-        int   srcY  = y + wY;
-        int   testY = offY + wY;
-        if ( srcY < src.y1() || srcY > src.y2() )
-        {
-            // outside source image but from center area so
-            // ignore this one
-            continue;
-        }
-        if ( testY < src.y1() || testY > src.y2() )
-        {
-            // center of pixel is on the image, but the
-            // search is off - just return and don't add any
-            // of this pixel
-            return;
-        }
-        for ( int wX = -window; wX <= window; ++wX )
+        __m128 v  = _mm_max_ps( _mm_mul_ps( _mm_loadu_ps( w + x ), l2e ), lo );
+        __m128 fi = _mm_cvtepi32_ps( _mm_cvttps_epi32( v ) );
+        // truncation rounds up for negative values, make it floor
+        fi        = _mm_sub_ps( fi, _mm_and_ps( _mm_cmpgt_ps( fi, v ), one ) );
+        __m128 f  = _mm_sub_ps( v, fi );
+
+        __m128 p = _mm_set1_ps( 1.33335581e-3F );
+        p        = _mm_add_ps( _mm_mul_ps( p, f ), _mm_set1_ps( 9.61812911e-3F ) );
+        p        = _mm_add_ps( _mm_mul_ps( p, f ), _mm_set1_ps( 5.55041087e-2F ) );
+        p        = _mm_add_ps( _mm_mul_ps( p, f ), _mm_set1_ps( 2.40226507e-1F ) );
+        p        = _mm_add_ps( _mm_mul_ps( p, f ), _mm_set1_ps( 6.93147182e-1F ) );
+        p        = _mm_add_ps( _mm_mul_ps( p, f ), one );
+
+        __m128i e = _mm_slli_epi32(
+            _mm_add_epi32( _mm_cvtps_epi32( fi ), _mm_set1_epi32( 127 ) ), 23 );
+        _mm_storeu_ps(
+            w + x, _mm_mul_ps( _mm_mul_ps( p, _mm_castsi128_ps( e ) ), vscal ) );
+    }
+#endif
+    for ( ; x < n; ++x )
+        w[x] = scale * expf( -w[x] );
+}
+
+/// parameters shared by the nlm variants
+struct nlm_params
+{
+    int   search;
+    int   compare;
+    float searchSigma;
+    float compareSigma;
+    float centerWeight;
+    bool  useL1;
+};
+
+/// @brief Non-local means evaluated one search offset at a time
+///
+/// For each offset, the difference between the reference patch and
+/// the shifted patch (summed over the channels) is box summed with
+/// a separable running sum: every row is summed horizontally once,
+/// and a running column sum over a ring of those rows covers the
+/// vertical extent of the patch. This makes the patch distance
+/// O(1) per pixel per offset, independent of the compare radius.
+/// Samples outside the planes hold the edge value.
+///
+/// The output planes are used to accumulate the weighted sums for a
+/// band of rows, normalized once all the offsets have been added.
+class nlm_accumulator
+{
+public:
+    typedef std::vector<const_plane_buffer> frame;
+
+    nlm_accumulator(
+        const std::vector<frame> &frames,
+        size_t                    refFrame,
+        const const_plane_buffer *sigma,
+        const nlm_params &        params );
+
+    static inline int band_size( int compare )
+    {
+        return std::max( 64, 8 * compare );
+    }
+
+    void process( std::vector<plane_buffer> &out, int oy, int oh );
+
+private:
+    void add_offset(
+        std::vector<plane_buffer> &out,
+        const frame &              src,
+        int                        dx,
+        int                        dy,
+        float                      spatW,
+        int                        oy,
+        int                        oh );
+
+    inline int hold_y( int y ) const
+    {
+        return std::min( _y2, std::max( _y1, y ) );
+    }
+
+    const std::vector<frame> &_frames;
+    size_t                    _ref;
+    const const_plane_buffer *_sigma;
+    nlm_params                _params;
+    int                       _w;
+    int                       _y1;
+    int                       _y2;
+    int                       _xBase;
+    int                       _ringRows;
+    float                     _norm;
+
+    std::vector<int>   _xIdx;
+    std::vector<float> _diff;
+    std::vector<float> _ring;
+    std::vector<float> _colSum;
+    std::vector<float> _wrow;
+    std::vector<float> _wsum;
+};
+
+////////////////////////////////////////
+
+nlm_accumulator::nlm_accumulator(
+    const std::vector<frame> &frames,
+    size_t                    refFrame,
+    const const_plane_buffer *sigma,
+    const nlm_params &        params )
+    : _frames( frames ), _ref( refFrame ), _sigma( sigma ), _params( params )
+{
+    const const_plane_buffer &p = frames[refFrame].front();
+
+    int c     = params.compare;
+    _w        = p.width();
+    _y1       = p.y1();
+    _y2       = p.y2();
+    _xBase    = c + params.search;
+    _ringRows = 2 * c + 1;
+    _norm     = 1.F / static_cast<float>(
+                        _ringRows * _ringRows *
+                        static_cast<int>( frames[refFrame].size() ) );
+
+    // column (relative to x1) to read for each patch column, holding
+    // the edge, for all the columns any offset can reach
+    _xIdx.resize( static_cast<size_t>( _w + 2 * _xBase ) );
+    for ( int x = -_xBase; x < _w + _xBase; ++x )
+        _xIdx[static_cast<size_t>( x + _xBase )] =
+            std::min( _w - 1, std::max( 0, x ) );
+
+    _diff.resize( static_cast<size_t>( _w + 2 * c ) );
+    _ring.resize( static_cast<size_t>( _ringRows * _w ) );
+    _colSum.resize( static_cast<size_t>( _w ) );
+    _wrow.resize( static_cast<size_t>( _w ) );
+    _wsum.resize( static_cast<size_t>( band_size( c ) * _w ) );
+}
+
+////////////////////////////////////////
+
+void nlm_accumulator::process( std::vector<plane_buffer> &out, int oy, int oh )
+{
+    const frame &ref = _frames[_ref];
+    size_t       nc  = ref.size();
+    size_t       n   = static_cast<size_t>( oh * _w );
+
+    std::fill( _wsum.begin(), _wsum.begin() + static_cast<ptrdiff_t>( n ), 0.F );
+    for ( size_t ch = 0; ch != nc; ++ch )
+    {
+        for ( int y = oy; y < oy + oh; ++y )
+            std::fill( out[ch].line( y ), out[ch].line( y ) + _w, 0.F );
+    }
+
+    int   search = _params.search;
+    float ssig   = _params.searchSigma;
+    float sscale = ssig > 0.F ? 1.F / ( 2.F * ssig * ssig ) : 0.F;
+    for ( size_t f = 0; f != _frames.size(); ++f )
+    {
+        for ( int dy = -search; dy <= search; ++dy )
         {
-            float xW    = windowKern[wY + window];
-            int   srcX  = x + wX;
-            int   testX = offX + wX;
-            if ( srcX < src.x1() || srcX > src.x2() )
+            for ( int dx = -search; dx <= search; ++dx )
             {
-                continue;
+                if ( f == _ref && dx == 0 && dy == 0 )
+                    continue;
+
+                float spatW =
+                    expf( -static_cast<float>( dx * dx + dy * dy ) * sscale );
+                add_offset( out, _frames[f], dx, dy, spatW, oy, oh );
             }
-            if ( testX < src.x1() || testX > src.x2() )
+        }
+    }
+
+    // the center pixel is weighted as specified instead of against
+    // itself, which would always be the maximum weight
+    float cw = _params.centerWeight;
+    for ( int y = oy; y < oy + oh; ++y )
+    {
+        float *wsum = _wsum.data() + ( y - oy ) * _w;
+        for ( size_t ch = 0; ch != nc; ++ch )
+        {
+            float *      o = out[ch].line( y );
+            const float *s = ref[ch].line( y );
+            for ( int x = 0; x < _w; ++x )
             {
-                // center of pixel is on the image, but the
-                // search is off - just return and don't add any
-                // of this pixel
-                return;
+                float wt = wsum[x] + cw;
+                o[x]     = wt > 0.F ? ( o[x] + cw * s[x] ) / wt : s[x];
             }
-
-            float delta = src.get( srcX, srcY ) - src.get( testX, testY );
-            wdiff += delta * delta * xW * yW;
         }
     }
-    float finWeight = expf( -wdiff * wdiff * compareSigma );
-    sum += src.get( x + offX, y + offY ) * finWeight;
-    weight += finWeight;
 }
 
-static void standard_nlm_p(
-    size_t       tIdx,
-    int          s,
-    int          e,
-    plane &      out,
-    const plane &src,
-    int          search,
-    int          compare,
-    float        searchSigma,
-    float        compareSigma,
-    float        centerWeight )
+////////////////////////////////////////
+
+void nlm_accumulator::add_offset(
+    std::vector<plane_buffer> &out,
+    const frame &              src,
+    int                        dx,
+    int                        dy,
+    float                      spatW,
+    int                        oy,
+    int                        oh )
 {
-    int                width = out.width();
-    std::vector<float> spatKern( compare * 2 + 1 );
-    // Buades recommends h = 10*sigma, but his images are 0 - 255 not
-    // 0 - 1, still want 10x?
-    compareSigma = 1.F / ( compareSigma * compareSigma );
-    for ( int y = s; y < e; ++y )
+    const frame &ref  = _frames[_ref];
+    size_t       nc   = ref.size();
+    int          c    = _params.compare;
+    int          win  = 2 * c + 1;
+    int          dw   = _w + 2 * c;
+    bool         isL1 = _params.useL1;
+
+    float h    = std::max( _params.compareSigma, 1e-6F );
+    float invH = isL1 ? 1.F / h : 1.F / ( h * h );
+
+    // the range of the difference row (offset by c) and the output
+    // row where both the reference and shifted sample are on the
+    // image, outside of which the edge is held
+    int        dLo = std::min( dw, std::max( c, c - dx ) );
+    int        dHi = std::max( dLo, std::min( dw - c, dw - c - dx ) );
+    int        oLo = std::min( _w, std::max( 0, -dx ) );
+    int        oHi = std::max( oLo, std::min( _w, _w - dx ) );
+    const int *ia  = _xIdx.data() + _xBase - c;
+    const int *ib  = ia + dx;
+    const int *ix  = _xIdx.data() + _xBase + dx;
+
+    float *diff   = _diff.data();
+    float *colSum = _colSum.data();
+    float *wrow   = _wrow.data();
+    std::fill( _colSum.begin(), _colSum.end(), 0.F );
+    for ( int r = 0; r < oh + 2 * c; ++r )
     {
-        scanline outscan = scan_ref( out, y );
-        for ( int x = 0; x < width; ++x )
+        int ry = hold_y( oy - c + r );
+        int sy = hold_y( oy - c + r + dy );
+
+        // difference of the patch rows, summed over the channels
+        std::fill( _diff.begin(), _diff.end(), 0.F );
+        for ( size_t ch = 0; ch != nc; ++ch )
         {
-            float weight = 0.F;
-            float sum    = 0.F;
-            for ( int sY = -search; sY <= search; ++sY )
+            const float *a = ref[ch].line( ry );
+            const float *b = src[ch].line( sy );
+            for ( int i = 0; i < dLo; ++i )
             {
-                int curY = y + sY;
-                for ( int sX = -search; sX <= search; ++sX )
+                float d = a[ia[i]] - b[ib[i]];
+                diff[i] += isL1 ? std::abs( d ) : d * d;
+            }
+            const float *ai = a - c;
+            const float *bi = b - c + dx;
+            if ( isL1 )
+            {
+                for ( int i = dLo; i < dHi; ++i )
+                    diff[i] += std::abs( ai[i] - bi[i] );
+            }
+            else
+            {
+                for ( int i = dLo; i < dHi; ++i )
                 {
-                    if ( sX == 0 && sY == 0 )
-                    {
-                        sum += centerWeight * src.get( x + sX, curY );
-                        weight += centerWeight;
-                        continue;
-                    }
-                    nlm_add_contrib_l2(
-                        weight,
-                        sum,
-                        src,
-                        x,
-                        y,
-                        sX,
-                        sY,
-                        compare,
-                        spatKern,
-                        compareSigma );
+                    float d = ai[i] - bi[i];
+                    diff[i] += d * d;
                 }
             }
-            // in a subsequent paper, Buades recommends to average
-            // the result w/ a portion of the source image:
-            // out = est + max(0, (VarX - sigma^2)/VarX ) * (orig - est)
-            //
-            // basically saying as the (local) variance of the pixel
-            // goes up relative to the global standard deviation
-            // provided, mix back in a portion of the original
+            for ( int i = dHi; i < dw; ++i )
+            {
+                float d = a[ia[i]] - b[ib[i]];
+                diff[i] += isL1 ? std::abs( d ) : d * d;
+            }
         }
+
+        // horizontal box sum into the ring, and add to the columns
+        float *hrow = _ring.data() + ( r % win ) * _w;
+        double hs   = 0.0;
+        for ( int i = 0; i < win - 1; ++i )
+            hs += diff[i];
+        for ( int x = 0; x < _w; ++x )
+        {
+            hs += diff[x + win - 1];
+            hrow[x] = static_cast<float>( hs );
+            hs -= diff[x];
+        }
+        for ( int x = 0; x < _w; ++x )
+            colSum[x] += hrow[x];
+
+        if ( r < 2 * c )
+            continue;
+
+        // the columns now cover the patches centered on row y
+        int    y    = oy + r - 2 * c;
+        float *wsum = _wsum.data() + ( y - oy ) * _w;
+        if ( _sigma )
+        {
+            const float *sig = _sigma->line( y );
+            for ( int x = 0; x < _w; ++x )
+            {
+                float ph = std::max( sig[x], 1e-6F );
+                float ih = isL1 ? 1.F / ph : 1.F / ( ph * ph );
+                wrow[x]  = std::max( 0.F, colSum[x] * _norm ) * ih;
+            }
+        }
+        else
+        {
+            for ( int x = 0; x < _w; ++x )
+                wrow[x] = std::max( 0.F, colSum[x] * _norm ) * invH;
+        }
+        nlm_weights( wrow, spatW, _w );
+        for ( int x = 0; x < _w; ++x )
+            wsum[x] += wrow[x];
+
+        int vy = hold_y( y + dy );
+        for ( size_t ch = 0; ch != nc; ++ch )
+        {
+            float *      o = out[ch].line( y );
+            const float *s = src[ch].line( vy );
+            for ( int x = 0; x < oLo; ++x )
+                o[x] += wrow[x] * s[ix[x]];
+            const float *si = s + dx;
+            for ( int x = oLo; x < oHi; ++x )
+                o[x] += wrow[x] * si[x];
+            for ( int x = oHi; x < _w; ++x )
+                o[x] += wrow[x] * s[ix[x]];
+        }
+
+        // retire the oldest row, the next row takes its slot
+        const float *orow = _ring.data() + ( ( r + 1 ) % win ) * _w;
+        for ( int x = 0; x < _w; ++x )
+            colSum[x] -= orow[x];
+    }
+}
+
+////////////////////////////////////////
+
+static void nlm_thread(
+    size_t,
+    int                                         s,
+    int                                         e,
+    std::vector<plane_buffer> &                 out,
+    const std::vector<nlm_accumulator::frame> & frames,
+    size_t                                      refFrame,
+    const const_plane_buffer *                  sigma,
+    const nlm_params &                          params,
+    int                                         bandH )
+{
+    nlm_accumulator acc( frames, refFrame, sigma, params );
+
+    int y1 = out.front().y1();
+    int y2 = out.front().y2();
+    for ( int band = s; band < e; ++band )
+    {
+        int oy = y1 + band * bandH;
+        acc.process( out, oy, std::min( bandH, y2 + 1 - oy ) );
+    }
+}
+
+////////////////////////////////////////
+
+static std::vector<plane> nlm_impl(
+    const std::vector<std::vector<plane>> &frames,
+    size_t                                 refFrame,
+    const plane *                          sigma,
+    const nlm_params &                     params )
+{
+    precondition( !frames.empty(), "nlm requires at least one frame" );
+    precondition( params.search >= 0, "invalid nlm search radius" );
+    precondition( params.compare >= 0, "invalid nlm compare radius" );
+
+    const std::vector<plane> &ref = frames[refFrame];
+    precondition( !ref.empty(), "nlm requires at least one channel" );
+
+    engine::dimensions d = ref.front().dims();
+    for ( auto &f: frames )
+    {
+        precondition(
+            f.size() == ref.size(),
+            "nlm frames have a differing number of channels" );
+        for ( auto &p: f )
+            precondition( p.dims() == d, "nlm planes differ in size" );
+    }
+    if ( sigma )
+        precondition(
+            sigma->dims() == d, "nlm compare sigma plane differs in size" );
+
+    // make sure everything is computed prior to threading
+    std::vector<nlm_accumulator::frame> in;
+    in.reserve( frames.size() );
+    for ( auto &f: frames )
+    {
+        in.emplace_back();
+        for ( auto &p: f )
+            in.back().push_back( p );
+    }
+    const_plane_buffer  sigbuf;
+    const_plane_buffer *sigp = nullptr;
+    if ( sigma )
+    {
+        sigbuf = *sigma;
+        sigp   = &sigbuf;
     }
+
+    std::vector<plane>        r;
+    std::vector<plane_buffer> out;
+    for ( size_t ch = 0; ch != ref.size(); ++ch )
+    {
+        r.emplace_back( d );
+        out.push_back( r.back() );
+    }
+
+    int bandH  = nlm_accumulator::band_size( params.compare );
+    int nBands = ( r.front().height() + bandH - 1 ) / bandH;
+    threading::get().dispatch(
+        std::bind(
+            nlm_thread,
+            std::placeholders::_1,
+            std::placeholders::_2,
+            std::placeholders::_3,
+            std::ref( out ),
+            std::cref( in ),
+            refFrame,
+            sigp,
+            std::cref( params ),
+            bandH ),
+        0,
+        nBands );
+
+    return r;
 }
 
 } // namespace
@@ -990,14 +1626,22 @@ namespace image
 
 plane erode( const plane &p, int radius )
 {
-    return plane( "p.erode", p.dims(), p, radius );
+    precondition( radius >= 0, "invalid erode radius {0}", radius );
+    if ( radius == 0 )
+        return p;
+    return plane(
+        "p.erode_v", p.dims(), plane( "p.erode_h", p.dims(), p, radius ), radius );
 }
 
 ////////////////////////////////////////
 
 plane dilate( const plane &p, int radius )
 {
-    return plane( "p.dilate", p.dims(), p, radius );
+    precondition( radius >= 0, "invalid dilate radius {0}", radius );
+    if ( radius == 0 )
+        return p;
+    return plane(
+        "p.dilate_v", p.dims(), plane( "p.dilate_h", p.dims(), p, radius ), radius );
 }
 
 ////////////////////////////////////////
@@ -1191,24 +1835,23 @@ plane nlm(
     float        compareSigma,
     float        centerWeight )
 {
-    plane r( p.x1(), p.y1(), p.x2(), p.y2() );
+    nlm_params parms{ search,       compare,      searchSigma,
+                      compareSigma, centerWeight, false };
+    return nlm_impl( { { p } }, 0, nullptr, parms ).front();
+}
 
-    threading::get().dispatch(
-        std::bind(
-            standard_nlm_p,
-            std::placeholders::_1,
-            std::placeholders::_2,
-            std::placeholders::_3,
-            std::ref( r ),
-            std::cref( p ),
-            search,
-            compare,
-            searchSigma,
-            compareSigma,
-            centerWeight ),
-        p );
+////////////////////////////////////////
 
-    return r;
+plane nlm(
+    const plane &p,
+    int          search,
+    int          compare,
+    float        searchSigma,
+    const plane &compareSigma,
+    float        centerWeight )
+{
+    nlm_params parms{ search, compare, searchSigma, 1.F, centerWeight, false };
+    return nlm_impl( { { p } }, 0, &compareSigma, parms ).front();
 }
 
 ////////////////////////////////////////
@@ -1219,31 +1862,79 @@ plane nlm(
     int                       compare,
     float                     searchSigma,
     float                     compareSigma,
-    float                     centerWeight );
+    float                     centerWeight )
+{
+    std::vector<std::vector<plane>> frames;
+    for ( auto &f: p )
+        frames.push_back( { f } );
+
+    nlm_params parms{ search,       compare,      searchSigma,
+                      compareSigma, centerWeight, false };
+    return nlm_impl( frames, p.size() / 2, nullptr, parms ).front();
+}
+
+////////////////////////////////////////
+
 image_buf
 nlm( const image_buf &p,
      int              search,
      int              compare,
      float            searchSigma,
      float            compareSigma,
-     float            centerWeight );
+     float            centerWeight )
+{
+    std::vector<std::vector<plane>> frames( 1 );
+    frames[0].assign( p.begin(), p.end() );
+
+    nlm_params parms{ search,       compare,      searchSigma,
+                      compareSigma, centerWeight, false };
+    std::vector<plane> r = nlm_impl( frames, 0, nullptr, parms );
+
+    image_buf ret = p;
+    for ( size_t c = 0; c < ret.size(); ++c )
+        ret[c] = std::move( r[c] );
+    return ret;
+}
+
+////////////////////////////////////////
+
 image_buf
 nlm( const std::vector<image_buf> &p,
      int                           search,
      int                           compare,
      float                         searchSigma,
      float                         compareSigma,
-     float                         centerWeight );
+     float                         centerWeight )
+{
+    std::vector<std::vector<plane>> frames;
+    for ( auto &f: p )
+        frames.emplace_back( f.begin(), f.end() );
+
+    nlm_params parms{ search,       compare,      searchSigma,
+                      compareSigma, centerWeight, false };
+    size_t             refFrame = p.size() / 2;
+    std::vector<plane> r        = nlm_impl( frames, refFrame, nullptr, parms );
+
+    image_buf ret = p[refFrame];
+    for ( size_t c = 0; c < ret.size(); ++c )
+        ret[c] = std::move( r[c] );
+    return ret;
+}
+
+////////////////////////////////////////
 
-/// use L-1 norm instead of L-2 (faster because we can precompute
-/// areas for differences)
 plane nlm_L1(
     const plane &p,
     int          search,
     int          compare,
     float        searchSigma,
     float        compareSigma,
-    float        centerWeight );
+    float        centerWeight )
+{
+    nlm_params parms{ search,       compare,      searchSigma,
+                      compareSigma, centerWeight, true };
+    return nlm_impl( { { p } }, 0, nullptr, parms ).front();
+}
 
 ////////////////////////////////////////
 
@@ -1251,18 +1942,26 @@ void add_spatial( engine::registry &r )
 {
     using namespace engine;
 
+    // the horizontal passes only read their own line
     r.add(
-        op( "p.erode",
-            base::choose_runtime( apply_erode ),
-            n_scanline_plane_adapter<false, decltype( apply_erode )>(),
+        op( "p.erode_h",
+            base::choose_runtime( apply_erode_h ),
+            n_scanline_plane_adapter<false, decltype( apply_erode_h )>(),
             dispatch_scan_processing,
-            op::n_to_one ) );
+            op::n_to_one,
+            0 ) );
     r.add(
-        op( "p.dilate",
-            base::choose_runtime( apply_dilate ),
-            n_scanline_plane_adapter<false, decltype( apply_dilate )>(),
+        op( "p.dilate_h",
+            base::choose_runtime( apply_dilate_h ),
+            n_scanline_plane_adapter<false, decltype( apply_dilate_h )>(),
             dispatch_scan_processing,
-            op::n_to_one ) );
+            op::n_to_one,
+            0 ) );
+    // the vertical passes work a block of lines at a time
+    r.add( op(
+        "p.erode_v", base::choose_runtime( apply_erode_v ), op::threaded ) );
+    r.add( op(
+        "p.dilate_v", base::choose_runtime( apply_dilate_v ), op::threaded ) );
 
     r.add(
         op( "p.median_3x3",
@@ -85,6 +85,17 @@ plane savitsky_golay_filter( const plane &p, int radius, int order );
 plane savitsky_golay_minimize_error(
     const plane &p, int radius, int max_order );
 
+/// @brief non-local means
+///
+/// Each pixel is replaced by the average of the pixels within the
+/// search radius, weighted by exp( -d / compareSigma^2 ) where d is
+/// the mean squared difference of the patches of the compare radius
+/// around the two. When searchSigma is positive, the weights also
+/// fall off with the distance of the offset. The center pixel is
+/// given centerWeight.
+///
+/// The patch distances are box summed for each search offset, so the
+/// cost does not depend on the compare radius.
 plane nlm(
     const plane &p,
     int          search,
@@ -92,6 +103,7 @@ plane nlm(
     float        searchSigma,
     float        compareSigma,
     float        centerWeight );
+/// as above, with a per-pixel compareSigma
 plane nlm(
     const plane &p,
     int          search,
@@ -99,6 +111,8 @@ plane nlm(
     float        searchSigma,
     const plane &compareSigma,
     float        centerWeight );
+/// a list of frames (of one channel), of which the middle frame is
+/// filtered, searching all of them with weights computed per frame
 plane nlm(
     const std::vector<plane> &p,
     int                       search,
@@ -106,6 +120,8 @@ plane nlm(
     float                     searchSigma,
     float                     compareSigma,
     float                     centerWeight );
+/// the channels of the image share the weights, with the patch
+/// distances summed over the channels
 image_buf
 nlm( const image_buf &p,
      int              search,
@@ -113,6 +129,8 @@ nlm( const image_buf &p,
      float            searchSigma,
      float            compareSigma,
      float            centerWeight );
+/// a list of frames, of which the middle frame is filtered, searching
+/// all of them (the channels sharing the weights)
 image_buf
 nlm( const std::vector<image_buf> &p,
      int                           search,
@@ -121,8 +139,8 @@ nlm( const std::vector<image_buf> &p,
      float                         compareSigma,
      float                         centerWeight );
 
-/// use L-1 norm instead of L-2 (faster because we can precompute
-/// areas for differences)
+/// use L-1 norm instead of L-2, weighting by
+/// exp( -d / compareSigma ) with d the mean absolute difference
 plane nlm_L1(
     const plane &p,
     int          search,
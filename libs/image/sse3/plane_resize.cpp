@@ -0,0 +1,81 @@
+// SPDX-License-Identifier: MIT
+// Copyright contributors to the gecko project.
+
+#include "plane_resize.h"
+
+#ifdef __SSE__
+#    if defined( LINUX ) || defined( __linux__ )
+#        include <x86intrin.h>
+#    else
+#        include <immintrin.h>
+#        include <xmmintrin.h>
+#    endif
+#endif
+
+////////////////////////////////////////
+
+namespace
+{
+inline __m128
+dot4( const float *in, const float *weights, int taps )
+{
+    __m128 acc = _mm_mul_ps( _mm_loadu_ps( in ), _mm_loadu_ps( weights ) );
+    for ( int k = 4; k < taps; k += 4 )
+        acc = _mm_add_ps(
+            acc, _mm_mul_ps( _mm_loadu_ps( in + k ), _mm_loadu_ps( weights + k ) ) );
+    return acc;
+}
+
+} // namespace
+
+////////////////////////////////////////
+
+namespace image
+{
+namespace sse3
+{
+////////////////////////////////////////
+
+void resample_row(
+    float *      out,
+    int          w,
+    const float *in,
+    const int *  first,
+    const float *weights,
+    int          taps )
+{
+    int x = 0;
+    // the tables are padded to a multiple of 4 taps, unless the source
+    // is narrower than that
+    if ( taps % 4 == 0 )
+    {
+        // each output has the products of its taps summed in one
+        // register, then the 4 registers are reduced together
+        for ( ; x + 4 <= w; x += 4 )
+        {
+            const float *wt = weights + x * taps;
+            __m128       a  = dot4( in + first[x], wt, taps );
+            __m128       b  = dot4( in + first[x + 1], wt + taps, taps );
+            __m128       c  = dot4( in + first[x + 2], wt + 2 * taps, taps );
+            __m128       d  = dot4( in + first[x + 3], wt + 3 * taps, taps );
+            _mm_storeu_ps(
+                out + x, _mm_hadd_ps( _mm_hadd_ps( a, b ), _mm_hadd_ps( c, d ) ) );
+        }
+    }
+
+    for ( ; x < w; ++x )
+    {
+        const float *src = in + first[x];
+        const float *wt  = weights + x * taps;
+        float        sum = 0.F;
+        for ( int k = 0; k < taps; ++k )
+            sum += src[k] * wt[k];
+        out[x] = sum;
+    }
+}
+
+////////////////////////////////////////
+
+} // namespace sse3
+
+} // namespace image
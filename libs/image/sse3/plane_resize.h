@@ -0,0 +1,24 @@
+// SPDX-License-Identifier: MIT
+// Copyright contributors to the gecko project.
+
+#pragma once
+
+////////////////////////////////////////
+
+namespace image
+{
+namespace sse3
+{
+/// out[x] is the sum of taps weights (starting at weights + x * taps)
+/// times the source values starting at in + first[x]
+void resample_row(
+    float *      out,
+    int          w,
+    const float *in,
+    const int *  first,
+    const float *weights,
+    int          taps );
+
+} // namespace sse3
+
+} // namespace image
@@ -3,9 +3,13 @@
 
 #include "threading.h"
 
+#include <algorithm>
 #include <atomic>
 #include <base/contract.h>
 #include <base/thread_util.h>
+#include <exception>
+#include <media/io_workers.h>
+#include <memory>
 
 ////////////////////////////////////////
 
@@ -28,11 +32,33 @@ static void initThreading( int count )
     if ( count >= 0 )
         theThreadObj = std::make_shared<image::threading>( count );
     else
-        theThreadObj =
-            std::make_shared<image::threading>( base::thread::core_count() );
+    {
+        // leave the cores the frames are encoded and decoded on to them
+        long io = static_cast<long>( media::io_workers::global()->size() );
+        theThreadObj = std::make_shared<image::threading>(
+            static_cast<int>( std::max( 1L, base::thread::core_count() - io ) ) );
+    }
     std::atexit( shutdownThreading );
 }
 
+/// the rows of a part of the range are stored relative to the start
+/// of the dispatch, packed as [begin, end) into one word so owners
+/// and thieves can both update them with a single compare exchange
+inline uint64_t pack_range( uint32_t b, uint32_t e )
+{
+    return ( static_cast<uint64_t>( b ) << 32 ) | static_cast<uint64_t>( e );
+}
+
+inline uint32_t range_begin( uint64_t r )
+{
+    return static_cast<uint32_t>( r >> 32 );
+}
+
+inline uint32_t range_end( uint64_t r )
+{
+    return static_cast<uint32_t>( r & 0xFFFFFFFF );
+}
+
 } // namespace
 
 ////////////////////////////////////////
@@ -41,21 +67,122 @@ namespace image
 {
 ////////////////////////////////////////
 
-threading::threading( int tCount ) : _avail_workers( nullptr ), _count( tCount )
+struct threading::job
 {
-    size_t n = 0;
-    if ( tCount > 0 )
+    job( const std::function<void( size_t, int, int )> &f,
+         int                                            start,
+         int                                            N,
+         size_t                                         nSlots )
+        : func( f )
+        , offset( start )
+        , slot_count( nSlots )
+        , parts( new std::atomic<uint64_t>[nSlots] )
     {
-        n = static_cast<size_t>( tCount );
-        //std::cout << "Starting " << n << " threads for image processing..." << std::endl;
-        //		std::lock_guard<std::mutex> lk( std::mutex );
-        _threads.resize( n );
-        for ( size_t i = 0; i != n; ++i )
+        // start with the same even split as a static schedule so
+        // rows stay together when nothing needs to be stolen
+        uint32_t n    = static_cast<uint32_t>( N );
+        uint32_t nPer = static_cast<uint32_t>( ( n + nSlots - 1 ) / nSlots );
+        // the smallest chunk to process at once, such that the
+        // shrinking chunks are not all single rows for large ranges
+        min_grain =
+            std::max( uint32_t( 1 ), n / static_cast<uint32_t>( nSlots * 16 ) );
+        for ( size_t i = 0; i != nSlots; ++i )
+        {
+            uint32_t b = std::min( n, static_cast<uint32_t>( i ) * nPer );
+            uint32_t e = std::min( n, b + nPer );
+            parts[i].store( pack_range( b, e ), std::memory_order_relaxed );
+        }
+    }
+
+    /// claims the next chunk of the part for slot i, returning false
+    /// when the part is empty
+    bool claim( size_t i, uint32_t &b, uint32_t &e )
+    {
+        std::atomic<uint64_t> &p   = parts[i];
+        uint64_t               cur = p.load();
+        while ( true )
         {
-            _threads[i].reset( new worker_bee );
-            put_back( _threads[i].get() );
+            uint32_t cb = range_begin( cur );
+            uint32_t ce = range_end( cur );
+            if ( cb >= ce )
+                return false;
+            // take half of what is left, so the rest of the part
+            // is available to thieves as the part runs out
+            uint32_t take = std::max( min_grain, ( ce - cb + 1 ) / 2 );
+            uint32_t ne   = std::min( ce, cb + take );
+            if ( p.compare_exchange_weak( cur, pack_range( ne, ce ) ) )
+            {
+                b = cb;
+                e = ne;
+                return true;
+            }
         }
     }
+
+    /// steals the back half of the largest remaining part of another
+    /// slot, placing it in the part for slot i
+    bool steal( size_t i )
+    {
+        while ( true )
+        {
+            size_t   victim = slot_count;
+            uint64_t vcur   = 0;
+            uint32_t most   = 0;
+            for ( size_t s = 0; s != slot_count; ++s )
+            {
+                if ( s == i )
+                    continue;
+                uint64_t cur = parts[s].load();
+                uint32_t cb  = range_begin( cur );
+                uint32_t ce  = range_end( cur );
+                if ( ce > cb && ( ce - cb ) > most )
+                {
+                    most   = ce - cb;
+                    victim = s;
+                    vcur   = cur;
+                }
+            }
+            if ( victim == slot_count )
+                return false;
+
+            uint32_t cb  = range_begin( vcur );
+            uint32_t ce  = range_end( vcur );
+            uint32_t mid = cb + ( ce - cb ) / 2;
+            if ( parts[victim].compare_exchange_strong(
+                     vcur, pack_range( cb, mid ) ) )
+            {
+                parts[i].store( pack_range( mid, ce ) );
+                return true;
+            }
+        }
+    }
+
+    const std::function<void( size_t, int, int )> &func;
+    int                                             offset;
+    size_t                                          slot_count;
+    uint32_t                                        min_grain = 1;
+    std::unique_ptr<std::atomic<uint64_t>[]>        parts;
+
+    // these are protected by the threading mutex
+    size_t             joined  = 1;
+    size_t             active  = 0;
+    bool               drained = false;
+    std::exception_ptr error;
+
+    std::atomic<bool> failed{ false };
+};
+
+////////////////////////////////////////
+
+threading::threading( int tCount ) : _count( tCount )
+{
+    if ( tCount > 0 )
+    {
+        size_t n = static_cast<size_t>( tCount );
+        _threads.reserve( n );
+        for ( size_t i = 0; i != n; ++i )
+            _threads.emplace_back( &threading::bee, this );
+    }
 }
 
 ////////////////////////////////////////
@@ -70,116 +197,43 @@ void threading::dispatch(
     precondition(
         N > 0, "attempt to dispatch with no items ({0}) to process", N );
 
-    // TODO: do we want to oversubscribe a bit, or only dispatch n-1
-    // threads?  right now, it's simpler to oversubscribe, although we
-    // could adjust count if that turns to be an issue
-
-    //	int nPer = ( N + ( nT - 1 ) ) / nT;
-    int nPer = ( N + _count ) / ( _count + 1 );
-    int curS = start;
-    int endV = start + N;
-
-    worker_bee *workers = nullptr;
-    worker_bee *avail   = nullptr;
-    size_t      curIdx  = 0;
-    while ( curS < endV )
+    if ( _count == 0 || N == 1 )
     {
-        int chunkE = curS + nPer;
-        if ( chunkE > endV )
-        {
-            // if we didn't use all that we stole, put them back
-            // before we do the last chunk we kept to do while we wait
-            // for others
-            if ( avail )
-            {
-                put_back( avail );
-                avail = nullptr;
-            }
-            chunkE = endV;
-            f( curIdx, curS, chunkE );
-            break;
-        }
-
-        if ( !avail )
-            avail = try_steal();
-
-        if ( avail )
-        {
-            worker_bee *b    = avail;
-            worker_bee *next = avail->_next.load( std::memory_order_relaxed );
-            avail            = next;
-            b->_next.store( workers, std::memory_order_relaxed );
-            b->_index = curIdx;
-            b->_start = curS;
-            b->_end   = chunkE;
-            b->_func  = &f;
-            b->_finished.store( false, std::memory_order_relaxed );
-            b->_sema.signal();
-            workers = b;
-        }
-        else
-        {
-            // no threads available currently, run a chunk...
-            f( curIdx, curS, chunkE );
-        }
-        curS = chunkE;
-        ++curIdx;
+        f( 0, start, start + N );
+        return;
     }
 
-    if ( avail )
+    job j( f, start, N, size() );
     {
-        put_back( avail );
-        avail = nullptr;
+        std::lock_guard<std::mutex> lk( _mutex );
+        _jobs.push_back( &j );
     }
+    _work_cond.notify_all();
 
-    // TODO: Add a contribution model where we can process other
-    // people's requests... should be able to make a custom
-    // loop that injects ourself into the pool, but only does
-    // a single sem_timedwait and then returns to check this...
-    while ( workers )
-    {
-        worker_bee *cur  = workers;
-        worker_bee *prev = nullptr;
-        while ( cur )
-        {
-            if ( cur->_finished.load( std::memory_order_relaxed ) )
-            {
-                worker_bee *next = cur->_next.load( std::memory_order_relaxed );
-                cur->_next.store( nullptr, std::memory_order_relaxed );
-                put_back( cur );
-                if ( cur == workers )
-                    workers = next;
-                else if ( prev )
-                    prev->_next.store( next, std::memory_order_relaxed );
-                cur = next;
-            }
-            else
-            {
-                prev = cur;
-                cur  = cur->_next.load( std::memory_order_relaxed );
-            }
-        }
-        // HRM, how do we safely get this out of the list to loop around again?
-        //		if ( workers )
-        //		{
-        //			// things still in flight, donate some work
-        //			worker_bee wb( std::this_thread::get_id() );
-        //			donate( wb );
-        //		}
-    }
+    // the caller is always the first slot, and keeps working (and
+    // stealing) until there is nothing left to claim
+    participate( j, 0 );
+
+    std::unique_lock<std::mutex> lk( _mutex );
+    _jobs.erase( std::find( _jobs.begin(), _jobs.end(), &j ) );
+    while ( j.active > 0 )
+        _done_cond.wait( lk );
+
+    if ( j.error )
+        std::rethrow_exception( j.error );
 }
 
 ////////////////////////////////////////
 
 void threading::shutdown( void )
 {
-    _avail_workers.store( nullptr, std::memory_order_relaxed );
-    for ( auto &t: _threads )
     {
-        t->_shutdown.store( true, std::memory_order_relaxed );
-        t->_sema.signal();
-        t->_thread.join();
+        std::lock_guard<std::mutex> lk( _mutex );
+        _shutdown = true;
     }
+    _work_cond.notify_all();
+    for ( auto &t: _threads )
+        t.join();
     _threads.clear();
 }
 
@@ -201,40 +255,75 @@ void threading::init( int count )
 
 ////////////////////////////////////////
 
-void threading::donate( worker_bee & ) {}
-
-////////////////////////////////////////
-
-threading::worker_bee::worker_bee( void )
-    : _next( nullptr ), _func( nullptr ), _finished( true ), _shutdown( false )
+void threading::bee( void )
 {
-    _thread = std::thread( &threading::worker_bee::run_bee, this );
+    std::unique_lock<std::mutex> lk( _mutex );
+    while ( !_shutdown )
+    {
+        job *j = find_job();
+        if ( !j )
+        {
+            _work_cond.wait( lk );
+            continue;
+        }
+
+        size_t slot = j->joined++;
+        ++( j->active );
+        lk.unlock();
+        participate( *j, slot );
+        lk.lock();
+        if ( --( j->active ) == 0 )
+            _done_cond.notify_all();
+    }
 }
 
 ////////////////////////////////////////
 
-threading::worker_bee::worker_bee( std::thread::id )
-    : _next( nullptr ), _func( nullptr ), _finished( true ), _shutdown( false )
-{}
+threading::job *threading::find_job( void )
+{
+    // prefer the most recent dispatch, which is usually one nested
+    // in an earlier one that is waiting on it
+    for ( auto i = _jobs.rbegin(); i != _jobs.rend(); ++i )
+    {
+        job *j = *i;
+        if ( !j->drained && j->joined < j->slot_count )
+            return j;
+    }
+    return nullptr;
+}
 
 ////////////////////////////////////////
 
-void threading::worker_bee::run_bee( void )
+void threading::participate( job &j, size_t slot )
 {
-    while ( true )
+    uint32_t b, e;
+    while ( !j.failed.load( std::memory_order_relaxed ) )
     {
-        _sema.wait();
-
-        if ( _shutdown.load( std::memory_order_relaxed ) )
-            break;
+        if ( !j.claim( slot, b, e ) )
+        {
+            if ( !j.steal( slot ) )
+                break;
+            continue;
+        }
 
-        if ( _func )
+        try
         {
-            ( *_func )( _index, _start, _end );
-            _func = nullptr;
-            _finished.store( true, std::memory_order_relaxed );
+            j.func(
+                slot,
+                j.offset + static_cast<int>( b ),
+                j.offset + static_cast<int>( e ) );
+        }
+        catch ( ... )
+        {
+            std::lock_guard<std::mutex> lk( _mutex );
+            if ( !j.error )
+                j.error = std::current_exception();
+            j.failed.store( true );
         }
     }
+
+    std::lock_guard<std::mutex> lk( _mutex );
+    j.drained = true;
 }
 
 ////////////////////////////////////////
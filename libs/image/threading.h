@@ -3,18 +3,14 @@
 
 #pragma once
 
-#include <base/semaphore.h>
-#include <deque>
-#include <functional>
-#include <vector>
-//#include <base/lock_free_list.h>
 #include "image.h"
 #include "plane.h"
 
-#include <atomic>
 #include <condition_variable>
+#include <functional>
 #include <mutex>
 #include <thread>
+#include <vector>
 
 ////////////////////////////////////////
 
@@ -31,6 +27,14 @@ namespace image
 /// The number of threads created is driven off the global number
 /// returned by core_count in base/thread_util.h
 ///
+/// Each dispatch starts with the range split evenly across the
+/// threads, but a thread which finishes its part steals half of the
+/// largest part remaining, and parts are processed in shrinking
+/// chunks so there is always something left to steal. The thread
+/// calling dispatch works on the range as well, and a dispatch from
+/// within a dispatched function is safe: it is run by the calling
+/// thread and whichever threads are idle.
+///
 class threading
 {
 public:
@@ -44,6 +48,14 @@ public:
 
     /// calls function f on the range split by the number of threads
     /// live, and does not return until they have all finished.
+    ///
+    /// The first argument to f is the index of the thread working on
+    /// the range in this dispatch, which is less than size(). The
+    /// same index may be passed to several calls (with different
+    /// ranges), but those calls are never concurrent, so per-index
+    /// results should be accumulated, not assigned. If f throws,
+    /// the remaining work is abandoned and the first exception is
+    /// rethrown to the caller.
     void dispatch(
         const std::function<void( size_t, int, int )> &f, int start, int N );
 
@@ -56,86 +68,25 @@ public:
     /// Shutdown the threads
     void shutdown( void );
 
-    /// Get the singleton threading object
+    /// Get the singleton threading object, which (unless given a
+    /// count) uses the cores not in the media::io_workers budget
     static threading &get( int count = -1 );
     static void       init( int count = -1 );
 
 private:
-    void bee( size_t i );
-
-    struct worker_bee
-    {
-        worker_bee( void );
-        worker_bee( std::thread::id selfthread );
-
-        std::atomic<worker_bee *> _next;
-
-        size_t                                         _index = 0;
-        int                                            _start = 0;
-        int                                            _end   = 0;
-        const std::function<void( size_t, int, int )> *_func  = nullptr;
-        std::atomic<bool>                              _finished;
-
-        std::thread       _thread;
-        base::semaphore   _sema;
-        std::atomic<bool> _shutdown;
-
-    private:
-        void run_bee( void );
-    };
-
-    inline worker_bee *try_steal( void )
-    {
-        worker_bee *cur = _avail_workers.load( std::memory_order_relaxed );
-        worker_bee *ret = nullptr;
-        while ( cur )
-        {
-            ret = cur;
-            // this avoids the ABA problem since we're always taking
-            // the whole list and assigning in nullptr, so there's no
-            // real 'B' to even start to have an ABA issue - if
-            // someone puts the same 'A' back on the list, that's
-            // fine, we're happy to use it since we're not deleting
-            // these or anything...
-            if ( _avail_workers.compare_exchange_weak(
-                     cur,
-                     nullptr,
-                     std::memory_order_release,
-                     std::memory_order_acquire ) )
-                break;
-        }
-        return ret;
-    }
-
-    inline void put_back( worker_bee *wb )
-    {
-        worker_bee *endcur = wb;
-        while ( endcur->_next.load( std::memory_order_relaxed ) )
-            endcur = endcur->_next.load( std::memory_order_relaxed );
-
-        worker_bee *curhead = _avail_workers.load( std::memory_order_relaxed );
-        while ( true )
-        {
-            endcur->_next = curhead;
-            if ( _avail_workers.compare_exchange_weak(
-                     curhead,
-                     wb,
-                     std::memory_order_release,
-                     std::memory_order_acquire ) )
-                break;
-        }
-    }
-
-    void donate( worker_bee &wb );
-
-    // we don't care so much about the ABA problem since we aren't
-    // deleting the items... and we want to checkout all the threads
-    // at once if we can so we are always assigning in a nullptr and
-    // taking or returning a chunk of a list
-    std::atomic<worker_bee *> _avail_workers;
-    //base::lock_free_list<worker_bee> _avail_workers;
-    std::vector<std::unique_ptr<worker_bee>> _threads;
-    int                                      _count = 0;
+    struct job;
+
+    void bee( void );
+    job *find_job( void );
+    void participate( job &j, size_t slot );
+
+    std::mutex               _mutex;
+    std::condition_variable  _work_cond;
+    std::condition_variable  _done_cond;
+    std::vector<job *>       _jobs;
+    std::vector<std::thread> _threads;
+    bool                     _shutdown = false;
+    int                      _count    = 0;
 };
 
 } // namespace image
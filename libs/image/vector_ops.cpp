@@ -255,8 +255,8 @@ static void colorize_thread_abs(
         }
     }
 
-    mags[tIdx]    = maxFlowMag;
-    avemags[tIdx] = maxFlowAve;
+    mags[tIdx] = std::max( mags[tIdx], maxFlowMag );
+    avemags[tIdx] += maxFlowAve;
 }
 
 static void colorize_thread_rel(
@@ -296,8 +296,8 @@ static void colorize_thread_rel(
         }
     }
 
-    mags[tIdx]    = maxFlowMag;
-    avemags[tIdx] = maxFlowAve;
+    mags[tIdx] = std::max( mags[tIdx], maxFlowMag );
+    avemags[tIdx] += maxFlowAve;
 }
 
 static image_buf colorize_vector( const vector_field &v, float scale )
@@ -416,9 +416,9 @@ static void colorize_thread_rel_alpha(
         }
     }
 
-    mags[tIdx]    = maxFlowMag;
-    avemags[tIdx] = maxFlowAve;
-    avesums[tIdx] = maxFlowAveSum;
+    mags[tIdx] = std::max( mags[tIdx], maxFlowMag );
+    avemags[tIdx] += maxFlowAve;
+    avesums[tIdx] += maxFlowAveSum;
 }
 
 static image_buf
@@ -0,0 +1,271 @@
+// SPDX-License-Identifier: MIT
+// Copyright contributors to the gecko project.
+
+#include "async_video_track.h"
+
+#include <base/contract.h>
+
+////////////////////////////////////////
+
+namespace media
+{
+////////////////////////////////////////
+
+async_video_track::async_video_track(
+    std::shared_ptr<video_track> t,
+    size_t                       lookahead,
+    size_t                       writeBehind,
+    size_t                       threads,
+    decode_func                  decode )
+    : video_track(
+          t ? t->name() : std::string(),
+          t ? t->view() : std::string(),
+          t ? t->begin() : 0,
+          t ? t->end() : 0,
+          t ? t->rate() : sample_rate(),
+          t ? t->desc() : track_description( TRACK_VIDEO ) )
+    , _track( std::move( t ) )
+    , _lookahead( lookahead )
+    , _write_depth( writeBehind )
+    , _decode( std::move( decode ) )
+    , _readers( lookahead > 0 ? std::max( threads, size_t( 1 ) ) : 0 )
+{
+    precondition( _track, "async track requires a track to wrap" );
+}
+
+////////////////////////////////////////
+
+async_video_track::~async_video_track( void )
+{
+    {
+        std::lock_guard<std::mutex> lk( _write_mutex );
+        _done = true;
+        _write_ready.notify_all();
+    }
+    // the writer finishes the queue before exiting, errors are only
+    // reported through flush
+    if ( _writer.joinable() )
+        _writer.join();
+}
+
+////////////////////////////////////////
+
+void async_video_track::flush( void )
+{
+    std::unique_lock<std::mutex> lk( _write_mutex );
+    _write_space.wait( lk, [this]() { return _writes.empty(); } );
+    check_error();
+}
+
+////////////////////////////////////////
+
+frame *async_video_track::doRead( int64_t f )
+{
+    std::future<std::unique_ptr<frame>> pending;
+    {
+        std::lock_guard<std::mutex> lk( _read_mutex );
+        auto                        i = _reads.find( f );
+        if ( i != _reads.end() )
+        {
+            pending = std::move( i->second );
+            _reads.erase( i );
+        }
+    }
+
+    // a frame not read ahead is read here (waiting for any reads
+    // ahead in the wrapped track) before queueing the next ones
+    std::unique_ptr<frame> ret;
+    if ( pending.valid() )
+    {
+        queue_reads( f );
+        ret = pending.get();
+    }
+    else
+    {
+        ret.reset( read_track( f ) );
+        queue_reads( f );
+    }
+
+    if ( !rate().valid() )
+    {
+        std::lock_guard<std::mutex> lk( _track_mutex );
+        if ( _track->rate().valid() )
+            update_rate( _track->rate() );
+    }
+    return ret.release();
+}
+
+////////////////////////////////////////
+
+void async_video_track::doWrite(
+    int64_t f, const frame &frm, base::allocator &a )
+{
+    flush();
+    std::lock_guard<std::mutex> lk( _track_mutex );
+    write_to( *_track, f, frm, a );
+}
+
+////////////////////////////////////////
+
+void async_video_track::doStore(
+    int64_t f, const std::shared_ptr<frame> &frm, base::allocator &a )
+{
+    queue_write( { f, frm, &a, nullptr } );
+}
+
+////////////////////////////////////////
+
+void async_video_track::store_stream(
+    int64_t                                 f,
+    std::shared_ptr<frame>                  layout,
+    base::allocator &                       a,
+    std::function<void( frame_stream & )> provide )
+{
+    precondition( layout && provide, "stream needs a layout and bands" );
+    queue_write( { f, std::move( layout ), &a, std::move( provide ) } );
+}
+
+////////////////////////////////////////
+
+std::unique_ptr<frame_stream> async_video_track::doStartFrame(
+    int64_t f, const frame &layout, base::allocator &a )
+{
+    // the bands are written as they are provided, after the frames
+    // stored before
+    flush();
+    std::lock_guard<std::mutex> lk( _track_mutex );
+    return _track->start_frame( f, layout, a );
+}
+
+////////////////////////////////////////
+
+frame *async_video_track::read_track( int64_t f )
+{
+    std::lock_guard<std::mutex> lk( _track_mutex );
+    return read_from( *_track, f );
+}
+
+////////////////////////////////////////
+
+void async_video_track::write_track( const pending_write &w )
+{
+    std::lock_guard<std::mutex> lk( _track_mutex );
+    if ( !w.provide )
+    {
+        write_to( *_track, w.offset, *w.image, *w.alloc );
+        return;
+    }
+
+    auto out = _track->start_frame( w.offset, *w.image, *w.alloc );
+    w.provide( *out );
+    out->finish();
+}
+
+////////////////////////////////////////
+
+void async_video_track::queue_write( pending_write &&w )
+{
+    if ( _write_depth == 0 )
+    {
+        write_track( w );
+        return;
+    }
+
+    std::unique_lock<std::mutex> lk( _write_mutex );
+    _write_space.wait( lk, [this]() {
+        return _writes.size() < _write_depth || _write_error;
+    } );
+    check_error();
+
+    _writes.push_back( std::move( w ) );
+    if ( !_writer.joinable() )
+        _writer = std::thread( [this]() { write_loop(); } );
+    _write_ready.notify_one();
+}
+
+////////////////////////////////////////
+
+void async_video_track::queue_reads( int64_t f )
+{
+    if ( _lookahead == 0 )
+        return;
+
+    int64_t last = std::min( end(), f + static_cast<int64_t>( _lookahead ) );
+
+    std::lock_guard<std::mutex> lk( _read_mutex );
+    // reads outside the lookahead are no longer wanted (the caller
+    // went somewhere else), any in flight just finish unclaimed
+    for ( auto i = _reads.begin(); i != _reads.end(); )
+    {
+        if ( i->first <= f || i->first > last )
+            i = _reads.erase( i );
+        else
+            ++i;
+    }
+
+    for ( int64_t n = std::max( f + 1, begin() ); n <= last; ++n )
+    {
+        if ( _reads.find( n ) != _reads.end() )
+            continue;
+
+        // the pool is destroyed first, so the tasks can use this
+        typedef std::packaged_task<std::unique_ptr<frame>()> read_task;
+        auto task = std::make_shared<read_task>( [this, n]() {
+            std::unique_ptr<frame> frm( read_track( n ) );
+            // outside the track lock, so frames decode in parallel
+            if ( frm && _decode )
+                _decode( *frm );
+            return frm;
+        } );
+        _reads[n] = task->get_future();
+        _readers.queue( [task]() { ( *task )(); } );
+    }
+}
+
+////////////////////////////////////////
+
+void async_video_track::write_loop( void )
+{
+    std::unique_lock<std::mutex> lk( _write_mutex );
+    while ( true )
+    {
+        _write_ready.wait( lk, [this]() { return _done || !_writes.empty(); } );
+        if ( _writes.empty() )
+            return;
+
+        // leave the frame on the queue while it is written so flush
+        // waits for it
+        pending_write &w = _writes.front();
+        lk.unlock();
+        try
+        {
+            write_track( w );
+        }
+        catch ( ... )
+        {
+            lk.lock();
+            if ( !_write_error )
+                _write_error = std::current_exception();
+            lk.unlock();
+        }
+        lk.lock();
+        _writes.pop_front();
+        _write_space.notify_all();
+    }
+}
+
+////////////////////////////////////////
+
+void async_video_track::check_error( void )
+{
+    if ( _write_error )
+    {
+        std::exception_ptr e = _write_error;
+        _write_error         = nullptr;
+        std::rethrow_exception( e );
+    }
+}
+
+////////////////////////////////////////
+
+} // namespace media
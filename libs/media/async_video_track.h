@@ -0,0 +1,126 @@
+// SPDX-License-Identifier: MIT
+// Copyright contributors to the gecko project.
+
+#pragma once
+
+#include "video_track.h"
+
+#include <base/thread_pool.h>
+#include <condition_variable>
+#include <deque>
+#include <exception>
+#include <functional>
+#include <future>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <thread>
+
+////////////////////////////////////////
+
+namespace media
+{
+///
+/// @brief Class async_video_track wraps a video track to read ahead of
+/// and write behind the caller.
+///
+/// Each read queues the frames following it, up to the lookahead,
+/// to be read in the background, so the next read is (hopefully)
+/// already done. Reading a frame usually only parses its header, so
+/// the decode function given is also run on the frame in the
+/// background, to decode the pixels the caller is going to extract
+/// (@sa image::decode_planes). Stored (or streamed) frames are put on
+/// a queue written in order by a background thread, so encoding
+/// overlaps the compute of the next frame. Once the queue holds the
+/// write-behind depth of frames, store blocks until one has been
+/// written.
+///
+/// The wrapped track is only used by one thread at a time, the
+/// decode functions are run in parallel (with more than one thread).
+///
+/// Errors writing a frame are thrown from a later store or flush.
+///
+class async_video_track final : public video_track
+{
+public:
+    /// run on each frame read ahead, on the reading thread
+    using decode_func = std::function<void( frame & )>;
+
+    /// a lookahead or write behind depth of 0 disables that side, and
+    /// threads is the number of frames decoded at once
+    async_video_track(
+        std::shared_ptr<video_track> t,
+        size_t                       lookahead,
+        size_t                       writeBehind,
+        size_t                       threads = 1,
+        decode_func                  decode  = decode_func() );
+    ~async_video_track( void ) override;
+
+    inline const std::shared_ptr<video_track> &wrapped( void ) const
+    {
+        return _track;
+    }
+
+    /// queues frame f to be streamed to the wrapped track by the
+    /// writer thread, in order with the stored frames: the stream is
+    /// started with the layout, then given to provide to write the
+    /// bands to. Blocks while the write behind queue is full, as
+    /// store does.
+    void store_stream(
+        int64_t                                 f,
+        std::shared_ptr<frame>                  layout,
+        base::allocator &                       a,
+        std::function<void( frame_stream & )> provide );
+
+    /// waits for all the stored frames to be written, throwing the
+    /// first error encountered writing them
+    void flush( void );
+
+protected:
+    frame *doRead( int64_t f ) override;
+    void   doWrite( int64_t f, const frame &frm, base::allocator &a ) override;
+    void   doStore(
+        int64_t f, const std::shared_ptr<frame> &frm, base::allocator &a ) override;
+    std::unique_ptr<frame_stream>
+    doStartFrame( int64_t f, const frame &layout, base::allocator &a ) override;
+
+private:
+    struct pending_write
+    {
+        int64_t                                offset;
+        std::shared_ptr<frame>                 image;
+        base::allocator *                      alloc;
+        std::function<void( frame_stream & )> provide;
+    };
+
+    frame *read_track( int64_t f );
+    void   write_track( const pending_write &w );
+    void   queue_write( pending_write &&w );
+    void   queue_reads( int64_t f );
+    void write_loop( void );
+    void check_error( void );
+
+    std::shared_ptr<video_track> _track;
+    size_t                       _lookahead;
+    size_t                       _write_depth;
+    decode_func                  _decode;
+
+    // held for every call into the wrapped track
+    std::mutex _track_mutex;
+
+    std::mutex                                            _read_mutex;
+    std::map<int64_t, std::future<std::unique_ptr<frame>>> _reads;
+
+    std::mutex                _write_mutex;
+    std::condition_variable   _write_ready;
+    std::condition_variable   _write_space;
+    std::deque<pending_write> _writes;
+    std::exception_ptr        _write_error;
+    bool                      _done = false;
+    std::thread               _writer;
+
+    // last so the decodes in flight finish before anything else goes
+    base::thread_pool _readers;
+};
+
+} // namespace media
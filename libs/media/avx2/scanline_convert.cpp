@@ -0,0 +1,336 @@
+// SPDX-License-Identifier: MIT
+// Copyright contributors to the gecko project.
+
+#include "scanline_convert.h"
+
+#include <algorithm>
+#include <base/endian.h>
+#include <base/half.h>
+#include <cstring>
+
+#ifdef __AVX2__
+#    if defined( LINUX ) || defined( __linux__ )
+#        include <x86intrin.h>
+#    else
+#        include <immintrin.h>
+#    endif
+#endif
+
+////////////////////////////////////////
+
+namespace media
+{
+namespace avx2
+{
+namespace
+{
+#ifdef __AVX2__
+inline __m128i swap16( __m128i v )
+{
+    return _mm_shuffle_epi8(
+        v, _mm_set_epi8( 14, 15, 12, 13, 10, 11, 8, 9, 6, 7, 4, 5, 2, 3, 0, 1 ) );
+}
+
+inline __m256i swap32( __m256i v )
+{
+    return _mm256_shuffle_epi8(
+        v,
+        _mm256_set_epi8(
+            12, 13, 14, 15, 8, 9, 10, 11, 4, 5, 6, 7, 0, 1, 2, 3,
+            12, 13, 14, 15, 8, 9, 10, 11, 4, 5, 6, 7, 0, 1, 2, 3 ) );
+}
+
+/// exact half to float: the exponent and mantissa are shifted into
+/// place and rescaled by 2^112, which also handles denormals, then
+/// infinity / nan get the full exponent
+inline __m256 half_to_float( __m128i h )
+{
+    __m256i v    = _mm256_cvtepu16_epi32( h );
+    __m256i sign = _mm256_slli_epi32(
+        _mm256_and_si256( v, _mm256_set1_epi32( 0x8000 ) ), 16 );
+    __m256i em = _mm256_and_si256( v, _mm256_set1_epi32( 0x7fff ) );
+    __m256  f  = _mm256_mul_ps(
+        _mm256_castsi256_ps( _mm256_slli_epi32( em, 13 ) ),
+        _mm256_castsi256_ps( _mm256_set1_epi32( 0x77800000 ) ) );
+    __m256i infnan = _mm256_and_si256(
+        _mm256_cmpgt_epi32( em, _mm256_set1_epi32( 0x7bff ) ),
+        _mm256_set1_epi32( 0x7f800000 ) );
+    return _mm256_castsi256_ps( _mm256_or_si256(
+        _mm256_or_si256( _mm256_castps_si256( f ), infnan ), sign ) );
+}
+
+/// float to half, rounding to nearest even, with overflow going to
+/// infinity and nan staying a (quiet) nan
+inline __m128i float_to_half( __m256 f )
+{
+    __m256i u    = _mm256_castps_si256( f );
+    __m256i sign = _mm256_and_si256( u, _mm256_set1_epi32( INT32_MIN ) );
+    u            = _mm256_xor_si256( u, sign );
+
+    // overflow / infinity / nan
+    __m256i isbig = _mm256_cmpgt_epi32( u, _mm256_set1_epi32( 0x477fffff ) );
+    __m256i big   = _mm256_blendv_epi8(
+        _mm256_set1_epi32( 0x7c00 ),
+        _mm256_set1_epi32( 0x7e00 ),
+        _mm256_cmpgt_epi32( u, _mm256_set1_epi32( 0x7f800000 ) ) );
+
+    // denormals (and zero) by letting the float add do the rounding
+    __m256i isden = _mm256_cmpgt_epi32( _mm256_set1_epi32( 0x38800000 ), u );
+    __m256i magic = _mm256_set1_epi32( 0x3f000000 );
+    __m256i den   = _mm256_sub_epi32(
+        _mm256_castps_si256( _mm256_add_ps(
+            _mm256_castsi256_ps( u ), _mm256_castsi256_ps( magic ) ) ),
+        magic );
+
+    // normals, rebias the exponent and round the mantissa
+    __m256i odd = _mm256_and_si256(
+        _mm256_srli_epi32( u, 13 ), _mm256_set1_epi32( 1 ) );
+    __m256i nrm = _mm256_add_epi32(
+        u, _mm256_set1_epi32( static_cast<int>( 0xc8000fffU ) ) );
+    nrm = _mm256_srli_epi32( _mm256_add_epi32( nrm, odd ), 13 );
+
+    __m256i r = _mm256_blendv_epi8( nrm, den, isden );
+    r         = _mm256_blendv_epi8( r, big, isbig );
+    r         = _mm256_or_si256( r, _mm256_srli_epi32( sign, 16 ) );
+    return _mm_packus_epi32(
+        _mm256_castsi256_si128( r ), _mm256_extracti128_si256( r, 1 ) );
+}
+
+/// clamps round( v * scale ) to [0, scale], as 16 bit values
+inline __m128i float_to_unorm( __m256 v, float scale )
+{
+    __m256 s = _mm256_set1_ps( scale );
+    __m256 t = _mm256_add_ps( _mm256_mul_ps( v, s ), _mm256_set1_ps( 0.5F ) );
+    t        = _mm256_max_ps( _mm256_min_ps( t, s ), _mm256_setzero_ps() );
+    __m256i i = _mm256_cvttps_epi32( t );
+    return _mm_packus_epi32(
+        _mm256_castsi256_si128( i ), _mm256_extracti128_si256( i, 1 ) );
+}
+
+inline __m128i load8x16( const uint16_t *in )
+{
+    return _mm_loadu_si128( reinterpret_cast<const __m128i *>( in ) );
+}
+
+inline void store8x16( uint16_t *out, __m128i v )
+{
+    _mm_storeu_si128( reinterpret_cast<__m128i *>( out ), v );
+}
+#endif
+
+inline float half_bits_to_float( uint16_t h )
+{
+    return float( base::half( base::half::binary, h ) );
+}
+
+inline uint16_t float_to_half_bits( float v )
+{
+    return base::half_cast<base::half, std::round_to_nearest>( v ).bits();
+}
+
+inline uint16_t to_unorm16( float v )
+{
+    return static_cast<uint16_t>(
+        std::max( 0.F, std::min( 65535.F, v * 65535.0F + 0.5F ) ) );
+}
+
+} // namespace
+
+////////////////////////////////////////
+
+void get_u8( float *out, const uint8_t *in, int64_t n )
+{
+    int64_t x = 0;
+#ifdef __AVX2__
+    __m256 s = _mm256_set1_ps( 255.F );
+    for ( ; x + 8 <= n; x += 8 )
+    {
+        __m128i v = _mm_loadl_epi64( reinterpret_cast<const __m128i *>( in + x ) );
+        _mm256_storeu_ps(
+            out + x,
+            _mm256_div_ps( _mm256_cvtepi32_ps( _mm256_cvtepu8_epi32( v ) ), s ) );
+    }
+#endif
+    for ( ; x < n; ++x )
+        out[x] = static_cast<float>( in[x] ) / 255.0F;
+}
+
+////////////////////////////////////////
+
+void get_u16( float *out, const uint16_t *in, int64_t n )
+{
+    int64_t x = 0;
+#ifdef __AVX2__
+    __m256 s = _mm256_set1_ps( 65535.F );
+    for ( ; x + 8 <= n; x += 8 )
+    {
+        __m256i v = _mm256_cvtepu16_epi32( load8x16( in + x ) );
+        _mm256_storeu_ps( out + x, _mm256_div_ps( _mm256_cvtepi32_ps( v ), s ) );
+    }
+#endif
+    for ( ; x < n; ++x )
+        out[x] = static_cast<float>( in[x] ) / 65535.0F;
+}
+
+////////////////////////////////////////
+
+void get_u16_swap( float *out, const uint16_t *in, int64_t n )
+{
+    int64_t x = 0;
+#ifdef __AVX2__
+    __m256 s = _mm256_set1_ps( 65535.F );
+    for ( ; x + 8 <= n; x += 8 )
+    {
+        __m256i v = _mm256_cvtepu16_epi32( swap16( load8x16( in + x ) ) );
+        _mm256_storeu_ps( out + x, _mm256_div_ps( _mm256_cvtepi32_ps( v ), s ) );
+    }
+#endif
+    for ( ; x < n; ++x )
+        out[x] = static_cast<float>( bswap_16( in[x] ) ) / 65535.0F;
+}
+
+////////////////////////////////////////
+
+void get_f16( float *out, const uint16_t *in, int64_t n )
+{
+    int64_t x = 0;
+#ifdef __AVX2__
+    for ( ; x + 8 <= n; x += 8 )
+        _mm256_storeu_ps( out + x, half_to_float( load8x16( in + x ) ) );
+#endif
+    for ( ; x < n; ++x )
+        out[x] = half_bits_to_float( in[x] );
+}
+
+////////////////////////////////////////
+
+void get_f16_swap( float *out, const uint16_t *in, int64_t n )
+{
+    int64_t x = 0;
+#ifdef __AVX2__
+    for ( ; x + 8 <= n; x += 8 )
+        _mm256_storeu_ps( out + x, half_to_float( swap16( load8x16( in + x ) ) ) );
+#endif
+    for ( ; x < n; ++x )
+        out[x] = half_bits_to_float( bswap_16( in[x] ) );
+}
+
+////////////////////////////////////////
+
+void get_f32_swap( float *out, const uint32_t *in, int64_t n )
+{
+    int64_t x = 0;
+#ifdef __AVX2__
+    for ( ; x + 8 <= n; x += 8 )
+    {
+        __m256i v =
+            _mm256_loadu_si256( reinterpret_cast<const __m256i *>( in + x ) );
+        _mm256_storeu_si256(
+            reinterpret_cast<__m256i *>( out + x ), swap32( v ) );
+    }
+#endif
+    for ( ; x < n; ++x )
+    {
+        uint32_t v = bswap_32( in[x] );
+        memcpy( out + x, &v, sizeof( float ) );
+    }
+}
+
+////////////////////////////////////////
+
+void set_u8( uint8_t *out, const float *in, int64_t n )
+{
+    int64_t x = 0;
+#ifdef __AVX2__
+    for ( ; x + 8 <= n; x += 8 )
+    {
+        __m128i v = float_to_unorm( _mm256_loadu_ps( in + x ), 255.F );
+        _mm_storel_epi64(
+            reinterpret_cast<__m128i *>( out + x ), _mm_packus_epi16( v, v ) );
+    }
+#endif
+    for ( ; x < n; ++x )
+        out[x] = static_cast<uint8_t>(
+            std::max( 0.F, std::min( 255.F, in[x] * 255.0F + 0.5F ) ) );
+}
+
+////////////////////////////////////////
+
+void set_u16( uint16_t *out, const float *in, int64_t n )
+{
+    int64_t x = 0;
+#ifdef __AVX2__
+    for ( ; x + 8 <= n; x += 8 )
+        store8x16( out + x, float_to_unorm( _mm256_loadu_ps( in + x ), 65535.F ) );
+#endif
+    for ( ; x < n; ++x )
+        out[x] = to_unorm16( in[x] );
+}
+
+////////////////////////////////////////
+
+void set_u16_swap( uint16_t *out, const float *in, int64_t n )
+{
+    int64_t x = 0;
+#ifdef __AVX2__
+    for ( ; x + 8 <= n; x += 8 )
+        store8x16(
+            out + x,
+            swap16( float_to_unorm( _mm256_loadu_ps( in + x ), 65535.F ) ) );
+#endif
+    for ( ; x < n; ++x )
+        out[x] = bswap_16( to_unorm16( in[x] ) );
+}
+
+////////////////////////////////////////
+
+void set_f16( uint16_t *out, const float *in, int64_t n )
+{
+    int64_t x = 0;
+#ifdef __AVX2__
+    for ( ; x + 8 <= n; x += 8 )
+        store8x16( out + x, float_to_half( _mm256_loadu_ps( in + x ) ) );
+#endif
+    for ( ; x < n; ++x )
+        out[x] = float_to_half_bits( in[x] );
+}
+
+////////////////////////////////////////
+
+void set_f16_swap( uint16_t *out, const float *in, int64_t n )
+{
+    int64_t x = 0;
+#ifdef __AVX2__
+    for ( ; x + 8 <= n; x += 8 )
+        store8x16( out + x, swap16( float_to_half( _mm256_loadu_ps( in + x ) ) ) );
+#endif
+    for ( ; x < n; ++x )
+        out[x] = bswap_16( float_to_half_bits( in[x] ) );
+}
+
+////////////////////////////////////////
+
+void set_f32_swap( uint32_t *out, const float *in, int64_t n )
+{
+    int64_t x = 0;
+#ifdef __AVX2__
+    for ( ; x + 8 <= n; x += 8 )
+    {
+        __m256i v =
+            _mm256_loadu_si256( reinterpret_cast<const __m256i *>( in + x ) );
+        _mm256_storeu_si256(
+            reinterpret_cast<__m256i *>( out + x ), swap32( v ) );
+    }
+#endif
+    for ( ; x < n; ++x )
+    {
+        uint32_t v;
+        memcpy( &v, in + x, sizeof( float ) );
+        out[x] = bswap_32( v );
+    }
+}
+
+////////////////////////////////////////
+
+} // namespace avx2
+} // namespace media
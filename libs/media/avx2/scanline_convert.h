@@ -0,0 +1,34 @@
+// SPDX-License-Identifier: MIT
+// Copyright contributors to the gecko project.
+
+#pragma once
+
+#include <cstdint>
+
+////////////////////////////////////////
+
+namespace media
+{
+namespace avx2
+{
+/// @defgroup conversion of contiguous runs of pixels to / from float,
+/// the _swap variants for the opposite of native endianness
+/// @{
+void get_u8( float *out, const uint8_t *in, int64_t n );
+void get_u16( float *out, const uint16_t *in, int64_t n );
+void get_u16_swap( float *out, const uint16_t *in, int64_t n );
+void get_f16( float *out, const uint16_t *in, int64_t n );
+void get_f16_swap( float *out, const uint16_t *in, int64_t n );
+void get_f32_swap( float *out, const uint32_t *in, int64_t n );
+
+void set_u8( uint8_t *out, const float *in, int64_t n );
+void set_u16( uint16_t *out, const float *in, int64_t n );
+void set_u16_swap( uint16_t *out, const float *in, int64_t n );
+void set_f16( uint16_t *out, const float *in, int64_t n );
+void set_f16_swap( uint16_t *out, const float *in, int64_t n );
+void set_f32_swap( uint32_t *out, const float *in, int64_t n );
+/// @}
+
+} // namespace avx2
+
+} // namespace media
@@ -0,0 +1,36 @@
+// SPDX-License-Identifier: MIT
+// Copyright contributors to the gecko project.
+
+#pragma once
+
+// only to be included (after the OpenEXR headers) when HAVE_OPENEXR
+#include <ImfCompression.h>
+
+namespace media
+{
+////////////////////////////////////////
+
+/// number of scanlines OpenEXR compresses together in a chunk
+inline int lines_per_chunk( OPENEXR_IMF_NAMESPACE::Compression c )
+{
+    namespace EXR = OPENEXR_IMF_NAMESPACE;
+    switch ( c )
+    {
+        case EXR::NO_COMPRESSION:
+        case EXR::RLE_COMPRESSION:
+        case EXR::ZIPS_COMPRESSION: return 1;
+        case EXR::ZIP_COMPRESSION:
+        case EXR::PXR24_COMPRESSION: return 16;
+        case EXR::PIZ_COMPRESSION:
+        case EXR::B44_COMPRESSION:
+        case EXR::B44A_COMPRESSION:
+        case EXR::DWAA_COMPRESSION: return 32;
+        case EXR::DWAB_COMPRESSION: return 256;
+        default: break;
+    }
+    return 1;
+}
+
+////////////////////////////////////////
+
+} // namespace media
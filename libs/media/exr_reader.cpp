@@ -5,6 +5,7 @@
 
 #if defined( HAVE_OPENEXR )
 #    include "data.h"
+#    include "exr_threading.h"
 #    include "file_per_sample_reader.h"
 #    include "file_sequence.h"
 #    include "image.h"
@@ -14,7 +15,6 @@
 #    include <base/env.h>
 #    include <base/file_system.h>
 #    include <base/string_util.h>
-#    include <base/thread_util.h>
 #    include <color/standards.h>
 #    include <thread>
 
@@ -67,7 +67,10 @@
 #    include <ImfVersion.h>
 #    pragma GCC diagnostic pop
 
+#    include "exr_compression.h"
+
 #    include <algorithm>
+#    include <cstring>
 #    include <iostream>
 #endif
 
@@ -503,6 +506,58 @@ static void fill_metadata( M &md, color::state &cs, const EXR::Header &header )
 
 ////////////////////////////////////////
 
+/// sets the pixels of the buffer in the span [x1, x2] of line y to 0
+inline void zero_span( image_buffer &buf, int64_t y, int64_t x1, int64_t x2 )
+{
+    if ( x2 < x1 )
+        return;
+
+    int64_t xs   = buf.xstride_bytes();
+    int64_t bpp  = ( buf.bits() + 7 ) / 8;
+    char *  line = static_cast<char *>( buf.data() ) +
+                  ( y - buf.y1() ) * buf.ystride_bytes() + ( x1 - buf.x1() ) * xs;
+    if ( xs == bpp )
+    {
+        memset( line, 0, static_cast<size_t>( ( x2 - x1 + 1 ) * bpp ) );
+        return;
+    }
+    for ( int64_t x = x1; x <= x2; ++x, line += xs )
+        memset( line, 0, static_cast<size_t>( bpp ) );
+}
+
+/// copies [x1, x2] x [y1, y2] from a packed scratch area starting
+/// at (sx, sy) into the buffer
+inline void copy_region(
+    image_buffer &buf,
+    const char *  src,
+    int64_t       sx,
+    int64_t       sy,
+    int64_t       srcStride,
+    int64_t       bpp,
+    int64_t       x1,
+    int64_t       x2,
+    int64_t       y1,
+    int64_t       y2 )
+{
+    int64_t xs = buf.xstride_bytes();
+    for ( int64_t y = y1; y <= y2; ++y )
+    {
+        const char *s = src + ( y - sy ) * srcStride + ( x1 - sx ) * bpp;
+        char *      d = static_cast<char *>( buf.data() ) +
+                   ( y - buf.y1() ) * buf.ystride_bytes() +
+                   ( x1 - buf.x1() ) * xs;
+        if ( xs == bpp )
+        {
+            memcpy( d, s, static_cast<size_t>( ( x2 - x1 + 1 ) * bpp ) );
+            continue;
+        }
+        for ( int64_t x = x1; x <= x2; ++x, s += bpp, d += xs )
+            memcpy( d, s, static_cast<size_t>( bpp ) );
+    }
+}
+
+////////////////////////////////////////
+
 class exr_image final : public image
 {
 public:
@@ -513,12 +568,16 @@ public:
         const EXR::Header &                             header,
         std::vector<std::string>                        pnames,
         std::vector<std::string>                        pfullnames,
-        const std::vector<plane_layout> &               pl )
+        const std::vector<plane_layout> &               pl,
+        int                                             level = 0 )
         : _file( f )
         , _stream( s )
         , _header( header )
         , _plane_names( std::move( pnames ) )
         , _full_plane_names( std::move( pfullnames ) )
+        , _part( part )
+        , _level( level )
+        , _plane_layouts( pl )
     {
         if ( header.type() == EXR::TILEDIMAGE )
             _tiled_part.reset( new EXR::TiledInputPart( *f, part ) );
@@ -526,11 +585,34 @@ public:
             _scan_part.reset( new EXR::InputPart( *f, part ) );
 
         const auto &disp = header.displayWindow();
-        const auto &data = header.displayWindow();
+        const auto &data = data_window();
         set_active_area( area_rect::from_points(
             data.min.x, data.min.y, data.max.x, data.max.y ) );
-        set_full_area( area_rect::from_points(
-            disp.min.x, disp.min.y, disp.max.x, disp.max.y ) );
+        // the display window is only defined for the full resolution
+        if ( level == 0 )
+            set_full_area( area_rect::from_points(
+                disp.min.x, disp.min.y, disp.max.x, disp.max.y ) );
+        else
+            set_full_area( active_area() );
+
+        if ( _tiled_part )
+        {
+            switch ( _tiled_part->levelMode() )
+            {
+                case EXR::MIPMAP_LEVELS:
+                    set_level_count( _tiled_part->numLevels() );
+                    break;
+                case EXR::RIPMAP_LEVELS:
+                    // only the levels reduced in both directions
+                    set_level_count( std::min(
+                        _tiled_part->numXLevels(),
+                        _tiled_part->numYLevels() ) );
+                    break;
+                case EXR::ONE_LEVEL:
+                case EXR::NUM_LEVELMODES:
+                default: break;
+            }
+        }
 
         size_t nPs = _plane_names.size();
         for ( size_t cur = 0; cur != nPs; ++cur )
@@ -564,150 +646,303 @@ protected:
 
     void fill_plane( size_t plane, image_buffer &buffer ) override
     {
-        if ( plane >= _plane_names.size() )
-            throw_runtime(
-                "Attempt to access plane {0}, beyond the end of the EXR image ({1} planes)",
-                plane,
-                _plane_names.size() );
-
-        const EXR::Channel &imfchan =
-            _header.channels()[_full_plane_names[plane]];
-        IMATH::Box2i dataWin = _header.dataWindow();
-        // TODO: handle subsampling
-        size_t bytes = 0;
-        bool   flt   = false;
-
-        switch ( imfchan.type )
-        {
-            case EXR::UINT: bytes = sizeof( uint32_t ); break;
-
-            case EXR::HALF:
-                bytes = sizeof( base::half );
-                flt   = true;
-                break;
+        std::vector<size_t>       planes( 1, plane );
+        std::vector<image_buffer> bufs( 1, buffer );
+        read_planes( planes, bufs );
+    }
 
-            case EXR::FLOAT:
-                bytes = sizeof( float );
-                flt   = true;
-                break;
+    void fill_image( std::vector<image_buffer> &planes ) override
+    {
+        std::vector<size_t> idx( planes.size() );
+        for ( size_t p = 0; p != idx.size(); ++p )
+            idx[p] = p;
+        read_planes( idx, planes );
+    }
 
-            case EXR::NUM_PIXELTYPES:
-            default:
-                throw_logic(
-                    "Unknown OpenEXR pixel type {0}",
-                    static_cast<int>( imfchan.type ) );
-        }
+    /// all the requested channels are added to one frame buffer, so
+    /// each chunk is decompressed once, with OpenEXR converting to a
+    /// 32-bit float buffer as it reads
+    void fill_planes(
+        const std::vector<size_t> &planes,
+        std::vector<image_buffer> &bufs ) override
+    {
+        read_planes( planes, bufs );
+    }
 
-        if ( buffer.is_floating() != flt ||
-             static_cast<size_t>( buffer.bits() ) != ( bytes * 8 ) )
-            throw_runtime(
-                "Attempt to access EXR image with wrong buffer type" );
+    /// scanline images report the lines compressed together in a
+    /// chunk, tiled images the tile size
+    std::pair<int64_t, int64_t> compute_preferred_chunk( void ) const override
+    {
+        if ( _tiled_part )
+            return std::make_pair(
+                static_cast<int64_t>( _tiled_part->tileXSize() ),
+                static_cast<int64_t>( _tiled_part->tileYSize() ) );
 
-        // TODO: support sub-scanline reading (double copy :()
-        if ( buffer.x1() != dataWin.min.x || buffer.x2() != dataWin.max.x )
-            throw_runtime( "Only full scanline reading of EXR implemented" );
+        return std::make_pair(
+            active_area().width(), lines_per_chunk( _header.compression() ) );
+    }
 
-        size_t scanlinebytes =
-            static_cast<size_t>( dataWin.max.x - dataWin.min.x + 1 ) * bytes;
-        char *data = static_cast<char *>( buffer.data() );
-        data -= dataWin.min.x * bytes;
-        data -= buffer.y1() * scanlinebytes;
+    std::shared_ptr<image> create_level( int level ) const override
+    {
+        return std::make_shared<exr_image>(
+            _file,
+            _stream,
+            _part,
+            _header,
+            _plane_names,
+            _full_plane_names,
+            _plane_layouts,
+            level );
+    }
 
-        EXR::FrameBuffer fbuf;
-        fbuf.insert(
-            _full_plane_names[plane],
-            EXR::Slice( imfchan.type, data, bytes, scanlinebytes ) );
+private:
+    struct slice_request
+    {
+        const std::string *name;
+        EXR::PixelType     type;
+        int64_t            bytes;
+        image_buffer *     buf;
+    };
 
-        if ( _scan_part )
-        {
-            _scan_part->setFrameBuffer( fbuf );
-            _scan_part->readPixels( buffer.y1(), buffer.y2() );
-        }
-        else if ( _tiled_part )
-            throw_not_yet();
+    IMATH::Box2i data_window( void ) const
+    {
+        if ( _tiled_part )
+            return _tiled_part->dataWindowForLevel( _level, _level );
+        return _header.dataWindow();
     }
 
-    void fill_image( std::vector<image_buffer> &planes ) override
+    void read_planes(
+        const std::vector<size_t> &planes, std::vector<image_buffer> &bufs )
     {
-        image_buffer::rect readarea;
-        size_t             pIdx = 0;
-        EXR::FrameBuffer   fbuf;
+        if ( planes.empty() )
+            return;
 
-        for ( auto i = _header.channels().begin();
-              i != _header.channels().end();
-              ++i, ++pIdx )
+        std::vector<slice_request> slices;
+        slices.reserve( planes.size() );
+        for ( size_t i = 0; i != planes.size(); ++i )
         {
-            // TODO: handle subsampling
-            const EXR::Channel &curc = i.channel();
-            EXR::PixelType      type = curc.type;
-
-            image_buffer &buffer = planes[pIdx];
-            size_t        bytes  = 0;
-            bool          flt    = false;
-            switch ( type )
-            {
-                case EXR::UINT: bytes = sizeof( uint32_t ); break;
-
-                case EXR::HALF:
-                    bytes = sizeof( base::half );
-                    flt   = true;
-                    break;
-
-                case EXR::FLOAT:
-                    bytes = sizeof( float );
-                    flt   = true;
-                    break;
-
-                case EXR::NUM_PIXELTYPES:
-                default:
-                    throw_logic(
-                        "Unknown OpenEXR pixel type {0}",
-                        static_cast<int>( type ) );
-            }
-            if ( pIdx == 0 )
-                readarea = buffer.active_area();
-            else if ( readarea != buffer.active_area() )
+            size_t plane = planes[i];
+            if ( plane >= _plane_names.size() )
                 throw_runtime(
-                    "Image reads must request the same region for all planes" );
+                    "Attempt to access plane {0}, beyond the end of the EXR image ({1} planes)",
+                    plane,
+                    _plane_names.size() );
 
-            if ( buffer.is_floating() != flt )
+            image_buffer &buffer = bufs[i];
+            precondition(
+                buffer.raw(),
+                "Expect valid memory buffer to be provided to read" );
+            if ( buffer.active_area() != bufs.front().active_area() )
                 throw_runtime(
-                    "Buffer and file differ in floating point interpretation of data" );
+                    "Image reads must request the same region for all planes" );
 
-            if ( static_cast<size_t>( buffer.bits() ) != bytes * 8 )
+            // TODO: handle subsampling
+            slice_request sr;
+            sr.name = &( _full_plane_names[plane] );
+            sr.buf  = &buffer;
+            if ( buffer.is_floating() && buffer.bits() == 32 )
+                sr.type = EXR::FLOAT;
+            else if ( buffer.is_floating() && buffer.bits() == 16 )
+                sr.type = EXR::HALF;
+            else if ( !buffer.is_floating() && buffer.bits() == 32 )
+                sr.type = EXR::UINT;
+            else
                 throw_runtime(
-                    "Mismatch in bits for provided memory buffer and on-disk plane definition" );
+                    "Attempt to access EXR image with wrong buffer type" );
+            sr.bytes = buffer.bits() / 8;
+            slices.push_back( sr );
+        }
 
-            precondition(
-                buffer.raw(),
-                "Expect valid memory buffer to be provided to read" );
+        // only the part of the request on the data window is read,
+        // the rest is the outside value (0)
+        const area_rect &   area = bufs.front().active_area();
+        const IMATH::Box2i &dw   = data_window();
+        int64_t             ix1  = std::max( area.x1(), int64_t( dw.min.x ) );
+        int64_t             ix2  = std::min( area.x2(), int64_t( dw.max.x ) );
+        int64_t             iy1  = std::max( area.y1(), int64_t( dw.min.y ) );
+        int64_t             iy2  = std::min( area.y2(), int64_t( dw.max.y ) );
+        for ( auto &s: slices )
+        {
+            for ( int64_t y = area.y1(); y <= area.y2(); ++y )
+            {
+                if ( y < iy1 || y > iy2 || ix1 > ix2 )
+                    zero_span( *s.buf, y, area.x1(), area.x2() );
+                else
+                {
+                    zero_span( *s.buf, y, area.x1(), ix1 - 1 );
+                    zero_span( *s.buf, y, ix2 + 1, area.x2() );
+                }
+            }
+        }
+        if ( ix1 > ix2 || iy1 > iy2 )
+            return;
 
-            char *data = static_cast<char *>( buffer.data() );
-            data -= buffer.x1() * buffer.xstride_bytes();
-            data -= buffer.y1() * buffer.ystride_bytes();
+        if ( _scan_part )
+            read_scanlines( slices, area, dw, ix1, ix2, iy1, iy2 );
+        else if ( _tiled_part )
+            read_tiles( slices, area, dw, ix1, ix2, iy1, iy2 );
+    }
 
+    /// inserts a slice for each request pointing at the buffer, or
+    /// when provided, packed scratch memory starting at (sx, sy)
+    static void insert_slices(
+        EXR::FrameBuffer &                fbuf,
+        const std::vector<slice_request> &slices,
+        std::vector<std::vector<char>> *  scratch,
+        int64_t                           sx,
+        int64_t                           sy,
+        int64_t                           sw )
+    {
+        for ( size_t i = 0; i != slices.size(); ++i )
+        {
+            const slice_request &s = slices[i];
+            char *               data;
+            int64_t              xs, ys;
+            if ( scratch )
+            {
+                xs   = s.bytes;
+                ys   = sw * s.bytes;
+                data = ( *scratch )[i].data() - sx * xs - sy * ys;
+            }
+            else
+            {
+                xs   = s.buf->xstride_bytes();
+                ys   = s.buf->ystride_bytes();
+                data = static_cast<char *>( s.buf->data() ) -
+                       s.buf->x1() * xs - s.buf->y1() * ys;
+            }
             fbuf.insert(
-                _full_plane_names[pIdx],
+                *s.name,
                 EXR::Slice(
-                    type,
+                    s.type,
                     data,
-                    buffer.xstride_bytes(),
-                    buffer.ystride_bytes() ) );
+                    static_cast<size_t>( xs ),
+                    static_cast<size_t>( ys ) ) );
         }
+    }
 
-        if ( _scan_part )
+    void read_scanlines(
+        const std::vector<slice_request> &slices,
+        const area_rect &                 area,
+        const IMATH::Box2i &              dw,
+        int64_t                           ix1,
+        int64_t                           ix2,
+        int64_t                           iy1,
+        int64_t                           iy2 )
+    {
+        // OpenEXR only decodes the chunks overlapping the lines
+        // requested, but always writes the full width of the data
+        // window, so that can only go directly to the buffer when it
+        // covers the data window horizontally
+        if ( area.x1() <= dw.min.x && area.x2() >= dw.max.x )
         {
+            EXR::FrameBuffer fbuf;
+            insert_slices( fbuf, slices, nullptr, 0, 0, 0 );
             _scan_part->setFrameBuffer( fbuf );
-            _scan_part->readPixels( readarea.y1(), readarea.y2() );
+            _scan_part->readPixels(
+                static_cast<int>( iy1 ), static_cast<int>( iy2 ) );
+            return;
+        }
+
+        // otherwise read bands of whole chunks into scratch memory
+        // and copy out the window requested
+        int64_t chunk = lines_per_chunk( _header.compression() );
+        int64_t band  = chunk * std::max( int64_t( 1 ), int64_t( 64 ) / chunk );
+        int64_t dwW   = int64_t( dw.max.x ) - int64_t( dw.min.x ) + 1;
+
+        std::vector<std::vector<char>> scratch( slices.size() );
+        for ( size_t i = 0; i != slices.size(); ++i )
+            scratch[i].resize( static_cast<size_t>( dwW * band * slices[i].bytes ) );
+
+        for ( int64_t by = iy1; by <= iy2; )
+        {
+            // end on a chunk boundary so no chunk is decoded twice
+            int64_t cidx = ( by - dw.min.y ) / chunk;
+            int64_t ey   = std::min(
+                iy2, dw.min.y + ( cidx + band / chunk ) * chunk - 1 );
+
+            EXR::FrameBuffer fbuf;
+            insert_slices( fbuf, slices, &scratch, dw.min.x, by, dwW );
+            _scan_part->setFrameBuffer( fbuf );
+            _scan_part->readPixels(
+                static_cast<int>( by ), static_cast<int>( ey ) );
+
+            for ( size_t i = 0; i != slices.size(); ++i )
+                copy_region(
+                    *slices[i].buf,
+                    scratch[i].data(),
+                    dw.min.x,
+                    by,
+                    dwW * slices[i].bytes,
+                    slices[i].bytes,
+                    ix1,
+                    ix2,
+                    by,
+                    ey );
+            by = ey + 1;
         }
-        else if ( _tiled_part )
-            throw_not_yet();
     }
 
-    std::pair<int64_t, int64_t> compute_preferred_chunk( void ) const
+    void read_tiles(
+        const std::vector<slice_request> &slices,
+        const area_rect &                 area,
+        const IMATH::Box2i &              dw,
+        int64_t                           ix1,
+        int64_t                           ix2,
+        int64_t                           iy1,
+        int64_t                           iy2 )
     {
-        // TODO:
-        return image::compute_preferred_chunk();
+        // only the tiles overlapping the request are read, a row of
+        // tiles at a time
+        int64_t tw  = _tiled_part->tileXSize();
+        int64_t th  = _tiled_part->tileYSize();
+        int     tx1 = static_cast<int>( ( ix1 - dw.min.x ) / tw );
+        int     tx2 = static_cast<int>( ( ix2 - dw.min.x ) / tw );
+        int     ty1 = static_cast<int>( ( iy1 - dw.min.y ) / th );
+        int     ty2 = static_cast<int>( ( iy2 - dw.min.y ) / th );
+
+        std::vector<std::vector<char>> scratch( slices.size() );
+        for ( int ty = ty1; ty <= ty2; ++ty )
+        {
+            IMATH::Box2i b1 =
+                _tiled_part->dataWindowForTile( tx1, ty, _level, _level );
+            IMATH::Box2i b2 =
+                _tiled_part->dataWindowForTile( tx2, ty, _level, _level );
+            int64_t rx1 = b1.min.x, rx2 = b2.max.x;
+            int64_t ry1 = b1.min.y, ry2 = b1.max.y;
+
+            bool direct = rx1 >= area.x1() && rx2 <= area.x2() &&
+                          ry1 >= area.y1() && ry2 <= area.y2();
+            int64_t rw = rx2 - rx1 + 1;
+            if ( !direct )
+            {
+                for ( size_t i = 0; i != slices.size(); ++i )
+                    scratch[i].resize( static_cast<size_t>(
+                        rw * ( ry2 - ry1 + 1 ) * slices[i].bytes ) );
+            }
+
+            EXR::FrameBuffer fbuf;
+            insert_slices(
+                fbuf, slices, direct ? nullptr : &scratch, rx1, ry1, rw );
+            _tiled_part->setFrameBuffer( fbuf );
+            _tiled_part->readTiles( tx1, tx2, ty, ty, _level, _level );
+
+            if ( direct )
+                continue;
+
+            for ( size_t i = 0; i != slices.size(); ++i )
+                copy_region(
+                    *slices[i].buf,
+                    scratch[i].data(),
+                    rx1,
+                    ry1,
+                    rw * slices[i].bytes,
+                    slices[i].bytes,
+                    ix1,
+                    ix2,
+                    std::max( ry1, iy1 ),
+                    std::min( ry2, iy2 ) );
+        }
     }
 
     std::shared_ptr<EXR::MultiPartInputFile> _file;
@@ -717,6 +952,9 @@ protected:
     std::unique_ptr<EXR::InputPart>          _scan_part;
     std::vector<std::string>                 _plane_names;
     std::vector<std::string>                 _full_plane_names;
+    int                                      _part;
+    int                                      _level;
+    std::vector<plane_layout>                _plane_layouts;
 };
 
 ////////////////////////////////////////
@@ -865,7 +1103,7 @@ public:
                                 v.store( std::make_shared<exr_image>(
                                     _file,
                                     _stream,
-                                    0,
+                                    p,
                                     header,
                                     channames,
                                     chanfullnames,
@@ -876,7 +1114,7 @@ public:
                                 v.store( std::make_shared<exr_deep>(
                                     _file,
                                     _stream,
-                                    0,
+                                    p,
                                     header,
                                     channames,
                                     chanfullnames,
@@ -904,7 +1142,7 @@ public:
                     v.store( std::make_shared<exr_image>(
                         _file,
                         _stream,
-                        0,
+                        p,
                         header,
                         channames,
                         chanfullnames,
@@ -915,7 +1153,7 @@ public:
                     v.store( std::make_shared<exr_deep>(
                         _file,
                         _stream,
-                        0,
+                        p,
                         header,
                         channames,
                         chanfullnames,
@@ -1031,9 +1269,7 @@ public:
 void register_exr_reader( void )
 {
 #ifdef HAVE_OPENEXR
-    if ( EXR::globalThreadCount() == 0 )
-        EXR::setGlobalThreadCount(
-            static_cast<int>( base::thread::core_count() ) );
+    use_io_workers_for_exr();
 
     reader::register_reader( std::make_shared<OpenEXRReader>() );
 #endif
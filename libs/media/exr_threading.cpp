@@ -0,0 +1,100 @@
+// SPDX-License-Identifier: MIT
+// Copyright contributors to the gecko project.
+
+#include "exr_threading.h"
+#if defined( HAVE_OPENEXR )
+#    include "io_workers.h"
+
+#    include <algorithm>
+#    include <mutex>
+
+#    pragma GCC diagnostic push
+#    if defined( __clang__ )
+#        pragma GCC diagnostic ignored "-Wreserved-id-macro"
+#        pragma GCC diagnostic ignored "-Wweak-vtables"
+#    endif
+#    pragma GCC diagnostic ignored "-Wdeprecated"
+#    pragma GCC diagnostic ignored "-Wconversion"
+#    pragma GCC diagnostic ignored "-Wshadow"
+#    pragma GCC diagnostic ignored "-Wsign-conversion"
+#    pragma GCC diagnostic ignored "-Wold-style-cast"
+#    pragma GCC diagnostic ignored "-Wunused-parameter"
+
+#    include <IlmThread.h>
+#    include <IlmThreadPool.h>
+#    pragma GCC diagnostic pop
+#endif
+
+////////////////////////////////////////
+
+namespace
+{
+#if defined( HAVE_OPENEXR )
+namespace ILMT = ILMTHREAD_NAMESPACE;
+
+///
+/// @brief Class exr_task_provider hands the tasks OpenEXR would
+/// otherwise run on its own threads to the io_workers.
+///
+/// OpenEXR owns (and deletes) the provider, which keeps the workers
+/// alive until it is done with them.
+///
+class exr_task_provider final : public ILMT::ThreadPoolProvider
+{
+public:
+    explicit exr_task_provider( std::shared_ptr<media::io_workers> w )
+        : _workers( std::move( w ) )
+    {}
+
+    int numThreads( void ) const override
+    {
+        return static_cast<int>( _workers->size() );
+    }
+
+    void setNumThreads( int count ) override
+    {
+        _workers->resize( static_cast<size_t>( std::max( 0, count ) ) );
+    }
+
+    void addTask( ILMT::Task *task ) override
+    {
+        // deleting the task is what tells the task group it is done
+        _workers->queue( [task]() {
+            task->execute();
+            delete task;
+        } );
+    }
+
+    void finish( void ) override { _workers->wait(); }
+
+private:
+    std::shared_ptr<media::io_workers> _workers;
+};
+
+std::once_flag installProviderFlag;
+
+void installProvider( void )
+{
+    ILMT::ThreadPool::globalThreadPool().setThreadProvider(
+        new exr_task_provider( media::io_workers::global() ) );
+}
+#endif
+
+} // namespace
+
+////////////////////////////////////////
+
+namespace media
+{
+////////////////////////////////////////
+
+void use_io_workers_for_exr( void )
+{
+#if defined( HAVE_OPENEXR )
+    std::call_once( installProviderFlag, installProvider );
+#endif
+}
+
+////////////////////////////////////////
+
+} // namespace media
@@ -0,0 +1,17 @@
+// SPDX-License-Identifier: MIT
+// Copyright contributors to the gecko project.
+
+#pragma once
+
+namespace media
+{
+////////////////////////////////////////
+
+/// schedules the (de)compression tasks of OpenEXR on the shared
+/// io_workers instead of the OpenEXR global thread pool, safe to call
+/// more than once
+void use_io_workers_for_exr( void );
+
+////////////////////////////////////////
+
+} // namespace media
@@ -3,9 +3,12 @@
 
 #include "exr_writer.h"
 #if defined( HAVE_OPENEXR )
+#    include "exr_threading.h"
 #    include "file_sequence.h"
+#    include "frame_stream.h"
 #    include "image.h"
 #    include "image_buffer.h"
+#    include "io_workers.h"
 #    include "track_description.h"
 #    include "video_track.h"
 #    include "writer.h"
@@ -13,7 +16,6 @@
 #    include <base/contract.h>
 #    include <base/file_system.h>
 #    include <base/string_util.h>
-#    include <base/thread_util.h>
 #    include <base/time_util.h>
 #    include <chrono>
 #    include <color/state.h>
@@ -71,6 +73,8 @@
 #    include <ImfVecAttribute.h>
 #    pragma GCC diagnostic pop
 
+#    include "exr_compression.h"
+
 #    include <algorithm>
 #    include <iostream>
 #endif
@@ -174,32 +178,6 @@ EXR::Compression extractCompression( const parameter_set &parms )
     return r;
 }
 
-static inline int num_scanlines( EXR::Compression c )
-{
-    switch ( c )
-    {
-        case EXR::NO_COMPRESSION: return 1;
-        case EXR::RLE_COMPRESSION: return -1;
-        case EXR::ZIPS_COMPRESSION: return 1;
-        case EXR::ZIP_COMPRESSION: return 16;
-
-        case EXR::PIZ_COMPRESSION:
-        case EXR::PXR24_COMPRESSION:
-            // TODO: look at code to determine, for now pull whole image...
-            return -1;
-
-        case EXR::B44_COMPRESSION:
-        case EXR::B44A_COMPRESSION: return 4;
-
-        case EXR::DWAA_COMPRESSION: return 32;
-        case EXR::DWAB_COMPRESSION: return 256;
-
-        case EXR::NUM_COMPRESSION_METHODS:
-        default: break;
-    }
-    return -1;
-}
-
 template <typename D, typename S>
 static inline void do_copy( D &out, const S &in )
 {
@@ -461,65 +439,180 @@ static void frame_to_headers(
         throw_logic( "Writing of deep data not yet finished" );
 }
 
-static void rebuild_frame_buffer(
+static void insert_slices(
     EXR::FrameBuffer &               fB,
-    const image &                    img,
+    const std::vector<std::string> & names,
     const std::vector<image_buffer> &bufs )
 {
     precondition(
-        bufs.size() == img.size(), "expecting calc_bufs to fill buffers" );
+        bufs.size() == names.size(),
+        "expecting a buffer for each of the {0} planes, received {1}",
+        names.size(),
+        bufs.size() );
 
-    const area_rect &dataWin = img.active_area();
-    int64_t          w       = dataWin.width();
-    int64_t          baseOff = dataWin.x1() + dataWin.y1() * w;
-    for ( size_t p = 0; p < img.size(); ++p )
+    for ( size_t p = 0; p < names.size(); ++p )
     {
-        const image_buffer &ib         = bufs[p];
-        int64_t             curScanOff = ( ib.y1() - dataWin.y1() ) * w;
-        size_t offTotal = static_cast<size_t>( baseOff + curScanOff );
+        const image_buffer &ib = bufs[p];
+        EXR::PixelType      pt;
         if ( ib.bits() == 16 && ib.is_floating() )
+            pt = EXR::HALF;
+        else if ( ib.bits() == 32 && ib.is_floating() )
+            pt = EXR::FLOAT;
+        else if ( ib.bits() == 32 && ib.is_unsigned() )
+            pt = EXR::UINT;
+        else
+            throw_runtime( "Invalid image buffer for writing to EXR" );
+
+        // the frame buffer is addressed by absolute pixel coordinates
+        size_t    xs   = static_cast<size_t>( ib.xstride_bytes() );
+        size_t    ys   = static_cast<size_t>( ib.ystride_bytes() );
+        ptrdiff_t orig = ib.x1() * ib.xstride_bytes() + ib.y1() * ib.ystride_bytes();
+        char *    data =
+            const_cast<char *>( static_cast<const char *>( ib.data() ) ) - orig;
+        fB.insert( names[p], EXR::Slice( pt, data, xs, ys ) );
+    }
+}
+
+////////////////////////////////////////
+
+class exr_frame_stream final : public frame_stream
+{
+public:
+    exr_frame_stream(
+        base::ostream &&stream, const frame &layout, EXR::Compression compression )
+        : _stream( std::move( stream ) ), _estr( _stream )
+    {
+        std::vector<EXR::Header> headers;
+        frame_to_headers( headers, layout, compression );
+
+        for ( auto i = layout.image_begin(); i != layout.image_end(); ++i )
         {
-            char *data =
-                ( const_cast<char *>( static_cast<const char *>( ib.data() ) ) -
-                  offTotal * sizeof( base::half ) );
-            fB.insert(
-                img.plane_name( p ),
-                EXR::Slice(
-                    EXR::HALF,
-                    data,
-                    static_cast<size_t>( ib.xstride_bytes() ),
-                    static_cast<size_t>( ib.ystride_bytes() ) ) );
+            const image &img = ( *i );
+            part         cur;
+            cur.area = img.active_area();
+            cur.next = cur.area.y1();
+            cur.chunk = lines_per_chunk( compression );
+            for ( size_t p = 0; p < img.size(); ++p )
+                cur.planes.push_back( img.plane_name( p ) );
+            _parts.push_back( std::move( cur ) );
         }
-        else if ( ib.bits() == 32 && ib.is_floating() )
+
+        // the chunks are encoded on the shared workers, with as many
+        // in flight as there are workers to encode them
+        _threads = static_cast<int>( io_workers::global()->size() );
+        _file.reset( new EXR::MultiPartOutputFile(
+            _estr,
+            headers.data(),
+            static_cast<int>( headers.size() ),
+            false,
+            _threads ) );
+    }
+
+    /// the number of chunks a band should cover for them all to be
+    /// encoded at once
+    int parallel_chunks( void ) const { return std::max( 1, _threads ); }
+
+    size_t image_count( void ) const override { return _parts.size(); }
+
+    int chunk_height( size_t img ) const override
+    {
+        return find( img ).chunk;
+    }
+
+    int64_t next_row( size_t img ) const override { return find( img ).next; }
+
+    void write_band( size_t img, const std::vector<image_buffer> &planes ) override
+    {
+        part &cur = find( img );
+        if ( planes.empty() )
+            return;
+
+        const image_buffer &first = planes.front();
+        int64_t             rows  = first.height();
+        precondition(
+            first.y1() == cur.next,
+            "expecting band of image {0} to start at row {1}, received {2}",
+            img,
+            cur.next,
+            first.y1() );
+        precondition(
+            cur.next + rows <= cur.area.y2() + 1,
+            "band of image {0} extends past the last row {1}",
+            img,
+            cur.area.y2() );
+        for ( auto &ib: planes )
         {
-            char *data =
-                ( const_cast<char *>( static_cast<const char *>( ib.data() ) ) -
-                  offTotal * sizeof( float ) );
-            fB.insert(
-                img.plane_name( p ),
-                EXR::Slice(
-                    EXR::FLOAT,
-                    data,
-                    static_cast<size_t>( ib.xstride_bytes() ),
-                    static_cast<size_t>( ib.ystride_bytes() ) ) );
+            precondition(
+                ib.y1() == first.y1() && ib.height() == rows &&
+                    ib.x1() == cur.area.x1() && ib.width() == cur.area.width(),
+                "expecting the buffers of a band to cover the same rows and the width of the image" );
         }
-        else if ( ib.bits() == 32 )
+
+        EXR::FrameBuffer fbuf;
+        insert_slices( fbuf, cur.planes, planes );
+
+        // OpenEXR holds the rows of an incomplete chunk itself, and
+        // encodes the chunk once the rows are all provided
+        EXR::OutputPart out( *_file, static_cast<int>( img ) );
+        out.setFrameBuffer( fbuf );
+        out.writePixels( static_cast<int>( rows ) );
+        cur.next += rows;
+    }
+
+    void finish( void ) override
+    {
+        for ( size_t i = 0; i < _parts.size(); ++i )
         {
-            char *data =
-                ( const_cast<char *>( static_cast<const char *>( ib.data() ) ) -
-                  offTotal * sizeof( uint32_t ) );
-            fB.insert(
-                img.plane_name( p ),
-                EXR::Slice(
-                    EXR::UINT,
-                    data,
-                    static_cast<size_t>( ib.xstride_bytes() ),
-                    static_cast<size_t>( ib.ystride_bytes() ) ) );
+            if ( _parts[i].next != _parts[i].area.y2() + 1 )
+                throw_runtime(
+                    "image {0} of the frame finished at row {1} of {2} - {3}",
+                    i,
+                    _parts[i].next,
+                    _parts[i].area.y1(),
+                    _parts[i].area.y2() );
         }
-        else
-            throw_runtime( "Invalid image buffer for writing to EXR" );
+        // writes the offset tables
+        _file.reset();
     }
-}
+
+private:
+    struct part
+    {
+        area_rect                area;
+        int64_t                  next  = 0;
+        int                      chunk = 1;
+        std::vector<std::string> planes;
+    };
+
+    void check_image( size_t img ) const
+    {
+        precondition(
+            img < _parts.size(),
+            "invalid image {0} of frame stream ({1} images)",
+            img,
+            _parts.size() );
+    }
+
+    const part &find( size_t img ) const
+    {
+        check_image( img );
+        return _parts[img];
+    }
+
+    part &find( size_t img )
+    {
+        check_image( img );
+        return _parts[img];
+    }
+
+    base::ostream                            _stream;
+    exr_ostream                              _estr;
+    std::vector<part>                        _parts;
+    int                                      _threads = 0;
+    std::unique_ptr<EXR::MultiPartOutputFile> _file;
+};
+
+////////////////////////////////////////
 
 class exr_write_track final : public video_track
 {
@@ -559,31 +652,20 @@ public:
 
     void doWrite( int64_t f, const frame &frm, base::allocator &a ) override
     {
-        auto          fs     = base::file_system::get( _files.uri() );
-        base::ostream stream = fs->open_write( _files.get_frame( f ) );
-        exr_ostream   estr( stream );
-
-        std::vector<EXR::Header> headers;
-        frame_to_headers( headers, frm, _compression );
-
-        EXR::MultiPartOutputFile outfile{ estr,
-                                          headers.data(),
-                                          static_cast<int>( headers.size() ) };
-
-        int partNum = 0;
-        // TODO: handle tiles
-        int numScans = num_scanlines( _compression );
+        exr_frame_stream out( open_frame( f ), frm, _compression );
 
         // TODO: does this need to move up a level?
         std::vector<image_buffer> bufs;
-        for ( auto i = frm.image_begin(); i != frm.image_end(); ++i, ++partNum )
+        size_t                    idx = 0;
+        for ( auto i = frm.image_begin(); i != frm.image_end(); ++i, ++idx )
         {
-            EXR::OutputPart curOut( outfile, partNum );
-
             image &img       = ( *i );
             auto   prefchunk = img.preferred_chunk_size();
 
-            int pullScans = std::max( numScans, prefchunk.second );
+            // a chunk per call would be encoded one at a time
+            int pullScans = std::max(
+                out.chunk_height( idx ) * out.parallel_chunks(),
+                prefchunk.second );
             int y         = img.active_area().y1();
             int yend      = img.active_area().y2() + 1;
 
@@ -611,23 +693,29 @@ public:
                 }
 
                 img.extract_image( bufs );
-
-                // hrm, this seems inefficient, but exr also copies all this stuff all the time
-                EXR::FrameBuffer fbuf;
-                rebuild_frame_buffer( fbuf, img, bufs );
-
-                curOut.setFrameBuffer( fbuf );
-                curOut.writePixels( curScans );
+                out.write_band( idx, bufs );
 
                 y = ey;
             }
         }
 
-        if ( frm.data_begin() != frm.data_end() )
-            throw_logic( "Writing of deep data not yet finished" );
+        out.finish();
+    }
+
+    std::unique_ptr<frame_stream>
+    doStartFrame( int64_t f, const frame &layout, base::allocator & ) override
+    {
+        return std::unique_ptr<frame_stream>(
+            new exr_frame_stream( open_frame( f ), layout, _compression ) );
     }
 
 private:
+    base::ostream open_frame( int64_t f )
+    {
+        auto fs = base::file_system::get( _files.uri() );
+        return fs->open_write( _files.get_frame( f ) );
+    }
+
     file_sequence    _files;
     EXR::Compression _compression;
 };
@@ -668,6 +756,14 @@ public:
             " b44a   - Lossy 4-by-4, flat fields are compressed more\n"
             " dwaa   - Lossy DCT in blocks of 32 scanlines\n"
             " dwab   - Lossy DCT in blocks of 256 scanlines\n" );
+        _parms.push_back( media::parameter_definition(
+            "io_threads", int64_t( -1 ), int64_t( 256 ), int64_t( -1 ) ) );
+        _parms.back().help(
+            "Set the number of threads encoding (and decoding) chunks.\n"
+            "The threads are shared by every file read or written, so\n"
+            "this sets the budget for all of them, 0 encodes in the\n"
+            "writing thread, and -1 keeps the current budget (a quarter\n"
+            "of the cores by default)\n" );
     }
     virtual ~OpenEXRWriter( void ) = default;
 
@@ -684,6 +780,10 @@ container OpenEXRWriter::create(
 {
     container ret;
 
+    auto t = params.find( "io_threads" );
+    if ( t != params.end() && t->second.valid() && t->second.as_int() >= 0 )
+        io_workers::global()->resize( static_cast<size_t>( t->second.as_int() ) );
+
     if ( tdlist.empty() )
     {
         ret.add_track( std::make_shared<exr_write_track>( u, params ) );
@@ -716,9 +816,7 @@ container OpenEXRWriter::create(
 void register_exr_writer( void )
 {
 #if defined( HAVE_OPENEXR )
-    if ( EXR::globalThreadCount() == 0 )
-        EXR::setGlobalThreadCount(
-            static_cast<int>( base::thread::core_count() ) );
+    use_io_workers_for_exr();
 
     writer::register_writer( std::make_shared<OpenEXRWriter>() );
 #endif
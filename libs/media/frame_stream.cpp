@@ -0,0 +1,16 @@
+// SPDX-License-Identifier: MIT
+// Copyright contributors to the gecko project.
+
+#include "frame_stream.h"
+
+////////////////////////////////////////
+
+namespace media
+{
+////////////////////////////////////////
+
+frame_stream::~frame_stream( void ) {}
+
+////////////////////////////////////////
+
+} // namespace media
@@ -0,0 +1,61 @@
+// SPDX-License-Identifier: MIT
+// Copyright contributors to the gecko project.
+
+#pragma once
+
+#include "image_buffer.h"
+
+#include <cstdint>
+#include <vector>
+
+////////////////////////////////////////
+
+namespace media
+{
+///
+/// @brief Class frame_stream writes the images of a frame a band of
+/// scanlines at a time.
+///
+/// The frame given to video_track::start_frame describes the images
+/// (layers, views, planes, areas and metadata) to write, but the
+/// pixels are provided here as they are produced. The rows of each
+/// image are provided in increasing order, and each chunk of rows is
+/// encoded as soon as it is complete, so the full frame is never held
+/// by the writer.
+///
+class frame_stream
+{
+public:
+    frame_stream( void ) = default;
+    virtual ~frame_stream( void );
+    frame_stream( const frame_stream & ) = delete;
+    frame_stream &operator=( const frame_stream & ) = delete;
+    frame_stream( frame_stream && )                 = delete;
+    frame_stream &operator=( frame_stream && ) = delete;
+
+    /// number of images in the frame, in the order of frame::image_begin
+    virtual size_t image_count( void ) const = 0;
+
+    /// the number of rows of image img encoded together: bands of a
+    /// multiple of this are encoded without being held
+    virtual int chunk_height( size_t img ) const = 0;
+
+    /// the next row expected for image img
+    virtual int64_t next_row( size_t img ) const = 0;
+
+    /// @brief writes the rows covered by the buffers to image img
+    ///
+    /// there is one buffer per plane of the image in the order of the
+    /// planes, all covering the width of the active area of the image
+    /// and the same rows, starting with next_row. The buffers need not
+    /// match the plane layout (i.e. a float buffer for a half plane),
+    /// they are converted as they are encoded.
+    virtual void
+    write_band( size_t img, const std::vector<image_buffer> &planes ) = 0;
+
+    /// completes the frame, which is an error if not all the rows of
+    /// all the images have been written
+    virtual void finish( void ) = 0;
+};
+
+} // namespace media
@@ -3,8 +3,7 @@
 
 #include "image.h"
 
-#include "image_buffer.h"
-
+#include <algorithm>
 #include <base/allocator.h>
 
 ////////////////////////////////////////
@@ -140,7 +139,8 @@ void image::extract_plane( size_t plane, image_buffer &pbuf )
     if ( interleaved() )
         throw_not_yet();
 
-    fill_plane( plane, pbuf );
+    if ( !copy_decoded( plane, pbuf ) )
+        fill_plane( plane, pbuf );
 }
 
 ////////////////////////////////////////
@@ -174,6 +174,193 @@ void image::extract_image( std::vector<image_buffer> &planes )
 
 ////////////////////////////////////////
 
+void image::extract_planes(
+    const std::vector<size_t> &planes, std::vector<image_buffer> &bufs )
+{
+    precondition(
+        planes.size() == bufs.size(),
+        "expect an image buffer for each requested plane" );
+    if ( planes.empty() )
+        return;
+
+    if ( interleaved() )
+        throw_not_yet();
+
+    for ( size_t i = 0; i != planes.size(); ++i )
+    {
+        if ( planes[i] >= size() )
+            throw_runtime(
+                "Attempt to extract plane {0}, only {1} planes available",
+                planes[i],
+                size() );
+        if ( !bufs[i].raw() )
+            throw_runtime(
+                "Invalid un-initialized image buffer for plane {0} ('{1}')",
+                planes[i],
+                plane_name( planes[i] ) );
+        if ( bufs[i].active_area() != bufs.front().active_area() )
+            throw_runtime(
+                "Image reads must request the same region for all planes" );
+    }
+
+    if ( _decoded.empty() )
+    {
+        fill_planes( planes, bufs );
+        return;
+    }
+
+    // only the planes not decoded ahead are read now
+    std::vector<size_t>       rest;
+    std::vector<image_buffer> restBufs;
+    for ( size_t i = 0; i != planes.size(); ++i )
+    {
+        if ( !copy_decoded( planes[i], bufs[i] ) )
+        {
+            rest.push_back( planes[i] );
+            restBufs.push_back( bufs[i] );
+        }
+    }
+    fill_planes( rest, restBufs );
+}
+
+////////////////////////////////////////
+
+void image::decode_planes( const std::vector<size_t> &planes )
+{
+    if ( interleaved() )
+        throw_not_yet();
+
+    _decoded.resize( size() );
+    std::vector<size_t> todo;
+    if ( planes.empty() )
+    {
+        for ( size_t p = 0; p != size(); ++p )
+            if ( !_decoded[p].raw() )
+                todo.push_back( p );
+    }
+    else
+    {
+        for ( size_t p: planes )
+        {
+            if ( p >= size() )
+                throw_runtime(
+                    "Attempt to decode plane {0}, only {1} planes available",
+                    p,
+                    size() );
+            if ( !_decoded[p].raw() &&
+                 std::find( todo.begin(), todo.end(), p ) == todo.end() )
+                todo.push_back( p );
+        }
+    }
+    if ( todo.empty() )
+        return;
+
+    const area_rect &         ar = active_area();
+    std::vector<image_buffer> bufs;
+    bufs.reserve( todo.size() );
+    for ( size_t p: todo )
+    {
+        const plane_layout &pl = layout( p );
+        bufs.push_back( image_buffer::full_plane(
+            ar.x1(),
+            ar.y1(),
+            ar.x2(),
+            ar.y2(),
+            pl._bits,
+            pl._xsubsample_shift,
+            pl._ysubsample_shift,
+            pl._floating,
+            pl._unsigned ) );
+    }
+    fill_planes( todo, bufs );
+
+    for ( size_t i = 0; i != todo.size(); ++i )
+        _decoded[todo[i]] = std::move( bufs[i] );
+}
+
+////////////////////////////////////////
+
+void image::fill_planes(
+    const std::vector<size_t> &planes, std::vector<image_buffer> &bufs )
+{
+    image_buffer       tmp;
+    std::vector<float> line;
+    for ( size_t i = 0; i != planes.size(); ++i )
+    {
+        image_buffer &      buf = bufs[i];
+        const plane_layout &pl  = layout( planes[i] );
+        if ( buf.bits() == pl._bits && buf.is_floating() == pl._floating &&
+             buf.is_unsigned() == pl._unsigned )
+        {
+            fill_plane( planes[i], buf );
+            continue;
+        }
+
+        if ( tmp.bits() != pl._bits || tmp.is_floating() != pl._floating ||
+             tmp.is_unsigned() != pl._unsigned ||
+             tmp.active_area() != buf.active_area() )
+        {
+            tmp = image_buffer::full_plane(
+                buf.x1(),
+                buf.y1(),
+                buf.x2(),
+                buf.y2(),
+                pl._bits,
+                pl._xsubsample_shift,
+                pl._ysubsample_shift,
+                pl._floating,
+                pl._unsigned );
+        }
+        fill_plane( planes[i], tmp );
+
+        line.resize( static_cast<size_t>( buf.width() ) );
+        for ( int64_t y = buf.y1(); y <= buf.y2(); ++y )
+        {
+            tmp.get_scanline( y, line.data(), 1 );
+            buf.set_scanline( y, line.data(), 1 );
+        }
+    }
+}
+
+////////////////////////////////////////
+
+bool image::copy_decoded( size_t plane, image_buffer &buf ) const
+{
+    if ( plane >= _decoded.size() || !_decoded[plane].raw() ||
+         _decoded[plane].active_area() != buf.active_area() )
+        return false;
+
+    const image_buffer &src = _decoded[plane];
+    std::vector<float>  line( static_cast<size_t>( buf.width() ) );
+    for ( int64_t y = buf.y1(); y <= buf.y2(); ++y )
+    {
+        src.get_scanline( y, line.data(), 1 );
+        buf.set_scanline( y, line.data(), 1 );
+    }
+    return true;
+}
+
+////////////////////////////////////////
+
+std::shared_ptr<image> image::level( int l ) const
+{
+    precondition(
+        l >= 0 && l < _level_count,
+        "Invalid level {0} requested ({1} available)",
+        l,
+        _level_count );
+    return create_level( l );
+}
+
+////////////////////////////////////////
+
+std::shared_ptr<image> image::create_level( int l ) const
+{
+    throw_runtime( "Image does not provide level {0}", l );
+}
+
+////////////////////////////////////////
+
 std::pair<int64_t, int64_t> image::compute_preferred_chunk( void ) const
 {
     return std::make_pair(
@@ -3,12 +3,14 @@
 
 #pragma once
 
+#include "image_buffer.h"
 #include "metadata.h"
 
 #include <base/endian.h>
 #include <base/small_vector.h>
 #include <color/state.h>
 #include <cstdint>
+#include <memory>
 #include <string>
 #include <vector>
 
@@ -21,8 +23,6 @@ class allocator;
 
 namespace media
 {
-class image_buffer;
-
 /// TODO: add packing (i.e. dpx 10-bit, 12-bit)
 struct plane_layout
 {
@@ -123,6 +123,35 @@ public:
     void extract_plane( size_t plane, image_buffer &pbuf );
     void extract_image( std::vector<image_buffer> &planes );
 
+    /// @brief extracts a set of planes in one pass
+    ///
+    /// where the underlying format compresses multiple planes
+    /// together, this decodes the data once for all the requested
+    /// planes instead of once per plane. The buffers need not match
+    /// the plane layout, but must all cover the same area: the reader
+    /// converts directly into the buffer if it is able to (i.e. a
+    /// 32-bit float buffer for a 16-bit half plane), otherwise the
+    /// plane is read into a temporary buffer and converted.
+    void extract_planes(
+        const std::vector<size_t> &planes, std::vector<image_buffer> &bufs );
+
+    /// @brief decodes planes into memory ahead of extracting them
+    ///
+    /// later extracts of the whole active area of a decoded plane
+    /// copy (and convert) it out of memory instead of decoding it
+    /// again, so the decode can be done on another thread ahead of
+    /// the consumer (i.e. by the read ahead of an async_video_track).
+    /// The planes are kept in their own layout. All the planes are
+    /// decoded when the list is empty.
+    void decode_planes( const std::vector<size_t> &planes );
+
+    /// number of resolution levels stored (i.e. a mip-mapped image),
+    /// 1 when there is only the full resolution
+    inline int level_count( void ) const { return _level_count; }
+    /// returns an image for the provided resolution level, 0 being
+    /// the full resolution
+    std::shared_ptr<image> level( int l ) const;
+
     inline void set_meta( base::cstring name, metadata_value v )
     {
         _metadata[name] = std::move( v );
@@ -133,8 +162,15 @@ protected:
     virtual bool storage_interleaved( void ) const                = 0;
     virtual void fill_plane( size_t plane, image_buffer &buffer ) = 0;
     virtual void fill_image( std::vector<image_buffer> &planes )  = 0;
+    /// by default, fills each plane in turn
+    virtual void fill_planes(
+        const std::vector<size_t> &planes, std::vector<image_buffer> &bufs );
     /// by default, returns the entire area
     virtual std::pair<int64_t, int64_t> compute_preferred_chunk( void ) const;
+    /// only needs to be provided when there are multiple levels
+    virtual std::shared_ptr<image> create_level( int l ) const;
+
+    void set_level_count( int n ) { _level_count = n; }
 
     /// sets both full and active area to the same value
     void set_area( const area_rect &r )
@@ -165,16 +201,22 @@ private:
     };
     inline const plane_info &at( size_t p ) const { return _planes.at( p ); }
 
+    bool copy_decoded( size_t plane, image_buffer &buf ) const;
+
     using plane_store = base::small_vector<plane_info, 4>;
 
     area_rect _full_area;
     area_rect _active_area;
 
     float        _pix_aspect_ratio = 1.f;
+    int          _level_count      = 1;
     color::state _color_state;
 
     plane_store _planes;
 
+    // by plane, those without raw memory are not decoded
+    std::vector<image_buffer> _decoded;
+
     metadata _metadata;
 };
 
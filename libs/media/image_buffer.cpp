@@ -3,7 +3,11 @@
 
 #include "image_buffer.h"
 
+#include "avx2/scanline_convert.h"
+
 #include <base/contract.h>
+#include <base/cpu_features.h>
+#include <cstring>
 
 namespace media
 {
@@ -35,7 +39,11 @@ inline void unconvert_pel( uint16_t &d, float x )
 
 inline float convert_pel( base::half x ) { return float( x ); }
 
-inline void unconvert_pel( base::half &d, float x ) { d = x; }
+/// rounds to nearest even, matching the vector conversion
+inline void unconvert_pel( base::half &d, float x )
+{
+    d = base::half_cast<base::half, std::round_to_nearest>( x );
+}
 
 inline float convert_pel( float x ) { return x; }
 
@@ -48,6 +56,138 @@ inline void unconvert_pel( double &d, float v )
     d = static_cast<double>( v );
 }
 
+////////////////////////////////////////
+
+inline uint16_t to_half_bits( float v )
+{
+    base::half r;
+    unconvert_pel( r, v );
+    return r.bits();
+}
+
+/// conversions of a packed run of pixels, used as is when the cpu
+/// does not have the vector instructions
+void get_u8( float *out, const uint8_t *in, int64_t n )
+{
+    for ( int64_t x = 0; x < n; ++x )
+        out[x] = convert_pel( in[x] );
+}
+
+void get_u16( float *out, const uint16_t *in, int64_t n )
+{
+    for ( int64_t x = 0; x < n; ++x )
+        out[x] = convert_pel( in[x] );
+}
+
+void get_u16_swap( float *out, const uint16_t *in, int64_t n )
+{
+    for ( int64_t x = 0; x < n; ++x )
+        out[x] = convert_pel( static_cast<uint16_t>( bswap_16( in[x] ) ) );
+}
+
+void get_f16( float *out, const uint16_t *in, int64_t n )
+{
+    for ( int64_t x = 0; x < n; ++x )
+        out[x] = convert_pel( base::half( base::half::binary, in[x] ) );
+}
+
+void get_f16_swap( float *out, const uint16_t *in, int64_t n )
+{
+    for ( int64_t x = 0; x < n; ++x )
+        out[x] = convert_pel(
+            base::half( base::half::binary, bswap_16( in[x] ) ) );
+}
+
+void get_f32_swap( float *out, const uint32_t *in, int64_t n )
+{
+    for ( int64_t x = 0; x < n; ++x )
+    {
+        uint32_t v = bswap_32( in[x] );
+        memcpy( out + x, &v, sizeof( float ) );
+    }
+}
+
+void set_u8( uint8_t *out, const float *in, int64_t n )
+{
+    for ( int64_t x = 0; x < n; ++x )
+        unconvert_pel( out[x], in[x] );
+}
+
+void set_u16( uint16_t *out, const float *in, int64_t n )
+{
+    for ( int64_t x = 0; x < n; ++x )
+        unconvert_pel( out[x], in[x] );
+}
+
+void set_u16_swap( uint16_t *out, const float *in, int64_t n )
+{
+    for ( int64_t x = 0; x < n; ++x )
+    {
+        uint16_t tmp;
+        unconvert_pel( tmp, in[x] );
+        out[x] = bswap_16( tmp );
+    }
+}
+
+void set_f16( uint16_t *out, const float *in, int64_t n )
+{
+    for ( int64_t x = 0; x < n; ++x )
+        out[x] = to_half_bits( in[x] );
+}
+
+void set_f16_swap( uint16_t *out, const float *in, int64_t n )
+{
+    for ( int64_t x = 0; x < n; ++x )
+        out[x] = bswap_16( to_half_bits( in[x] ) );
+}
+
+void set_f32_swap( uint32_t *out, const float *in, int64_t n )
+{
+    for ( int64_t x = 0; x < n; ++x )
+    {
+        uint32_t v;
+        memcpy( &v, in + x, sizeof( float ) );
+        out[x] = bswap_32( v );
+    }
+}
+
+struct line_converters
+{
+    decltype( &get_u8 )       from_u8;
+    decltype( &get_u16 )      from_u16;
+    decltype( &get_u16_swap ) from_u16_swap;
+    decltype( &get_f16 )      from_f16;
+    decltype( &get_f16_swap ) from_f16_swap;
+    decltype( &get_f32_swap ) from_f32_swap;
+    decltype( &set_u8 )       to_u8;
+    decltype( &set_u16 )      to_u16;
+    decltype( &set_u16_swap ) to_u16_swap;
+    decltype( &set_f16 )      to_f16;
+    decltype( &set_f16_swap ) to_f16_swap;
+    decltype( &set_f32_swap ) to_f32_swap;
+};
+
+const line_converters &converters( void )
+{
+    using base::choose_runtime;
+    using feat = base::cpu::simd_feature;
+    static const line_converters lc{
+        choose_runtime( &get_u8, { { feat::AVX2, &avx2::get_u8 } } ),
+        choose_runtime( &get_u16, { { feat::AVX2, &avx2::get_u16 } } ),
+        choose_runtime( &get_u16_swap, { { feat::AVX2, &avx2::get_u16_swap } } ),
+        choose_runtime( &get_f16, { { feat::AVX2, &avx2::get_f16 } } ),
+        choose_runtime( &get_f16_swap, { { feat::AVX2, &avx2::get_f16_swap } } ),
+        choose_runtime( &get_f32_swap, { { feat::AVX2, &avx2::get_f32_swap } } ),
+        choose_runtime( &set_u8, { { feat::AVX2, &avx2::set_u8 } } ),
+        choose_runtime( &set_u16, { { feat::AVX2, &avx2::set_u16 } } ),
+        choose_runtime( &set_u16_swap, { { feat::AVX2, &avx2::set_u16_swap } } ),
+        choose_runtime( &set_f16, { { feat::AVX2, &avx2::set_f16 } } ),
+        choose_runtime( &set_f16_swap, { { feat::AVX2, &avx2::set_f16_swap } } ),
+        choose_runtime( &set_f32_swap, { { feat::AVX2, &avx2::set_f32_swap } } )
+    };
+    return lc;
+}
+
 } // namespace
 
 ////////////////////////////////////////
@@ -132,6 +272,12 @@ void image_buffer::get_scanline_u8(
     const uint8_t *data = static_cast<const uint8_t *>( _data.get() );
     data += ( _offset + ( ( y - y1() ) >> _ysubsample_shift ) * _ystride ) / 8;
 
+    if ( packed_line( stride ) )
+    {
+        converters().from_u8( line, data, width() );
+        return;
+    }
+
     for ( int64_t x = 0, W = width(); x < W; ++x )
     {
         const uint8_t *curData =
@@ -148,6 +294,15 @@ void image_buffer::get_scanline_u16(
     const uint16_t *data = static_cast<const uint16_t *>( _data.get() );
     data += ( _offset + ( ( y - y1() ) >> _ysubsample_shift ) * _ystride ) / 16;
 
+    if ( packed_line( stride ) )
+    {
+        if ( _endian == base::endianness::NATIVE )
+            converters().from_u16( line, data, width() );
+        else
+            converters().from_u16_swap( line, data, width() );
+        return;
+    }
+
     if ( _endian == base::endianness::NATIVE )
     {
         for ( int64_t x = 0, W = width(); x < W; ++x )
@@ -176,6 +331,16 @@ void image_buffer::get_scanline_f16(
     const base::half *data = static_cast<const base::half *>( _data.get() );
     data += ( _offset + ( ( y - y1() ) >> _ysubsample_shift ) * _ystride ) / 16;
 
+    if ( packed_line( stride ) )
+    {
+        const uint16_t *udata = reinterpret_cast<const uint16_t *>( data );
+        if ( _endian == base::endianness::NATIVE )
+            converters().from_f16( line, udata, width() );
+        else
+            converters().from_f16_swap( line, udata, width() );
+        return;
+    }
+
     if ( _endian == base::endianness::NATIVE )
     {
         for ( int64_t x = 0, W = width(); x < W; ++x )
@@ -206,6 +371,16 @@ void image_buffer::get_scanline_f32(
     const float *data = static_cast<const float *>( _data.get() );
     data += ( _offset + ( ( y - y1() ) >> _ysubsample_shift ) * _ystride ) / 32;
 
+    if ( packed_line( stride ) )
+    {
+        if ( _endian == base::endianness::NATIVE )
+            memcpy( line, data, static_cast<size_t>( width() ) * sizeof( float ) );
+        else
+            converters().from_f32_swap(
+                line, reinterpret_cast<const uint32_t *>( data ), width() );
+        return;
+    }
+
     if ( _endian == base::endianness::NATIVE )
     {
         for ( int64_t x = 0, W = width(); x < W; ++x )
@@ -276,6 +451,12 @@ void image_buffer::set_scanline_u8(
     uint8_t *data = static_cast<uint8_t *>( _data.get() );
     data += ( _offset + ( ( y - y1() ) >> _ysubsample_shift ) * _ystride ) / 8;
 
+    if ( packed_line( stride ) )
+    {
+        converters().to_u8( data, line, width() );
+        return;
+    }
+
     for ( int64_t x = 0, W = width(); x < W; ++x )
     {
         uint8_t *curData = data + ( ( x >> _xsubsample_shift ) * _xstride ) / 8;
@@ -291,6 +472,15 @@ void image_buffer::set_scanline_u16(
     uint16_t *data = static_cast<uint16_t *>( _data.get() );
     data += ( _offset + ( ( y - y1() ) >> _ysubsample_shift ) * _ystride ) / 16;
 
+    if ( packed_line( stride ) )
+    {
+        if ( _endian == base::endianness::NATIVE )
+            converters().to_u16( data, line, width() );
+        else
+            converters().to_u16_swap( data, line, width() );
+        return;
+    }
+
     if ( _endian == base::endianness::NATIVE )
     {
         for ( int64_t x = 0, W = width(); x < W; ++x )
@@ -321,6 +511,16 @@ void image_buffer::set_scanline_f16(
     base::half *data = static_cast<base::half *>( _data.get() );
     data += ( _offset + ( ( y - y1() ) >> _ysubsample_shift ) * _ystride ) / 16;
 
+    if ( packed_line( stride ) )
+    {
+        uint16_t *udata = reinterpret_cast<uint16_t *>( data );
+        if ( _endian == base::endianness::NATIVE )
+            converters().to_f16( udata, line, width() );
+        else
+            converters().to_f16_swap( udata, line, width() );
+        return;
+    }
+
     if ( _endian == base::endianness::NATIVE )
     {
         for ( int64_t x = 0, W = width(); x < W; ++x )
@@ -352,6 +552,16 @@ void image_buffer::set_scanline_f32(
     float *data = static_cast<float *>( _data.get() );
     data += ( _offset + ( ( y - y1() ) >> _ysubsample_shift ) * _ystride ) / 32;
 
+    if ( packed_line( stride ) )
+    {
+        if ( _endian == base::endianness::NATIVE )
+            memcpy( data, line, static_cast<size_t>( width() ) * sizeof( float ) );
+        else
+            converters().to_f32_swap(
+                reinterpret_cast<uint32_t *>( data ), line, width() );
+        return;
+    }
+
     if ( _endian == base::endianness::NATIVE )
     {
         for ( int64_t x = 0, W = width(); x < W; ++x )
@@ -204,6 +204,7 @@ public:
     constexpr inline int64_t bits( void ) const { return _bits; }
 
     constexpr inline bool is_floating( void ) const { return _floating; }
+    constexpr inline bool is_unsigned( void ) const { return _unsigned; }
 
     constexpr inline int64_t xstride_bytes( void ) const
     {
@@ -349,6 +350,13 @@ public:
     }
 
 private:
+    /// whether a line is a packed run of pixels, which can use the
+    /// vectorized conversions
+    inline bool packed_line( int64_t stride ) const
+    {
+        return stride == 1 && _xsubsample_shift == 0 && _xstride == _bits;
+    }
+
     void get_scanline_u8( int64_t y, float *line, int64_t stride ) const;
     void get_scanline_u16( int64_t y, float *line, int64_t stride ) const;
     void get_scanline_f16( int64_t y, float *line, int64_t stride ) const;
@@ -0,0 +1,168 @@
+// SPDX-License-Identifier: MIT
+// Copyright contributors to the gecko project.
+
+#include "io_workers.h"
+
+#include <algorithm>
+#include <base/contract.h>
+#include <base/thread_util.h>
+
+////////////////////////////////////////
+
+namespace media
+{
+////////////////////////////////////////
+
+io_workers::io_workers( size_t threads ) : _size( threads ) {}
+
+////////////////////////////////////////
+
+io_workers::~io_workers( void )
+{
+    {
+        std::lock_guard<std::mutex> lk( _mutex );
+        _done = true;
+        _work_ready.notify_all();
+    }
+    // the workers finish the queue before exiting
+    for ( auto &w: _workers )
+        w->thread.join();
+    run_queued();
+}
+
+////////////////////////////////////////
+
+size_t io_workers::size( void ) const
+{
+    std::lock_guard<std::mutex> lk( _mutex );
+    return _size;
+}
+
+////////////////////////////////////////
+
+void io_workers::resize( size_t threads )
+{
+    std::vector<std::unique_ptr<worker>> stopped;
+    {
+        std::lock_guard<std::mutex> lk( _mutex );
+        _size = threads;
+        while ( _workers.size() > threads )
+        {
+            _workers.back()->stop = true;
+            stopped.push_back( std::move( _workers.back() ) );
+            _workers.pop_back();
+        }
+        // new threads are started as work is queued
+        _work_ready.notify_all();
+    }
+
+    for ( auto &w: stopped )
+        w->thread.join();
+
+    // with no threads left, nothing else will pick up the queue
+    run_queued();
+}
+
+////////////////////////////////////////
+
+void io_workers::queue( std::function<void( void )> f )
+{
+    precondition( f, "invalid function to queue" );
+
+    std::unique_lock<std::mutex> lk( _mutex );
+    if ( _size == 0 )
+    {
+        lk.unlock();
+        f();
+        return;
+    }
+
+    _work.push_back( std::move( f ) );
+    if ( _workers.size() < _size && _busy + _work.size() > _workers.size() )
+    {
+        _workers.emplace_back( new worker );
+        worker &w = *( _workers.back() );
+        w.thread  = std::thread( [this, &w]() { work( w ); } );
+    }
+    _work_ready.notify_one();
+}
+
+////////////////////////////////////////
+
+void io_workers::wait( void )
+{
+    std::unique_lock<std::mutex> lk( _mutex );
+    _work_done.wait( lk, [this]() { return _work.empty() && _busy == 0; } );
+}
+
+////////////////////////////////////////
+
+const std::shared_ptr<io_workers> &io_workers::global( void )
+{
+    static std::shared_ptr<io_workers> theWorkers = std::make_shared<io_workers>(
+        static_cast<size_t>( std::max( 1L, base::thread::core_count() / 4 ) ) );
+    return theWorkers;
+}
+
+////////////////////////////////////////
+
+void io_workers::work( worker &w )
+{
+    std::unique_lock<std::mutex> lk( _mutex );
+    while ( true )
+    {
+        _work_ready.wait(
+            lk, [&]() { return w.stop || _done || !_work.empty(); } );
+        if ( w.stop || _work.empty() )
+            return;
+
+        std::function<void( void )> f = std::move( _work.front() );
+        _work.pop_front();
+        ++_busy;
+        lk.unlock();
+        try
+        {
+            f();
+        }
+        catch ( ... )
+        {
+            // nowhere to report it, the work handles its own errors
+        }
+        lk.lock();
+        --_busy;
+        if ( _work.empty() && _busy == 0 )
+            _work_done.notify_all();
+    }
+}
+
+////////////////////////////////////////
+
+void io_workers::run_queued( void )
+{
+    std::unique_lock<std::mutex> lk( _mutex );
+    if ( !_workers.empty() )
+        return;
+
+    while ( !_work.empty() )
+    {
+        std::function<void( void )> f = std::move( _work.front() );
+        _work.pop_front();
+        ++_busy;
+        lk.unlock();
+        try
+        {
+            f();
+        }
+        catch ( ... )
+        {
+        }
+        lk.lock();
+        --_busy;
+    }
+    if ( _busy == 0 )
+        _work_done.notify_all();
+}
+
+////////////////////////////////////////
+
+} // namespace media
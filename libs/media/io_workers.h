@@ -0,0 +1,81 @@
+// SPDX-License-Identifier: MIT
+// Copyright contributors to the gecko project.
+
+#pragma once
+
+#include <condition_variable>
+#include <cstddef>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+////////////////////////////////////////
+
+namespace media
+{
+///
+/// @brief Class io_workers is a budget of threads for the encode and
+/// decode work of the readers and writers.
+///
+/// The readers and writers queue their (de)compression work here
+/// instead of each starting threads of their own, so the number of
+/// threads busy with I/O stays the same no matter how many files are
+/// open at once. The global budget is shared by all of them, and is
+/// sized to a quarter of the cores unless set otherwise, leaving the
+/// rest to the image processing threads (which size themselves to
+/// what is left).
+///
+/// Threads are only started once work is queued. Work must not wait
+/// on other work queued here, or it may wait forever.
+///
+class io_workers
+{
+public:
+    /// a budget of 0 threads does the work as it is queued
+    explicit io_workers( size_t threads );
+    ~io_workers( void );
+    io_workers( const io_workers & ) = delete;
+    io_workers &operator=( const io_workers & ) = delete;
+    io_workers( io_workers && )                 = delete;
+    io_workers &operator=( io_workers && ) = delete;
+
+    size_t size( void ) const;
+
+    /// changes the number of threads, the work already queued is
+    /// still done
+    void resize( size_t threads );
+
+    /// queues f to run on one of the threads, f is expected to handle
+    /// its own errors
+    void queue( std::function<void( void )> f );
+
+    /// waits for the work queued so far to finish
+    void wait( void );
+
+    /// the budget shared by the readers and writers
+    static const std::shared_ptr<io_workers> &global( void );
+
+private:
+    struct worker
+    {
+        std::thread thread;
+        bool        stop = false;
+    };
+
+    void work( worker &w );
+    void run_queued( void );
+
+    mutable std::mutex                      _mutex;
+    std::condition_variable                 _work_ready;
+    std::condition_variable                 _work_done;
+    std::deque<std::function<void( void )>> _work;
+    std::vector<std::unique_ptr<worker>>    _workers;
+    size_t                                  _size;
+    size_t                                  _busy = 0;
+    bool                                    _done = false;
+};
+
+} // namespace media
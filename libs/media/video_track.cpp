@@ -3,6 +3,8 @@
 
 #include "video_track.h"
 
+#include <base/contract.h>
+
 ////////////////////////////////////////
 
 namespace media
@@ -24,6 +26,22 @@ frame *video_track::read( int64_t offset, const sample_rate &r )
 
 ////////////////////////////////////////
 
+void video_track::doStore(
+    int64_t f, const std::shared_ptr<frame> &frm, base::allocator &a )
+{
+    doWrite( f, *frm, a );
+}
+
+////////////////////////////////////////
+
+std::unique_ptr<frame_stream>
+video_track::doStartFrame( int64_t f, const frame &, base::allocator & )
+{
+    throw_runtime( "track '{0}' is unable to stream frame {1}", name(), f );
+}
+
+////////////////////////////////////////
+
 //void
 //video_track::write( int64_t offset, const sample_rate &, const sample_data &sd )
 //{
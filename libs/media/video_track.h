@@ -4,6 +4,7 @@
 #pragma once
 
 #include "frame.h"
+#include "frame_stream.h"
 #include "track.h"
 
 namespace base
@@ -44,7 +45,18 @@ public:
     store( int64_t f, const std::shared_ptr<frame> &frm, base::allocator &a )
     {
         if ( frm )
-            doWrite( f, *frm, a );
+            doStore( f, frm, a );
+    }
+
+    /// @brief starts writing frame f a band of scanlines at a time
+    ///
+    /// the images of the layout describe what to write, but their
+    /// pixels are not used, they are provided to the returned stream
+    /// instead. Throws if the track is unable to stream.
+    inline std::unique_ptr<frame_stream>
+    start_frame( int64_t f, const frame &layout, base::allocator &a )
+    {
+        return doStartFrame( f, layout, a );
     }
 
     // to add
@@ -68,6 +80,26 @@ protected:
     virtual void
     doWrite( int64_t offset, const frame &sd, base::allocator &a ) = 0;
 
+    /// called by store, writes the frame immediately by default, but
+    /// a track may hold on to the frame to write it later
+    virtual void doStore(
+        int64_t f, const std::shared_ptr<frame> &frm, base::allocator &a );
+
+    /// by default, the track is unable to stream
+    virtual std::unique_ptr<frame_stream>
+    doStartFrame( int64_t f, const frame &layout, base::allocator &a );
+
+    /// for tracks which wrap another track
+    static inline frame *read_from( video_track &t, int64_t offset )
+    {
+        return t.doRead( offset );
+    }
+    static inline void write_to(
+        video_track &t, int64_t offset, const frame &frm, base::allocator &a )
+    {
+        t.doWrite( offset, frm, a );
+    }
+
 private:
 };
 
@@ -3,15 +3,19 @@
 
 #include "socket.h"
 
+#include <algorithm>
 #include <base/contract.h>
+#include <cmath>
 #include <cstring>
 #include <unistd.h>
 #ifdef _WIN32
 #    include <winsock2.h>
 #else
+#    include <fcntl.h>
 #    include <netinet/in.h>
 #    include <netinet/ip.h>
 #    include <sys/socket.h>
+#    include <sys/time.h>
 #endif
 
 namespace net
@@ -53,6 +57,50 @@ void socket::bind( uint32_t host, uint16_t port )
 
 ////////////////////////////////////////
 
+void socket::set_non_blocking( bool nb )
+{
+    precondition( _socket >= 0, "invalid socket" );
+#ifdef _WIN32
+    u_long mode = nb ? 1 : 0;
+    if ( ioctlsocket( _socket, FIONBIO, &mode ) != 0 )
+        throw_lasterror( "socket/nonblocking" );
+#else
+    int flags = fcntl( _socket, F_GETFL, 0 );
+    if ( flags < 0 )
+        throw_errno( "socket/getflags" );
+    flags = nb ? ( flags | O_NONBLOCK ) : ( flags & ~O_NONBLOCK );
+    if ( fcntl( _socket, F_SETFL, flags ) < 0 )
+        throw_errno( "socket/nonblocking" );
+#endif
+}
+
+////////////////////////////////////////
+
+void socket::set_send_timeout( double secs )
+{
+    precondition( _socket >= 0, "invalid socket" );
+    secs = std::max( secs, 0.0 );
+#ifdef _WIN32
+    DWORD ms = static_cast<DWORD>( secs * 1000.0 );
+    if ( setsockopt(
+             _socket,
+             SOL_SOCKET,
+             SO_SNDTIMEO,
+             reinterpret_cast<const char *>( &ms ),
+             sizeof( ms ) ) < 0 )
+        throw_lasterror( "setsockopt/sendtimeout" );
+#else
+    struct timeval tval;
+    tval.tv_sec  = static_cast<time_t>( std::floor( secs ) );
+    tval.tv_usec = static_cast<suseconds_t>(
+        ( secs - static_cast<double>( tval.tv_sec ) ) * 1000000.0 );
+    if ( setsockopt( _socket, SOL_SOCKET, SO_SNDTIMEO, &tval, sizeof( tval ) ) < 0 )
+        throw_errno( "setsockopt/sendtimeout" );
+#endif
+}
+
+////////////////////////////////////////
+
 void socket::close( void )
 {
     if ( _socket >= 0 )
@@ -27,6 +27,17 @@ public:
 
     int get_socket( void ) const { return _socket; }
 
+    /// @brief Switches the socket to (or from) non-blocking mode
+    /// Reads and writes on a non-blocking socket still wait for the
+    /// data to arrive or be sent, but accept and read_some return
+    /// rather than wait.
+    void set_non_blocking( bool nb );
+
+    /// @brief Sets how long (in seconds) a write waits for the peer to
+    /// take more of the data before failing with ETIMEDOUT.
+    /// 0 waits forever.
+    void set_send_timeout( double secs );
+
     void close( void );
 
 protected:
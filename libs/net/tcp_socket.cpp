@@ -14,15 +14,71 @@
 #    include <netinet/in.h>
 #    include <netinet/ip.h>
 #    include <netinet/tcp.h>
+#    include <poll.h>
 #    include <sys/ioctl.h>
 #    include <sys/select.h>
 #    include <sys/socket.h>
 #    include <sys/types.h>
+#    include <sys/uio.h>
 #endif
+#ifdef __linux__
+#    include <sys/sendfile.h>
+#endif
+#include <algorithm>
 
 #include "address.h"
 #include "tcp_socket.h"
 
+namespace
+{
+////////////////////////////////////////
+
+// waits (up to the send or receive timeout of the socket) for a
+// non-blocking socket to be ready, poll is used since select can not
+// handle descriptors past FD_SETSIZE
+void wait_ready( int s, bool writing )
+{
+    struct timeval tval;
+    tval.tv_sec  = 0;
+    tval.tv_usec = 0;
+#ifndef _WIN32
+    // windows does not support the SO_SNDTIMEO, although they do support setting it?
+    socklen_t tSz = sizeof( tval );
+    if ( ::getsockopt(
+             s, SOL_SOCKET, writing ? SO_SNDTIMEO : SO_RCVTIMEO, &tval, &tSz ) !=
+         0 )
+        throw_errno( "getsockopt/timeout" );
+#endif
+    int timeout = -1;
+    if ( tval.tv_sec != 0 || tval.tv_usec != 0 )
+        timeout = static_cast<int>( tval.tv_sec * 1000 + tval.tv_usec / 1000 );
+
+    struct pollfd pfd;
+    pfd.fd     = s;
+    pfd.events = writing ? POLLOUT : POLLIN;
+    while ( true )
+    {
+        pfd.revents = 0;
+#ifdef _WIN32
+        int n = WSAPoll( &pfd, 1, timeout );
+#else
+        int n = ::poll( &pfd, 1, timeout );
+#endif
+        if ( n == -1 && errno == EINTR )
+            continue;
+        if ( n == -1 )
+            throw_errno( writing ? "write/writewait" : "read/readwait" );
+        if ( n == 0 )
+            throw_location( std::system_error(
+                ETIMEDOUT, std::system_category(), writing ? "write" : "read" ) );
+        return;
+    }
+}
+
+////////////////////////////////////////
+
+} // namespace
+
 namespace net
 {
 ////////////////////////////////////////
@@ -172,6 +228,8 @@ std::shared_ptr<tcp_socket> tcp_socket::accept( void )
                   reinterpret_cast<struct sockaddr *>( &clientaddr ),
                   &len ) ) < 0 )
     {
+        if ( errno == EAGAIN || errno == EWOULDBLOCK )
+            return nullptr;
         if ( errno != EINTR && errno != ECONNABORTED )
             throw_errno( "TCP socket accept failed" );
     }
@@ -193,7 +251,9 @@ void tcp_socket::read( void *buf, size_t bytes )
         nread = ::read( _socket, mem, nleft );
         if ( nread < 0 )
         {
-            if ( errno != EINTR )
+            if ( errno == EAGAIN || errno == EWOULDBLOCK )
+                wait_ready( _socket, false );
+            else if ( errno != EINTR )
                 throw_errno( "reading TCP socket {0}", _socket );
             continue;
         }
@@ -225,40 +285,9 @@ void tcp_socket::write( const void *buf, size_t bytes )
             if ( e == EINTR )
                 continue;
 
-            if ( e == EAGAIN )
+            if ( e == EAGAIN || e == EWOULDBLOCK )
             {
-                fd_set fds;
-                FD_ZERO( &fds );
-                FD_SET( _socket, &fds );
-                struct timeval tval;
-#ifdef _WIN32
-                tval.tv_sec  = 0;
-                tval.tv_usec = 0;
-#else
-                // windows does not support the SO_SNDTIMEO, although they do support setting it?
-                socklen_t tSz = sizeof( tval );
-                if ( ::getsockopt(
-                         _socket, SOL_SOCKET, SO_SNDTIMEO, &tval, &tSz ) != 0 )
-                    throw_errno( "getsockopt/sndtimeo" );
-#endif
-                while ( true )
-                {
-                    int s = 0;
-                    if ( tval.tv_sec == 0 && tval.tv_usec == 0 )
-                        s = select( _socket + 1, nullptr, &fds, nullptr, nullptr );
-                    else
-                        s = select( _socket + 1, nullptr, &fds, nullptr, &tval );
-
-                    if ( s == -1 && errno == EINTR )
-                        continue;
-                    if ( s == -1 )
-                        throw_errno( "write/writewait" );
-
-                    if ( s == 0 )
-                        throw_errno( "write/systemswamp" );
-
-                    break;
-                }
+                wait_ready( _socket, true );
                 continue;
             }
             throw_errno( "write" );
@@ -271,6 +300,163 @@ void tcp_socket::write( const void *buf, size_t bytes )
 
 ////////////////////////////////////////
 
+void tcp_socket::write( const buffer *bufs, size_t count )
+{
+#ifdef _WIN32
+    for ( size_t i = 0; i < count; ++i )
+        write( bufs[i].data, bufs[i].size );
+#else
+    precondition( count <= 16, "too many buffers to write at once ({0})", count );
+    struct iovec iov[16];
+    for ( size_t i = 0; i < count; ++i )
+    {
+        iov[i].iov_base = const_cast<void *>( bufs[i].data );
+        iov[i].iov_len  = bufs[i].size;
+    }
+
+    struct iovec *cur = iov;
+    while ( count > 0 )
+    {
+        ssize_t nwrite = ::writev( _socket, cur, static_cast<int>( count ) );
+        if ( nwrite < 0 )
+        {
+            int e = errno;
+            if ( e == EINTR )
+                continue;
+
+            if ( e == EAGAIN || e == EWOULDBLOCK )
+            {
+                wait_ready( _socket, true );
+                continue;
+            }
+            throw_errno( "writev" );
+        }
+
+        // skip what was written, which may end part way into a buffer
+        size_t done = static_cast<size_t>( nwrite );
+        while ( count > 0 && done >= cur->iov_len )
+        {
+            done -= cur->iov_len;
+            ++cur;
+            --count;
+        }
+        if ( count > 0 )
+        {
+            cur->iov_base = static_cast<char *>( cur->iov_base ) + done;
+            cur->iov_len -= done;
+        }
+    }
+#endif
+}
+
+////////////////////////////////////////
+
+size_t tcp_socket::read_some( void *buf, size_t bytes, bool &closed )
+{
+    closed = false;
+    while ( true )
+    {
+        ssize_t nread = ::read( _socket, buf, bytes );
+        if ( nread > 0 )
+            return static_cast<size_t>( nread );
+        if ( nread == 0 )
+        {
+            closed = bytes > 0;
+            return 0;
+        }
+        if ( errno == EAGAIN || errno == EWOULDBLOCK )
+            return 0;
+        if ( errno == ECONNRESET )
+        {
+            closed = true;
+            return 0;
+        }
+        if ( errno != EINTR )
+            throw_errno( "reading TCP socket {0}", _socket );
+    }
+}
+
+////////////////////////////////////////
+
+void tcp_socket::send_file( int fd, uint64_t offset, uint64_t bytes )
+{
+#ifdef __linux__
+    while ( bytes > 0 )
+    {
+        off_t   off = static_cast<off_t>( offset );
+        ssize_t n   = ::sendfile(
+            _socket, fd, &off, static_cast<size_t>( std::min<uint64_t>( bytes, 1 << 30 ) ) );
+        if ( n > 0 )
+        {
+            offset += static_cast<uint64_t>( n );
+            bytes -= static_cast<uint64_t>( n );
+            continue;
+        }
+        if ( n == 0 )
+            throw_runtime( "file ended {0} bytes early", bytes );
+        if ( errno == EINTR )
+            continue;
+        if ( errno == EAGAIN || errno == EWOULDBLOCK )
+        {
+            wait_ready( _socket, true );
+            continue;
+        }
+        // not a file sendfile can handle, fall back to reading it
+        if ( errno == EINVAL || errno == ENOSYS )
+            break;
+        throw_errno( "sendfile" );
+    }
+    if ( bytes == 0 )
+        return;
+#endif
+
+#ifdef _WIN32
+    if ( ::_lseeki64( fd, static_cast<__int64>( offset ), SEEK_SET ) < 0 )
+        throw_errno( "seeking file to send" );
+#endif
+
+    // otherwise read it a piece at a time (rather than mapping it, where
+    // the file being truncated meanwhile would raise SIGBUS)
+    char buf[65536];
+    while ( bytes > 0 )
+    {
+        size_t want = static_cast<size_t>( std::min<uint64_t>( bytes, sizeof( buf ) ) );
+#ifdef _WIN32
+        auto n = ::_read( fd, buf, static_cast<unsigned>( want ) );
+#else
+        ssize_t n = ::pread( fd, buf, want, static_cast<off_t>( offset ) );
+#endif
+        if ( n < 0 && errno == EINTR )
+            continue;
+        if ( n < 0 )
+            throw_errno( "reading file to send" );
+        if ( n == 0 )
+            throw_runtime( "file ended {0} bytes early", bytes );
+        write( buf, static_cast<size_t>( n ) );
+        offset += static_cast<uint64_t>( n );
+        bytes -= static_cast<uint64_t>( n );
+    }
+}
+
+////////////////////////////////////////
+
+void tcp_socket::set_cork( bool cork )
+{
+#if defined( __linux__ )
+    int on = cork ? 1 : 0;
+    if ( setsockopt( _socket, IPPROTO_TCP, TCP_CORK, &on, sizeof( on ) ) < 0 )
+        throw_errno( "setsockopt/cork" );
+#elif defined( TCP_NOPUSH )
+    int on = cork ? 1 : 0;
+    if ( setsockopt( _socket, IPPROTO_TCP, TCP_NOPUSH, &on, sizeof( on ) ) < 0 )
+        throw_errno( "setsockopt/nopush" );
+#else
+    ( void )cork;
+#endif
+}
+
+////////////////////////////////////////
+
 size_t tcp_socket::bytes_waiting( void )
 {
 #ifdef _WIN32
@@ -289,13 +475,21 @@ size_t tcp_socket::bytes_waiting( void )
 
 void tcp_socket::wait( void )
 {
-    fd_set readset;
-    FD_ZERO( &readset );
-    FD_SET( _socket, &readset );
-
-    int count = ::select( _socket + 1, &readset, nullptr, nullptr, nullptr );
+    struct pollfd pfd;
+    pfd.fd     = _socket;
+    pfd.events = POLLIN;
+    int count  = 0;
+    do
+    {
+        pfd.revents = 0;
+#ifdef _WIN32
+        count = WSAPoll( &pfd, 1, -1 );
+#else
+        count = ::poll( &pfd, 1, -1 );
+#endif
+    } while ( count < 0 && errno == EINTR );
     if ( count < 0 )
-        throw_errno( "wait/select" );
+        throw_errno( "wait/poll" );
 }
 
 ////////////////////////////////////////
@@ -32,11 +32,43 @@ public:
 
     void connect( uint32_t host, uint16_t port, double timeout = 0.0 );
 
+    /// @brief Accept a connection
+    /// A non-blocking socket returns a null pointer when no connection
+    /// is waiting.
     std::shared_ptr<tcp_socket> accept( void );
 
     void read( void *buf, size_t bytes );
     void write( const void *buf, size_t bytes );
 
+    /// @brief Piece of memory to write
+    struct buffer
+    {
+        const void *data;
+        size_t      size;
+    };
+
+    /// @brief Write several pieces of memory
+    /// Gathered into a single system call (writev), so a header and
+    /// the content after it need not be copied together first, nor go
+    /// out in separate packets.
+    void write( const buffer *bufs, size_t count );
+
+    /// @brief Read up to bytes of what has arrived
+    /// Returns the number of bytes read, which is 0 when nothing has
+    /// arrived on a non-blocking socket, and sets closed once the
+    /// other end has shut down the connection.
+    size_t read_some( void *buf, size_t bytes, bool &closed );
+
+    /// @brief Send part of an open file
+    /// Uses sendfile where possible, so the file is never copied into
+    /// user space, and reads the file a piece at a time otherwise.
+    void send_file( int fd, uint64_t offset, uint64_t bytes );
+
+    /// @brief Hold back partial packets until uncorked
+    /// So a header and the start of the content written after it can
+    /// go out in the same packet.
+    void set_cork( bool cork );
+
     size_t bytes_waiting( void );
 
     void wait( void );
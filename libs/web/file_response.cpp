@@ -0,0 +1,242 @@
+// SPDX-License-Identifier: MIT
+// Copyright contributors to the gecko project.
+
+#include "file_response.h"
+
+#include <base/contract.h>
+#include <base/scope_guard.h>
+#include <fcntl.h>
+#include <limits>
+#include <sys/stat.h>
+#include <unistd.h>
+
+namespace
+{
+////////////////////////////////////////
+
+std::string header_value( const web::request &req, const char *name )
+{
+    return req.find_header( name ).to_string();
+}
+
+////////////////////////////////////////
+
+std::string http_date( time_t t )
+{
+    struct tm tmv;
+    ::gmtime_r( &t, &tmv );
+    char buf[64];
+    size_t n = ::strftime( buf, sizeof( buf ), "%a, %d %b %Y %H:%M:%S GMT", &tmv );
+    return std::string( buf, n );
+}
+
+////////////////////////////////////////
+
+// the time of an HTTP date, or -1 if it is not one
+time_t parse_http_date( const std::string &d )
+{
+    struct tm tmv = {};
+    const char *end = ::strptime( d.c_str(), "%a, %d %b %Y %H:%M:%S GMT", &tmv );
+    if ( !end || *end != '\0' )
+        return -1;
+    return ::timegm( &tmv );
+}
+
+////////////////////////////////////////
+
+// whether any of the comma separated entity tags are the same (weakly,
+// which is all a GET needs) as the tag, or are *
+bool etag_matches( const std::string &tags, const std::string &etag )
+{
+    auto weak = []( std::string t ) {
+        if ( t.compare( 0, 2, "W/" ) == 0 )
+            t.erase( 0, 2 );
+        return t;
+    };
+    std::string want = weak( etag );
+
+    size_t pos = 0;
+    while ( pos < tags.size() )
+    {
+        size_t end = tags.find( ',', pos );
+        if ( end == std::string::npos )
+            end = tags.size();
+        std::string t = tags.substr( pos, end - pos );
+        t.erase( 0, t.find_first_not_of( " \t" ) );
+        t.erase( t.find_last_not_of( " \t" ) + 1 );
+        if ( t == "*" || weak( t ) == want )
+            return true;
+        pos = end + 1;
+    }
+    return false;
+}
+
+////////////////////////////////////////
+
+// parses a Range header into the first byte and the number of bytes,
+// returning 1 for a range to send, 0 for a range to ignore (several
+// ranges, or not understood) and -1 for a range past the end
+int parse_range( const std::string &range, uint64_t size, uint64_t &first, uint64_t &count )
+{
+    if ( range.compare( 0, 6, "bytes=" ) != 0 || range.find( ',' ) != std::string::npos )
+        return 0;
+
+    std::string spec = range.substr( 6 );
+    size_t      dash = spec.find( '-' );
+    if ( dash == std::string::npos )
+        return 0;
+
+    auto number = []( const std::string &s, uint64_t &v ) {
+        // too large a number is not understood either
+        if ( s.empty() )
+            return false;
+        v = 0;
+        for ( char c: s )
+        {
+            if ( c < '0' || c > '9' ||
+                 v > ( std::numeric_limits<uint64_t>::max() - uint64_t( c - '0' ) ) / 10 )
+                return false;
+            v = v * 10 + uint64_t( c - '0' );
+        }
+        return true;
+    };
+
+    uint64_t a = 0, b = 0;
+    bool     hasA = number( spec.substr( 0, dash ), a );
+    bool     hasB = number( spec.substr( dash + 1 ), b );
+    if ( !hasA )
+    {
+        // the last b bytes
+        if ( !hasB || dash != 0 )
+            return 0;
+        if ( b == 0 || size == 0 )
+            return -1;
+        count = std::min( b, size );
+        first = size - count;
+        return 1;
+    }
+
+    if ( dash + 1 != spec.size() && !hasB )
+        return 0;
+    if ( hasB && b < a )
+        return 0;
+    if ( a >= size )
+        return -1;
+    first = a;
+    count = ( hasB ? std::min( b, size - 1 ) : size - 1 ) - a + 1;
+    return 1;
+}
+
+////////////////////////////////////////
+
+} // namespace
+
+namespace web
+{
+////////////////////////////////////////
+
+file_response::file_response( const std::string &path )
+{
+    _fd = ::open( path.c_str(), O_RDONLY | O_CLOEXEC );
+    if ( _fd < 0 )
+        throw_errno( "opening {0}", path );
+
+    struct stat st;
+    if ( ::fstat( _fd, &st ) != 0 )
+    {
+        int e = errno;
+        ::close( _fd );
+        errno = e;
+        throw_errno( "stat of {0}", path );
+    }
+    if ( !S_ISREG( st.st_mode ) )
+    {
+        ::close( _fd );
+        throw_runtime( "not a regular file: {0}", path );
+    }
+
+    _size     = static_cast<uint64_t>( st.st_size );
+    _mtime    = st.st_mtime;
+    _modified = http_date( _mtime );
+    _etag     = base::format(
+        "\"{0,b16}-{1,b16}\"", _size, static_cast<uint64_t>( _mtime ) );
+}
+
+////////////////////////////////////////
+
+file_response::~file_response( void )
+{
+    if ( _fd >= 0 )
+        ::close( _fd );
+}
+
+////////////////////////////////////////
+
+void file_response::send( const request &req, net::tcp_socket &socket )
+{
+    response resp( _head );
+    resp.set_header( "ETag", _etag );
+    resp.set_header( "Last-Modified", _modified );
+    resp.set_header( "Accept-Ranges", "bytes" );
+
+    // If-None-Match wins over If-Modified-Since when both are there
+    bool        unchanged = false;
+    std::string inm       = header_value( req, "If-None-Match" );
+    if ( !inm.empty() )
+        unchanged = etag_matches( inm, _etag );
+    else
+    {
+        time_t since = parse_http_date( header_value( req, "If-Modified-Since" ) );
+        unchanged    = since != -1 && _mtime <= since;
+    }
+    if ( unchanged )
+    {
+        resp.set_status_code( status_code::NOT_MODIFIED );
+        resp.send_head( socket, _size );
+        return;
+    }
+
+    uint64_t    first   = 0;
+    uint64_t    count   = _size;
+    std::string range   = header_value( req, "Range" );
+    std::string ifRange = header_value( req, "If-Range" );
+    // a range of a file which changed since the client last had it
+    // would be a piece of something else, so the whole file is sent
+    if ( !range.empty() && ( ifRange.empty() || ifRange == _etag || ifRange == _modified ) )
+    {
+        int r = parse_range( range, _size, first, count );
+        if ( r < 0 )
+        {
+            response bad;
+            bad.set_status_code( status_code::RANGE_NOT_SATISFIABLE );
+            bad.set_header( "Content-Range", base::format( "bytes */{0}", _size ) );
+            bad.send( socket );
+            return;
+        }
+        if ( r > 0 )
+        {
+            resp.set_status_code( status_code::PARTIAL_CONTENT );
+            resp.set_header(
+                "Content-Range",
+                base::format( "bytes {0}-{1}/{2}", first, first + count - 1, _size ) );
+        }
+    }
+
+    socket.set_cork( true );
+    on_scope_exit
+    {
+        try
+        {
+            socket.set_cork( false );
+        }
+        catch ( ... )
+        {}
+    };
+    resp.send_head( socket, count );
+    if ( req.method() != "HEAD" && count > 0 )
+        socket.send_file( _fd, first, count );
+}
+
+////////////////////////////////////////
+
+} // namespace web
@@ -0,0 +1,70 @@
+// SPDX-License-Identifier: MIT
+// Copyright contributors to the gecko project.
+
+#pragma once
+
+#include "request.h"
+#include "response.h"
+
+#include <cstdint>
+#include <ctime>
+#include <string>
+
+namespace web
+{
+////////////////////////////////////////
+
+/// @brief Response with the content of a file.
+///
+/// The content goes straight from the file to the socket (see
+/// net::tcp_socket::send_file), without being copied through user
+/// space where the system allows, so a large file is sent as fast as
+/// the network goes using no more memory than a small one. The header
+/// is corked up with the start of the content, so they go out in the
+/// same packet.
+///
+/// A single byte range may be asked for (Range, and If-Range), and the
+/// ETag and Last-Modified sent let clients revalidate what they have
+/// with a conditional GET (If-None-Match or If-Modified-Since).
+class file_response
+{
+public:
+    /// @brief Open the file to send
+    /// Throws if it is not a regular file which can be read.
+    explicit file_response( const std::string &path );
+    ~file_response( void );
+    file_response( const file_response & ) = delete;
+    file_response &operator=( const file_response & ) = delete;
+
+    /// @brief Add an HTTP header (e.g. Content-Type) to send
+    void set_header( std::string n, std::string v )
+    {
+        _head.set_header( std::move( n ), std::move( v ) );
+    }
+
+    /// @brief Size of the file
+    uint64_t size( void ) const { return _size; }
+
+    /// @brief Entity tag of the file (changes as the file does)
+    const std::string &etag( void ) const { return _etag; }
+
+    /// @brief Modification time of the file, as an HTTP date
+    const std::string &last_modified( void ) const { return _modified; }
+
+    /// @brief Send the file (or the part asked for) answering the request
+    /// Only the header is sent for a HEAD request, or when the client
+    /// already has the file (304 Not Modified).
+    void send( const request &req, net::tcp_socket &socket );
+
+private:
+    int         _fd   = -1;
+    uint64_t    _size = 0;
+    time_t      _mtime = 0;
+    std::string _etag;
+    std::string _modified;
+    response    _head;
+};
+
+////////////////////////////////////////
+
+} // namespace web
@@ -0,0 +1,288 @@
+// SPDX-License-Identifier: MIT
+// Copyright contributors to the gecko project.
+
+#include "http_parser.h"
+
+#include <base/contract.h>
+#include <cstring>
+#include <limits>
+#include <strings.h>
+
+namespace
+{
+////////////////////////////////////////
+
+bool iequal( base::cstring a, base::cstring b )
+{
+    return a.size() == b.size() && ::strncasecmp( a.data(), b.data(), a.size() ) == 0;
+}
+
+////////////////////////////////////////
+
+inline bool is_space( char c ) { return c == ' ' || c == '\t'; }
+
+////////////////////////////////////////
+
+int hex_digit( char c )
+{
+    if ( c >= '0' && c <= '9' )
+        return c - '0';
+    if ( c >= 'a' && c <= 'f' )
+        return c - 'a' + 10;
+    if ( c >= 'A' && c <= 'F' )
+        return c - 'A' + 10;
+    return -1;
+}
+
+////////////////////////////////////////
+
+} // namespace
+
+namespace web
+{
+////////////////////////////////////////
+
+http_parser::http_parser( size_t max_header, size_t max_fields )
+    : _max_header( max_header ), _max_fields( max_fields )
+{}
+
+////////////////////////////////////////
+
+bool http_parser::parse( const recv_buffer &in )
+{
+    _base  = in.data();
+    _avail = in.size();
+
+    span line;
+    while ( true )
+    {
+        switch ( _state )
+        {
+            case state::START_LINE:
+                if ( !next_line( line ) )
+                    return false;
+                // stray empty lines between messages are skipped
+                if ( line.len > 0 )
+                {
+                    _start = line;
+                    _state = state::HEADER;
+                }
+                break;
+
+            case state::HEADER:
+                if ( !next_line( line ) )
+                    return false;
+                if ( line.len == 0 )
+                    start_content();
+                else
+                    add_field( line );
+                if ( _pos > _max_header )
+                    throw_runtime( "HTTP header larger than {0} bytes", _max_header );
+                break;
+
+            case state::CONTENT:
+                if ( _avail - _pos < _remaining )
+                    return false;
+                _content.push_back(
+                    { static_cast<uint32_t>( _pos ), static_cast<uint32_t>( _remaining ) } );
+                _pos += _remaining;
+                _state = state::DONE;
+                break;
+
+            case state::CHUNK_SIZE:
+            {
+                if ( !next_line( line ) )
+                    return false;
+                const char *p    = _base + line.off;
+                const char *e    = p + line.len;
+                size_t      size = 0;
+                const char *s    = p;
+                for ( int d; p != e && ( d = hex_digit( *p ) ) >= 0; ++p )
+                {
+                    if ( size > ( std::numeric_limits<uint32_t>::max() >> 4 ) )
+                        throw_runtime( "HTTP chunk too large" );
+                    size = size * 16 + static_cast<size_t>( d );
+                }
+                // chunk extensions are ignored
+                if ( p == s || ( p != e && *p != ';' && !is_space( *p ) ) )
+                    throw_runtime( "invalid HTTP chunk size" );
+                _remaining = size;
+                _state     = size == 0 ? state::TRAILER : state::CHUNK_DATA;
+                break;
+            }
+
+            case state::CHUNK_DATA:
+                if ( _avail - _pos < _remaining + 2 )
+                    return false;
+                if ( _base[_pos + _remaining] != '\r' ||
+                     _base[_pos + _remaining + 1] != '\n' )
+                    throw_runtime( "invalid HTTP chunk" );
+                _content.push_back(
+                    { static_cast<uint32_t>( _pos ), static_cast<uint32_t>( _remaining ) } );
+                _pos += _remaining + 2;
+                _state = state::CHUNK_SIZE;
+                break;
+
+            case state::TRAILER:
+                if ( !next_line( line ) )
+                    return false;
+                if ( line.len == 0 )
+                    _state = state::DONE;
+                else
+                    add_field( line );
+                break;
+
+            case state::DONE: return true;
+        }
+
+        if ( _pos > std::numeric_limits<uint32_t>::max() )
+            throw_runtime( "HTTP message too large" );
+    }
+}
+
+////////////////////////////////////////
+
+void http_parser::read( net::tcp_socket &socket, recv_buffer &in )
+{
+    while ( !parse( in ) )
+        in.read_more( socket );
+}
+
+////////////////////////////////////////
+
+base::cstring http_parser::find( base::cstring name ) const
+{
+    for ( auto &f: _fields )
+    {
+        if ( iequal( view( f.name ), name ) )
+            return view( f.value );
+    }
+    return base::cstring();
+}
+
+////////////////////////////////////////
+
+size_t http_parser::content_size( void ) const
+{
+    size_t n = 0;
+    for ( auto &c: _content )
+        n += c.len;
+    return n;
+}
+
+////////////////////////////////////////
+
+void http_parser::append_content( std::string &out ) const
+{
+    if ( _content.size() == 1 && out.empty() )
+    {
+        out.assign( _base + _content[0].off, _content[0].len );
+        return;
+    }
+
+    out.reserve( out.size() + content_size() );
+    for ( auto &c: _content )
+        out.append( _base + c.off, c.len );
+}
+
+////////////////////////////////////////
+
+void http_parser::reset( void )
+{
+    _state     = state::START_LINE;
+    _pos       = 0;
+    _scan      = 0;
+    _remaining = 0;
+    _start     = span();
+    // cleared rather than freed, so parsing the next message does not
+    // allocate
+    _fields.clear();
+    _content.clear();
+}
+
+////////////////////////////////////////
+
+bool http_parser::next_line( span &line )
+{
+    // lines are only searched once, however many pieces they arrive in
+    if ( _scan < _pos )
+        _scan = _pos;
+    const void *nl = std::memchr( _base + _scan, '\n', _avail - _scan );
+    if ( !nl )
+    {
+        _scan = _avail;
+        if ( _avail - _pos > _max_header )
+            throw_runtime( "HTTP header larger than {0} bytes", _max_header );
+        return false;
+    }
+
+    size_t end = static_cast<size_t>( static_cast<const char *>( nl ) - _base );
+    if ( end == _pos || _base[end - 1] != '\r' )
+        throw_runtime( "invalid HTTP line" );
+    line.off = static_cast<uint32_t>( _pos );
+    line.len = static_cast<uint32_t>( end - 1 - _pos );
+    _pos     = end + 1;
+    return true;
+}
+
+////////////////////////////////////////
+
+void http_parser::add_field( const span &line )
+{
+    if ( _fields.size() >= _max_fields )
+        throw_runtime( "more than {0} HTTP header fields", _max_fields );
+
+    const char *p     = _base + line.off;
+    const char *e     = p + line.len;
+    const char *colon = static_cast<const char *>( std::memchr( p, ':', line.len ) );
+    // no white space is allowed in (or around) the name, which also
+    // refuses obsolete line folding
+    if ( !colon || colon == p || is_space( *p ) || is_space( colon[-1] ) )
+        throw_runtime( "invalid HTTP header field" );
+
+    const char *v = colon + 1;
+    while ( v != e && is_space( *v ) )
+        ++v;
+    while ( e != v && is_space( e[-1] ) )
+        --e;
+
+    field f;
+    f.name.off  = line.off;
+    f.name.len  = static_cast<uint32_t>( colon - p );
+    f.value.off = static_cast<uint32_t>( v - _base );
+    f.value.len = static_cast<uint32_t>( e - v );
+    _fields.push_back( f );
+}
+
+////////////////////////////////////////
+
+void http_parser::start_content( void )
+{
+    base::cstring te = find( "Transfer-Encoding" );
+    base::cstring cl = find( "Content-Length" );
+    if ( !te.empty() )
+    {
+        if ( !iequal( te, "chunked" ) )
+            throw_runtime( "unsupported Transfer-Encoding: {0}", te.to_string() );
+        _state = state::CHUNK_SIZE;
+    }
+    else if ( !cl.empty() )
+    {
+        size_t len = 0;
+        for ( size_t i = 0; i < cl.size(); ++i )
+        {
+            char c = cl[i];
+            if ( c < '0' || c > '9' || len > std::numeric_limits<uint32_t>::max() )
+                throw_runtime( "invalid Content-Length: {0}", cl.to_string() );
+            len = len * 10 + static_cast<size_t>( c - '0' );
+        }
+        _remaining = len;
+        _state     = state::CONTENT;
+    }
+    else
+        _state = state::DONE;
+}
+
+////////////////////////////////////////
+
+} // namespace web
@@ -0,0 +1,133 @@
+// SPDX-License-Identifier: MIT
+// Copyright contributors to the gecko project.
+
+#pragma once
+
+#include "recv_buffer.h"
+
+#include <base/const_string.h>
+#include <cstdint>
+#include <cstring>
+#include <string>
+#include <vector>
+
+namespace web
+{
+////////////////////////////////////////
+
+/// @brief Incremental parser of an HTTP message (request or response).
+///
+/// The message is parsed in place, out of the bytes received so far.
+/// Each call to parse carries on from where the last one stopped, so
+/// a message arriving in pieces is still only looked at once. The
+/// start line, header names and values are base::cstring views into
+/// the buffer, valid until the message is consumed from it. Chunked
+/// content is located in place as well, and only copied out (once)
+/// by append_content.
+class http_parser
+{
+public:
+    /// @brief Constructor
+    /// Messages with a start line and header larger than max_header
+    /// bytes, or with more than max_fields fields, are refused.
+    explicit http_parser( size_t max_header = 64 * 1024, size_t max_fields = 100 );
+
+    /// @brief Parse what has arrived in the buffer
+    /// Returns true once the whole message has arrived. Throws if the
+    /// message is invalid or over the limits.
+    bool parse( const recv_buffer &in );
+
+    /// @brief Wait for and parse a whole message from the socket
+    void read( net::tcp_socket &socket, recv_buffer &in );
+
+    /// @brief Whether the whole message has been parsed
+    bool done( void ) const { return _state == state::DONE; }
+
+    /// @brief Size of the whole message in the buffer
+    size_t size( void ) const { return _pos; }
+
+    /// @brief Request line (or status line of a response)
+    base::cstring start_line( void ) const { return view( _start ); }
+
+    /// @brief Number of header (and trailer) fields
+    size_t field_count( void ) const { return _fields.size(); }
+
+    base::cstring field_name( size_t i ) const { return view( _fields[i].name ); }
+    base::cstring field_value( size_t i ) const { return view( _fields[i].value ); }
+
+    /// @brief Value of the (case insensitive) named field, or empty
+    base::cstring find( base::cstring name ) const;
+
+    /// @brief Size of the content, once de-chunked
+    size_t content_size( void ) const;
+
+    /// @brief Append the content (de-chunked) to a string
+    void append_content( std::string &out ) const;
+
+    /// @brief Start parsing the next message
+    /// To be called once the parsed message is consumed from the buffer.
+    void reset( void );
+
+private:
+    enum class state
+    {
+        START_LINE,
+        HEADER,
+        CONTENT,
+        CHUNK_SIZE,
+        CHUNK_DATA,
+        TRAILER,
+        DONE
+    };
+
+    struct span
+    {
+        uint32_t off = 0;
+        uint32_t len = 0;
+    };
+
+    struct field
+    {
+        span name;
+        span value;
+    };
+
+    base::cstring view( const span &s ) const
+    {
+        return base::cstring( _base + s.off, s.len );
+    }
+
+    bool next_line( span &line );
+    void add_field( const span &line );
+    void start_content( void );
+
+    const char *       _base  = nullptr;
+    size_t             _avail = 0;
+    size_t             _pos   = 0;
+    size_t             _scan  = 0;
+    size_t             _max_header;
+    size_t             _max_fields;
+    state              _state = state::START_LINE;
+    span               _start;
+    std::vector<field> _fields;
+    std::vector<span>  _content;
+    size_t             _remaining = 0;
+};
+
+////////////////////////////////////////
+
+/// @brief Position of the first c in s at or after pos, or npos
+/// A single memchr, where const_string::find recurses once per
+/// character, and a request line can be as long as the header limit.
+inline size_t find_char( base::cstring s, char c, size_t pos = 0 )
+{
+    if ( pos >= s.size() )
+        return base::cstring::npos;
+    const void *p = std::memchr( s.data() + pos, c, s.size() - pos );
+    return p ? static_cast<size_t>( static_cast<const char *>( p ) - s.data() )
+             : base::cstring::npos;
+}
+
+////////////////////////////////////////
+
+} // namespace web
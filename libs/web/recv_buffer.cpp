@@ -0,0 +1,91 @@
+// SPDX-License-Identifier: MIT
+// Copyright contributors to the gecko project.
+
+#include "recv_buffer.h"
+
+#include <algorithm>
+#include <base/contract.h>
+#include <cstring>
+
+namespace web
+{
+////////////////////////////////////////
+
+bool recv_buffer::fill( net::tcp_socket &socket )
+{
+    const size_t chunk = 16384;
+
+    // move what is left to the front rather than grow forever
+    if ( _pos > 0 && _pos >= _data.size() / 2 )
+    {
+        _data.erase( 0, _pos );
+        _pos = 0;
+    }
+
+    // a single read, so a blocking socket only waits if nothing has
+    // arrived yet
+    size_t off = _data.size();
+    _data.resize( off + chunk );
+    bool   closed = false;
+    size_t n      = socket.read_some( &_data[off], chunk, closed );
+    _data.resize( off + n );
+    return !closed;
+}
+
+////////////////////////////////////////
+
+void recv_buffer::read_more( net::tcp_socket &socket )
+{
+    size_t had = size();
+    while ( size() == had )
+    {
+        socket.wait();
+        if ( !fill( socket ) && size() == had )
+            throw_location( std::system_error(
+                ECONNABORTED,
+                std::system_category(),
+                base::format( "TCP socket read {0}", socket.get_socket() ) ) );
+    }
+}
+
+////////////////////////////////////////
+
+void recv_buffer::read( void *buf, size_t bytes )
+{
+    if ( bytes > size() )
+        throw_runtime( "HTTP message ended early" );
+    std::memcpy( buf, data(), bytes );
+    consume( bytes );
+}
+
+////////////////////////////////////////
+
+void recv_buffer::read( net::tcp_socket &socket, void *buf, size_t bytes )
+{
+    // a few bytes missing are read into the buffer along with whatever
+    // follows them, more than that go straight to their destination
+    while ( size() < bytes && bytes - size() < 4096 )
+        read_more( socket );
+
+    size_t have = std::min( bytes, size() );
+    read( buf, have );
+    if ( bytes > have )
+        socket.read( static_cast<char *>( buf ) + have, bytes - have );
+}
+
+////////////////////////////////////////
+
+void recv_buffer::consume( size_t bytes )
+{
+    precondition( bytes <= size(), "consuming more than is buffered" );
+    _pos += bytes;
+    if ( _pos == _data.size() )
+    {
+        _data.clear();
+        _pos = 0;
+    }
+}
+
+////////////////////////////////////////
+
+} // namespace web
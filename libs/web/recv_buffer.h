@@ -0,0 +1,62 @@
+// SPDX-License-Identifier: MIT
+// Copyright contributors to the gecko project.
+
+#pragma once
+
+#include <cstddef>
+#include <net/tcp_socket.h>
+#include <string>
+
+namespace web
+{
+////////////////////////////////////////
+
+/// @brief Bytes received on a connection but not yet parsed.
+///
+/// Reads from the socket are done a buffer at a time rather than the
+/// few bytes wanted next, and the messages parsed out of what has
+/// arrived. Whatever arrived past the end of a message is left in the
+/// buffer for the next one.
+class recv_buffer
+{
+public:
+    /// @brief Read whatever has arrived on the socket
+    /// Does not wait on a non-blocking socket. Returns false once the
+    /// other end has closed the connection.
+    bool fill( net::tcp_socket &socket );
+
+    /// @brief Wait for more to arrive on the socket
+    /// Throws if the connection is closed first.
+    void read_more( net::tcp_socket &socket );
+
+    /// @brief Add bytes received some other way
+    void append( const char *data, size_t bytes ) { _data.append( data, bytes ); }
+
+    /// @brief The bytes not yet consumed
+    const char *data( void ) const { return _data.data() + _pos; }
+
+    /// @brief The number of bytes not yet consumed
+    size_t size( void ) const { return _data.size() - _pos; }
+
+    bool empty( void ) const { return _pos == _data.size(); }
+
+    /// @brief Copy out and consume bytes
+    /// Throws if fewer bytes than that are buffered.
+    void read( void *buf, size_t bytes );
+
+    /// @brief Copy out and consume bytes, reading any not yet buffered
+    /// Large amounts missing are read straight from the socket rather
+    /// than through the buffer.
+    void read( net::tcp_socket &socket, void *buf, size_t bytes );
+
+    /// @brief Drop bytes from the front of the buffer
+    void consume( size_t bytes );
+
+private:
+    std::string _data;
+    size_t      _pos = 0;
+};
+
+////////////////////////////////////////
+
+} // namespace web
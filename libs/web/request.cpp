@@ -11,41 +11,30 @@ namespace web
 
 request::request( net::tcp_socket &socket )
 {
-    std::string line = read_line( socket );
-    size_t      off  = line.find( ' ' );
-    if ( off == std::string::npos )
-        throw_runtime( "invalid HTTP request" );
-    size_t off2 = line.find( ' ', off + 1 );
-    if ( off2 == std::string::npos )
-        throw_runtime( "invalid HTTP request" );
-    size_t off3 = line.find( '/', off2 + 1 );
-    if ( off3 == std::string::npos )
-        throw_runtime( "invalid HTTP request" );
-    _method              = line.substr( 0, off );
-    std::string tmp_path = line.substr( off + 1, off2 - off - 1 );
-    _version             = line.substr( off3 + 1 );
-
-    line = read_line( socket );
-    while ( !line.empty() )
-    {
-        off = line.find( ':' );
-        if ( off == std::string::npos )
-            throw_runtime( "invalid HTTP request" );
-        std::string key( line.substr( 0, off ) );
-        std::string value( line.substr( off + 2 ) );
-        _header[key] = value;
-        line         = read_line( socket );
-    }
+    recv_buffer in;
+    http_parser msg;
+    msg.read( socket, in );
+    parse( msg );
+    own_header();
+}
 
-    auto host = _header.find( "Host" );
-    if ( host != _header.end() )
-        _path = base::uri( "http", host->second, tmp_path );
+////////////////////////////////////////
 
-    read_content( socket );
+request::request( net::tcp_socket &socket, recv_buffer &in )
+{
+    http_parser msg;
+    msg.read( socket, in );
+    parse( msg );
+    own_header();
+    in.consume( msg.size() );
 }
 
 ////////////////////////////////////////
 
+request::request( const http_parser &msg ) { parse( msg ); }
+
+////////////////////////////////////////
+
 request::request(
     std::string method, const base::uri &path, std::string version )
     : web_base( std::move( version ) )
@@ -59,11 +48,23 @@ request::~request( void ) {}
 
 ////////////////////////////////////////
 
+std::string request::path_param( const std::string &name ) const
+{
+    for ( auto &p: _params )
+    {
+        if ( p.first == name )
+            return p.second;
+    }
+    return std::string();
+}
+
+////////////////////////////////////////
+
 void request::send( net::tcp_socket &server )
 {
     std::string tmp = base::format(
         "{0} {1} HTTP/{2}\r\n", _method, _path.full_path(), _version );
-    for ( auto &h: _header )
+    for ( auto &h: header() )
         tmp += base::format( "{0}: {1}\r\n", h.first, h.second );
     if ( !_content.empty() )
         tmp += base::format( "Content-Length: {0}\r\n", _content.size() );
@@ -75,6 +76,33 @@ void request::send( net::tcp_socket &server )
 
 ////////////////////////////////////////
 
+void request::parse( const http_parser &msg )
+{
+    precondition( msg.done(), "HTTP request not yet parsed" );
+
+    base::cstring line = msg.start_line();
+    size_t        off  = find_char( line, ' ' );
+    if ( off == base::cstring::npos )
+        throw_runtime( "invalid HTTP request" );
+    size_t off2 = find_char( line, ' ', off + 1 );
+    if ( off2 == base::cstring::npos )
+        throw_runtime( "invalid HTTP request" );
+    size_t off3 = find_char( line, '/', off2 + 1 );
+    if ( off3 == base::cstring::npos )
+        throw_runtime( "invalid HTTP request" );
+    _method                = line.substr( 0, off ).to_string();
+    base::cstring tmp_path = line.substr( off + 1, off2 - off - 1 );
+    _version               = line.substr( off3 + 1 ).to_string();
+
+    set_fields( msg );
+
+    base::cstring host = msg.find( "Host" );
+    if ( !host.empty() )
+        _path = base::uri( "http", host.to_string(), tmp_path.to_string() );
+}
+
+////////////////////////////////////////
+
 std::ostream &operator<<( std::ostream &out, const request &r )
 {
     std::string tmp = base::format(
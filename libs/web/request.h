@@ -8,6 +8,7 @@
 #include <base/uri.h>
 #include <map>
 #include <net/tcp_socket.h>
+#include <vector>
 
 namespace web
 {
@@ -18,9 +19,22 @@ class request : public web_base
 {
 public:
     /// @brief Server constructor
-    /// The request is read from the (client) socket.
+    /// The request is read from the (client) socket, anything sent
+    /// after it is lost.
     request( net::tcp_socket &socket );
 
+    /// @brief Server constructor
+    /// The request is read through the buffer, which is left holding
+    /// anything sent after it.
+    request( net::tcp_socket &socket, recv_buffer &in );
+
+    /// @brief Server constructor
+    /// The header fields are looked up in the parsed message, which
+    /// has to stay as it is while the request is used (as the server
+    /// does while a handler runs). Copies of the request take their
+    /// own.
+    request( const http_parser &msg );
+
     /// @brief Client constructor
     /// Construct a request to send to the server.
     request(
@@ -44,15 +58,35 @@ public:
     /// @brief Get the full map of HTTP header.
     const std::map<std::string, std::string> &header( void ) const
     {
-        return _header;
+        return web_base::header();
+    }
+
+    /// @brief Parameters captured from the path by the server route
+    /// Named after the {name} segments of the route, the groups of a
+    /// regular expression route without a name have an empty name.
+    const std::vector<std::pair<std::string, std::string>> &path_params( void ) const
+    {
+        return _params;
+    }
+
+    /// @brief Value of a path parameter (empty if there is none)
+    std::string path_param( const std::string &name ) const;
+
+    /// @brief Add a path parameter
+    void add_path_param( std::string name, std::string value )
+    {
+        _params.emplace_back( std::move( name ), std::move( value ) );
     }
 
     /// @brief Send the request to the give socket
     void send( net::tcp_socket &socket );
 
 private:
-    std::string _method;
-    base::uri   _path;
+    void parse( const http_parser &msg );
+
+    std::string                                      _method;
+    base::uri                                        _path;
+    std::vector<std::pair<std::string, std::string>> _params;
 };
 
 ////////////////////////////////////////
@@ -11,37 +11,27 @@ namespace web
 
 response::response( net::tcp_socket &socket )
 {
-    std::string line = read_line( socket );
+    recv_buffer in;
+    http_parser msg;
+    msg.read( socket, in );
+    parse( msg );
+    own_header();
+}
 
-    size_t off = line.find( '/' );
-    if ( off == std::string::npos )
-        throw_runtime( "invalid HTTP response" );
-    size_t off2 = line.find( ' ', off );
-    if ( off2 == std::string::npos )
-        throw_runtime( "invalid HTTP response" );
-    size_t off3 = line.find( ' ', off2 + 1 );
-    if ( off3 == std::string::npos )
-        throw_runtime( "invalid HTTP response" );
+////////////////////////////////////////
 
-    _version = line.substr( off + 1, off2 - off - 1 );
-    _status  = static_cast<status_code>(
-        std::stoi( line.substr( off2 + 1, off2 - off3 - 1 ), nullptr, 10 ) );
-    _reason = line.substr( off3 + 1 );
+response::response( net::tcp_socket &socket, recv_buffer &in )
+{
+    http_parser msg;
+    msg.read( socket, in );
+    parse( msg );
+    own_header();
+    in.consume( msg.size() );
+}
 
-    line = read_line( socket );
-    while ( !line.empty() )
-    {
-        off = line.find( ':' );
-        if ( off == std::string::npos )
-            throw_runtime( "invalid HTTP response" );
-        std::string key( line.substr( 0, off ) );
-        std::string value( line.substr( off + 2 ) );
-        _header[key] = value;
-        line         = read_line( socket );
-    }
+////////////////////////////////////////
 
-    read_content( socket );
-}
+response::response( const http_parser &msg ) { parse( msg ); }
 
 ////////////////////////////////////////
 
@@ -50,9 +40,17 @@ response::~response( void ) {}
 ////////////////////////////////////////
 
 void response::send( net::tcp_socket &socket )
+{
+    send_head( socket, _content.size() );
+    socket.write( _content.c_str(), _content.size() );
+}
+
+////////////////////////////////////////
+
+void response::send_head( net::tcp_socket &socket, uint64_t length )
 {
     precondition(
-        _header.find( "Transfer-Encoding" ) == _header.end(),
+        header().find( "Transfer-Encoding" ) == header().end(),
         "Content-Length cannot be used with Transfer-Encoding" );
 
     std::string tmp = base::format(
@@ -60,11 +58,10 @@ void response::send( net::tcp_socket &socket )
         _version,
         static_cast<int>( _status ),
         _reason );
-    for ( auto &h: _header )
+    for ( auto &h: header() )
         tmp += base::format( "{0}: {1}\r\n", h.first, h.second );
-    tmp += base::format( "Content-Length: {0}\r\n\r\n", _content.size() );
+    tmp += base::format( "Content-Length: {0}\r\n\r\n", length );
     socket.write( tmp.c_str(), tmp.size() );
-    socket.write( _content.c_str(), _content.size() );
 }
 
 ////////////////////////////////////////
@@ -76,14 +73,14 @@ void response::send( net::tcp_socket &socket, std::istream &in )
         "invalid HTTP version for chunked response ({0})",
         _version );
     precondition(
-        _header.find( "Content-Length" ) == _header.end(),
+        header().find( "Content-Length" ) == header().end(),
         "Transfer-Encoding cannot be used with Content-Length" );
     std::string tmp = base::format(
         "HTTP/{0} {1} {2}\r\n",
         _version,
         static_cast<int>( _status ),
         _reason );
-    for ( auto &h: _header )
+    for ( auto &h: header() )
         tmp += base::format( "{0}: {1}\r\n", h.first, h.second );
     tmp += base::format( "Transfer-Encoding: chunked\r\n\r\n" );
     socket.write( tmp.c_str(), tmp.size() );
@@ -128,6 +125,31 @@ void response::send( net::tcp_socket &socket, std::istream &in )
 
 ////////////////////////////////////////
 
+void response::parse( const http_parser &msg )
+{
+    precondition( msg.done(), "HTTP response not yet parsed" );
+
+    base::cstring line = msg.start_line();
+    size_t        off  = find_char( line, '/' );
+    if ( off == base::cstring::npos )
+        throw_runtime( "invalid HTTP response" );
+    size_t off2 = find_char( line, ' ', off );
+    if ( off2 == base::cstring::npos )
+        throw_runtime( "invalid HTTP response" );
+    size_t off3 = find_char( line, ' ', off2 + 1 );
+    if ( off3 == base::cstring::npos )
+        throw_runtime( "invalid HTTP response" );
+
+    _version = line.substr( off + 1, off2 - off - 1 ).to_string();
+    _status  = static_cast<status_code>(
+        std::stoi( line.substr( off2 + 1, off3 - off2 - 1 ).to_string(), nullptr, 10 ) );
+    _reason = line.substr( off3 + 1 ).to_string();
+
+    set_fields( msg );
+}
+
+////////////////////////////////////////
+
 std::ostream &operator<<( std::ostream &out, const response &r )
 {
     std::string tmp = base::format(
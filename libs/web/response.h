@@ -27,8 +27,19 @@ public:
     response( std::string &&c ) { _content = std::move( c ); }
 
     /// @brief Constructor from a server socket
+    /// Anything sent after the response is lost.
     response( net::tcp_socket &socket );
 
+    /// @brief Constructor from a server socket
+    /// The response is read through the buffer, which is left holding
+    /// anything sent after it.
+    response( net::tcp_socket &socket, recv_buffer &in );
+
+    /// @brief Constructor from a parsed message
+    /// The header fields are looked up in the message, which has to
+    /// stay as it is while the response is used.
+    response( const http_parser &msg );
+
     virtual ~response( void );
     response( const response & ) = default;
     response( response && )      = default;
@@ -59,6 +70,11 @@ public:
     /// @brief Send the response over the socket
     void send( net::tcp_socket &socket );
 
+    /// @brief Send the status line and header over the socket
+    /// For content of the given length sent separately (or not at all,
+    /// for a HEAD request).
+    void send_head( net::tcp_socket &socket, uint64_t length );
+
     /// @brief Send the response over the socket with content from a stream
     void send( net::tcp_socket &socket, std::istream &out );
 
@@ -69,6 +85,8 @@ public:
     const std::string &reason( void ) const { return _reason; }
 
 private:
+    void parse( const http_parser &msg );
+
     status_code _status = status_code::OK;
     std::string _reason = reason_phrase( status_code::OK );
 };
@@ -0,0 +1,307 @@
+// SPDX-License-Identifier: MIT
+// Copyright contributors to the gecko project.
+
+#include "route_table.h"
+
+#include <algorithm>
+#include <base/contract.h>
+#include <cctype>
+#include <cstring>
+
+namespace
+{
+////////////////////////////////////////
+
+bool is_meta( char c ) { return std::strchr( "\\^$.|?*+()[]{}", c ) != nullptr; }
+
+////////////////////////////////////////
+
+// the length of a {name} segment starting at p, or 0 if it is not one
+size_t param_length( const std::string &p, size_t pos )
+{
+    if ( p[pos] != '{' || ( pos > 0 && p[pos - 1] != '/' ) )
+        return 0;
+    size_t end = pos + 1;
+    while ( end < p.size() && ( std::isalnum( static_cast<unsigned char>( p[end] ) ) ||
+                                p[end] == '_' ) )
+        ++end;
+    if ( end == pos + 1 || end == p.size() || p[end] != '}' )
+        return 0;
+    if ( end + 1 < p.size() && p[end + 1] != '/' )
+        return 0;
+    return end + 1 - pos;
+}
+
+////////////////////////////////////////
+
+} // namespace
+
+namespace web
+{
+////////////////////////////////////////
+
+size_t route_table::add( const std::string &pattern )
+{
+    for ( size_t i = 0; i < _routes.size(); ++i )
+    {
+        if ( _routes[i].pattern == pattern )
+            return i;
+    }
+
+    route r;
+    r.pattern = pattern;
+
+    // walk the literal start of the pattern (and its {name} segments as
+    // long as it is nothing but those) into the trie
+    uint32_t n       = 0;
+    uint32_t prefix  = 0;
+    uint32_t before  = 0;
+    size_t   pos     = 0;
+    bool     literal = true;
+    while ( pos < pattern.size() )
+    {
+        size_t plen = param_length( pattern, pos );
+        if ( plen > 0 )
+        {
+            // only a trie route if the rest has no regular expression
+            bool rest = std::none_of(
+                pattern.begin() + static_cast<std::ptrdiff_t>( pos + plen ),
+                pattern.end(),
+                []( char c ) { return is_meta( c ) && c != '{' && c != '}'; } );
+            if ( !rest )
+            {
+                literal = false;
+                break;
+            }
+            r.names.push_back( pattern.substr( pos + 1, plen - 2 ) );
+            n = add_param( n );
+            pos += plen;
+            continue;
+        }
+        if ( is_meta( pattern[pos] ) )
+        {
+            // the character before a quantifier may not be there
+            char c = pattern[pos];
+            if ( c == '?' || c == '*' || c == '{' )
+                prefix = before;
+            literal = false;
+            break;
+        }
+        before = prefix;
+        n      = add_child( n, pattern[pos] );
+        if ( r.names.empty() )
+            prefix = n;
+        ++pos;
+    }
+
+    size_t idx = _routes.size();
+    if ( literal )
+    {
+        precondition(
+            r.names.size() <= max_params,
+            "too many parameters in route {0}",
+            pattern );
+        _nodes[n].route = idx;
+        _routes.push_back( std::move( r ) );
+        return idx;
+    }
+
+    // a regular expression, with any {name} segments made into groups,
+    // tried for paths reaching the trie node of its literal prefix (which
+    // stops at the first {name})
+    r.names.clear();
+    std::string re;
+    for ( size_t i = 0; i < pattern.size(); )
+    {
+        size_t plen = param_length( pattern, i );
+        if ( plen > 0 )
+        {
+            re += "([^/]+)";
+            i += plen;
+        }
+        else
+            re.push_back( pattern[i++] );
+    }
+    r.re = std::make_unique<std::regex>( re, std::regex::ECMAScript | std::regex::optimize );
+    precondition(
+        r.re->mark_count() <= max_params, "too many groups in route {0}", pattern );
+
+    // names for the groups, those which were not {name} are left empty
+    r.names.resize( r.re->mark_count() );
+    size_t group = 0;
+    for ( size_t i = 0; i < pattern.size() && group < r.names.size(); )
+    {
+        size_t plen = param_length( pattern, i );
+        if ( plen > 0 )
+        {
+            r.names[group++] = pattern.substr( i + 1, plen - 2 );
+            i += plen;
+            continue;
+        }
+        if ( pattern[i] == '\\' )
+            i += 2;
+        else
+        {
+            if ( pattern[i] == '(' && ( i + 1 >= pattern.size() || pattern[i + 1] != '?' ) )
+                ++group;
+            ++i;
+        }
+    }
+
+    // alternatives need not share the prefix
+    if ( pattern.find( '|' ) != std::string::npos )
+        prefix = 0;
+    _nodes[prefix].patterns.push_back( idx );
+    _routes.push_back( std::move( r ) );
+    return idx;
+}
+
+////////////////////////////////////////
+
+bool route_table::find( base::cstring path, match &m ) const
+{
+    m.route = npos;
+    m.count = 0;
+    if ( find_in_trie( 0, path, 0, m ) )
+        return true;
+
+    // the deepest node along the literal path with patterns first
+    uint32_t deepest[64];
+    size_t   nDeep = 0;
+    uint32_t n     = 0;
+    for ( size_t pos = 0; n != none; ++pos )
+    {
+        if ( !_nodes[n].patterns.empty() )
+        {
+            if ( nDeep == 64 )
+            {
+                std::move( deepest + 1, deepest + 64, deepest );
+                --nDeep;
+            }
+            deepest[nDeep++] = n;
+        }
+        if ( pos == path.size() )
+            break;
+        n = child( n, path[pos] );
+    }
+
+    // kept between look ups so matching does not grow it each time
+    thread_local std::cmatch groups;
+    while ( nDeep > 0 )
+    {
+        for ( size_t r: _nodes[deepest[--nDeep]].patterns )
+        {
+            const route &rt = _routes[r];
+            if ( !std::regex_match(
+                     path.data(), path.data() + path.size(), groups, *( rt.re ) ) )
+                continue;
+            m.route = r;
+            m.count = rt.names.size();
+            for ( size_t g = 0; g < m.count; ++g )
+            {
+                m.names[g] = &rt.names[g];
+                if ( groups[g + 1].matched )
+                    m.values[g] = base::cstring( groups[g + 1].first, groups[g + 1].second );
+                else
+                    m.values[g] = base::cstring();
+            }
+            return true;
+        }
+    }
+    return false;
+}
+
+////////////////////////////////////////
+
+uint32_t route_table::child( uint32_t n, char c ) const
+{
+    auto &kids = _nodes[n].children;
+    auto  i    = std::lower_bound(
+        kids.begin(), kids.end(), c, []( const std::pair<char, uint32_t> &k, char v ) {
+            return k.first < v;
+        } );
+    return ( i != kids.end() && i->first == c ) ? i->second : none;
+}
+
+////////////////////////////////////////
+
+uint32_t route_table::add_child( uint32_t n, char c )
+{
+    uint32_t k = child( n, c );
+    if ( k != none )
+        return k;
+
+    k = static_cast<uint32_t>( _nodes.size() );
+    _nodes.emplace_back();
+    auto &kids = _nodes[n].children;
+    auto  i    = std::lower_bound(
+        kids.begin(), kids.end(), c, []( const std::pair<char, uint32_t> &v, char x ) {
+            return v.first < x;
+        } );
+    kids.emplace( i, c, k );
+    return k;
+}
+
+////////////////////////////////////////
+
+uint32_t route_table::add_param( uint32_t n )
+{
+    if ( _nodes[n].param == none )
+    {
+        uint32_t k = static_cast<uint32_t>( _nodes.size() );
+        _nodes.emplace_back();
+        _nodes[n].param = k;
+    }
+    return _nodes[n].param;
+}
+
+////////////////////////////////////////
+
+bool route_table::find_in_trie(
+    uint32_t n, base::cstring path, size_t pos, match &m ) const
+{
+    // literal characters are followed as far as they go, only trying
+    // a {name} segment where the literal path fails
+    while ( true )
+    {
+        const node &cur = _nodes[n];
+        if ( pos == path.size() )
+        {
+            if ( cur.route == npos )
+                return false;
+            const route &rt = _routes[cur.route];
+            m.route = cur.route;
+            for ( size_t i = 0; i < m.count; ++i )
+                m.names[i] = &rt.names[i];
+            return true;
+        }
+
+        if ( cur.param != none && m.count < max_params )
+        {
+            uint32_t next = child( n, path[pos] );
+            if ( next != none && find_in_trie( next, path, pos + 1, m ) )
+                return true;
+
+            const char *slash = static_cast<const char *>(
+                std::memchr( path.data() + pos, '/', path.size() - pos ) );
+            size_t end = slash ? static_cast<size_t>( slash - path.data() ) : path.size();
+            if ( end == pos )
+                return false;
+            size_t count        = m.count;
+            m.values[m.count++] = path.substr( pos, end - pos );
+            if ( find_in_trie( cur.param, path, end, m ) )
+                return true;
+            m.count = count;
+            return false;
+        }
+
+        n = child( n, path[pos] );
+        if ( n == none )
+            return false;
+        ++pos;
+    }
+}
+
+////////////////////////////////////////
+
+} // namespace web
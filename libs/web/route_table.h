@@ -0,0 +1,96 @@
+// SPDX-License-Identifier: MIT
+// Copyright contributors to the gecko project.
+
+#pragma once
+
+#include <array>
+#include <base/const_string.h>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <regex>
+#include <string>
+#include <vector>
+
+namespace web
+{
+////////////////////////////////////////
+
+/// @brief Table of route patterns to look request paths up in.
+///
+/// Routes are compiled once, as they are added. A route is either a
+/// literal path, a path with `{name}` segments (matching any one path
+/// segment), or a regular expression. The first two are stored in a
+/// prefix trie, so looking up a path walks the trie once instead of
+/// trying every route, and does not allocate. Regular expressions are
+/// compiled to a std::regex, stored in the trie under their literal
+/// prefix, and only tried for paths starting with that prefix.
+///
+/// A path matching several routes goes to a literal match first, then
+/// `{name}` segments, and then the regular expressions, those with the
+/// longest literal prefix first and otherwise in the order added.
+class route_table
+{
+public:
+    static constexpr size_t npos       = static_cast<size_t>( -1 );
+    static constexpr size_t max_params = 8;
+
+    /// @brief Result of a look up
+    /// The parameter values are views into the path looked up.
+    struct match
+    {
+        size_t                                   route = npos;
+        size_t                                   count = 0;
+        std::array<const std::string *, max_params> names;
+        std::array<base::cstring, max_params>       values;
+
+        explicit operator bool( void ) const { return route != npos; }
+    };
+
+    /// @brief Add a route
+    /// Returns the index of the route, which is the same as before
+    /// when the same pattern is added again.
+    size_t add( const std::string &pattern );
+
+    /// @brief Number of routes
+    size_t size( void ) const { return _routes.size(); }
+
+    /// @brief The pattern of a route
+    const std::string &pattern( size_t route ) const { return _routes[route].pattern; }
+
+    /// @brief Look a path up
+    /// Returns false (and leaves m.route as npos) if no route matches.
+    bool find( base::cstring path, match &m ) const;
+
+private:
+    static constexpr uint32_t none = static_cast<uint32_t>( -1 );
+
+    struct node
+    {
+        std::vector<std::pair<char, uint32_t>> children;
+        uint32_t                               param = none;
+        size_t                                 route = npos;
+        std::vector<size_t>                    patterns;
+    };
+
+    struct route
+    {
+        std::string                 pattern;
+        std::vector<std::string>    names;
+        std::unique_ptr<std::regex> re;
+    };
+
+    uint32_t child( uint32_t n, char c ) const;
+    uint32_t add_child( uint32_t n, char c );
+    uint32_t add_param( uint32_t n );
+
+    bool find_in_trie(
+        uint32_t n, base::cstring path, size_t pos, match &m ) const;
+
+    std::vector<node>  _nodes = std::vector<node>( 1 );
+    std::vector<route> _routes;
+};
+
+////////////////////////////////////////
+
+} // namespace web
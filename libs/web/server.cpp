@@ -3,10 +3,212 @@
 
 #include "server.h"
 
+#include <algorithm>
 #include <base/scope_guard.h>
 #include <base/thread_pool.h>
+#include <chrono>
+#include <fcntl.h>
 #include <net/tcp_socket.h>
-#include <regex>
+#include <strings.h>
+#include <sys/socket.h>
+#include <unistd.h>
+#include <unordered_map>
+#include <vector>
+#ifdef __linux__
+#    include <sys/epoll.h>
+#else
+#    include <poll.h>
+#endif
+
+namespace
+{
+typedef std::chrono::steady_clock clock_type;
+
+////////////////////////////////////////
+
+struct connection
+{
+    explicit connection( size_t maxHeader ) : parser( maxHeader ) {}
+
+    int                              fd = -1;
+    std::shared_ptr<net::tcp_socket> socket;
+    web::recv_buffer                 input;
+    web::http_parser                 parser;
+    clock_type::time_point           last_active;
+    bool                             busy    = false;
+    bool                             closed  = false;
+    bool                             closing = false;
+};
+
+typedef std::shared_ptr<connection> connection_ptr;
+
+////////////////////////////////////////
+
+// waits for sockets to have something to read, woken early by a
+// write to wake_fd
+class poller
+{
+public:
+    poller( void )
+    {
+        if ( ::pipe( _wake ) != 0 )
+            throw_errno( "server wake pipe" );
+        for ( int fd: _wake )
+            ::fcntl( fd, F_SETFL, ::fcntl( fd, F_GETFL, 0 ) | O_NONBLOCK );
+#ifdef __linux__
+        _epoll = ::epoll_create1( EPOLL_CLOEXEC );
+        if ( _epoll < 0 )
+            throw_errno( "epoll_create" );
+#endif
+        add( _wake[0] );
+    }
+
+    ~poller( void )
+    {
+#ifdef __linux__
+        ::close( _epoll );
+#endif
+        ::close( _wake[0] );
+        ::close( _wake[1] );
+    }
+
+    poller( const poller & ) = delete;
+    poller &operator=( const poller & ) = delete;
+
+    int wake_fd( void ) const { return _wake[1]; }
+
+    void add( int fd )
+    {
+#ifdef __linux__
+        struct epoll_event ev;
+        ev.events  = EPOLLIN;
+        ev.data.fd = fd;
+        if ( ::epoll_ctl( _epoll, EPOLL_CTL_ADD, fd, &ev ) != 0 )
+            throw_errno( "epoll add {0}", fd );
+#else
+        struct pollfd p;
+        p.fd      = fd;
+        p.events  = POLLIN;
+        p.revents = 0;
+        _fds.push_back( p );
+#endif
+    }
+
+    void remove( int fd )
+    {
+#ifdef __linux__
+        ::epoll_ctl( _epoll, EPOLL_CTL_DEL, fd, nullptr );
+#else
+        auto i = std::find_if(
+            _fds.begin(), _fds.end(), [=]( const pollfd &p ) { return p.fd == fd; } );
+        if ( i != _fds.end() )
+        {
+            *i = _fds.back();
+            _fds.pop_back();
+        }
+#endif
+    }
+
+    /// waits up to timeout milliseconds (forever if negative) for
+    /// sockets to read from
+    const std::vector<int> &wait( int timeout )
+    {
+        _ready.clear();
+#ifdef __linux__
+        struct epoll_event events[256];
+        int                n = ::epoll_wait( _epoll, events, 256, timeout );
+        if ( n < 0 && errno != EINTR )
+            throw_errno( "epoll_wait" );
+        for ( int i = 0; i < n; ++i )
+            _ready.push_back( events[i].data.fd );
+#else
+        int n = ::poll( _fds.data(), _fds.size(), timeout );
+        if ( n < 0 && errno != EINTR )
+            throw_errno( "poll" );
+        for ( size_t i = 0; n > 0 && i < _fds.size(); ++i )
+        {
+            if ( _fds[i].revents != 0 )
+                _ready.push_back( _fds[i].fd );
+        }
+#endif
+        auto w = std::find( _ready.begin(), _ready.end(), _wake[0] );
+        if ( w != _ready.end() )
+        {
+            char buf[64];
+            while ( ::read( _wake[0], buf, sizeof( buf ) ) > 0 )
+                ;
+            _ready.erase( w );
+        }
+        return _ready;
+    }
+
+private:
+    int _wake[2];
+#ifdef __linux__
+    int _epoll = -1;
+#else
+    std::vector<struct pollfd> _fds;
+#endif
+    std::vector<int> _ready;
+};
+
+////////////////////////////////////////
+
+void wake( int fd )
+{
+    char c = 0;
+    while ( ::write( fd, &c, 1 ) < 0 && errno == EINTR )
+        ;
+}
+
+////////////////////////////////////////
+
+// HTTP/1.1 connections stay open unless asked otherwise, and HTTP/1.0
+// ones close unless asked otherwise
+bool keep_alive( const web::request &req )
+{
+    std::string conn = req.find_header( "Connection" ).to_string();
+    if ( req.version() == "1.0" )
+        return ::strcasecmp( conn.c_str(), "keep-alive" ) == 0;
+    return ::strcasecmp( conn.c_str(), "close" ) != 0;
+}
+
+////////////////////////////////////////
+
+void bad_request( net::tcp_socket &client )
+{
+    try
+    {
+        web::response resp;
+        resp.set_status_code( web::status_code::BAD_REQUEST );
+        resp.set_header( "Connection", "close" );
+        resp.send( client );
+    }
+    catch ( ... )
+    {}
+}
+
+////////////////////////////////////////
+
+void send_internal_error( net::tcp_socket &client )
+{
+    try
+    {
+        if ( client )
+        {
+            web::response resp(
+                "<!DOCTYPE html><html lang=\"en\"><head><title>Internal Server Error</title></head><body>Internal Server Error</body></html>" );
+            resp.set_status_code( web::status_code::INTERNAL_ERROR );
+            resp.send( client );
+        }
+    }
+    catch ( ... )
+    {}
+}
+
+////////////////////////////////////////
+
+} // namespace
 
 namespace web
 {
@@ -21,7 +223,11 @@ server::server( uint16_t port, size_t threads )
 server::handler &
 server::resource( const std::string &method, const std::string &re )
 {
-    return _resources[method][re];
+    routes &r   = _resources[method];
+    size_t  idx = r.table.add( re );
+    if ( idx == r.handlers.size() )
+        r.handlers.emplace_back();
+    return r.handlers[idx];
 }
 
 ////////////////////////////////////////
@@ -35,41 +241,215 @@ server::handler &server::default_resource( const std::string &method )
 
 void server::run( void )
 {
-    _done = false;
+    net::tcp_socket listener;
+    listener.bind( _port );
+    listener.listen( _backlog );
+    listener.set_non_blocking( true );
+
+    poller events;
+    events.add( listener.get_socket() );
+    {
+        std::lock_guard<std::mutex> lk( _wake_mutex );
+        _wake = events.wake_fd();
+    }
+    on_scope_exit
+    {
+        std::lock_guard<std::mutex> lk( _wake_mutex );
+        _wake = -1;
+        _done = false;
+    };
+
+    std::unordered_map<int, connection_ptr> conns;
 
-    base::thread_pool threads( _threads );
+    // connections whose request has been handled, and whether to keep
+    // them open, handed back by the workers
+    std::mutex                                  finishedMutex;
+    std::vector<std::pair<connection_ptr, bool>> finished;
 
-    net::tcp_socket socket;
-    socket.bind( _port );
-    socket.listen( 5 );
+    // declared last so the handlers finish before the rest goes away
+    base::thread_pool workers( std::max( _threads, size_t( 1 ) ) );
 
+    auto drop = [&]( const connection_ptr &c ) {
+        events.remove( c->fd );
+        conns.erase( c->fd );
+    };
+
+    // hands the next request off to a worker once it has all arrived
+    auto start_next = [&]( const connection_ptr &c ) {
+        try
+        {
+            if ( !c->parser.parse( c->input ) )
+                return false;
+        }
+        catch ( const std::exception &e )
+        {
+            base::print_exception( std::cerr, e );
+            bad_request( *( c->socket ) );
+            // closing straight away would reset the connection, losing
+            // the response if the client is still sending, so wait for
+            // the client to close (or the idle timeout)
+            ::shutdown( c->fd, SHUT_WR );
+            c->closing = true;
+            c->input.consume( c->input.size() );
+            return true;
+        }
+
+        events.remove( c->fd );
+        c->busy = true;
+        int wakeFd = events.wake_fd();
+        workers.queue( [&, c, wakeFd]() {
+            bool keep = this->handle_client( c->parser, *( c->socket ) );
+            c->input.consume( c->parser.size() );
+            c->parser.reset();
+            {
+                std::lock_guard<std::mutex> lk( finishedMutex );
+                finished.emplace_back( c, keep );
+            }
+            wake( wakeFd );
+        } );
+        return true;
+    };
+
+    // whether the listener is watched, and when (and with how many
+    // connections open) it stopped being so
+    bool                   accepting   = true;
+    clock_type::time_point pausedAt;
+    size_t                 pausedConns = 0;
+
+    auto lastSweep = clock_type::now();
     while ( !_done )
     {
-        auto client = socket.accept();
-        threads.queue( [=]() {
+        int timeout = ( _idle_timeout > 0.0 || !accepting ) ? 1000 : -1;
+        for ( int fd: events.wait( timeout ) )
+        {
+            auto now = clock_type::now();
+            if ( fd == listener.get_socket() )
+            {
+                try
+                {
+                    while ( auto s = listener.accept() )
+                    {
+                        s->set_non_blocking( true );
+                        // the handlers wait on writes with this, the
+                        // idle sweep skips busy connections
+                        if ( _idle_timeout > 0.0 )
+                            s->set_send_timeout( _idle_timeout );
+                        auto c         = std::make_shared<connection>( _max_header );
+                        c->fd          = s->get_socket();
+                        c->socket      = std::move( s );
+                        c->last_active = now;
+                        events.add( c->fd );
+                        conns[c->fd] = c;
+                    }
+                }
+                catch ( const std::exception &e )
+                {
+                    // out of file descriptors most likely, the listener
+                    // stays readable so stop watching it for a while
+                    // rather than spinning on it
+                    base::print_exception( std::cerr, e );
+                    events.remove( listener.get_socket() );
+                    accepting   = false;
+                    pausedAt    = now;
+                    pausedConns = conns.size();
+                }
+                continue;
+            }
+
+            auto i = conns.find( fd );
+            if ( i == conns.end() )
+                continue;
+            connection_ptr c = i->second;
             try
             {
-                this->handle_client( *client );
+                c->closed = !c->input.fill( *( c->socket ) );
             }
-            catch ( const std::exception &e )
+            catch ( ... )
             {
-                try
+                drop( c );
+                continue;
+            }
+            c->last_active = now;
+            if ( c->closing )
+            {
+                c->input.consume( c->input.size() );
+                if ( c->closed )
+                    drop( c );
+            }
+            else if ( !start_next( c ) && c->closed )
+                drop( c );
+        }
+
+        std::vector<std::pair<connection_ptr, bool>> done;
+        {
+            std::lock_guard<std::mutex> lk( finishedMutex );
+            done.swap( finished );
+        }
+        auto now = clock_type::now();
+        for ( auto &d: done )
+        {
+            const connection_ptr &c = d.first;
+            c->busy                 = false;
+            c->last_active          = now;
+
+            // the socket may be reused by now if the handler took it
+            auto i = conns.find( c->fd );
+            if ( i == conns.end() || i->second != c )
+                continue;
+            if ( !d.second || !*( c->socket ) )
+            {
+                conns.erase( i );
+                continue;
+            }
+            if ( !start_next( c ) )
+            {
+                if ( c->closed )
+                    conns.erase( i );
+                else
+                    events.add( c->fd );
+            }
+        }
+
+        // try accepting again once a connection has closed, or a while
+        // has passed
+        if ( !accepting &&
+             ( conns.size() < pausedConns || now - pausedAt >= std::chrono::seconds( 1 ) ) )
+        {
+            events.add( listener.get_socket() );
+            accepting = true;
+        }
+
+        if ( _idle_timeout > 0.0 && now - lastSweep >= std::chrono::seconds( 1 ) )
+        {
+            lastSweep = now;
+            auto idle = std::chrono::duration_cast<clock_type::duration>(
+                std::chrono::duration<double>( _idle_timeout ) );
+            for ( auto i = conns.begin(); i != conns.end(); )
+            {
+                if ( !i->second->busy && now - i->second->last_active > idle )
                 {
-                    response resp(
-                        "<!DOCTYPE html><html lang=\"en\"><head><title>Internal Server Error</title></head><body>Internal Server Error</body></html>" );
-                    resp.set_status_code( status_code::INTERNAL_ERROR );
-                    resp.send( *client );
+                    events.remove( i->first );
+                    i = conns.erase( i );
                 }
-                catch ( ... )
-                {}
-                base::print_exception( std::cerr, e );
+                else
+                    ++i;
             }
-        } );
+        }
     }
 }
 
 ////////////////////////////////////////
 
+void server::stop( void )
+{
+    std::lock_guard<std::mutex> lk( _wake_mutex );
+    _done = true;
+    if ( _wake >= 0 )
+        wake( _wake );
+}
+
+////////////////////////////////////////
+
 void server::not_found( request &, net::tcp_socket &client )
 {
     response resp(
@@ -80,38 +460,61 @@ void server::not_found( request &, net::tcp_socket &client )
 
 ////////////////////////////////////////
 
-void server::handle_client( net::tcp_socket &client )
+bool server::handle_client( const http_parser &msg, net::tcp_socket &client )
 {
-    // TODO support keep-alive connection properly
-    while ( true )
+    bool keep = false;
+    try
     {
-        request     req( client );
-        const auto &resources = _resources.find( req.method() );
-        if ( resources != _resources.end() )
-        {
-            std::string path = req.path().full_path();
-            for ( auto &r: resources->second )
-            {
-                std::regex re( r.first );
-                if ( std::regex_match( path, re ) )
-                {
-                    r.second( req, client );
-                    return;
-                }
-            }
-        }
+        request req( msg );
+        keep = keep_alive( req );
+        dispatch( req, client );
+    }
+    catch ( const std::system_error &e )
+    {
+        // a timed out write means the client stopped reading, there
+        // is no point waiting again to send it an error
+        keep = false;
+        if ( e.code().value() != ETIMEDOUT )
+            send_internal_error( client );
+        base::print_exception( std::cerr, e );
+    }
+    catch ( const std::exception &e )
+    {
+        keep = false;
+        send_internal_error( client );
+        base::print_exception( std::cerr, e );
+    }
+    return keep && client;
+}
 
-        const auto &handler = _defaults.find( req.method() );
-        if ( handler != _defaults.end() )
+////////////////////////////////////////
+
+void server::dispatch( request &req, net::tcp_socket &client )
+{
+    const auto &resources = _resources.find( req.method() );
+    if ( resources != _resources.end() )
+    {
+        std::string        path = req.path().full_path();
+        route_table::match m;
+        if ( resources->second.table.find( path, m ) )
         {
-            handler->second( req, client );
+            for ( size_t i = 0; i < m.count; ++i )
+                req.add_path_param( *( m.names[i] ), m.values[i].to_string() );
+            resources->second.handlers[m.route]( req, client );
             return;
         }
+    }
 
-        response resp;
-        resp.set_status_code( status_code::METHOD_NOT_ALLOWED );
-        resp.send( client );
+    const auto &handler = _defaults.find( req.method() );
+    if ( handler != _defaults.end() )
+    {
+        handler->second( req, client );
+        return;
     }
+
+    response resp;
+    resp.set_status_code( status_code::METHOD_NOT_ALLOWED );
+    resp.send( client );
 }
 
 ////////////////////////////////////////
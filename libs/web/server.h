@@ -5,11 +5,14 @@
 
 #include "request.h"
 #include "response.h"
+#include "route_table.h"
 
-#include <base/thread_pool.h>
+#include <atomic>
 #include <cstdint>
+#include <deque>
 #include <functional>
 #include <map>
+#include <mutex>
 #include <string>
 
 namespace web
@@ -17,6 +20,17 @@ namespace web
 ////////////////////////////////////////
 
 /// @brief A web server.
+///
+/// The thread calling run waits on all the connections at once (with
+/// epoll where available), reading whatever arrives into a buffer per
+/// connection. Only once a whole request has arrived is it handed to
+/// one of the worker threads to handle, so idle or slow connections
+/// cost a buffer rather than a thread. Connections are kept open
+/// between requests (HTTP/1.1 keep-alive), and requests pipelined on
+/// a connection are handled one after another, in order.
+///
+/// A handler may take the socket over (moving it out, e.g. for a
+/// WebSocket), which ends the server's handling of that connection.
 class server
 {
 public:
@@ -24,28 +38,62 @@ public:
     typedef std::function<void( request &, net::tcp_socket &client )> handler;
 
     /// @brief Constructor
+    /// The threads are the number of requests handled at once.
     server( uint16_t port, size_t threads = 1 );
 
+    /// @brief Set the length of the queue of connections waiting to be accepted
+    void set_backlog( int b ) { _backlog = b; }
+
+    /// @brief Set the largest request line and header accepted (in bytes)
+    /// Larger requests are refused as bad requests.
+    void set_max_header_size( size_t n ) { _max_header = n; }
+
+    /// @brief Set how long (in seconds) an idle connection is kept open
+    /// This also bounds how long sending a response waits for a
+    /// client which stopped reading, so it does not hold a handler
+    /// thread. 0 keeps idle connections open until the client closes
+    /// them.
+    void set_idle_timeout( double secs ) { _idle_timeout = secs; }
+
     /// @brief Add a resource handler
+    /// The route is a literal path, a path with `{name}` segments, or a
+    /// regular expression, compiled as it is added (see route_table),
+    /// with the parameters it captures added to the request.
     handler &resource( const std::string &method, const std::string &re );
 
     /// @brief Add a default resource handler
     handler &default_resource( const std::string &method );
 
-    /// @brief Run the server (forever)
+    /// @brief Run the server (until stopped)
     void run( void );
 
+    /// @brief Stop the server running in another thread
+    void stop( void );
+
     /// @brief Simple not found handler.
     static void not_found( request &req, net::tcp_socket &client );
 
 private:
-    void handle_client( net::tcp_socket &client );
-    std::map<std::string, std::map<std::string, handler>> _resources;
-    std::map<std::string, handler>                        _defaults;
+    bool handle_client( const http_parser &msg, net::tcp_socket &client );
+    void dispatch( request &req, net::tcp_socket &client );
+
+    struct routes
+    {
+        route_table         table;
+        std::deque<handler> handlers;
+    };
+
+    std::map<std::string, routes>  _resources;
+    std::map<std::string, handler> _defaults;
 
-    bool     _done = false;
-    uint16_t _port;
-    size_t   _threads = 0;
+    std::atomic<bool> _done{ false };
+    std::mutex        _wake_mutex;
+    int               _wake = -1;
+    uint16_t          _port;
+    size_t            _threads      = 0;
+    int               _backlog      = 128;
+    size_t            _max_header   = 64 * 1024;
+    double            _idle_timeout = 60.0;
 };
 
 ////////////////////////////////////////
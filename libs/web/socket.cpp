@@ -8,7 +8,85 @@
 #include <base/base64.h>
 #include <base/endian.h>
 #include <base/sha160.h>
-#include <bitset>
+#include <cstring>
+#if defined( __SSE2__ )
+#    include <emmintrin.h>
+#elif defined( __ARM_NEON )
+#    include <arm_neon.h>
+#endif
+
+namespace
+{
+////////////////////////////////////////
+
+// out = in ^ key, repeating the 4 byte key (out and in may be the same)
+void apply_mask( uint8_t *out, const uint8_t *in, size_t n, const uint8_t key[4] )
+{
+    // every step is a multiple of 4 bytes, so the key lines up with each
+    // word just as it is laid out in memory
+    uint32_t k32;
+    std::memcpy( &k32, key, sizeof( k32 ) );
+    size_t i = 0;
+#if defined( __SSE2__ )
+    const __m128i k128 = _mm_set1_epi32( static_cast<int>( k32 ) );
+    for ( ; i + 16 <= n; i += 16 )
+    {
+        __m128i v = _mm_loadu_si128( reinterpret_cast<const __m128i *>( in + i ) );
+        _mm_storeu_si128( reinterpret_cast<__m128i *>( out + i ), _mm_xor_si128( v, k128 ) );
+    }
+#elif defined( __ARM_NEON )
+    const uint8x16_t k128 = vreinterpretq_u8_u32( vdupq_n_u32( k32 ) );
+    for ( ; i + 16 <= n; i += 16 )
+        vst1q_u8( out + i, veorq_u8( vld1q_u8( in + i ), k128 ) );
+#endif
+    const uint64_t k64 = ( uint64_t( k32 ) << 32 ) | k32;
+    for ( ; i + 8 <= n; i += 8 )
+    {
+        uint64_t v;
+        std::memcpy( &v, in + i, sizeof( v ) );
+        v ^= k64;
+        std::memcpy( out + i, &v, sizeof( v ) );
+    }
+    for ( ; i < n; ++i )
+        out[i] = in[i] ^ key[i % 4];
+}
+
+////////////////////////////////////////
+
+// fills in the header of a frame (up to 14 bytes) and returns its size,
+// with the mask key when there is one
+size_t frame_header( uint8_t *hdr, uint8_t opcode, uint64_t len, const uint8_t *key )
+{
+    uint8_t maskBit = key ? 0x80 : 0;
+    size_t  n       = 0;
+    hdr[n++]        = 0x80 | opcode;
+    if ( len < 126 )
+        hdr[n++] = maskBit | static_cast<uint8_t>( len );
+    else if ( len < 65536 )
+    {
+        hdr[n++] = maskBit | 126;
+        uint16_t l = base::byteswap( uint16_t( len ) );
+        std::memcpy( hdr + n, &l, sizeof( l ) );
+        n += sizeof( l );
+    }
+    else
+    {
+        hdr[n++] = maskBit | 127;
+        uint64_t l = base::byteswap( len );
+        std::memcpy( hdr + n, &l, sizeof( l ) );
+        n += sizeof( l );
+    }
+    if ( key )
+    {
+        std::memcpy( hdr + n, key, 4 );
+        n += 4;
+    }
+    return n;
+}
+
+////////////////////////////////////////
+
+} // namespace
 
 namespace web
 {
@@ -65,10 +143,9 @@ socket::socket( base::uri &server, const std::string &agent, double timeout )
     req.set_header( "Sec-WebSocket-Version", "13" );
     req.set_header( "Sec-WebSocket-Key", base::base64_encode( nonce ) );
 
-    _socket.connect( server, 80, timeout );
     req.send( _socket );
 
-    response resp( _socket );
+    response resp( _socket, _input );
     _masked = false;
 }
 
@@ -94,147 +171,112 @@ void socket::run( void )
 
 bool socket::wait( std::string &message, bool &bin )
 {
-    bool done   = false;
-    bool gotmsg = false;
-    bin         = false;
+    message.clear();
+    bin          = false;
+    bool started = false;
 
-    while ( !done )
+    while ( true )
     {
-        uint8_t bits;
-        _socket.read( &bits, sizeof( bits ) );
-        bool eom = bits & 0x80;
-
-        // opcode
-        switch ( bits & 0x0f )
-        {
-            case 0:
-                // continuation
-                break;
-
-            case 1:
-                // text frame
-                bin = false;
-                break;
-
-            case 2:
-                // binary frame
-                bin = true;
-                break;
-
-            case 8:
-                // connection close
-                close();
-                done = true;
-                break;
-
-            case 9:
-                // ping
-                break;
-
-            case 10:
-                // pong
-                break;
-
-            default:
-                // reserved
-                throw_runtime( "unknown WebSocket opcode" );
-        }
-        _socket.read( &bits, sizeof( bits ) );
-        bool masked = bits & 0x80;
+        uint8_t head[2];
+        _input.read( _socket, head, sizeof( head ) );
+        bool    fin    = head[0] & 0x80;
+        uint8_t opcode = head[0] & 0x0f;
+        bool    masked = head[1] & 0x80;
         if ( masked != _masked )
             throw_runtime( "WebSocket mask mismatch" );
 
-        uint64_t bytes = bits & 0x7f;
-
+        uint64_t bytes = head[1] & 0x7f;
         if ( bytes == 126 )
         {
             uint16_t b16;
-            _socket.read( &b16, sizeof( b16 ) );
+            _input.read( _socket, &b16, sizeof( b16 ) );
             bytes = base::byteswap( b16 );
         }
         else if ( bytes == 127 )
         {
-            _socket.read( &bytes, sizeof( bytes ) );
+            _input.read( _socket, &bytes, sizeof( bytes ) );
             bytes = base::byteswap( bytes );
         }
 
         uint8_t key[4] = {};
         if ( masked )
-            _socket.read( &key, sizeof( key ) );
+            _input.read( _socket, &key, sizeof( key ) );
 
-        size_t mlen = message.size();
-        message.resize( mlen + bytes );
-        _socket.read( &message[0] + mlen, bytes );
-        if ( masked )
+        if ( opcode & 0x08 )
         {
-            for ( size_t i = 0; i < bytes; ++i )
-                message[i + mlen] ^= key[i % 4];
+            // control frames may come between the fragments of a message
+            if ( !fin || bytes > 125 )
+                throw_runtime( "invalid WebSocket control frame" );
+            uint8_t payload[125];
+            _input.read( _socket, payload, bytes );
+            if ( masked )
+                apply_mask( payload, payload, bytes, key );
+
+            switch ( opcode )
+            {
+                case 8:
+                    // connection close
+                    close();
+                    return false;
+
+                case 9:
+                    // ping
+                    send_frame( 0xA, payload, bytes );
+                    break;
+
+                case 10:
+                    // pong
+                    break;
+
+                default:
+                    // reserved
+                    throw_runtime( "unknown WebSocket opcode {0}", int( opcode ) );
+            }
+            continue;
         }
 
-        if ( eom && !done )
+        switch ( opcode )
         {
-            done   = true;
-            gotmsg = true;
-        }
-    }
-
-    return gotmsg;
-}
+            case 0:
+                // continuation
+                if ( !started )
+                    throw_runtime( "WebSocket continuation without a message" );
+                break;
 
-////////////////////////////////////////
+            case 1:
+            case 2:
+                // text or binary frame
+                if ( started )
+                    throw_runtime( "WebSocket message interrupted by another" );
+                started = true;
+                bin     = opcode == 2;
+                break;
 
-void socket::send( const char *msg, size_t len )
-{
-    uint8_t bits;
-    bits = 0x80 | 0x1;
-    _socket.write( &bits, 1 );
+            default:
+                // reserved
+                throw_runtime( "unknown WebSocket opcode {0}", int( opcode ) );
+        }
 
-    if ( len < 126 )
-    {
-        bits = uint8_t( len );
-        if ( !_masked )
-            bits |= 0x80;
-        _socket.write( &bits, 1 );
-    }
-    else if ( len < 65536 )
-    {
-        bits = 126;
-        if ( !_masked )
-            bits |= 0x80;
-        _socket.write( &bits, 1 );
-        /// @todo Deal with endianess here.
-        uint16_t l = base::byteswap( uint16_t( len ) );
-        _socket.write( &l, sizeof( l ) );
-    }
-    else
-    {
-        bits = 127;
-        if ( !_masked )
-            bits |= 0x80;
-        _socket.write( &bits, 1 );
-        uint64_t l = base::byteswap( uint64_t( len ) );
-        _socket.write( &l, sizeof( l ) );
-    }
+        size_t mlen = message.size();
+        if ( bytes > _max_message - mlen )
+            throw_runtime( "WebSocket message larger than {0} bytes", _max_message );
+        message.resize( mlen + bytes );
+        uint8_t *data = reinterpret_cast<uint8_t *>( &message[0] ) + mlen;
+        _input.read( _socket, data, bytes );
+        if ( masked )
+            apply_mask( data, data, bytes, key );
 
-    if ( !_masked )
-    {
-        uint8_t key[4] = {};
-        for ( size_t i = 0; i < 4; ++i )
-            key[i] = random_byte();
-        _socket.write( key, sizeof( key ) );
-
-        std::string tmp;
-        tmp.reserve( len );
-        for ( size_t i = 0; i < len; ++i )
-            tmp.push_back( msg[i] ^ key[i % 4] );
-        _socket.write( tmp.c_str(), tmp.size() );
+        if ( fin )
+            return true;
     }
-    else
-        _socket.write( msg, len );
 }
 
 ////////////////////////////////////////
 
+void socket::send( const char *msg, size_t len ) { send_frame( 0x1, msg, len ); }
+
+////////////////////////////////////////
+
 void socket::send( const base::json &msg )
 {
     std::string tmp;
@@ -247,25 +289,66 @@ void socket::send( const base::json &msg )
 void socket::close( void )
 {
     if ( !_closed )
-    {
-        uint8_t bits;
-        bits = 0x80 | 0x8;
-        _socket.write( &bits, 1 );
+        send_frame( 0x8, nullptr, 0 );
+    _closed = true;
+}
+
+////////////////////////////////////////
 
-        bits = 0;
-        if ( !_masked )
-            bits |= 0x80;
-        _socket.write( &bits, 1 );
+size_t socket::broadcast(
+    const std::vector<socket *> &sockets, const char *msg, size_t len, bool binary )
+{
+    uint8_t opcode = binary ? 0x2 : 0x1;
+    uint8_t hdr[14];
+    size_t  hlen = frame_header( hdr, opcode, len, nullptr );
 
-        if ( !_masked )
+    const net::tcp_socket::buffer bufs[2] = { { hdr, hlen }, { msg, len } };
+    size_t                        sent    = 0;
+    for ( socket *s: sockets )
+    {
+        if ( !s || s->_closed )
+            continue;
+        try
+        {
+            // only sockets opened to a server mask what they send
+            if ( s->_masked )
+                s->_socket.write( bufs, 2 );
+            else
+                s->send_frame( opcode, msg, len );
+            ++sent;
+        }
+        catch ( ... )
         {
-            uint8_t key[4] = {};
-            for ( size_t i = 0; i < 4; ++i )
-                key[i] = random_byte();
-            _socket.write( key, sizeof( key ) );
+            s->_closed = true;
         }
     }
-    _closed = true;
+    return sent;
+}
+
+////////////////////////////////////////
+
+void socket::send_frame( uint8_t opcode, const void *msg, size_t len )
+{
+    uint8_t hdr[14];
+    if ( _masked )
+    {
+        size_t                        hlen    = frame_header( hdr, opcode, len, nullptr );
+        const net::tcp_socket::buffer bufs[2] = { { hdr, hlen }, { msg, len } };
+        _socket.write( bufs, 2 );
+        return;
+    }
+
+    uint8_t key[4];
+    for ( size_t i = 0; i < 4; ++i )
+        key[i] = random_byte();
+    size_t hlen = frame_header( hdr, opcode, len, key );
+
+    // masked into memory kept from one message to the next
+    _scratch.resize( len );
+    if ( len > 0 )
+        apply_mask( _scratch.data(), static_cast<const uint8_t *>( msg ), len, key );
+    const net::tcp_socket::buffer bufs[2] = { { hdr, hlen }, { _scratch.data(), len } };
+    _socket.write( bufs, 2 );
 }
 
 ////////////////////////////////////////
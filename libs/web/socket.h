@@ -8,6 +8,7 @@
 #include <base/json.h>
 #include <base/signal.h>
 #include <random>
+#include <vector>
 
 namespace web
 {
@@ -44,10 +45,32 @@ public:
     /// @brief Send a message.
     void send( const base::json &msg );
 
+    /// @brief Send a binary message.
+    void send_binary( const void *msg, size_t len ) { send_frame( 0x2, msg, len ); }
+
+    /// @brief Send the same message to many sockets.
+    /// The frame header is only encoded once, and sent along with the
+    /// message straight from msg to each socket opened from a request
+    /// (sockets opened to a server have to mask each frame anew).
+    /// Sockets which fail are marked closed and skipped from then on.
+    /// @returns the number of sockets the message was sent to.
+    static size_t broadcast(
+        const std::vector<socket *> &sockets,
+        const char *                 msg,
+        size_t                       len,
+        bool                         binary = false );
+
+    /// @brief Largest message to accept (256MiB by default)
+    void set_max_message_size( size_t bytes ) { _max_message = bytes; }
+
     /// @brief Run the socket.
     void run( void );
 
     /// @brief Wait for a message.
+    /// A message sent in several fragments is put back together, with
+    /// pings answered as they come. The message string is cleared
+    /// rather than freed, so waiting again with the same string reuses
+    /// its memory.
     /// @param message String to fill in with message.
     /// @param binary Set to true of the message is binary, false if text.
     /// @returns false if the connection closed.
@@ -68,9 +91,14 @@ public:
 protected:
     uint8_t random_byte( void ) { return _dist8( _rand ); }
 
-    bool                                   _masked = false;
-    bool                                   _closed = false;
+    void send_frame( uint8_t opcode, const void *msg, size_t len );
+
+    bool                                   _masked      = false;
+    bool                                   _closed      = false;
+    size_t                                 _max_message = size_t( 256 ) << 20;
     net::tcp_socket                        _socket;
+    recv_buffer                            _input;
+    std::vector<uint8_t>                   _scratch;
     std::random_device                     _rand;
     std::uniform_int_distribution<uint8_t> _dist8;
 };
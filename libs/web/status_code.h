@@ -38,6 +38,7 @@ enum class status_code
     GONE                = 410,
     LENGTH_REQUIRED     = 411,
     PRECONDITION_FAILED = 412,
+    RANGE_NOT_SATISFIABLE = 416,
     INTERNAL_ERROR      = 500,
     NOT_IMPLEMENTED     = 501,
     BAD_GATEWAY         = 502,
@@ -3,6 +3,9 @@
 
 #include "web_base.h"
 
+#include <stdexcept>
+#include <strings.h>
+
 namespace web
 {
 ////////////////////////////////////////
@@ -19,62 +22,64 @@ web_base::~web_base( void ) {}
 
 ////////////////////////////////////////
 
-std::string web_base::read_line( net::tcp_socket &socket )
+web_base::web_base( const web_base &o )
+    : _header( o.header() ), _content( o._content ), _version( o._version )
+{}
+
+////////////////////////////////////////
+
+web_base::web_base( web_base &&o )
+    : _content( std::move( o._content ) ), _version( std::move( o._version ) )
+{
+    o.own_header();
+    _header = std::move( o._header );
+}
+
+////////////////////////////////////////
+
+base::cstring web_base::find_header( base::cstring n ) const
 {
-    char c = '\0';
-    socket.read( &c, 1 );
+    if ( _msg )
+        return _msg->find( n );
 
-    std::string result;
-    while ( c != '\r' )
+    for ( auto &h: _header )
     {
-        result.push_back( c );
-        socket.read( &c, 1 );
+        if ( h.first.size() == n.size() &&
+             ::strncasecmp( h.first.data(), n.data(), n.size() ) == 0 )
+            return base::cstring( h.second );
     }
-    socket.read( &c, 1 );
-    if ( c != '\n' )
-        throw_runtime( "invalid HTTP line" );
-    return result;
+    return base::cstring();
 }
 
 ////////////////////////////////////////
 
-void web_base::read_content( net::tcp_socket &socket )
+std::string web_base::operator[]( base::cstring n ) const
 {
-    auto te = _header.find( "Transfer-Encoding" );
-    auto cl = _header.find( "Content-Length" );
-    if ( te != _header.end() )
-    {
-        if ( te->second == "chunked" )
-        {
-            size_t size = 0;
-            do
-            {
-                std::string line = read_line( socket );
-                size_t      pos  = 0;
-                size             = std::stoul( line, &pos, 16 );
-                if ( size > 0 )
-                {
-                    size_t off = _content.size();
-                    _content.resize( _content.size() + size );
-                    socket.read( &_content[off], size );
-                    char c[2];
-                    socket.read( &c, 2 );
-                    if ( c[0] != '\r' || c[1] != '\n' )
-                        throw_runtime( "invalid HTTP chunk" );
-                }
-            } while ( size > 0 );
-        }
-        else
-            throw_runtime( "unknown Transfer-Encoding: {0}", te->second );
-        /// @todo Read trailer headers
-    }
-    else if ( cl != _header.end() )
-    {
-        size_t size = std::stoul( cl->second, nullptr, 10 );
-        size_t off  = _content.size();
-        _content.resize( _content.size() + size );
-        socket.read( &_content[off], size );
-    }
+    base::cstring v = find_header( n );
+    // present but empty fields are still found
+    if ( v.data() == nullptr )
+        throw std::out_of_range( "no HTTP header field " + n.to_string() );
+    return v.to_string();
+}
+
+////////////////////////////////////////
+
+void web_base::set_fields( const http_parser &msg )
+{
+    _header.clear();
+    _msg = &msg;
+    msg.append_content( _content );
+}
+
+////////////////////////////////////////
+
+void web_base::own_header( void ) const
+{
+    if ( !_msg )
+        return;
+    for ( size_t i = 0; i < _msg->field_count(); ++i )
+        _header[_msg->field_name( i ).to_string()] = _msg->field_value( i ).to_string();
+    _msg = nullptr;
 }
 
 ////////////////////////////////////////
@@ -3,6 +3,8 @@
 
 #pragma once
 
+#include "http_parser.h"
+
 #include <map>
 #include <net/tcp_socket.h>
 #include <string>
@@ -17,8 +19,10 @@ public:
     web_base( void );
     web_base( std::string v );
     virtual ~web_base( void );
-    web_base( const web_base & ) = default;
-    web_base( web_base && )      = default;
+    /// copies (and moves) take their own header, rather than refer to
+    /// the parsed message
+    web_base( const web_base &o );
+    web_base( web_base &&o );
     web_base &operator=( const web_base & ) = delete;
     web_base &operator=( web_base && ) = delete;
 
@@ -35,25 +39,40 @@ public:
     /// @brief Add HTTP header name/value pair.
     void set_header( std::string n, std::string v )
     {
+        own_header();
         _header[std::move( n )] = std::move( v );
     }
 
+    /// @brief Value of the (case insensitive) named header field, or empty
+    /// Does not copy the header out of a parsed message.
+    base::cstring find_header( base::cstring n ) const;
+
     /// @brief Get an HTTP header value
-    std::string operator[]( const std::string &n ) { return _header.at( n ); }
+    /// Throws std::out_of_range if there is no such field.
+    std::string operator[]( base::cstring n ) const;
 
     /// @brief The map of HTTP header values.
+    /// Built from a parsed message the first time it is asked for.
     const std::map<std::string, std::string> &header( void ) const
     {
+        own_header();
         return _header;
     }
 
 protected:
-    std::string read_line( net::tcp_socket &socket );
-    void        read_content( net::tcp_socket &sockte );
+    /// refers to the header fields of a parsed message, and copies
+    /// its content
+    void set_fields( const http_parser &msg );
+
+    /// copies the header fields out of the parsed message, if any
+    void own_header( void ) const;
 
-    std::map<std::string, std::string> _header;
-    std::string                        _content;
-    std::string                        _version = "1.1";
+    // the header fields are looked up in the parsed message until
+    // they are needed as a map
+    mutable const http_parser *                _msg = nullptr;
+    mutable std::map<std::string, std::string> _header;
+    std::string                                _content;
+    std::string                                _version = "1.1";
 };
 
 ////////////////////////////////////////
@@ -0,0 +1,189 @@
+// SPDX-License-Identifier: MIT
+// Copyright contributors to the gecko project.
+
+#include <algorithm>
+#include <base/contract.h>
+#include <base/file_system.h>
+#include <base/scope_guard.h>
+#include <base/unit_test.h>
+#include <cmath>
+#include <image/allocator.h>
+#include <image/media_io.h>
+#include <iostream>
+#include <media/reader.h>
+#include <media/sample.h>
+#include <media/writer.h>
+
+namespace
+{
+// not a multiple of any chunk height, so the last band is short
+const int     width  = 67;
+const int     height = 101;
+const int64_t frame  = 3;
+
+// multiples of 1/16 below 4 survive the trip through half floats
+float source_at( int c, int x, int y )
+{
+    return static_cast<float>( ( x * 5 + y * 3 + c * 11 ) % 64 ) / 16.F;
+}
+
+image::image_buf source( void )
+{
+    image::image_buf img;
+    for ( int c = 0; c < 3; ++c )
+    {
+        image::plane p( 0, 0, width - 1, height - 1 );
+        for ( int y = 0; y < height; ++y )
+            for ( int x = 0; x < width; ++x )
+                p.get( x, y ) = source_at( c, x, y );
+        img.add_plane( std::move( p ) );
+    }
+    return img;
+}
+
+/// the rows [y1, y2] of the image in planes of their own
+image::image_buf band( const image::image_buf &img, int y1, int y2 )
+{
+    image::image_buf r;
+    for ( auto &p: img )
+    {
+        image::plane b( p.x1(), y1, p.x2(), y2 );
+        for ( int y = y1; y <= y2; ++y )
+            for ( int x = p.x1(); x <= p.x2(); ++x )
+                b.get( x, y ) = p.get( x, y );
+        r.add_plane( std::move( b ) );
+    }
+    return r;
+}
+
+media::container open_output( const base::uri &u )
+{
+    std::vector<media::track_description> tds;
+    tds.push_back( media::TRACK_VIDEO );
+    tds.back().rate( media::sample_rate( 1, 1 ) );
+    tds.back().offset( frame );
+    tds.back().duration( 1 );
+    return media::writer::open( u, tds, media::parameter_set() );
+}
+
+int safemain( int argc, char *argv[] )
+{
+    base::cmd_line options( argv[0] );
+
+    base::unit_test test( "exr_stream" );
+    test.setup( options );
+
+    options.add_help();
+
+    try
+    {
+        options.parse( argc, argv );
+    }
+    catch ( std::exception & )
+    {
+        std::cerr << options << std::endl;
+        throw_add( "parsing command line" );
+    }
+
+    base::uri pattern( "file", "", "tmp", "test_exr_stream.%04d.exr" );
+    base::uri written( "file", "", "tmp", "test_exr_stream.0003.exr" );
+    auto      fs = base::file_system::get( written );
+
+    auto check = [&]( const char *name ) {
+        on_scope_exit { fs->unlink( written ); };
+
+        media::container ic = media::reader::open( pattern );
+        auto             vt = ic.video_tracks()[0];
+        media::sample    s( frame, vt->rate() );
+        auto             frm = s( vt );
+        image::image_buf img = image::extract_frame(
+            *frm, std::string(), std::string(), { "R", "G", "B" } );
+
+        for ( int c = 0; c < 3; ++c )
+        {
+            const image::plane &p = img[static_cast<size_t>( c )];
+            if ( p.width() != width || p.height() != height )
+            {
+                test.failure(
+                    "{0}: read back {1}x{2} (expected {3}x{4})",
+                    name,
+                    p.width(),
+                    p.height(),
+                    width,
+                    height );
+                return;
+            }
+            for ( int y = 0; y < height; ++y )
+            {
+                for ( int x = 0; x < width; ++x )
+                {
+                    float v = p.get( x, y );
+                    float e = source_at( c, x, y );
+                    if ( v != e )
+                    {
+                        test.failure(
+                            "{0}: plane {1}: {2} at {3}, {4} (expected {5})",
+                            name,
+                            c,
+                            v,
+                            x,
+                            y,
+                            e );
+                        return;
+                    }
+                }
+            }
+        }
+        test.success( "{0}", name );
+    };
+
+    test["band_by_band"] = [&]( void ) {
+        image::image_buf img = source();
+        {
+            media::container oc = open_output( pattern );
+            auto layout = image::to_frame( img, { "R", "G", "B" }, "f16" );
+            auto out    = oc.video_tracks()[0]->start_frame(
+                frame, *layout, image::allocator::get() );
+            // bands which do not line up with the chunks, as a
+            // producer of rows would provide them
+            int rows = out->chunk_height( 0 ) + 3;
+            for ( int y = 0; y < height; y += rows )
+            {
+                int ye = std::min( height, y + rows ) - 1;
+                image::write_image( *out, 0, band( img, y, ye ) );
+            }
+            out->finish();
+        }
+        check( "band_by_band" );
+    };
+
+    test["stream_frame"] = [&]( void ) {
+        image::image_buf img = source();
+        {
+            media::container oc = open_output( pattern );
+            image::stream_frame(
+                *oc.video_tracks()[0], frame, img, { "R", "G", "B" }, "f16" );
+        }
+        check( "stream_frame" );
+    };
+
+    test.run( options );
+    test.clean();
+
+    return -static_cast<int>( test.failure_count() );
+}
+
+} // namespace
+
+int main( int argc, char *argv[] )
+{
+    try
+    {
+        return safemain( argc, argv );
+    }
+    catch ( const std::exception &e )
+    {
+        base::print_exception( std::cerr, e );
+    }
+    return -1;
+}
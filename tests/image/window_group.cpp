@@ -0,0 +1,148 @@
+// SPDX-License-Identifier: MIT
+// Copyright contributors to the gecko project.
+
+#include <base/unit_test.h>
+#include <cmath>
+#include <functional>
+#include <image/plane_convolve.h>
+#include <image/plane_ops.h>
+#include <iostream>
+
+namespace
+{
+// tall enough for the window to slide several times on every thread
+const int width  = 37;
+const int height = 211;
+
+float source_at( int x, int y )
+{
+    return std::sin( static_cast<float>( x * 7 + y * y ) * 0.01F );
+}
+
+image::plane source( void )
+{
+    image::plane p( 0, 0, width - 1, height - 1 );
+    for ( int y = 0; y < height; ++y )
+        for ( int x = 0; x < width; ++x )
+            p.get( x, y ) = source_at( x, y );
+    return p;
+}
+
+// the central gradient of 2 * source + 1
+float cgrad_at( int x, int y )
+{
+    if ( y == 0 || y == height - 1 )
+        return 0.F;
+    return ( ( source_at( x, y + 1 ) * 2.F + 1.F ) -
+             ( source_at( x, y - 1 ) * 2.F + 1.F ) ) *
+           0.5F;
+}
+
+int safemain( int argc, char *argv[] )
+{
+    base::cmd_line options( argv[0] );
+
+    base::unit_test test( "window_group" );
+    test.setup( options );
+
+    options.add_help();
+
+    try
+    {
+        options.parse( argc, argv );
+    }
+    catch ( std::exception & )
+    {
+        std::cerr << options << std::endl;
+        throw_add( "parsing command line" );
+    }
+
+    auto check = [&]( const char *                          name,
+                      const image::plane &                  p,
+                      const std::function<float( int, int )> &expect ) {
+        for ( int y = 0; y < height; ++y )
+        {
+            for ( int x = 0; x < width; ++x )
+            {
+                float v = p.get( x, y );
+                float e = expect( x, y );
+                if ( std::abs( v - e ) > 1e-5F )
+                {
+                    test.failure(
+                        "{0}: {1} at {2}, {3} (expected {4})", name, v, x, y, e );
+                    return;
+                }
+            }
+        }
+        test.success( "{0}", name );
+    };
+
+    test["chain"] = [&]( void ) {
+        image::plane p = source();
+        image::plane r = image::central_gradient_vert( p * 2.F + 1.F ) + 3.F;
+        check( "chain", r, []( int x, int y ) { return cgrad_at( x, y ) + 3.F; } );
+    };
+
+    test["read_after_window"] = [&]( void ) {
+        // the input of the gradient is read again by the add after it
+        image::plane p = source();
+        image::plane r =
+            image::central_gradient_vert( p * 2.F + 1.F ) + ( p * 2.F + 1.F );
+        check( "read_after_window", r, []( int x, int y ) {
+            return cgrad_at( x, y ) + ( source_at( x, y ) * 2.F + 1.F );
+        } );
+    };
+
+    test["output_before_window"] = [&]( void ) {
+        // the input of the gradient is also a result in its own right
+        image::plane p = source();
+        image::plane a = p * 2.F + 1.F;
+        image::plane r = image::central_gradient_vert( a ) + 3.F;
+        check( "output_before_window", r, []( int x, int y ) {
+            return cgrad_at( x, y ) + 3.F;
+        } );
+        check( "output_before_window_input", a, []( int x, int y ) {
+            return source_at( x, y ) * 2.F + 1.F;
+        } );
+    };
+
+    test["separable_in_group"] = [&]( void ) {
+        // the passes join the group computing the input, and must
+        // match the tiled path run on the computed input
+        for ( const std::vector<float> &k:
+              { std::vector<float>{ 0.25F, 0.5F, 0.25F },
+                std::vector<float>{ 0.1F, 0.2F, 0.4F, 0.2F, 0.1F },
+                std::vector<float>{ 0.5F, 0.F, 0.1F, 0.2F, 0.1F, 0.F, 0.1F } } )
+        {
+            image::plane p = source();
+            image::plane a = p * 2.F + 1.F;
+            a.cdata();
+            image::plane tiled = image::separable_convolve( a, k, k );
+            image::plane fused =
+                image::separable_convolve( p * 2.F + 1.F, k, k ) + 0.F;
+            check( "separable_in_group", fused, [&]( int x, int y ) {
+                return tiled.get( x, y );
+            } );
+        }
+    };
+
+    test.run( options );
+    test.clean();
+
+    return -static_cast<int>( test.failure_count() );
+}
+
+} // namespace
+
+int main( int argc, char *argv[] )
+{
+    try
+    {
+        return safemain( argc, argv );
+    }
+    catch ( const std::exception &e )
+    {
+        base::print_exception( std::cerr, e );
+    }
+    return -1;
+}
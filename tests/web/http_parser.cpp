@@ -0,0 +1,169 @@
+// SPDX-License-Identifier: MIT
+// Copyright contributors to the gecko project.
+
+#include <base/unit_test.h>
+#include <iostream>
+#include <web/request.h>
+#include <web/response.h>
+
+namespace
+{
+// feeds the message to the parser a byte at a time, returning how
+// many bytes it took for the parser to finish
+size_t feed( web::http_parser &p, web::recv_buffer &in, const std::string &msg )
+{
+    for ( size_t n = 0; n < msg.size(); ++n )
+    {
+        in.append( &msg[n], 1 );
+        if ( p.parse( in ) )
+            return n + 1;
+    }
+    return 0;
+}
+
+int safemain( int argc, char *argv[] )
+{
+    base::cmd_line options( argv[0] );
+
+    base::unit_test test( "http_parser" );
+    test.setup( options );
+
+    options.add_help();
+
+    try
+    {
+        options.parse( argc, argv );
+    }
+    catch ( std::exception & )
+    {
+        std::cerr << options << std::endl;
+        throw_add( "parsing command line" );
+    }
+
+    test["request"] = [&]( void ) {
+        std::string msg =
+            "POST /a/b?c=d HTTP/1.1\r\nHost: example.com\r\n"
+            "content-length:  5 \r\nX-Empty:\r\n\r\nhelloGET";
+        web::recv_buffer in;
+        web::http_parser p;
+        size_t           n = feed( p, in, msg );
+        web::request     req( p );
+        if ( n == msg.size() - 3 && p.size() == n && req.method() == "POST" &&
+             req.path().full_path() == "/a/b?c=d" && req.version() == "1.1" &&
+             req.content() == "hello" && req.header().at( "content-length" ) == "5" &&
+             req.header().at( "X-Empty" ).empty() && p.find( "HOST" ) == "example.com" )
+            test.success( "parsed request" );
+        else
+            test.failure( "parsed {0} of {1} bytes: {2}", n, msg.size(), req );
+    };
+
+    test["chunked"] = [&]( void ) {
+        std::string msg = "HTTP/1.1 200 OK\r\nTransfer-Encoding: chunked\r\n\r\n"
+                          "5;ext=1\r\nhello\r\n6\r\n world\r\n0\r\nX-Trailer: t\r\n\r\n";
+        web::recv_buffer in;
+        web::http_parser p;
+        size_t           n = feed( p, in, msg );
+        web::response    resp( p );
+        in.consume( p.size() );
+        if ( n == msg.size() && in.empty() && resp.status() == web::status_code::OK &&
+             resp.content() == "hello world" && p.content_size() == 11 &&
+             p.find( "x-trailer" ) == "t" )
+            test.success( "parsed chunked response" );
+        else
+            test.failure( "parsed {0} of {1} bytes: {2}", n, msg.size(), resp );
+    };
+
+    test["pipelined"] = [&]( void ) {
+        std::string msg = "GET /1 HTTP/1.1\r\nHost: x\r\n\r\n"
+                          "GET /2 HTTP/1.1\r\nHost: x\r\n\r\n";
+        web::recv_buffer in;
+        in.append( msg.data(), msg.size() );
+        web::http_parser p;
+        std::string      paths;
+        while ( p.parse( in ) )
+        {
+            paths += web::request( p ).path().full_path();
+            in.consume( p.size() );
+            p.reset();
+        }
+        if ( paths == "/1/2" && in.empty() )
+            test.success( "parsed both requests" );
+        else
+            test.failure( "parsed {0}", paths );
+    };
+
+    test["header_lookup"] = [&]( void ) {
+        std::string msg = "GET /h HTTP/1.1\r\nHost: x\r\nConnection: Upgrade\r\n\r\n";
+        web::recv_buffer in;
+        in.append( msg.data(), msg.size() );
+        web::http_parser p;
+        p.parse( in );
+        web::request req( p );
+        bool found   = req.find_header( "connection" ) == "Upgrade" && req["HOST"] == "x";
+        bool missing = false;
+        try
+        {
+            req["Upgrade"];
+        }
+        catch ( const std::out_of_range & )
+        {
+            missing = true;
+        }
+
+        // a copy takes its own header, so the buffer can be reused
+        web::request copy( req );
+        in.consume( p.size() );
+        std::string junk( msg.size(), '-' );
+        in.append( junk.data(), junk.size() );
+        if ( found && missing && copy.header().at( "Connection" ) == "Upgrade" &&
+             copy["host"] == "x" )
+            test.success( "header fields looked up in place" );
+        else
+            test.failure( "unexpected header fields: {0}", copy );
+    };
+
+    test["limits"] = [&]( void ) {
+        std::string big = "GET / HTTP/1.1\r\nX-Big: " + std::string( 2000, 'x' ) + "\r\n\r\n";
+        std::string bad = "GET / HTTP/1.1\r\n folded\r\n\r\n";
+        int         refused = 0;
+        for ( auto *msg: { &big, &bad } )
+        {
+            web::recv_buffer in;
+            in.append( msg->data(), msg->size() );
+            web::http_parser p( 1024 );
+            try
+            {
+                p.parse( in );
+            }
+            catch ( const std::exception &e )
+            {
+                test.message( "refused: {0}", e.what() );
+                ++refused;
+            }
+        }
+        if ( refused == 2 )
+            test.success( "refused messages over the limits" );
+        else
+            test.failure( "accepted invalid messages" );
+    };
+
+    test.run( options );
+    test.clean();
+
+    return -static_cast<int>( test.failure_count() );
+}
+
+} // namespace
+
+int main( int argc, char *argv[] )
+{
+    try
+    {
+        return safemain( argc, argv );
+    }
+    catch ( const std::exception &e )
+    {
+        base::print_exception( std::cerr, e );
+    }
+    return -1;
+}
@@ -0,0 +1,107 @@
+// SPDX-License-Identifier: MIT
+// Copyright contributors to the gecko project.
+
+#include <base/unit_test.h>
+#include <iostream>
+#include <web/route_table.h>
+
+namespace
+{
+// the pattern matched and the parameters, as name=value
+std::string lookup( const web::route_table &t, const std::string &path )
+{
+    web::route_table::match m;
+    if ( !t.find( path, m ) )
+        return "none";
+    std::string ret = t.pattern( m.route );
+    for ( size_t i = 0; i < m.count; ++i )
+        ret += " " + *( m.names[i] ) + "=" + m.values[i].to_string();
+    return ret;
+}
+
+int safemain( int argc, char *argv[] )
+{
+    base::cmd_line options( argv[0] );
+
+    base::unit_test test( "route_table" );
+    test.setup( options );
+
+    options.add_help();
+
+    try
+    {
+        options.parse( argc, argv );
+    }
+    catch ( std::exception & )
+    {
+        std::cerr << options << std::endl;
+        throw_add( "parsing command line" );
+    }
+
+    web::route_table table;
+    table.add( "/" );
+    table.add( "/users" );
+    table.add( "/users/{id}" );
+    table.add( "/users/me" );
+    table.add( "/users/{id}/posts/{post}" );
+    table.add( "/files/{dir}/(.*)\\.txt" );
+    table.add( "/files/(.*)" );
+    table.add( "/colou?r" );
+    table.add( "/a|/b" );
+
+    auto check = [&]( const std::string &path, const std::string &expect ) {
+        std::string got = lookup( table, path );
+        if ( got == expect )
+            test.success( "{0} -> {1}", path, got );
+        else
+            test.failure( "{0} -> {1} (expected {2})", path, got, expect );
+    };
+
+    test["literal"] = [&]( void ) {
+        check( "/", "/" );
+        check( "/users", "/users" );
+        check( "/users/me", "/users/me" );
+        check( "/user", "none" );
+        check( "/nothing", "none" );
+        if ( table.add( "/users" ) == 1 )
+            test.success( "same route added twice" );
+        else
+            test.failure( "same route added twice is a new route" );
+    };
+
+    test["params"] = [&]( void ) {
+        check( "/users/42", "/users/{id} id=42" );
+        check( "/users/mel", "/users/{id} id=mel" );
+        check( "/users/42/posts/7", "/users/{id}/posts/{post} id=42 post=7" );
+        check( "/users/42/posts", "none" );
+        check( "/users/", "none" );
+    };
+
+    test["patterns"] = [&]( void ) {
+        check( "/files/a/b.txt", "/files/{dir}/(.*)\\.txt dir=a =b" );
+        check( "/files/a/b.png", "/files/(.*) =a/b.png" );
+        check( "/color", "/colou?r" );
+        check( "/colour", "/colou?r" );
+        check( "/b", "/a|/b" );
+    };
+
+    test.run( options );
+    test.clean();
+
+    return -static_cast<int>( test.failure_count() );
+}
+
+} // namespace
+
+int main( int argc, char *argv[] )
+{
+    try
+    {
+        return safemain( argc, argv );
+    }
+    catch ( const std::exception &e )
+    {
+        base::print_exception( std::cerr, e );
+    }
+    return -1;
+}
@@ -0,0 +1,359 @@
+// SPDX-License-Identifier: MIT
+// Copyright contributors to the gecko project.
+
+#include <base/scope_guard.h>
+#include <base/unit_test.h>
+#include <chrono>
+#include <fstream>
+#include <iostream>
+#include <stdlib.h>
+#include <thread>
+#include <unistd.h>
+#include <vector>
+#include <web/file_response.h>
+#include <web/server.h>
+#include <web/socket.h>
+
+namespace
+{
+const uint16_t test_port = 18733;
+
+std::shared_ptr<net::tcp_socket> connect( void )
+{
+    for ( int retry = 0;; ++retry )
+    {
+        auto s = std::make_shared<net::tcp_socket>();
+        try
+        {
+            s->connect( uint32_t( net::address::special::LOOPBACK ), test_port, 5.0 );
+            return s;
+        }
+        catch ( ... )
+        {
+            // the server may not be listening yet
+            if ( retry == 50 )
+                throw;
+        }
+        std::this_thread::sleep_for( std::chrono::milliseconds( 20 ) );
+    }
+}
+
+void send( net::tcp_socket &s, const std::string &msg )
+{
+    s.write( msg.data(), msg.size() );
+}
+
+// the status line and header of a response (with no content)
+std::string read_head( net::tcp_socket &s )
+{
+    std::string head;
+    bool        closed = false;
+    while ( head.find( "\r\n\r\n" ) == std::string::npos && !closed )
+    {
+        char   buf[1024];
+        size_t n = s.read_some( buf, sizeof( buf ), closed );
+        head.append( buf, n );
+    }
+    return head;
+}
+
+int safemain( int argc, char *argv[] )
+{
+    base::cmd_line options( argv[0] );
+
+    base::unit_test test( "server" );
+    test.setup( options );
+
+    options.add_help();
+
+    try
+    {
+        options.parse( argc, argv );
+    }
+    catch ( std::exception & )
+    {
+        std::cerr << options << std::endl;
+        throw_add( "parsing command line" );
+    }
+
+    web::server server( test_port, 2 );
+    // short enough for the stalled readers to be dropped quickly
+    server.set_idle_timeout( 2.0 );
+    server.resource( "GET", "/hello/(.*)" ) = []( web::request &   req,
+                                                  net::tcp_socket &client ) {
+        web::response resp( "hello " + req.path().full_path().substr( 7 ) );
+        resp.send( client );
+    };
+    server.resource( "POST", "/echo" ) = []( web::request &   req,
+                                             net::tcp_socket &client ) {
+        web::response resp( std::string( req.content() ) );
+        resp.send( client );
+    };
+    server.resource( "GET", "/users/{id}" ) = []( web::request &   req,
+                                                   net::tcp_socket &client ) {
+        web::response resp( "user " + req.path_param( "id" ) );
+        resp.send( client );
+    };
+
+    char tmpName[] = "/tmp/gecko_file_response_XXXXXX";
+    int  tmpFd     = ::mkstemp( tmpName );
+    if ( tmpFd < 0 )
+        throw_errno( "creating temporary file" );
+    ::close( tmpFd );
+    on_scope_exit { ::unlink( tmpName ); };
+    std::string fileContent;
+    for ( int i = 0; i < 100000; ++i )
+        fileContent += base::format( "{0,w8}\n", i );
+    std::ofstream( tmpName ) << fileContent;
+    std::string etag = web::file_response( tmpName ).etag();
+
+    server.resource( "GET", "/file" ) = [&]( web::request &req, net::tcp_socket &client ) {
+        web::file_response( tmpName ).send( req, client );
+    };
+    server.resource( "GET", "/ws" ) = []( web::request &req, net::tcp_socket &client ) {
+        web::socket ws( req, std::move( client ) );
+        std::string msg;
+        bool        bin = false;
+        while ( ws.wait( msg, bin ) )
+        {
+            if ( bin )
+                web::socket::broadcast( { &ws }, msg.data(), msg.size(), true );
+            else
+                ws.send( msg );
+        }
+    };
+    // larger than the socket buffers take, so sending it waits on
+    // the client reading it
+    const std::string bigContent( size_t( 64 ) << 20, 'x' );
+    server.resource( "GET", "/big" ) = [&]( web::request &, net::tcp_socket &client ) {
+        std::string   c = bigContent;
+        web::response resp( std::move( c ) );
+        resp.send( client );
+    };
+    std::thread running( [&]( void ) { server.run(); } );
+
+    test["pipelined"] = [&]( void ) {
+        auto s = connect();
+        send(
+            *s,
+            "GET /hello/a HTTP/1.1\r\nHost: localhost\r\n\r\n"
+            "GET /hello/b HTTP/1.1\r\nHost: localhost\r\n\r\n"
+            "GET /hello/c HTTP/1.1\r\nHost: localhost\r\n\r\n" );
+        web::recv_buffer in;
+        std::string      got;
+        for ( int i = 0; i < 3; ++i )
+            got += web::response( *s, in ).content() + ";";
+        if ( got == "hello a;hello b;hello c;" )
+            test.success( "responses in order" );
+        else
+            test.failure( "unexpected responses: {0}", got );
+    };
+
+    test["path_params"] = [&]( void ) {
+        auto s = connect();
+        send( *s, "GET /users/42 HTTP/1.1\r\nHost: x\r\n\r\n" );
+        std::string a = web::response( *s ).content();
+        if ( a == "user 42" )
+            test.success( "path parameter passed to the handler" );
+        else
+            test.failure( "unexpected response: {0}", a );
+    };
+
+    test["split_request"] = [&]( void ) {
+        auto s = connect();
+        send( *s, "POST /echo HTTP/1.1\r\nHost: localhost\r\nTransfer-" );
+        std::this_thread::sleep_for( std::chrono::milliseconds( 50 ) );
+        send( *s, "Encoding: chunked\r\n\r\n5\r\nhello\r\n" );
+        std::this_thread::sleep_for( std::chrono::milliseconds( 50 ) );
+        send( *s, "6\r\n world\r\n0\r\n\r\nGET /hello/d HTTP/1.1\r\nHost: x\r\n\r\n" );
+        web::recv_buffer in;
+        std::string      a = web::response( *s, in ).content();
+        std::string      b = web::response( *s, in ).content();
+        if ( a == "hello world" && b == "hello d" )
+            test.success( "request handled once it all arrived" );
+        else
+            test.failure( "unexpected responses: {0} {1}", a, b );
+    };
+
+    test["connection_close"] = [&]( void ) {
+        auto s = connect();
+        send( *s, "GET /hello/e HTTP/1.1\r\nHost: x\r\nConnection: close\r\n\r\n" );
+        std::string a = web::response( *s ).content();
+        char        c;
+        bool        closed = false;
+        s->read_some( &c, 1, closed );
+        if ( a == "hello e" && closed )
+            test.success( "connection closed after the response" );
+        else
+            test.failure( "connection still open ({0})", a );
+    };
+
+    test["bad_request"] = [&]( void ) {
+        auto s = connect();
+        send( *s, "GET / HTTP/1.1\r\nHost: x\r\nX-Big: " + std::string( 100000, 'x' ) );
+        web::response resp( *s );
+        if ( resp.status() == web::status_code::BAD_REQUEST )
+            test.success( "oversized header refused" );
+        else
+            test.failure( "unexpected status {0}", static_cast<int>( resp.status() ) );
+    };
+
+    test["file"] = [&]( void ) {
+        auto s = connect();
+        send( *s, "GET /file HTTP/1.1\r\nHost: x\r\n\r\n" );
+        web::recv_buffer in;
+        web::response    resp( *s, in );
+        if ( resp.content() == fileContent )
+            test.success( "whole file sent" );
+        else
+            test.failure( "sent {0} bytes of {1}", resp.content().size(), fileContent.size() );
+    };
+
+    test["file_range"] = [&]( void ) {
+        auto s = connect();
+        send(
+            *s,
+            "GET /file HTTP/1.1\r\nHost: x\r\nRange: bytes=9-26\r\n\r\n"
+            "GET /file HTTP/1.1\r\nHost: x\r\nRange: bytes=-9\r\n\r\n"
+            "GET /file HTTP/1.1\r\nHost: x\r\nRange: bytes=900000-\r\n\r\n"
+            "GET /file HTTP/1.1\r\nHost: x\r\nRange: bytes=99999999999999999999-\r\n\r\n" );
+        web::recv_buffer in;
+        web::response    a( *s, in );
+        web::response    b( *s, in );
+        web::response    c( *s, in );
+        web::response    d( *s, in );
+        if ( a.status() == web::status_code::PARTIAL_CONTENT &&
+             a.content() == fileContent.substr( 9, 18 ) &&
+             b.content() == fileContent.substr( fileContent.size() - 9 ) &&
+             c.status() == web::status_code::RANGE_NOT_SATISFIABLE &&
+             d.status() == web::status_code::OK && d.content() == fileContent )
+            test.success( "ranges sent" );
+        else
+            test.failure(
+                "unexpected ranges: {0} '{1}' '{2}' {3}",
+                static_cast<int>( a.status() ),
+                a.content(),
+                b.content(),
+                static_cast<int>( c.status() ) );
+    };
+
+    test["file_not_modified"] = [&]( void ) {
+        auto s = connect();
+        send( *s, "GET /file HTTP/1.1\r\nHost: x\r\nIf-None-Match: " + etag + "\r\n\r\n" );
+        std::string head = read_head( *s );
+        if ( head.compare( 0, 12, "HTTP/1.1 304" ) == 0 )
+            test.success( "not sent again" );
+        else
+            test.failure( "unexpected response: {0}", head );
+    };
+
+    test["websocket_fragments"] = [&]( void ) {
+        auto s = connect();
+        send(
+            *s,
+            "GET /ws HTTP/1.1\r\nHost: x\r\nConnection: Upgrade\r\n"
+            "Upgrade: websocket\r\nSec-WebSocket-Key: dGhlIHNhbXBsZSBub25jZQ==\r\n\r\n" );
+        web::recv_buffer in;
+        web::response    upgrade( *s, in );
+
+        // a masked frame, with a zero key so the payload reads as sent
+        auto frame = []( int first, const std::string &payload ) {
+            return std::string( 1, char( first ) ) +
+                   char( 0x80 | static_cast<int>( payload.size() ) ) +
+                   std::string( 4, '\0' ) + payload;
+        };
+        send(
+            *s,
+            frame( 0x02, "hello " ) + frame( 0x89, "p" ) + frame( 0x80, "world" ) +
+                frame( 0x88, "" ) );
+
+        std::string got( 2 + 1 + 2 + 11 + 2, '\0' );
+        in.read( *s, &got[0], got.size() );
+        if ( upgrade.status() == web::status_code::PROTOCOL_SWITCH &&
+             got == std::string( "\x8a\x01p\x82\x0bhello world\x88\x00", got.size() ) )
+            test.success( "pong, reassembled message and close" );
+        else
+            test.failure( "unexpected frames: {0}", got );
+    };
+
+    test["websocket_client"] = [&]( void ) {
+        base::uri   u( base::to_string( base::format( "ws://127.0.0.1:{0}/ws", test_port ) ) );
+        web::socket ws( u );
+        std::string big;
+        for ( int i = 0; i < 300001; ++i )
+            big.push_back( static_cast<char>( i * 7 ) );
+        ws.send( "hi" );
+        ws.send_binary( big.data(), big.size() );
+        std::string a, b;
+        bool        aBin = true, bBin = false;
+        ws.wait( a, aBin );
+        ws.wait( b, bBin );
+        ws.close();
+        std::string rest;
+        bool        closed = !ws.wait( rest );
+        if ( a == "hi" && !aBin && b == big && bBin && closed )
+            test.success( "text and binary echoed" );
+        else
+            test.failure( "unexpected echo: '{0}' {1} bytes", a, b.size() );
+    };
+
+    test["idle_connections"] = [&]( void ) {
+        std::vector<std::shared_ptr<net::tcp_socket>> idle;
+        for ( int i = 0; i < 500; ++i )
+            idle.push_back( connect() );
+        auto s = connect();
+        send( *s, "GET /hello/f HTTP/1.1\r\nHost: x\r\n\r\n" );
+        std::string a = web::response( *s ).content();
+        if ( a == "hello f" )
+            test.success( "served with {0} idle connections open", idle.size() );
+        else
+            test.failure( "unexpected response: {0}", a );
+    };
+
+    test["stalled_readers"] = [&]( void ) {
+        // as many clients as handler threads, none reading the
+        // response, must not keep the next request from being served
+        std::vector<std::shared_ptr<net::tcp_socket>> stalled;
+        for ( int i = 0; i < 2; ++i )
+        {
+            stalled.push_back( connect() );
+            send( *stalled.back(), "GET /big HTTP/1.1\r\nHost: x\r\n\r\n" );
+        }
+        std::this_thread::sleep_for( std::chrono::milliseconds( 200 ) );
+
+        auto start = std::chrono::steady_clock::now();
+        auto s     = connect();
+        send( *s, "GET /hello/g HTTP/1.1\r\nHost: x\r\n\r\n" );
+        std::string a    = web::response( *s ).content();
+        double      secs = std::chrono::duration<double>(
+                          std::chrono::steady_clock::now() - start )
+                          .count();
+        if ( a == "hello g" && secs < 10.0 )
+            test.success( "served after {0} seconds with stalled readers", secs );
+        else
+            test.failure( "unexpected response after {0} seconds: {1}", secs, a );
+    };
+
+    test.run( options );
+    test.clean();
+
+    server.stop();
+    running.join();
+
+    return -static_cast<int>( test.failure_count() );
+}
+
+} // namespace
+
+int main( int argc, char *argv[] )
+{
+    try
+    {
+        return safemain( argc, argv );
+    }
+    catch ( const std::exception &e )
+    {
+        base::print_exception( std::cerr, e );
+    }
+    return -1;
+}